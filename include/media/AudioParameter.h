@@ -41,6 +41,10 @@ public:
     //  keyInputSource: to change audio input source, value is an int in audio_source_t
     //     (defined in media/mediarecorder.h)
     //  keyScreenState: either "on" or "off"
+    //  keyTrackStatistics: get only, answered by AudioFlinger for a playback output rather than
+    //     by the HAL; value is a comma separated list of "track:statistics" entries, see
+    //     TrackStatistics::toParameterValue(), or empty if AudioFlinger was built without
+    //     TRACK_MIX_STATISTICS
     static const char * const keyRouting;
     static const char * const keySamplingRate;
     static const char * const keyFormat;
@@ -48,6 +52,7 @@ public:
     static const char * const keyFrameCount;
     static const char * const keyInputSource;
     static const char * const keyScreenState;
+    static const char * const keyTrackStatistics;
 
     String8 toString();
 
@@ -17,6 +17,7 @@
 #ifndef ANDROID_AUDIOTRACK_H
 #define ANDROID_AUDIOTRACK_H
 
+#include <sys/uio.h>
 #include <cutils/sched_policy.h>
 #include <media/AudioSystem.h>
 #include <media/AudioTimestamp.h>
@@ -554,6 +555,25 @@ public:
      */
             ssize_t     write(const void* buffer, size_t size);
 
+    /* Like write(), but gathers the data from iovcnt buffers, so that many small buffers
+     * are copied with one obtainBuffer() and releaseBuffer() per contiguous region of the
+     * track buffer, rather than one per buffer.  A partial frame at the end is not written.
+     * Input parameters:
+     *  deadline    CLOCK_MONOTONIC time after which writev() no longer waits for space,
+     *              or -1 to wait as long as needed.
+     * Returns the number of bytes written, which is less than requested if the deadline
+     * passed, or the same negative status codes as write() if nothing was written.
+     */
+            ssize_t     writev(const struct iovec* iov, int iovcnt, nsecs_t deadline = -1);
+
+    /* Sets the number of frames which must be free in the track buffer before AudioFlinger
+     * wakes up a write() or writev() that is blocked because the buffer is full.
+     * A larger watermark means fewer wakeups, each followed by a larger copy.
+     * The watermark is limited by AudioFlinger to half the buffer; 0 restores the default.
+     * Returns INVALID_OPERATION if the transfer mode is not TRANSFER_SYNC.
+     */
+            status_t    setWriteWatermark(size_t frames);
+
     /*
      * Dumps the state of an audio track.
      */
@@ -705,6 +725,7 @@ protected:
     uint32_t                mNotificationFramesAct; // actual number of frames between each
                                                     // notification callback,
                                                     // at initial source sample rate
+    size_t                  mWriteWatermark;        // set by setWriteWatermark(), 0 if default
     bool                    mRefreshRemaining;      // processAudioBuffer() should refresh next 2
 
     // These are private to processAudioBuffer(), and are not protected by a lock
@@ -20,6 +20,7 @@
 #include <binder/IInterface.h>
 #include <binder/IMemory.h>
 #include <binder/Parcel.h>
+#include <utils/String8.h>
 
 namespace android {
 
@@ -31,6 +32,10 @@ public:
     virtual void    registerWriter(const sp<IMemory>& shared, size_t size, const char *name) = 0;
     virtual void    unregisterWriter(const sp<IMemory>& shared) = 0;
 
+    // Percentile summaries of the performance histograms of all writers, over the most recent
+    // windowSec seconds, or over several standard windows if windowSec is 0.
+    virtual status_t getPerformanceSummary(uint32_t windowSec, String8 *summary) = 0;
+
 };
 
 class BnMediaLogService: public BnInterface<IMediaLogService>
@@ -21,6 +21,7 @@
 #include <utils/List.h>
 #include <utils/Vector.h>
 #include <utils/KeyedVector.h>
+#include <utils/String8.h>
 #include <media/AudioTrack.h>
 #include <binder/MemoryHeapBase.h>
 #include <binder/MemoryBase.h>
@@ -48,6 +49,37 @@ public:
 // callback function prototype
 typedef void SoundPoolCallback(SoundPoolEvent event, SoundPool* soundPool, void* user);
 
+// PCM decoded from one source.  Decoded data is cached process-wide, so all Samples
+// loaded from the same URL or file region share one DecodedSample, in any SoundPool.
+class DecodedSample : public RefBase {
+public:
+    // Returns the cached decode of the source, or decodes it now if there is none.
+    // Waits if another thread is already decoding the same source.
+    static sp<DecodedSample> load(const char* url, int fd, int64_t offset, int64_t length);
+
+    virtual ~DecodedSample();
+
+    status_t            status() const { return mStatus; }
+    uint32_t            sampleRate() const { return mSampleRate; }
+    int                 numChannels() const { return mNumChannels; }
+    audio_format_t      format() const { return mFormat; }
+    size_t              size() const { return mSize; }
+    sp<IMemory>         getIMemory() const { return mData; }
+
+private:
+    DecodedSample(const String8& key);
+    status_t decode(const char* url, int fd, int64_t offset, int64_t length);
+
+    const String8       mKey;           // cache key, or empty if not cached
+    status_t            mStatus;        // NO_INIT until decoding is complete
+    uint32_t            mSampleRate;
+    int                 mNumChannels;
+    audio_format_t      mFormat;
+    size_t              mSize;
+    sp<MemoryHeapBase>  mHeap;
+    sp<IMemory>         mData;
+};
+
 // tracks samples used by application
 class Sample  : public RefBase {
 public:
@@ -87,7 +119,7 @@ private:
     int64_t             mLength;
     char*               mUrl;
     sp<IMemory>         mData;
-    sp<MemoryHeapBase>  mHeap;
+    sp<DecodedSample>   mDecoded;   // keeps the cached decode alive while this Sample is loaded
 };
 
 // stores pending events for stolen channels
@@ -122,7 +154,7 @@ class SoundChannel : public SoundEvent {
 public:
     enum state { IDLE, RESUMING, STOPPING, PAUSED, PLAYING };
     SoundChannel() : mState(IDLE), mNumChannels(1),
-            mPos(0), mToggle(0), mAutoPaused(false) {}
+            mPos(0), mToggle(0), mAutoPaused(false), mPosition(0), mStep(0), mMixDone(false) {}
     ~SoundChannel();
     void init(SoundPool* soundPool);
     void play(const sp<Sample>& sample, int channelID, float leftVolume, float rightVolume,
@@ -145,10 +177,15 @@ public:
     int nextChannelID() { return mNextEvent.channelID(); }
     void dump();
 
+    // When the SoundPool mixes in process, add this voice to frameCount stereo frames of
+    // Q4.27 sums.  Returns false if the voice is not playing.
+    bool mix(int32_t* out, size_t frameCount);
+
 private:
     static void callback(int event, void* user, void *info);
     void process(int event, void *info, unsigned long toggle);
     bool doStop_l();
+    void setStep_l();
 
     SoundPool*          mSoundPool;
     sp<AudioTrack>      mAudioTrack;
@@ -160,6 +197,11 @@ private:
     int                 mAudioBufferSize;
     unsigned long       mToggle;
     bool                mAutoPaused;
+
+    // used only when the SoundPool mixes in process, in which case mAudioTrack is 0
+    uint64_t            mPosition;  // current frame of the sample, Q32.32
+    uint64_t            mStep;      // sample frames per output frame, Q32.32
+    bool                mMixDone;   // reached the end, and waiting to be stopped
 };
 
 // application object for managing a pool of sounds
@@ -167,7 +209,10 @@ class SoundPool {
     friend class SoundPoolThread;
     friend class SoundChannel;
 public:
-    SoundPool(int maxChannels, audio_stream_type_t streamType, int srcQuality);
+    // If mixInProcess is true, all channels are mixed by the SoundPool into a single
+    // AudioTrack, rather than each channel using its own AudioTrack.
+    SoundPool(int maxChannels, audio_stream_type_t streamType, int srcQuality,
+            bool mixInProcess = false);
     ~SoundPool();
     int load(const char* url, int priority);
     int load(int fd, int64_t offset, int64_t length, int priority);
@@ -185,6 +230,11 @@ public:
     void setRate(int channelID, float rate);
     audio_stream_type_t streamType() const { return mStreamType; }
     int srcQuality() const { return mSrcQuality; }
+    bool isMixing() const { return mMixerTrack != 0; }
+    uint32_t mixerSampleRate() const { return mMixerSampleRate; }
+
+    // called with lock held when a channel starts playing, if isMixing()
+    void startMixer_l();
 
     // called from SoundPoolThread
     void sampleLoaded(int sampleID);
@@ -215,6 +265,12 @@ private:
     int run();
     void quit();
 
+    // in-process mixing
+    bool createMixer();
+    static void mixerCallback(int event, void* user, void *info);
+    void mix(AudioTrack::Buffer* buffer);
+    void stopMixerIfIdle();
+
     Mutex                   mLock;
     Mutex                   mRestartLock;
     Condition               mCondition;
@@ -232,6 +288,14 @@ private:
     int                     mNextChannelID;
     bool                    mQuit;
 
+    // in-process mixing
+    sp<AudioTrack>          mMixerTrack;        // != 0 if mixing in process
+    uint32_t                mMixerSampleRate;
+    int32_t*                mMixBuffer;         // stereo Q4.27 sums, used by mixer callback
+    size_t                  mMixBufferFrames;
+    bool                    mMixerStarted;      // protected by mLock
+    bool                    mMixerIdle;         // no voices are playing, protected by mRestartLock
+
     // callback
     Mutex                   mCallbackLock;
     SoundPoolCallback*      mCallback;
@@ -17,8 +17,10 @@
 #ifndef ANDROID_TONEGENERATOR_H_
 #define ANDROID_TONEGENERATOR_H_
 
+#include <pthread.h>
 #include <utils/RefBase.h>
 #include <utils/KeyedVector.h>
+#include <utils/String8.h>
 #include <utils/threads.h>
 #include <media/AudioSystem.h>
 #include <media/AudioTrack.h>
@@ -204,15 +206,18 @@ private:
 
     static const unsigned char sToneMappingTable[NUM_REGIONS-1][NUM_SUP_TONES];
 
+    friend class ToneGeneratorTest;
+    // For ToneGeneratorTest: a ToneGenerator without an AudioTrack, whose sequencer is run by
+    // calling audioCallback() directly.
+    ToneGenerator(uint32_t samplingRate, region toneRegion);
+
     static const unsigned int TONEGEN_MAX_WAVES = 3;     // Maximun number of sine waves in a tone segment
     static const unsigned int TONEGEN_MAX_SEGMENTS = 12;  // Maximun number of segments in a tone descriptor
     static const unsigned int TONEGEN_INF = 0xFFFFFFFF;  // Represents infinite time duration
     static const float TONEGEN_GAIN = 0.9;  // Default gain passed to  WaveGenerator().
 
     // ToneDescriptor class contains all parameters needed to generate a tone:
-    //    - The array waveFreq[]:
-    //         1 for static tone descriptors: contains the frequencies of all individual waves making the multi-tone.
-    //         2 for active tone descritors: contains the indexes of the WaveGenerator objects in mWaveGens
+    //    - The array waveFreq[] contains the frequencies of all individual waves making the multi-tone.
     //        The number of sine waves varies from 1 to TONEGEN_MAX_WAVES.
     //        The first null value indicates that no more waves are needed.
     //    - The array segments[] is used to generate the tone pulses. A segment is a period of time
@@ -280,35 +285,67 @@ private:
     void clearWaveGens();
     tone_type getToneForRegion(tone_type toneType);
 
-    // WaveGenerator generates a single sine wave
+    // ToneBuffer holds exactly one period of the sum of the sine waves of a tone segment,
+    // so that the segment can be played for any duration by copying from it.
+    // Buffers are shared by all ToneGenerators in the process.
+    class ToneBuffer : public RefBase {
+    public:
+        // Returns the cached buffer for these frequencies (0 terminated), or renders it now.
+        static sp<ToneBuffer> get(uint32_t samplingRate, const unsigned short *waveFreq,
+                float volume);
+
+        virtual ~ToneBuffer();
+
+        const short *data() const { return mData; }
+        size_t frameCount() const { return mFrameCount; }
+
+    private:
+        static const unsigned int RENDER_BLOCK_SIZE = 256;  // frames rendered between phase resyncs
+        static const unsigned int RENDER_LANES = 4;  // TONEGEN_MAX_WAVES rounded up for SIMD
+        static const size_t MAX_RECENT_BYTES = 512 * 1024;  // limit of sRecentBuffers
+
+        ToneBuffer(const String8& key);
+        bool render(uint32_t samplingRate, const unsigned short *waveFreq, float volume);
+
+        static Mutex sLock;  // protects sBuffers, sRecentBuffers and sRecentBytes
+        static DefaultKeyedVector< String8, wp<ToneBuffer> > sBuffers;  // all buffers by key
+        static Vector< sp<ToneBuffer> > sRecentBuffers;  // most recently used last
+        static size_t sRecentBytes;  // total size of sRecentBuffers
+
+        const String8 mKey;  // cache key
+        short *mData;  // one period of the segment
+        size_t mFrameCount;  // period in frames
+    };
+
+    // WaveGenerator plays all the sine waves of a tone segment from a ToneBuffer
     class WaveGenerator {
     public:
         enum gen_command {
             WAVEGEN_START,  // Start/restart wave from phase 0
             WAVEGEN_CONT,  // Continue wave from current phase
-            WAVEGEN_STOP  // Stop wave on zero crossing
+            WAVEGEN_STOP  // Stop wave with a fade out ramp
         };
 
-        WaveGenerator(unsigned short samplingRate, unsigned short frequency,
-                float volume);
+        WaveGenerator(const sp<ToneBuffer>& buffer);
         ~WaveGenerator();
 
         void getSamples(short *outBuffer, unsigned int count,
                 unsigned int command);
 
     private:
-        static const short GEN_AMP = 32000;  // amplitude of generator
-        static const short S_Q14 = 14;  // shift for Q14
+        static const unsigned int RAMP_SIZE = 256;  // number of entries in sRamp
         static const short S_Q15 = 15;  // shift for Q15
 
-        short mA1_Q14;  // Q14 coefficient
-        // delay line of full amplitude generator
-        short mS1, mS2;  // delay line S2 oldest
-        short mS2_0;  // saved value for reinitialisation
-        short mAmplitude_Q15;  // Q15 amplitude
+        static short sRamp[RAMP_SIZE];  // Q15 raised cosine fade out
+        static pthread_once_t sRampOnce;
+        static void initRamp();
+
+        const sp<ToneBuffer> mBuffer;
+        size_t mPosition;  // next frame to play in mBuffer
     };
 
-    KeyedVector<unsigned short, WaveGenerator *> mWaveGens;  // list of active wave generators.
+    KeyedVector<unsigned short, WaveGenerator *> mWaveGens;  // wave generators by segment index.
+    WaveGenerator *getWaveGen(unsigned int segmentIdx);  // NULL for a silent segment
 };
 
 }
@@ -21,6 +21,8 @@
 
 #include <binder/IMemory.h>
 #include <utils/Mutex.h>
+#include <utils/String8.h>
+#include <utils/Vector.h>
 #include <media/nbaio/roundup.h>
 
 namespace android {
@@ -32,14 +34,44 @@ public:
 class Writer;
 class Reader;
 
+// Events of periodic threads, which are not shown by Reader::dump() but which
+// MediaLogService accumulates into histograms.  See Writer::logPerformance().
+// Each carries a duration rather than a time, so that idle periods don't distort the statistics.
+enum PerformanceEvent {
+    PERF_CYCLE,                 // a cycle completed while warm, and took this long
+    PERF_UNDERRUN,              // as PERF_CYCLE, but the cycle took too long; follows PERF_CYCLE
+    PERF_WARMUP,                // warmup completed, and took this long
+};
+
+struct PerformanceEntry {
+    PerformanceEvent    mEvent;
+    int64_t             mNs;    // duration in nanoseconds
+};
+
 private:
 
 enum Event {
     EVENT_RESERVED,
     EVENT_STRING,               // ASCII string, not NUL-terminated
     EVENT_TIMESTAMP,            // clock_gettime(CLOCK_MONOTONIC)
+    EVENT_FORMAT_STRING,        // format ID followed by printf-style format, not NUL-terminated
+    EVENT_FORMAT_ARGS,          // format ID followed by tagged raw arguments, see logvFormat()
+    EVENT_PERFORMANCE,          // PerformanceEvent as uint8_t followed by int64_t nanoseconds
 };
 
+// tags for each argument of an EVENT_FORMAT_ARGS entry
+enum ArgType {
+    ARG_INT32 = 'i',            // int32_t
+    ARG_INT64 = 'l',            // int64_t
+    ARG_DOUBLE = 'f',           // double
+    ARG_POINTER = 'p',          // uint64_t
+    ARG_STRING = 's',           // uint8_t length followed by that many chars, not NUL-terminated
+};
+
+// Maximum number of distinct format strings that one Writer can log in binary form.
+// Additional formats are formatted at the time of the log call, as for logf().
+static const size_t kMaxFormats = 32;
+
 // ---------------------------------------------------------------------------
 
 // representation of a single log entry in private memory
@@ -126,6 +158,17 @@ public:
     virtual void    logTimestamp();
     virtual void    logTimestamp(const struct timespec& ts);
 
+    // Similar to logf(), but intended for real-time threads: instead of formatting in the
+    // caller, only the arguments are copied to the timeline in binary form, and the Reader
+    // formats them at dump time.  The format must be a string literal or otherwise have
+    // static lifetime, as it is identified by address.  Conversions with '*' or 'n' are not
+    // supported in binary form, and are formatted immediately instead.
+    virtual void    logFormat(const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
+    virtual void    logvFormat(const char *fmt, va_list ap);
+
+    // Log a PerformanceEvent in a compact form, as it may be logged every cycle
+    virtual void    logPerformance(PerformanceEvent event, const struct timespec& ts);
+
     virtual bool    isEnabled() const;
 
     // return value for all of these is the previous isEnabled()
@@ -139,11 +182,22 @@ private:
     void    log(Event event, const void *data, size_t length);
     void    log(const Entry *entry, bool trusted = false);
 
+    // Returns the ID of the format, first logging it as an EVENT_FORMAT_STRING if the
+    // Reader might not have seen it, or -1 if the format can't be logged in binary form.
+    int     formatId(const char *fmt);
+
     const size_t    mSize;      // circular buffer size in bytes, must be a power of 2
     Shared* const   mShared;    // raw pointer to shared memory
     const sp<IMemory> mIMemory; // ref-counted version
     int32_t         mRear;      // my private copy of mShared->mRear
     bool            mEnabled;   // whether to actually log
+
+    // formats that have been assigned an ID, indexed by ID
+    struct Format {
+        const char *mFmt;       // identified by address, NULL if this ID is unused
+        int32_t     mRear;      // value of mRear after the EVENT_FORMAT_STRING was logged
+    };
+    Format          mFormats[kMaxFormats];
 };
 
 // ---------------------------------------------------------------------------
@@ -159,6 +213,9 @@ public:
     virtual void    logvf(const char *fmt, va_list ap);
     virtual void    logTimestamp();
     virtual void    logTimestamp(const struct timespec& ts);
+    virtual void    logFormat(const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
+    virtual void    logvFormat(const char *fmt, va_list ap);
+    virtual void    logPerformance(PerformanceEvent event, const struct timespec& ts);
 
     virtual bool    isEnabled() const;
     virtual bool    setEnabled(bool enabled);
@@ -182,13 +239,34 @@ public:
     void    dump(int fd, size_t indent = 0);
     bool    isIMemory(const sp<IMemory>& iMemory) const;
 
+    // Append the PerformanceEvents logged since the previous call to dump() or
+    // readPerformance(), skipping all other events.  Returns true if any entries were lost
+    // since the previous call, because the Writer overwrote them before they could be read.
+    // Use a separate Reader for this, as it consumes the events that dump() would show.
+    bool    readPerformance(Vector<PerformanceEntry>& entries);
+
 private:
+    // Copy the entries logged since the previous read into a new array, and advance mFront.
+    // Returns the array, or NULL if there is nothing new; on return *avail is its size in bytes,
+    // *lost is incremented by the number of bytes overwritten before they could be read,
+    // and *start is the index of the oldest complete entry in the array.
+    // If maxSec is not NULL, it is set to the largest second of any EVENT_TIMESTAMP, or -1.
+    uint8_t *copyEntries(size_t *avail, size_t *lost, size_t *start, time_t *maxSec);
+
+
+    // Format the arguments of an EVENT_FORMAT_ARGS entry, or return false if it is corrupt
+    bool    formatArgs(const uint8_t *data, size_t length, String8& out) const;
+
     const size_t    mSize;      // circular buffer size in bytes, must be a power of 2
     const Shared* const mShared; // raw pointer to shared memory
     const sp<IMemory> mIMemory; // ref-counted version
     int32_t     mFront;         // index of oldest acknowledged Entry
 
     static const size_t kSquashTimestamp = 5; // squash this many or more adjacent timestamps
+
+    // formats received via EVENT_FORMAT_STRING, indexed by ID; persists across dumps
+    // because the Writer only logs each format again once it may have been overwritten
+    String8     mFormats[kMaxFormats];
 };
 
 };  // class NBLog
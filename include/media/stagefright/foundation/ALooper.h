@@ -25,6 +25,7 @@
 #include <utils/List.h>
 #include <utils/RefBase.h>
 #include <utils/threads.h>
+#include <utils/Vector.h>
 
 namespace android {
 
@@ -61,6 +62,7 @@ private:
 
     struct Event {
         int64_t mWhenUs;
+        uint32_t mSeqNo;    // orders events due at the same time
         sp<AMessage> mMessage;
     };
 
@@ -69,7 +71,9 @@ private:
 
     AString mName;
 
-    List<Event> mEventQueue;
+    // Binary heap with the earliest event first.
+    Vector<Event> mEventQueue;
+    uint32_t mNextSeqNo;
 
     struct LooperThread;
     sp<LooperThread> mThread;
@@ -78,6 +82,10 @@ private:
     void post(const sp<AMessage> &msg, int64_t delayUs);
     bool loop();
 
+    static bool isEarlier(const Event &a, const Event &b);
+    void pushEvent_l(const Event &event);
+    void popEvent_l(Event *event);
+
     DISALLOW_EVIL_CONSTRUCTORS(ALooper);
 };
 
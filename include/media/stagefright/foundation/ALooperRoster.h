@@ -33,7 +33,12 @@ struct ALooperRoster {
     void unregisterStaleHandlers();
 
     status_t postMessage(const sp<AMessage> &msg, int64_t delayUs = 0);
-    void deliverMessage(const sp<AMessage> &msg);
+
+    // Looks up the target handlers of a batch of events under a single
+    // lock.  The handler of an event is NULL if it is no longer registered.
+    void findHandlers(
+            const Vector<ALooper::Event> &events,
+            Vector<sp<AHandler> > *handlers);
 
     status_t postAndAwaitResponse(
             const sp<AMessage> &msg, sp<AMessage> *response);
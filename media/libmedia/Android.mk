@@ -81,3 +81,17 @@ LOCAL_C_INCLUDES := \
     $(call include-path-for, audio-utils)
 
 include $(BUILD_SHARED_LIBRARY)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= bench-proxy.cpp
+
+LOCAL_SHARED_LIBRARIES := libmedia libbinder libutils libcutils liblog
+
+LOCAL_MODULE:= bench-proxy
+
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_EXECUTABLE)
+
+include $(call all-makefiles-under,$(LOCAL_PATH))
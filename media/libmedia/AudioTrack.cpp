@@ -316,6 +316,7 @@ status_t AudioTrack::set(
     mReqFrameCount = frameCount;
     mNotificationFramesReq = notificationFrames;
     mNotificationFramesAct = 0;
+    mWriteWatermark = 0;
     mSessionId = sessionId;
     if (uid == -1 || (IPCThreadState::self()->getCallingPid() != getpid())) {
         mClientUid = IPCThreadState::self()->getCallingUid();
@@ -1092,7 +1093,7 @@ status_t AudioTrack::createTrack_l(
     mProxy->setSendLevel(mSendLevel);
     mProxy->setSampleRate(mSampleRate);
     mProxy->setEpoch(epoch);
-    mProxy->setMinimum(mNotificationFramesAct);
+    mProxy->setMinimum(mWriteWatermark != 0 ? mWriteWatermark : mNotificationFramesAct);
 
     mDeathNotifier = new DeathNotifier(this);
     mAudioTrack->asBinder()->linkToDeath(mDeathNotifier, this);
@@ -1281,6 +1282,100 @@ ssize_t AudioTrack::write(const void* buffer, size_t userSize)
     return written;
 }
 
+ssize_t AudioTrack::writev(const struct iovec* iov, int iovcnt, nsecs_t deadline)
+{
+    if (mTransfer != TRANSFER_SYNC || mIsTimed) {
+        return INVALID_OPERATION;
+    }
+
+    if (iovcnt < 0 || (iov == NULL && iovcnt != 0)) {
+        ALOGE("AudioTrack::writev(iov=%p, iovcnt=%d)", iov, iovcnt);
+        return BAD_VALUE;
+    }
+    size_t userSize = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        userSize += iov[i].iov_len;
+        if ((iov[i].iov_base == NULL && iov[i].iov_len != 0) || ssize_t(userSize) < 0) {
+            ALOGE("AudioTrack::writev(iov[%d]: base=%p, len=%zu)", i, iov[i].iov_base,
+                    iov[i].iov_len);
+            return BAD_VALUE;
+        }
+    }
+    userSize -= userSize % mFrameSize;
+
+    const bool expand = mFormat == AUDIO_FORMAT_PCM_8_BIT && !(mFlags & AUDIO_OUTPUT_FLAG_DIRECT);
+    size_t written = 0;
+    int index = 0;          // current user buffer
+    size_t offset = 0;      // position in current user buffer
+    Buffer audioBuffer;
+
+    while (userSize > 0) {
+        struct timespec timeout;
+        const struct timespec *requested = &ClientProxy::kForever;
+        if (deadline >= 0) {
+            nsecs_t remaining = deadline - systemTime(SYSTEM_TIME_MONOTONIC);
+            if (remaining > 0) {
+                timeout.tv_sec = remaining / 1000000000LL;
+                timeout.tv_nsec = remaining % 1000000000LL;
+                requested = &timeout;
+            } else {
+                requested = &ClientProxy::kNonBlocking;
+            }
+        }
+
+        audioBuffer.frameCount = userSize / mFrameSize;
+        status_t err = obtainBuffer(&audioBuffer, requested);
+        if (err < 0) {
+            if (written > 0) {
+                break;
+            }
+            return ssize_t(err);
+        }
+
+        // fill the whole region from as many user buffers as it takes
+        size_t toWrite = expand ? audioBuffer.size >> 1 : audioBuffer.size;
+        char *dst = audioBuffer.i8;
+        for (size_t left = toWrite; left > 0; ) {
+            size_t part = iov[index].iov_len - offset;
+            if (part > left) {
+                part = left;
+            }
+            const char *src = (const char *) iov[index].iov_base + offset;
+            if (expand) {
+                memcpy_to_i16_from_u8((int16_t *) dst, (const uint8_t *) src, part);
+                dst += part * sizeof(int16_t);
+            } else {
+                memcpy(dst, src, part);
+                dst += part;
+            }
+            left -= part;
+            offset += part;
+            if (offset == iov[index].iov_len) {
+                index++;
+                offset = 0;
+            }
+        }
+        userSize -= toWrite;
+        written += toWrite;
+
+        releaseBuffer(&audioBuffer);
+    }
+
+    return written;
+}
+
+status_t AudioTrack::setWriteWatermark(size_t frames)
+{
+    if (mTransfer != TRANSFER_SYNC) {
+        return INVALID_OPERATION;
+    }
+
+    AutoMutex lock(mLock);
+    mWriteWatermark = frames;
+    mProxy->setMinimum(frames != 0 ? frames : mNotificationFramesAct);
+    return NO_ERROR;
+}
+
 // -------------------------------------------------------------------------
 
 TimedAudioTrack::TimedAudioTrack() {
@@ -29,6 +29,7 @@ namespace android {
 enum {
     REGISTER_WRITER = IBinder::FIRST_CALL_TRANSACTION,
     UNREGISTER_WRITER,
+    GET_PERFORMANCE_SUMMARY,
 };
 
 class BpMediaLogService : public BpInterface<IMediaLogService>
@@ -57,6 +58,20 @@ public:
         // FIXME ignores status
     }
 
+    virtual status_t getPerformanceSummary(uint32_t windowSec, String8 *summary) {
+        Parcel data, reply;
+        data.writeInterfaceToken(IMediaLogService::getInterfaceDescriptor());
+        data.writeInt32((int32_t) windowSec);
+        status_t status = remote()->transact(GET_PERFORMANCE_SUMMARY, data, &reply);
+        if (status == NO_ERROR) {
+            status = (status_t) reply.readInt32();
+            if (status == NO_ERROR && summary != NULL) {
+                *summary = reply.readString8();
+            }
+        }
+        return status;
+    }
+
 };
 
 IMPLEMENT_META_INTERFACE(MediaLogService, "android.media.IMediaLogService");
@@ -84,6 +99,18 @@ status_t BnMediaLogService::onTransact(
             return NO_ERROR;
         }
 
+        case GET_PERFORMANCE_SUMMARY: {
+            CHECK_INTERFACE(IMediaLogService, data, reply);
+            uint32_t windowSec = (uint32_t) data.readInt32();
+            String8 summary;
+            status_t status = getPerformanceSummary(windowSec, &summary);
+            reply->writeInt32(status);
+            if (status == NO_ERROR) {
+                reply->writeString8(summary);
+            }
+            return NO_ERROR;
+        }
+
         default:
             return BBinder::onTransact(code, data, reply, flags);
     }
@@ -20,6 +20,11 @@
 
 #define USE_SHARED_MEM_BUFFER
 
+#include <sys/stat.h>
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+#include <audio_utils/primitives.h>
 #include <media/AudioTrack.h>
 #include <media/mediaplayer.h>
 #include <media/SoundPool.h>
@@ -35,10 +40,11 @@ uint32_t kDefaultFrameCount = 1200;
 size_t kDefaultHeapSize = 1024 * 1024; // 1MB
 
 
-SoundPool::SoundPool(int maxChannels, audio_stream_type_t streamType, int srcQuality)
+SoundPool::SoundPool(int maxChannels, audio_stream_type_t streamType, int srcQuality,
+        bool mixInProcess)
 {
-    ALOGV("SoundPool constructor: maxChannels=%d, streamType=%d, srcQuality=%d",
-            maxChannels, streamType, srcQuality);
+    ALOGV("SoundPool constructor: maxChannels=%d, streamType=%d, srcQuality=%d, mixInProcess=%d",
+            maxChannels, streamType, srcQuality, mixInProcess);
 
     // check limits
     mMaxChannels = maxChannels;
@@ -61,12 +67,22 @@ SoundPool::SoundPool(int maxChannels, audio_stream_type_t streamType, int srcQua
     mCallback = 0;
     mUserData = 0;
 
+    mMixerSampleRate = 0;
+    mMixBuffer = NULL;
+    mMixBufferFrames = 0;
+    mMixerStarted = false;
+    mMixerIdle = false;
+
     mChannelPool = new SoundChannel[mMaxChannels];
     for (int i = 0; i < mMaxChannels; ++i) {
         mChannelPool[i].init(this);
         mChannels.push_back(&mChannelPool[i]);
     }
 
+    if (mixInProcess) {
+        createMixer();
+    }
+
     // start decode thread
     startThreads();
 }
@@ -77,6 +93,14 @@ SoundPool::~SoundPool()
     mDecodeThread->quit();
     quit();
 
+    // The mixer callback uses the channels, so destroy the mixer track first.
+    // Do not hold mLock, as the AudioTrack destructor waits for the callback thread to exit.
+    if (mMixerTrack != 0) {
+        mMixerTrack->stop();
+        mMixerTrack.clear();
+    }
+    delete[] mMixBuffer;
+
     Mutex::Autolock lock(&mLock);
 
     mChannels.clear();
@@ -151,6 +175,13 @@ int SoundPool::run()
             mRestartLock.lock();
             if (mQuit) break;
         }
+
+        if (mMixerIdle) {
+            mMixerIdle = false;
+            mRestartLock.unlock();
+            stopMixerIfIdle();
+            mRestartLock.lock();
+        }
     }
 
     mStop.clear();
@@ -171,6 +202,86 @@ void SoundPool::quit()
     mRestartLock.unlock();
 }
 
+bool SoundPool::createMixer()
+{
+    uint32_t sampleRate;
+    if (AudioSystem::getOutputSamplingRate(&sampleRate, mStreamType) != NO_ERROR) {
+        sampleRate = kDefaultSampleRate;
+    }
+    // mix at the output sample rate in stereo 16-bit, so that the track can be a fast track
+    sp<AudioTrack> track = new AudioTrack(mStreamType, sampleRate, AUDIO_FORMAT_PCM_16_BIT,
+            AUDIO_CHANNEL_OUT_STEREO, 0 /*frameCount*/, AUDIO_OUTPUT_FLAG_FAST,
+            mixerCallback, this);
+    if (track->initCheck() != NO_ERROR) {
+        ALOGW("Unable to create mixer track, using one track per channel");
+        return false;
+    }
+    mMixBufferFrames = track->frameCount();
+    mMixBuffer = new int32_t[mMixBufferFrames * 2];
+    mMixerSampleRate = sampleRate;
+    mMixerTrack = track;
+    return true;
+}
+
+// call with lock held
+void SoundPool::startMixer_l()
+{
+    if (mMixerTrack != 0 && !mMixerStarted) {
+        ALOGV("start mixer");
+        mMixerTrack->start();
+        mMixerStarted = true;
+    }
+}
+
+void SoundPool::stopMixerIfIdle()
+{
+    Mutex::Autolock lock(&mLock);
+    if (!mMixerStarted) {
+        return;
+    }
+    for (int i = 0; i < mMaxChannels; ++i) {
+        if (mChannelPool[i].state() == SoundChannel::PLAYING) {
+            return;
+        }
+    }
+    ALOGV("stop idle mixer");
+    mMixerTrack->stop();
+    mMixerStarted = false;
+}
+
+void SoundPool::mixerCallback(int event, void* user, void *info)
+{
+    if (event == AudioTrack::EVENT_MORE_DATA) {
+        static_cast<SoundPool*>(user)->mix(static_cast<AudioTrack::Buffer*>(info));
+    }
+}
+
+void SoundPool::mix(AudioTrack::Buffer* buffer)
+{
+    size_t frameCount = buffer->size / (2 * sizeof(int16_t));
+    if (frameCount > mMixBufferFrames) {
+        frameCount = mMixBufferFrames;
+    }
+    memset(mMixBuffer, 0, frameCount * 2 * sizeof(int32_t));
+    bool active = false;
+    for (int i = 0; i < mMaxChannels; ++i) {
+        if (mChannelPool[i].mix(mMixBuffer, frameCount)) {
+            active = true;
+        }
+    }
+    ditherAndClamp((int32_t *) buffer->i16, mMixBuffer, frameCount);
+    buffer->size = frameCount * 2 * sizeof(int16_t);
+
+    if (!active) {
+        // A track can't be stopped from its own callback, so let the restart thread do it
+        Mutex::Autolock lock(&mRestartLock);
+        if (!mQuit && !mMixerIdle) {
+            mMixerIdle = true;
+            mCondition.signal();
+        }
+    }
+}
+
 bool SoundPool::startThreads()
 {
     createThreadEtc(beginThread, this, "SoundPool");
@@ -340,6 +451,9 @@ void SoundPool::resume(int channelID)
     SoundChannel* channel = findChannel(channelID);
     if (channel) {
         channel->resume();
+        if (channel->state() == SoundChannel::PLAYING) {
+            startMixer_l();
+        }
     }
 }
 
@@ -350,6 +464,9 @@ void SoundPool::autoResume()
     for (int i = 0; i < mMaxChannels; ++i) {
         SoundChannel* channel = &mChannelPool[i];
         channel->autoResume();
+        if (channel->state() == SoundChannel::PLAYING) {
+            startMixer_l();
+        }
     }
 }
 
@@ -487,52 +604,134 @@ Sample::~Sample()
 }
 
 status_t Sample::doLoad()
+{
+    ALOGV("Start decode");
+    mDecoded = DecodedSample::load(mUrl, mFd, mOffset, mLength);
+    if (mFd >= 0) {
+        ALOGV("close(%d)", mFd);
+        ::close(mFd);
+        mFd = -1;
+    }
+    status_t status = mDecoded->status();
+    if (status != NO_ERROR) {
+        ALOGE("Unable to load sample: %s", mUrl);
+        mDecoded.clear();
+        return status;
+    }
+    mData = mDecoded->getIMemory();
+    mSize = mDecoded->size();
+    mSampleRate = mDecoded->sampleRate();
+    mNumChannels = mDecoded->numChannels();
+    mFormat = mDecoded->format();
+    mState = READY;
+    return NO_ERROR;
+}
+
+// Process-wide cache of decoded samples.  It holds weak references, so a decode is released
+// as soon as the last Sample using it is unloaded.
+static Mutex gDecodedSamplesLock;
+static Condition gDecodedSamplesCondition;     // signalled when any decode completes
+static DefaultKeyedVector< String8, wp<DecodedSample> > gDecodedSamples;
+
+DecodedSample::DecodedSample(const String8& key)
+    : mKey(key), mStatus(NO_INIT), mSampleRate(0), mNumChannels(0),
+      mFormat(AUDIO_FORMAT_DEFAULT), mSize(0)
+{
+}
+
+DecodedSample::~DecodedSample()
+{
+    if (mKey.isEmpty()) {
+        return;
+    }
+    Mutex::Autolock lock(&gDecodedSamplesLock);
+    // the entry may already have been replaced by a new decode of the same source
+    ssize_t index = gDecodedSamples.indexOfKey(mKey);
+    if (index >= 0 && gDecodedSamples.valueAt(index) == this) {
+        gDecodedSamples.removeItemsAt(index);
+    }
+}
+
+/*static*/
+sp<DecodedSample> DecodedSample::load(const char* url, int fd, int64_t offset, int64_t length)
+{
+    // A file descriptor is identified by the file it refers to rather than by its number,
+    // which differs for each load().  Include the size and modification time so that a
+    // modified file is decoded again.
+    String8 key;
+    struct stat st;
+    if (url != NULL) {
+        key = String8::format("url:%s", url);
+    } else if (fstat(fd, &st) == 0) {
+        key = String8::format("fd:%llu:%llu:%lld:%ld:%lld:%lld",
+                (unsigned long long) st.st_dev, (unsigned long long) st.st_ino,
+                (long long) st.st_size, (long) st.st_mtime, offset, length);
+    }
+
+    sp<DecodedSample> decoded;
+    if (!key.isEmpty()) {
+        Mutex::Autolock lock(&gDecodedSamplesLock);
+        decoded = gDecodedSamples.valueFor(key).promote();
+        if (decoded != 0) {
+            ALOGV("load: sharing decode of %s", key.string());
+            while (decoded->mStatus == NO_INIT) {
+                gDecodedSamplesCondition.wait(gDecodedSamplesLock);
+            }
+            return decoded;
+        }
+        decoded = new DecodedSample(key);
+        gDecodedSamples.add(key, decoded);
+    } else {
+        decoded = new DecodedSample(key);
+    }
+
+    // decode without the lock, so that other sources can be decoded in parallel
+    status_t status = decoded->decode(url, fd, offset, length);
+
+    Mutex::Autolock lock(&gDecodedSamplesLock);
+    decoded->mStatus = status;
+    gDecodedSamplesCondition.broadcast();
+    return decoded;
+}
+
+status_t DecodedSample::decode(const char* url, int fd, int64_t offset, int64_t length)
 {
     uint32_t sampleRate;
     int numChannels;
     audio_format_t format;
+    size_t size;
     status_t status;
-    mHeap = new MemoryHeapBase(kDefaultHeapSize);
+    sp<MemoryHeapBase> heap = new MemoryHeapBase(kDefaultHeapSize);
 
-    ALOGV("Start decode");
-    if (mUrl) {
-        status = MediaPlayer::decode(mUrl, &sampleRate, &numChannels, &format, mHeap, &mSize);
+    if (url != NULL) {
+        status = MediaPlayer::decode(url, &sampleRate, &numChannels, &format, heap, &size);
     } else {
-        status = MediaPlayer::decode(mFd, mOffset, mLength, &sampleRate, &numChannels, &format,
-                                     mHeap, &mSize);
-        ALOGV("close(%d)", mFd);
-        ::close(mFd);
-        mFd = -1;
+        status = MediaPlayer::decode(fd, offset, length, &sampleRate, &numChannels, &format,
+                                     heap, &size);
     }
     if (status != NO_ERROR) {
-        ALOGE("Unable to load sample: %s", mUrl);
-        goto error;
+        return status;
     }
     ALOGV("pointer = %p, size = %u, sampleRate = %u, numChannels = %d",
-          mHeap->getBase(), mSize, sampleRate, numChannels);
+          heap->getBase(), size, sampleRate, numChannels);
 
     if (sampleRate > kMaxSampleRate) {
        ALOGE("Sample rate (%u) out of range", sampleRate);
-       status = BAD_VALUE;
-       goto error;
+       return BAD_VALUE;
     }
 
     if ((numChannels < 1) || (numChannels > 2)) {
         ALOGE("Sample channel count (%d) out of range", numChannels);
-        status = BAD_VALUE;
-        goto error;
+        return BAD_VALUE;
     }
 
-    mData = new MemoryBase(mHeap, 0, mSize);
+    mHeap = heap;
+    mData = new MemoryBase(mHeap, 0, size);
     mSampleRate = sampleRate;
     mNumChannels = numChannels;
     mFormat = format;
-    mState = READY;
+    mSize = size;
     return NO_ERROR;
-
-error:
-    mHeap.clear();
-    return status;
 }
 
 
@@ -565,6 +764,24 @@ void SoundChannel::play(const sp<Sample>& sample, int nextChannelID, float leftV
             return;
         }
 
+        if (mSoundPool->isMixing()) {
+            mSample = sample;
+            mChannelID = nextChannelID;
+            mPriority = priority;
+            mLoop = loop;
+            mLeftVolume = leftVolume;
+            mRightVolume = rightVolume;
+            mNumChannels = sample->numChannels();
+            mRate = rate;
+            mPosition = 0;
+            setStep_l();
+            mMixDone = false;
+            clearNextEvent();
+            mState = PLAYING;
+            mSoundPool->startMixer_l();
+            return;
+        }
+
         // initialize track
         size_t afFrameCount;
         uint32_t afSampleRate;
@@ -764,7 +981,9 @@ bool SoundChannel::doStop_l()
     if (mState != IDLE) {
         setVolume_l(0, 0);
         ALOGV("stop");
-        mAudioTrack->stop();
+        if (mAudioTrack != 0) {
+            mAudioTrack->stop();
+        }
         mSample.clear();
         mState = IDLE;
         mPriority = IDLE_PRIORITY;
@@ -802,7 +1021,9 @@ void SoundChannel::pause()
     if (mState == PLAYING) {
         ALOGV("pause track");
         mState = PAUSED;
-        mAudioTrack->pause();
+        if (mAudioTrack != 0) {
+            mAudioTrack->pause();
+        }
     }
 }
 
@@ -813,7 +1034,9 @@ void SoundChannel::autoPause()
         ALOGV("pause track");
         mState = PAUSED;
         mAutoPaused = true;
-        mAudioTrack->pause();
+        if (mAudioTrack != 0) {
+            mAudioTrack->pause();
+        }
     }
 }
 
@@ -824,7 +1047,9 @@ void SoundChannel::resume()
         ALOGV("resume track");
         mState = PLAYING;
         mAutoPaused = false;
-        mAudioTrack->start();
+        if (mAudioTrack != 0) {
+            mAudioTrack->start();
+        }
     }
 }
 
@@ -835,7 +1060,9 @@ void SoundChannel::autoResume()
         ALOGV("resume track");
         mState = PLAYING;
         mAutoPaused = false;
-        mAudioTrack->start();
+        if (mAudioTrack != 0) {
+            mAudioTrack->start();
+        }
     }
 }
 
@@ -846,6 +1073,19 @@ void SoundChannel::setRate(float rate)
         uint32_t sampleRate = uint32_t(float(mSample->sampleRate()) * rate + 0.5);
         mAudioTrack->setSampleRate(sampleRate);
         mRate = rate;
+    } else if (mSoundPool->isMixing() && mSample != 0) {
+        mRate = rate;
+        setStep_l();
+    }
+}
+
+// call with lock held
+void SoundChannel::setStep_l()
+{
+    mStep = uint64_t(double(mSample->sampleRate()) * mRate / mSoundPool->mixerSampleRate() *
+            4294967296.0 + 0.5);
+    if (mStep == 0) {
+        mStep = 1;
     }
 }
 
@@ -872,7 +1112,138 @@ void SoundChannel::setLoop(int loop)
             ((mSample->format() == AUDIO_FORMAT_PCM_16_BIT) ? sizeof(int16_t) : sizeof(uint8_t));
         mAudioTrack->setLoop(0, loopEnd, loop);
         mLoop = loop;
+    } else if (mSoundPool->isMixing() && mSample != 0) {
+        mLoop = loop;
+    }
+}
+
+static inline int16_t volumeToQ4_12(float volume)
+{
+    if (!(volume > 0.0f)) {
+        return 0;
+    }
+    if (volume >= 1.0f) {
+        return 1 << 12;
+    }
+    return int16_t(volume * (1 << 12) + 0.5f);
+}
+
+// read one frame of 8-bit or 16-bit PCM as 16-bit left and right samples
+static inline void readFrame(const uint8_t* data, bool pcm16, bool stereo, size_t frame,
+        int32_t* left, int32_t* right)
+{
+    if (pcm16) {
+        const int16_t* p = (const int16_t*) data + (stereo ? frame * 2 : frame);
+        *left = p[0];
+        *right = stereo ? p[1] : p[0];
+    } else {
+        const uint8_t* p = data + (stereo ? frame * 2 : frame);
+        *left = (int32_t(p[0]) - 0x80) << 8;
+        *right = stereo ? (int32_t(p[1]) - 0x80) << 8 : *left;
+    }
+}
+
+// Add frameCount frames of 16-bit PCM at unity rate to stereo Q4.27 sums.
+// This is the common case, so it has a NEON version.
+static void accumulate16(int32_t* out, const int16_t* in, size_t frameCount, bool stereo,
+        int16_t vl, int16_t vr)
+{
+#if defined(__ARM_NEON__)
+    if (stereo) {
+        for (; frameCount >= 4; frameCount -= 4) {
+            int32x4x2_t sums = vld2q_s32(out);
+            int16x4x2_t frames = vld2_s16(in);
+            sums.val[0] = vmlal_n_s16(sums.val[0], frames.val[0], vl);
+            sums.val[1] = vmlal_n_s16(sums.val[1], frames.val[1], vr);
+            vst2q_s32(out, sums);
+            in += 8;
+            out += 8;
+        }
+    } else {
+        for (; frameCount >= 4; frameCount -= 4) {
+            int32x4x2_t sums = vld2q_s32(out);
+            int16x4_t frames = vld1_s16(in);
+            sums.val[0] = vmlal_n_s16(sums.val[0], frames, vl);
+            sums.val[1] = vmlal_n_s16(sums.val[1], frames, vr);
+            vst2q_s32(out, sums);
+            in += 4;
+            out += 8;
+        }
+    }
+#endif
+    if (stereo) {
+        for (; frameCount > 0; frameCount--) {
+            out[0] += in[0] * vl;
+            out[1] += in[1] * vr;
+            in += 2;
+            out += 2;
+        }
+    } else {
+        for (; frameCount > 0; frameCount--) {
+            out[0] += in[0] * vl;
+            out[1] += in[0] * vr;
+            in++;
+            out += 2;
+        }
+    }
+}
+
+// called from the SoundPool mixer callback thread
+bool SoundChannel::mix(int32_t* out, size_t frameCount)
+{
+    Mutex::Autolock lock(&mLock);
+    if (mState != PLAYING || mSample == 0 || mMixDone) {
+        return false;
+    }
+    const bool pcm16 = mSample->format() == AUDIO_FORMAT_PCM_16_BIT;
+    const bool stereo = mNumChannels == 2;
+    const size_t frameSize = mNumChannels * (pcm16 ? sizeof(int16_t) : sizeof(uint8_t));
+    const size_t sampleFrames = mSample->size() / frameSize;
+    const uint8_t* data = mSample->data();
+    const int16_t vl = volumeToQ4_12(mLeftVolume);
+    const int16_t vr = volumeToQ4_12(mRightVolume);
+
+    while (frameCount > 0) {
+        size_t frame = mPosition >> 32;
+        if (frame >= sampleFrames) {
+            if (mLoop == 0 || sampleFrames == 0) {
+                // stopping also starts the next event if this voice was stolen
+                mMixDone = true;
+                mSoundPool->addToStopList(this);
+                break;
+            }
+            if (mLoop > 0) {
+                mLoop--;
+            }
+            mPosition -= uint64_t(sampleFrames) << 32;
+            continue;
+        }
+        size_t n;
+        if (mStep == (1ULL << 32) && pcm16) {
+            n = sampleFrames - frame;
+            if (n > frameCount) {
+                n = frameCount;
+            }
+            accumulate16(out, (const int16_t*) data + frame * mNumChannels, n, stereo, vl, vr);
+            mPosition += uint64_t(n) << 32;
+        } else {
+            // linear interpolation, where the last frame is interpolated with itself
+            for (n = 0; n < frameCount && frame < sampleFrames; n++) {
+                int32_t l0, r0, l1, r1;
+                readFrame(data, pcm16, stereo, frame, &l0, &r0);
+                readFrame(data, pcm16, stereo, frame + 1 < sampleFrames ? frame + 1 : frame,
+                        &l1, &r1);
+                int32_t fraction = uint32_t(mPosition) >> 17;     // Q0.15
+                out[2 * n] += (l0 + (((l1 - l0) * fraction) >> 15)) * vl;
+                out[2 * n + 1] += (r0 + (((r1 - r0) * fraction) >> 15)) * vr;
+                mPosition += mStep;
+                frame = mPosition >> 32;
+            }
+        }
+        out += 2 * n;
+        frameCount -= n;
     }
+    return true;
 }
 
 SoundChannel::~SoundChannel()
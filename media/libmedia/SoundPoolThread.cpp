@@ -18,6 +18,7 @@
 #define LOG_TAG "SoundPoolThread"
 #include "utils/Log.h"
 
+#include <unistd.h>
 #include "SoundPoolThread.h"
 
 namespace android {
@@ -31,7 +32,7 @@ void SoundPoolThread::write(SoundPoolMsg msg) {
     // if thread is quitting, don't add to queue
     if (mRunning) {
         mMsgQueue.push(msg);
-        mCondition.signal();
+        mCondition.broadcast();
     }
 }
 
@@ -42,7 +43,11 @@ const SoundPoolMsg SoundPoolThread::read() {
     }
     SoundPoolMsg msg = mMsgQueue[0];
     mMsgQueue.removeAt(0);
-    mCondition.signal();
+    if (msg.mMessageType == SoundPoolMsg::KILL) {
+        mThreadCount--;
+    }
+    // the condition is shared by writers, readers and quit(), so wake them all
+    mCondition.broadcast();
     return msg;
 }
 
@@ -51,20 +56,36 @@ void SoundPoolThread::quit() {
     if (mRunning) {
         mRunning = false;
         mMsgQueue.clear();
-        mMsgQueue.push(SoundPoolMsg(SoundPoolMsg::KILL, 0));
-        mCondition.signal();
-        mCondition.wait(mLock);
+        for (int i = 0; i < mThreadCount; i++) {
+            mMsgQueue.push(SoundPoolMsg(SoundPoolMsg::KILL, 0));
+        }
+        mCondition.broadcast();
+        while (mThreadCount > 0) {
+            mCondition.wait(mLock);
+        }
     }
     ALOGV("return from quit");
 }
 
 SoundPoolThread::SoundPoolThread(SoundPool* soundPool) :
-    mSoundPool(soundPool)
+    mSoundPool(soundPool), mRunning(false), mThreadCount(0)
 {
     mMsgQueue.setCapacity(maxMessages);
-    if (createThreadEtc(beginThread, this, "SoundPoolThread")) {
-        mRunning = true;
+    // Decoding is mostly waiting for the media server, so even a single core benefits from
+    // having a few decodes in flight.
+    long numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (numThreads < 2) {
+        numThreads = 2;
+    } else if (numThreads > maxThreads) {
+        numThreads = maxThreads;
+    }
+    Mutex::Autolock lock(&mLock);
+    for (long i = 0; i < numThreads; i++) {
+        if (createThreadEtc(beginThread, this, "SoundPoolThread")) {
+            mThreadCount++;
+        }
     }
+    mRunning = mThreadCount > 0;
 }
 
 SoundPoolThread::~SoundPoolThread()
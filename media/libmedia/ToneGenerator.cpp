@@ -18,8 +18,10 @@
 #define LOG_TAG "ToneGenerator"
 
 #include <math.h>
+#include <new>
 #include <utils/Log.h>
 #include <cutils/properties.h>
+#include <audio_utils/primitives.h>
 #include "media/ToneGenerator.h"
 
 
@@ -830,6 +832,34 @@ ToneGenerator::ToneGenerator(audio_stream_type_t streamType, float volume, bool
     }
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//    Method:        ToneGenerator::ToneGenerator()
+//
+//    Description:    Constructor used by the unit tests. Initializes the tone
+//        sequencer without an audio track: audioCallback() must be called
+//        directly, and not once the state is TONE_STOPPED.
+//
+//    Input:
+//        samplingRate:      Output sampling rate in Hz
+//        toneRegion:        Region of the supervisory tones
+//
+//    Output:
+//        none
+//
+////////////////////////////////////////////////////////////////////////////////
+ToneGenerator::ToneGenerator(uint32_t samplingRate, region toneRegion) {
+    mState = TONE_INIT;
+    mThreadCanCallJava = false;
+    mStreamType = AUDIO_STREAM_DEFAULT;
+    mVolume = 1.0f;
+    mpToneDesc = NULL;
+    mpNewToneDesc = NULL;
+    mSamplingRate = samplingRate;
+    mProcessSize = (mSamplingRate * 20) / 1000;
+    mRegion = toneRegion;
+}
+
 
 
 
@@ -1175,13 +1205,9 @@ void ToneGenerator::audioCallback(int event, void* user, void *info) {
             // If segment,  ON -> OFF transition : ramp volume down
             if (lpToneDesc->segments[lpToneGen->mCurSegment].waveFreq[0] != 0) {
                 lWaveCmd = WaveGenerator::WAVEGEN_STOP;
-                unsigned int lFreqIdx = 0;
-                unsigned short lFrequency = lpToneDesc->segments[lpToneGen->mCurSegment].waveFreq[lFreqIdx];
-
-                while (lFrequency != 0) {
-                    WaveGenerator *lpWaveGen = lpToneGen->mWaveGens.valueFor(lFrequency);
+                WaveGenerator *lpWaveGen = lpToneGen->getWaveGen(lpToneGen->mCurSegment);
+                if (lpWaveGen != NULL) {
                     lpWaveGen->getSamples(lpOut, lGenSmp, lWaveCmd);
-                    lFrequency = lpToneDesc->segments[lpToneGen->mCurSegment].waveFreq[++lFreqIdx];
                 }
                 ALOGV("ON->OFF, lGenSmp: %d, lReqSmp: %d", lGenSmp, lReqSmp);
             }
@@ -1224,6 +1250,9 @@ void ToneGenerator::audioCallback(int event, void* user, void *info) {
                     lpToneGen->mCurSegment = lpToneDesc->repeatSegment;
                     if (lpToneDesc->segments[lpToneDesc->repeatSegment].waveFreq[0] != 0) {
                         lWaveCmd = WaveGenerator::WAVEGEN_START;
+                    } else {
+                        // repeating from a silent segment
+                        lGenSmp = 0;
                     }
 
                     ALOGV("New segment %d, Next Time: %d", lpToneGen->mCurSegment,
@@ -1260,14 +1289,10 @@ void ToneGenerator::audioCallback(int event, void* user, void *info) {
         }
 
         if (lGenSmp) {
-            // If samples must be generated, call all active wave generators and acumulate waves in lpOut
-            unsigned int lFreqIdx = 0;
-            unsigned short lFrequency = lpToneDesc->segments[lpToneGen->mCurSegment].waveFreq[lFreqIdx];
-
-            while (lFrequency != 0) {
-                WaveGenerator *lpWaveGen = lpToneGen->mWaveGens.valueFor(lFrequency);
+            // If samples must be generated, accumulate the waves of the current segment in lpOut
+            WaveGenerator *lpWaveGen = lpToneGen->getWaveGen(lpToneGen->mCurSegment);
+            if (lpWaveGen != NULL) {
                 lpWaveGen->getSamples(lpOut, lGenSmp, lWaveCmd);
-                lFrequency = lpToneDesc->segments[lpToneGen->mCurSegment].waveFreq[++lFreqIdx];
             }
         }
 
@@ -1351,9 +1376,6 @@ bool ToneGenerator::prepareWave() {
         return false;
     }
 
-    // Remove existing wave generators if any
-    clearWaveGens();
-
     mpToneDesc = mpNewToneDesc;
 
     if (mDurationMs == -1) {
@@ -1367,25 +1389,31 @@ bool ToneGenerator::prepareWave() {
         ALOGV("prepareWave, duration limited to %d ms", mDurationMs);
     }
 
+    // Get the buffers of the new tone before removing the existing wave generators,
+    // so that the buffers shared by both tones don't need to be rendered again
+    KeyedVector<unsigned short, WaveGenerator *> waveGens;
     while (mpToneDesc->segments[segmentIdx].duration) {
-        // Get total number of sine waves: needed to adapt sine wave gain.
-        unsigned int lNumWaves = numWaves(segmentIdx);
-        unsigned int freqIdx = 0;
-        unsigned int frequency = mpToneDesc->segments[segmentIdx].waveFreq[freqIdx];
-        while (frequency) {
-            // Instantiate a wave generator if  ot already done for this frequency
-            if (mWaveGens.indexOfKey(frequency) == NAME_NOT_FOUND) {
-                ToneGenerator::WaveGenerator *lpWaveGen =
-                        new ToneGenerator::WaveGenerator((unsigned short)mSamplingRate,
-                                frequency,
-                                TONEGEN_GAIN/lNumWaves);
-                mWaveGens.add(frequency, lpWaveGen);
+        if (mpToneDesc->segments[segmentIdx].waveFreq[0] != 0) {
+            // Get total number of sine waves: needed to adapt sine wave gain.
+            unsigned int lNumWaves = numWaves(segmentIdx);
+            sp<ToneBuffer> buffer = ToneBuffer::get(mSamplingRate,
+                    mpToneDesc->segments[segmentIdx].waveFreq, TONEGEN_GAIN/lNumWaves);
+            if (buffer == 0) {
+                for (size_t lIdx = 0; lIdx < waveGens.size(); lIdx++) {
+                    delete waveGens.valueAt(lIdx);
+                }
+                clearWaveGens();
+                return false;
             }
-            frequency = mpNewToneDesc->segments[segmentIdx].waveFreq[++freqIdx];
+            waveGens.add(segmentIdx, new ToneGenerator::WaveGenerator(buffer));
         }
         segmentIdx++;
     }
 
+    // Remove existing wave generators if any
+    clearWaveGens();
+    mWaveGens = waveGens;
+
     // Initialize tone sequencer
     mTotalSmp = 0;
     mCurSegment = 0;
@@ -1450,6 +1478,27 @@ void ToneGenerator::clearWaveGens() {
     mWaveGens.clear();
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//    Method:        ToneGenerator::getWaveGen()
+//
+//    Description:    Returns the wave generator of a segment.
+//
+//    Input:
+//        segmentIdx:   index of the segment in the current tone descriptor
+//
+//    Output:
+//        returned value:   the wave generator, or NULL for a silent segment
+//
+////////////////////////////////////////////////////////////////////////////////
+ToneGenerator::WaveGenerator *ToneGenerator::getWaveGen(unsigned int segmentIdx) {
+    ssize_t index = mWaveGens.indexOfKey(segmentIdx);
+    if (index < 0) {
+        return NULL;
+    }
+    return mWaveGens.valueAt(index);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //    Method:       ToneGenerator::getToneForRegion()
@@ -1479,10 +1528,200 @@ ToneGenerator::tone_type ToneGenerator::getToneForRegion(tone_type toneType) {
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+//                ToneGenerator::ToneBuffer class    Implementation
+////////////////////////////////////////////////////////////////////////////////
+
+Mutex ToneGenerator::ToneBuffer::sLock;
+DefaultKeyedVector< String8, wp<ToneGenerator::ToneBuffer> > ToneGenerator::ToneBuffer::sBuffers;
+Vector< sp<ToneGenerator::ToneBuffer> > ToneGenerator::ToneBuffer::sRecentBuffers;
+size_t ToneGenerator::ToneBuffer::sRecentBytes = 0;
+
+//---------------------------------- public methods ----------------------------
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//    Method:        ToneBuffer::get()
+//
+//    Description:    Returns the buffer of a tone segment, rendering it if no
+//      ToneGenerator of this process has used the same segment recently.
+//
+//    Input:
+//        samplingRate:    Output sampling rate in Hz
+//        waveFreq:        Frequencies of the sine waves in Hz, 0 terminated
+//        volume:          volume of each sine wave (0.0 to 1.0)
+//
+//    Output:
+//        returned value:   the buffer, or 0 if it could not be allocated
+//
+////////////////////////////////////////////////////////////////////////////////
+sp<ToneGenerator::ToneBuffer> ToneGenerator::ToneBuffer::get(uint32_t samplingRate,
+        const unsigned short *waveFreq, float volume) {
+    String8 key;
+    key.appendFormat("%u:%f", samplingRate, volume);
+    for (unsigned int lIdx = 0; lIdx < TONEGEN_MAX_WAVES && waveFreq[lIdx] != 0; lIdx++) {
+        key.appendFormat(":%u", waveFreq[lIdx]);
+    }
+
+    // declared before the lock, so that released buffers are destroyed after it is released
+    Vector< sp<ToneBuffer> > evicted;
+    sp<ToneBuffer> buffer;
+    Mutex::Autolock lock(&sLock);
+
+    buffer = sBuffers.valueFor(key).promote();
+    if (buffer == 0) {
+        buffer = new ToneBuffer(key);
+        if (!buffer->render(samplingRate, waveFreq, volume)) {
+            return 0;
+        }
+        sBuffers.add(key, buffer);
+        ALOGV("ToneBuffer rendered %s, %zu frames", key.string(), buffer->mFrameCount);
+    } else {
+        for (size_t lIdx = 0; lIdx < sRecentBuffers.size(); lIdx++) {
+            if (sRecentBuffers[lIdx] == buffer) {
+                sRecentBuffers.removeAt(lIdx);
+                sRecentBytes -= buffer->mFrameCount * sizeof(short);
+                break;
+            }
+        }
+    }
+
+    // Keep the most recently used buffers even after their ToneGenerator stops,
+    // so that a tone started repeatedly (e.g. DTMF digits) is only rendered once
+    sRecentBuffers.push(buffer);
+    sRecentBytes += buffer->mFrameCount * sizeof(short);
+    while (sRecentBytes > MAX_RECENT_BYTES && sRecentBuffers.size() > 1) {
+        evicted.push(sRecentBuffers[0]);
+        sRecentBytes -= sRecentBuffers[0]->mFrameCount * sizeof(short);
+        sRecentBuffers.removeAt(0);
+    }
+
+    return buffer;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//    Method:        ToneBuffer::~ToneBuffer()
+//
+//    Description:    Destructor. Removes the buffer from the cache.
+//
+//    Input:
+//        none
+//
+//    Output:
+//        none
+//
+////////////////////////////////////////////////////////////////////////////////
+ToneGenerator::ToneBuffer::~ToneBuffer() {
+    {
+        Mutex::Autolock lock(&sLock);
+        // the key already refers to a newer buffer if get() was called after the last
+        // reference to this one was released, but before this destructor got the lock
+        ssize_t index = sBuffers.indexOfKey(mKey);
+        if (index >= 0 && sBuffers.valueAt(index) == this) {
+            sBuffers.removeItemsAt(index);
+        }
+    }
+    delete[] mData;
+}
+
+//---------------------------------- private methods ---------------------------
+
+ToneGenerator::ToneBuffer::ToneBuffer(const String8& key)
+    : mKey(key), mData(NULL), mFrameCount(0) {
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//    Method:        ToneBuffer::render()
+//
+//    Description:    Renders one period of the sum of the sine waves.
+//      All the waves are generated together, block by block: at the start of
+//      each block the oscillators are reset to the exact phase of the block,
+//      so rounding errors don't accumulate and the end of the period joins
+//      seamlessly with its start.
+//
+//    Input:
+//        samplingRate:    Output sampling rate in Hz
+//        waveFreq:        Frequencies of the sine waves in Hz, 0 terminated
+//        volume:          volume of each sine wave (0.0 to 1.0)
+//
+//    Output:
+//        returned value:   true if the buffer was allocated, false otherwise
+//
+////////////////////////////////////////////////////////////////////////////////
+bool ToneGenerator::ToneBuffer::render(uint32_t samplingRate, const unsigned short *waveFreq,
+        float volume) {
+    uint32_t lFreq[RENDER_LANES];
+    double lA1[RENDER_LANES];  // 2*cos(w)
+    double lAmplitude[RENDER_LANES];
+    double lS1[RENDER_LANES], lS2[RENDER_LANES];  // delay line, S2 oldest
+
+    // The period of the sum is the sampling rate divided by the greatest common
+    // divisor of the sampling rate and all the frequencies, so at most one second
+    uint32_t lGcd = samplingRate;
+    for (unsigned int lLane = 0; lLane < RENDER_LANES; lLane++) {
+        if (lLane < TONEGEN_MAX_WAVES && waveFreq[lLane] != 0 &&
+                (lLane == 0 || lFreq[lLane - 1] != 0)) {
+            lFreq[lLane] = waveFreq[lLane];
+            lAmplitude[lLane] = 32767. * volume;
+            uint32_t a = lGcd, b = lFreq[lLane];
+            while (b != 0) {
+                uint32_t r = a % b;
+                a = b;
+                b = r;
+            }
+            lGcd = a;
+        } else {
+            // unused lanes only keep the loop below a fixed width
+            lFreq[lLane] = 0;
+            lAmplitude[lLane] = 0;
+        }
+        lA1[lLane] = 2 * cos(2 * M_PI * lFreq[lLane] / samplingRate);
+    }
+    mFrameCount = samplingRate / lGcd;
+
+    mData = new (std::nothrow) short[mFrameCount];
+    if (mData == NULL) {
+        ALOGE("ToneBuffer cannot allocate %zu frames", mFrameCount);
+        return false;
+    }
+
+    for (size_t lStart = 0; lStart < mFrameCount; lStart += RENDER_BLOCK_SIZE) {
+        size_t lCount = mFrameCount - lStart;
+        if (lCount > RENDER_BLOCK_SIZE) {
+            lCount = RENDER_BLOCK_SIZE;
+        }
+        for (unsigned int lLane = 0; lLane < RENDER_LANES; lLane++) {
+            double w = 2 * M_PI * lFreq[lLane] / samplingRate;
+            double phase = 2 * M_PI * (double)(((uint64_t)lStart * lFreq[lLane]) % samplingRate)
+                    / samplingRate;
+            lS1[lLane] = sin(phase - w);
+            lS2[lLane] = sin(phase - 2 * w);
+        }
+        short *lpOut = mData + lStart;
+        for (size_t lIdx = 0; lIdx < lCount; lIdx++) {
+            double lSum = 0;
+            for (unsigned int lLane = 0; lLane < RENDER_LANES; lLane++) {
+                double lSample = lA1[lLane] * lS1[lLane] - lS2[lLane];
+                lS2[lLane] = lS1[lLane];
+                lS1[lLane] = lSample;
+                lSum += lAmplitude[lLane] * lSample;
+            }
+            lpOut[lIdx] = clamp16((int32_t)lrint(lSum));
+        }
+    }
+    return true;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 //                WaveGenerator::WaveGenerator class    Implementation
 ////////////////////////////////////////////////////////////////////////////////
 
+short ToneGenerator::WaveGenerator::sRamp[RAMP_SIZE];
+pthread_once_t ToneGenerator::WaveGenerator::sRampOnce = PTHREAD_ONCE_INIT;
+
 //---------------------------------- public methods ----------------------------
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1492,37 +1731,15 @@ ToneGenerator::tone_type ToneGenerator::getToneForRegion(tone_type toneType) {
 //    Description:    Constructor.
 //
 //    Input:
-//        samplingRate:    Output sampling rate in Hz
-//        frequency:       Frequency of the sine wave to generate in Hz
-//        volume:          volume (0.0 to 1.0)
+//        buffer:          One period of the waves to generate
 //
 //    Output:
 //        none
 //
 ////////////////////////////////////////////////////////////////////////////////
-ToneGenerator::WaveGenerator::WaveGenerator(unsigned short samplingRate,
-        unsigned short frequency, float volume) {
-    double d0;
-    double F_div_Fs;  // frequency / samplingRate
-
-    F_div_Fs = frequency / (double)samplingRate;
-    d0 = - (float)GEN_AMP * sin(2 * M_PI * F_div_Fs);
-    mS2_0 = (short)d0;
-    mS1 = 0;
-    mS2 = mS2_0;
-
-    mAmplitude_Q15 = (short)(32767. * 32767. * volume / GEN_AMP);
-    // take some margin for amplitude fluctuation
-    if (mAmplitude_Q15 > 32500)
-        mAmplitude_Q15 = 32500;
-
-    d0 = 32768.0 * cos(2 * M_PI * F_div_Fs);  // Q14*2*cos()
-    if (d0 > 32767)
-        d0 = 32767;
-    mA1_Q14 = (short) d0;
-
-    ALOGV("WaveGenerator init, mA1_Q14: %d, mS2_0: %d, mAmplitude_Q15: %d",
-            mA1_Q14, mS2_0, mAmplitude_Q15);
+ToneGenerator::WaveGenerator::WaveGenerator(const sp<ToneBuffer>& buffer)
+    : mBuffer(buffer), mPosition(0) {
+    pthread_once(&sRampOnce, initRamp);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1545,8 +1762,8 @@ ToneGenerator::WaveGenerator::~WaveGenerator() {
 //
 //    Method:        WaveGenerator::getSamples()
 //
-//    Description:    Generates count samples of a sine wave and accumulates
-//        result in outBuffer.
+//    Description:    Copies count samples of the waves from the buffer and
+//        accumulates them in outBuffer.
 //
 //    Input:
 //        outBuffer:      Output buffer where to accumulate samples.
@@ -1559,52 +1776,69 @@ ToneGenerator::WaveGenerator::~WaveGenerator() {
 ////////////////////////////////////////////////////////////////////////////////
 void ToneGenerator::WaveGenerator::getSamples(short *outBuffer,
         unsigned int count, unsigned int command) {
-    long lS1, lS2;
-    long lA1, lAmplitude;
-    long Sample;  // current sample
+    const short *lpData = mBuffer->data();
+    const size_t lFrameCount = mBuffer->frameCount();
 
-    // init local
     if (command == WAVEGEN_START) {
-        lS1 = (long)0;
-        lS2 = (long)mS2_0;
-    } else {
-        lS1 = (long)mS1;
-        lS2 = (long)mS2;
+        mPosition = 0;
     }
-    lA1 = (long)mA1_Q14;
-    lAmplitude = (long)mAmplitude_Q15;
 
     if (command == WAVEGEN_STOP) {
-        lAmplitude <<= 16;
         if (count == 0) {
             return;
         }
-        long dec = lAmplitude/count;
-        // loop generation
+        // step through the ramp in Q16 so that it spans count samples
+        uint32_t lRampPos = 0;
+        uint32_t lRampStep = (RAMP_SIZE << 16) / count;
         while (count--) {
-            Sample = ((lA1 * lS1) >> S_Q14) - lS2;
-            // shift delay
-            lS2 = lS1;
-            lS1 = Sample;
-            Sample = ((lAmplitude>>16) * Sample) >> S_Q15;
-            *(outBuffer++) += (short)Sample;  // put result in buffer
-            lAmplitude -= dec;
+            int32_t lSample = ((int32_t)lpData[mPosition] * sRamp[lRampPos >> 16]) >> S_Q15;
+            *outBuffer = clamp16(*outBuffer + lSample);
+            outBuffer++;
+            if (++mPosition == lFrameCount) {
+                mPosition = 0;
+            }
+            lRampPos += lRampStep;
         }
     } else {
-        // loop generation
-        while (count--) {
-            Sample = ((lA1 * lS1) >> S_Q14) - lS2;
-            // shift delay
-            lS2 = lS1;
-            lS1 = Sample;
-            Sample = (lAmplitude * Sample) >> S_Q15;
-            *(outBuffer++) += (short)Sample;  // put result in buffer
+        while (count) {
+            size_t lCount = lFrameCount - mPosition;
+            if (lCount > count) {
+                lCount = count;
+            }
+            const short *lpIn = lpData + mPosition;
+            for (size_t lIdx = 0; lIdx < lCount; lIdx++) {
+                outBuffer[lIdx] = clamp16(outBuffer[lIdx] + lpIn[lIdx]);
+            }
+            outBuffer += lCount;
+            count -= lCount;
+            mPosition += lCount;
+            if (mPosition == lFrameCount) {
+                mPosition = 0;
+            }
         }
     }
+}
+
+//---------------------------------- private methods ---------------------------
 
-    // save status
-    mS1 = (short)lS1;
-    mS2 = (short)lS2;
+////////////////////////////////////////////////////////////////////////////////
+//
+//    Method:        WaveGenerator::initRamp()
+//
+//    Description:    Precomputes the fade out ramp: a raised cosine, which
+//        is less audible than a linear ramp.
+//
+//    Input:
+//        none
+//
+//    Output:
+//        none
+//
+////////////////////////////////////////////////////////////////////////////////
+void ToneGenerator::WaveGenerator::initRamp() {
+    for (unsigned int lIdx = 0; lIdx < RAMP_SIZE; lIdx++) {
+        sRamp[lIdx] = (short)(32767. * 0.5 * (1. + cos(M_PI * lIdx / RAMP_SIZE)));
+    }
 }
 
 }  // end namespace android
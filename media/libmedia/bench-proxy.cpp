@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Benchmark of AudioTrack::writev() gathering many small application buffers.
+ *
+ * A muted stereo 16 bit track is played through AudioFlinger, and filled from application
+ * buffers of various sizes by the real AudioTrack::writev(), without blocking:
+ *  - "each" passes one application buffer per call, as one write() per buffer would do,
+ *    so there is one obtainBuffer() and releaseBuffer() per application buffer;
+ *  - "gathered" passes all the pending application buffers in one call, so there is one
+ *    obtainBuffer() and releaseBuffer() per contiguous region of the track buffer.
+ * Only the calls that wrote something are timed, so the frames/second reported are for the
+ * client side only.  The track is consumed in real time, so each configuration takes as
+ * long as the audio it writes.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include <binder/ProcessState.h>
+#include <media/AudioTrack.h>
+
+using namespace android;
+
+// ----------------------------------------------------------------------------
+
+static const uint32_t kSampleRate = 48000;
+static const size_t kFrameSize = 2 * sizeof(int16_t);  // stereo 16 bit
+
+// Position in the application buffers, advanced by what writev() accepted
+class Cursor {
+public:
+    Cursor(const struct iovec* iov, int iovcnt) : mIov(iov), mIovcnt(iovcnt), mIndex(0),
+            mOffset(0) { }
+
+    // Prepares in "iov" the pending application buffers, up to "max", and returns their count
+    int pending(struct iovec* iov, int max) {
+        if (mIndex == mIovcnt) {
+            // all written: start over with the same data
+            mIndex = 0;
+        }
+        int count = mIovcnt - mIndex < max ? mIovcnt - mIndex : max;
+        for (int i = 0; i < count; i++) {
+            iov[i] = mIov[mIndex + i];
+        }
+        iov[0].iov_base = (char *) iov[0].iov_base + mOffset;
+        iov[0].iov_len -= mOffset;
+        return count;
+    }
+
+    void advance(size_t bytes) {
+        while (bytes > 0) {
+            size_t part = mIov[mIndex].iov_len - mOffset;
+            if (part > bytes) {
+                part = bytes;
+            }
+            bytes -= part;
+            mOffset += part;
+            if (mOffset == mIov[mIndex].iov_len) {
+                mIndex++;
+                mOffset = 0;
+            }
+        }
+    }
+
+private:
+    const struct iovec* const mIov;
+    const int mIovcnt;
+    int mIndex;
+    size_t mOffset;
+};
+
+// Returns client frames per second, while writing totalFrames to a new track, or a negative
+// value if the track could not be created
+static double bench(bool gathered, size_t trackFrames, size_t userFrames, size_t totalFrames)
+{
+    sp<AudioTrack> track = new AudioTrack(AUDIO_STREAM_MUSIC, kSampleRate,
+            AUDIO_FORMAT_PCM_16_BIT, AUDIO_CHANNEL_OUT_STEREO, trackFrames,
+            AUDIO_OUTPUT_FLAG_NONE, NULL /*cbf*/, NULL /*user*/, 0 /*notificationFrames*/,
+            0 /*sessionId*/, AudioTrack::TRANSFER_SYNC);
+    if (track->initCheck() != NO_ERROR) {
+        fprintf(stderr, "AudioTrack creation failed (%d)\n", track->initCheck());
+        return -1;
+    }
+    track->setVolume(0.0f);
+
+    // enough application buffers to fill the whole track buffer in one call
+    const int userBuffers = (track->frameCount() + userFrames - 1) / userFrames;
+    int16_t* data = (int16_t *) calloc(userBuffers * userFrames, kFrameSize);
+    struct iovec* iov = new struct iovec[userBuffers];
+    for (int i = 0; i < userBuffers; i++) {
+        iov[i].iov_base = (char *) data + i * userFrames * kFrameSize;
+        iov[i].iov_len = userFrames * kFrameSize;
+    }
+    struct iovec* pending = new struct iovec[userBuffers];
+    Cursor cursor(iov, userBuffers);
+
+    track->start();
+    size_t frames = 0;
+    int64_t ns = 0;
+    while (frames < totalFrames) {
+        int count = cursor.pending(pending, gathered ? userBuffers : 1);
+        const nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        // a deadline in the past makes writev() non-blocking
+        ssize_t written = track->writev(pending, count, 0 /*deadline*/);
+        const nsecs_t end = systemTime(SYSTEM_TIME_MONOTONIC);
+        if (written > 0) {
+            ns += end - start;
+            frames += written / kFrameSize;
+            cursor.advance(written);
+        } else if (written == 0 || written == WOULD_BLOCK) {
+            // the track buffer is full, wait for the mixer to consume some of it
+            usleep(1000);
+        } else {
+            fprintf(stderr, "AudioTrack::writev() failed (%zd)\n", written);
+            break;
+        }
+    }
+    track->stop();
+
+    delete[] pending;
+    delete[] iov;
+    free(data);
+    return ns > 0 ? frames * 1e9 / ns : 0;
+}
+
+// ----------------------------------------------------------------------------
+
+// Parses a whole decimal number that fits in "max", rejecting signs, which strtoul() accepts
+static bool parseCount(const char* s, unsigned long max, unsigned long* value) {
+    if (*s < '0' || *s > '9') {
+        return false;
+    }
+    char* end;
+    errno = 0;
+    unsigned long v = strtoul(s, &end, 10);
+    if (errno != 0 || *end != '\0' || v > max) {
+        return false;
+    }
+    *value = v;
+    return true;
+}
+
+static int usage(const char* name) {
+    fprintf(stderr, "Usage: %s [-t track_frames] [-s seconds]\n", name);
+    fprintf(stderr, "    -t    track buffer size in frames (default 4096)\n");
+    fprintf(stderr, "    -s    seconds of 48 kHz audio written per configuration (default 5)\n");
+    return -1;
+}
+
+int main(int argc, char* argv[]) {
+    const char* const progname = argv[0];
+    size_t trackFrames = 4096;
+    size_t seconds = 5;
+
+    int ch;
+    unsigned long value;
+    while ((ch = getopt(argc, argv, "t:s:")) != -1) {
+        switch (ch) {
+        case 't':
+            if (!parseCount(optarg, 1 << 20, &value)) {
+                return usage(progname);
+            }
+            trackFrames = value;
+            break;
+        case 's':
+            if (!parseCount(optarg, 3600, &value)) {
+                return usage(progname);
+            }
+            seconds = value;
+            break;
+        case '?':
+        default:
+            return usage(progname);
+        }
+    }
+    if (trackFrames == 0 || seconds == 0) {
+        return usage(progname);
+    }
+
+    ProcessState::self()->startThreadPool();
+
+    static const size_t userFrameCounts[] = { 32, 64, 128, 256, 512, 1024 };
+    const size_t totalFrames = seconds * kSampleRate;
+
+    printf("AudioTrack::writev(), %zu frame track buffer, %zu frames per configuration\n",
+            trackFrames, totalFrames);
+    printf("%8s %14s %14s %7s\n", "frames", "each f/s", "gathered f/s", "ratio");
+    for (size_t u = 0; u < sizeof(userFrameCounts) / sizeof(userFrameCounts[0]); u++) {
+        const size_t userFrames = userFrameCounts[u];
+        const double each = bench(false /*gathered*/, trackFrames, userFrames, totalFrames);
+        const double gathered = bench(true /*gathered*/, trackFrames, userFrames, totalFrames);
+        if (each < 0 || gathered < 0) {
+            return 1;
+        }
+        printf("%8zu %14.0f %14.0f %7.2f\n", userFrames, each, gathered,
+                each > 0 ? gathered / each : 0);
+    }
+    return 0;
+}
@@ -0,0 +1,28 @@
+# Build the unit tests.
+LOCAL_PATH:= $(call my-dir)
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := ToneGenerator_test
+
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_SRC_FILES := \
+	ToneGenerator_test.cpp \
+
+LOCAL_SHARED_LIBRARIES := \
+	libmedia \
+	libstlport \
+	libutils \
+	liblog
+
+LOCAL_STATIC_LIBRARIES := \
+	libgtest \
+	libgtest_main \
+
+LOCAL_C_INCLUDES := \
+	bionic \
+	bionic/libstdc++/include \
+	external/gtest/include \
+	external/stlport/stlport \
+
+include $(BUILD_EXECUTABLE)
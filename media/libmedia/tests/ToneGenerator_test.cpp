@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "ToneGenerator_test"
+
+#include <gtest/gtest.h>
+#include <math.h>
+
+#include <media/AudioTrack.h>
+#include <media/ToneGenerator.h>
+#include <utils/Log.h>
+#include <utils/Vector.h>
+
+namespace android {
+
+// Runs the tone sequencer of a ToneGenerator without an AudioTrack, and reads the shared
+// ToneBuffers, so the tests need neither an audio device nor the region property.
+class ToneGeneratorTest : public ::testing::Test {
+protected:
+    static const uint32_t kSamplingRate = 8000;
+    static const unsigned int kBlockMs = 20;    // ToneGenerator::mProcessSize
+    static const size_t kBlockFrames = kSamplingRate * kBlockMs / 1000;
+
+    ToneGeneratorTest() : mToneGen(NULL) { }
+
+    virtual void TearDown() {
+        if (mToneGen != NULL) {
+            mToneGen->clearWaveGens();
+            delete mToneGen;
+            mToneGen = NULL;
+        }
+    }
+
+    // Starts a tone as startTone() does, except that no AudioTrack is started.
+    void start(ToneGenerator::tone_type toneType, bool ansi) {
+        mToneGen = new ToneGenerator(kSamplingRate,
+                ansi ? ToneGenerator::ANSI : ToneGenerator::CEPT);
+        mToneGen->mpNewToneDesc = &ToneGenerator::sToneDescriptors[
+                mToneGen->getToneForRegion(toneType)];
+        mToneGen->mDurationMs = -1;
+        ASSERT_TRUE(mToneGen->prepareWave());
+        mToneGen->mState = ToneGenerator::TONE_STARTING;
+    }
+
+    // Plays blocks of kBlockFrames until the tone stops or maxBlocks have been played,
+    // and returns the lengths in ms of the alternating runs of sound and silence,
+    // starting with sound.
+    Vector<unsigned int> play(size_t maxBlocks) {
+        Vector<unsigned int> runs;
+        bool sound = true;
+        unsigned int runMs = 0;
+        short out[kBlockFrames];
+        for (size_t i = 0; i < maxBlocks; i++) {
+            // the callback stops the AudioTrack in this state
+            if (mToneGen->mState == ToneGenerator::TONE_STOPPED) {
+                break;
+            }
+            AudioTrack::Buffer buffer;
+            buffer.frameCount = kBlockFrames;
+            buffer.size = sizeof(out);
+            buffer.i16 = out;
+            ToneGenerator::audioCallback(AudioTrack::EVENT_MORE_DATA, mToneGen, &buffer);
+
+            bool blockSound = false;
+            for (size_t j = 0; j < kBlockFrames; j++) {
+                blockSound |= out[j] != 0;
+            }
+            if (blockSound != sound) {
+                runs.push(runMs);
+                runMs = 0;
+                sound = blockSound;
+            }
+            runMs += kBlockMs;
+        }
+        runs.push(runMs);
+        return runs;
+    }
+
+    bool isStopped() const {
+        return mToneGen->mState == ToneGenerator::TONE_STOPPED;
+    }
+
+    static sp<RefBase> getToneBuffer(const unsigned short *waveFreq, float volume) {
+        return ToneGenerator::ToneBuffer::get(kSamplingRate, waveFreq, volume);
+    }
+
+    static const short *toneBufferData(const sp<RefBase>& buffer) {
+        return static_cast<ToneGenerator::ToneBuffer *>(buffer.get())->data();
+    }
+
+    static size_t toneBufferFrameCount(const sp<RefBase>& buffer) {
+        return static_cast<ToneGenerator::ToneBuffer *>(buffer.get())->frameCount();
+    }
+
+private:
+    ToneGenerator *mToneGen;
+};
+
+// The buffer holds one period of the sum of the waves: 8000 Hz / gcd(8000, 350, 440) frames.
+TEST_F(ToneGeneratorTest, ToneBufferHoldsOnePeriod) {
+    static const unsigned short kWaveFreq[] = { 350, 440, 0 };
+    const float volume = 0.45f;
+    sp<RefBase> buffer = getToneBuffer(kWaveFreq, volume);
+    ASSERT_TRUE(buffer != 0);
+    ASSERT_EQ(800u, toneBufferFrameCount(buffer));
+
+    const short *data = toneBufferData(buffer);
+    for (size_t i = 0; i < toneBufferFrameCount(buffer); i++) {
+        double expected = 32767. * volume *
+                (sin(2 * M_PI * 350 * i / kSamplingRate) + sin(2 * M_PI * 440 * i / kSamplingRate));
+        ASSERT_NEAR(expected, data[i], 2) << "frame " << i;
+    }
+}
+
+TEST_F(ToneGeneratorTest, ToneBuffersAreShared) {
+    static const unsigned short kDialFreq[] = { 350, 440, 0 };
+    static const unsigned short kBusyFreq[] = { 480, 620, 0 };
+    sp<RefBase> dial = getToneBuffer(kDialFreq, 0.45f);
+    EXPECT_EQ(dial.get(), getToneBuffer(kDialFreq, 0.45f).get());
+    EXPECT_NE(dial.get(), getToneBuffer(kDialFreq, 0.9f).get());
+    EXPECT_NE(dial.get(), getToneBuffer(kBusyFreq, 0.45f).get());
+}
+
+// The ANSI call waiting tone is 300 ms on, 9.7 s off, then 100 ms on, 100 ms off, 100 ms on,
+// and repeats from its silent 9.7 s segment.  Each run is within a block of its nominal
+// length: transitions happen on block boundaries, and a fade out block ends each tone.
+TEST_F(ToneGeneratorTest, CallWaitingCadence) {
+    start(ToneGenerator::TONE_SUP_CALL_WAITING, true /*ansi*/);
+
+    // up to the second repeat
+    Vector<unsigned int> runs = play(1100);
+    static const unsigned int kExpectedMs[] = {
+        300, 9700, 100, 100, 100,
+        9700, 100, 100, 100,
+    };
+    const size_t expectedRuns = sizeof(kExpectedMs) / sizeof(kExpectedMs[0]);
+    ASSERT_LE(expectedRuns, runs.size());
+    for (size_t i = 0; i < expectedRuns; i++) {
+        EXPECT_NEAR(kExpectedMs[i], runs[i], kBlockMs) << "run " << i;
+    }
+    EXPECT_FALSE(isStopped());
+}
+
+// TONE_PROP_ACK is two 100 ms beeps 100 ms apart, and then stops by itself.
+TEST_F(ToneGeneratorTest, FiniteToneStops) {
+    start(ToneGenerator::TONE_PROP_ACK, false /*ansi*/);
+
+    Vector<unsigned int> runs = play(50);
+    EXPECT_TRUE(isStopped());
+    ASSERT_EQ(4u, runs.size());
+    EXPECT_NEAR(100u, runs[0], kBlockMs);
+    EXPECT_NEAR(100u, runs[1], kBlockMs);
+    EXPECT_NEAR(100u, runs[2], kBlockMs);
+}
+
+}  // namespace android
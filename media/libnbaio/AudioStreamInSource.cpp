@@ -65,7 +65,7 @@ size_t AudioStreamInSource::framesOverrun()
     return mFramesOverrun;
 }
 
-ssize_t AudioStreamInSource::read(void *buffer, size_t count)
+ssize_t AudioStreamInSource::read(void *buffer, size_t count, int64_t readPTS)
 {
     if (CC_UNLIKELY(mFormat == Format_Invalid)) {
         return NEGOTIATE;
@@ -46,6 +46,41 @@ int NBLog::Entry::readAt(size_t offset) const
 
 // ---------------------------------------------------------------------------
 
+// Parse one printf conversion specification, starting just after the '%'.
+// On success returns a pointer past the conversion character, and sets *conversion to that
+// character and *modifier to the length modifier: '\0' if none, 'H' for "hh", 'q' for "ll",
+// or else the modifier character itself.  Returns NULL for anything that can't be logged in
+// binary form: '*' width or precision, "%n", and unknown conversions.
+static const char *parseConversion(const char *p, char *conversion, char *modifier)
+{
+    while (*p != '\0' && strchr("-+ #0'", *p) != NULL) {
+        p++;
+    }
+    while (('0' <= *p && *p <= '9') || *p == '.') {
+        p++;
+    }
+    if (*p == '*') {
+        return NULL;
+    }
+    *modifier = '\0';
+    if (*p == 'h' || *p == 'l') {
+        *modifier = *p++;
+        if (*p == *modifier) {
+            *modifier = *modifier == 'h' ? 'H' : 'q';
+            p++;
+        }
+    } else if (*p != '\0' && strchr("Lqjzt", *p) != NULL) {
+        *modifier = *p++;
+    }
+    if (*p == '\0' || strchr("diouxXcfFeEgGaAsp", *p) == NULL) {
+        return NULL;
+    }
+    *conversion = *p++;
+    return p;
+}
+
+// ---------------------------------------------------------------------------
+
 #if 0   // FIXME see note in NBLog.h
 NBLog::Timeline::Timeline(size_t size, void *shared)
     : mSize(roundup(size)), mOwn(shared == NULL),
@@ -74,17 +109,20 @@ size_t NBLog::Timeline::sharedSize(size_t size)
 NBLog::Writer::Writer()
     : mSize(0), mShared(NULL), mRear(0), mEnabled(false)
 {
+    memset(mFormats, 0, sizeof(mFormats));
 }
 
 NBLog::Writer::Writer(size_t size, void *shared)
     : mSize(roundup(size)), mShared((Shared *) shared), mRear(0), mEnabled(mShared != NULL)
 {
+    memset(mFormats, 0, sizeof(mFormats));
 }
 
 NBLog::Writer::Writer(size_t size, const sp<IMemory>& iMemory)
     : mSize(roundup(size)), mShared(iMemory != 0 ? (Shared *) iMemory->pointer() : NULL),
       mIMemory(iMemory), mRear(0), mEnabled(mShared != NULL)
 {
+    memset(mFormats, 0, sizeof(mFormats));
 }
 
 void NBLog::Writer::log(const char *string)
@@ -146,6 +184,192 @@ void NBLog::Writer::logTimestamp(const struct timespec& ts)
     log(EVENT_TIMESTAMP, &ts, sizeof(struct timespec));
 }
 
+void NBLog::Writer::logFormat(const char *fmt, ...)
+{
+    if (!mEnabled) {
+        return;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    Writer::logvFormat(fmt, ap);
+    va_end(ap);
+}
+
+void NBLog::Writer::logvFormat(const char *fmt, va_list ap)
+{
+    if (!mEnabled) {
+        return;
+    }
+    int id = formatId(fmt);
+    if (id < 0) {
+        Writer::logvf(fmt, ap);
+        return;
+    }
+    // keep a copy of the arguments in case they don't fit and must be formatted after all
+    va_list ap2;
+    va_copy(ap2, ap);
+    uint8_t buffer[255];
+    size_t length = 0;
+    buffer[length++] = id;
+    for (const char *p = fmt; *p != '\0'; ) {
+        if (*p++ != '%') {
+            continue;
+        }
+        if (*p == '%') {
+            p++;
+            continue;
+        }
+        char conversion, modifier;
+        // formatId() has already verified that every conversion is supported
+        p = parseConversion(p, &conversion, &modifier);
+        uint8_t type;
+        union {
+            int32_t i32;
+            int64_t i64;
+            double d;
+            uint64_t ptr;
+        } u;
+        size_t size;
+        const char *string = NULL;
+        switch (conversion) {
+        case 's':
+            string = va_arg(ap2, const char *);
+            if (string == NULL) {
+                string = "(null)";
+            }
+            type = ARG_STRING;
+            size = strnlen(string, 255);
+            break;
+        case 'p':
+            u.ptr = (uintptr_t) va_arg(ap2, void *);
+            type = ARG_POINTER;
+            size = sizeof(u.ptr);
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            u.d = modifier == 'L' ? (double) va_arg(ap2, long double) : va_arg(ap2, double);
+            type = ARG_DOUBLE;
+            size = sizeof(u.d);
+            break;
+        default: {
+            bool wide;
+            switch (modifier) {
+            case 'q':
+                u.i64 = va_arg(ap2, long long);
+                wide = true;
+                break;
+            case 'j':
+                u.i64 = va_arg(ap2, intmax_t);
+                wide = true;
+                break;
+            case 'l':
+                u.i64 = va_arg(ap2, long);
+                wide = sizeof(long) > sizeof(int32_t);
+                break;
+            case 'z':
+                u.i64 = va_arg(ap2, ssize_t);
+                wide = sizeof(size_t) > sizeof(int32_t);
+                break;
+            case 't':
+                u.i64 = va_arg(ap2, ptrdiff_t);
+                wide = sizeof(ptrdiff_t) > sizeof(int32_t);
+                break;
+            default:
+                // char and short are promoted to int
+                u.i64 = va_arg(ap2, int);
+                wide = false;
+                break;
+            }
+            if (wide) {
+                type = ARG_INT64;
+                size = sizeof(u.i64);
+            } else {
+                u.i32 = (int32_t) u.i64;
+                type = ARG_INT32;
+                size = sizeof(u.i32);
+            }
+            } break;
+        }
+        size_t needed = 1 + (type == ARG_STRING ? 1 : size);
+        if (length + needed > sizeof(buffer)) {
+            if (type != ARG_STRING || length + 2 > sizeof(buffer)) {
+                va_end(ap2);
+                Writer::logvf(fmt, ap);
+                return;
+            }
+            // truncate the string rather than give up
+            size = sizeof(buffer) - length - 2;
+        }
+        buffer[length++] = type;
+        if (type == ARG_STRING) {
+            buffer[length++] = size;
+            memcpy(&buffer[length], string, size);
+        } else {
+            memcpy(&buffer[length], &u, size);
+        }
+        length += size;
+    }
+    va_end(ap2);
+    log(EVENT_FORMAT_ARGS, buffer, length);
+}
+
+int NBLog::Writer::formatId(const char *fmt)
+{
+    size_t id;
+    for (id = 0; id < kMaxFormats && mFormats[id].mFmt != NULL; ++id) {
+        if (mFormats[id].mFmt == fmt) {
+            break;
+        }
+    }
+    if (id == kMaxFormats) {
+        return -1;
+    }
+    Format *format = &mFormats[id];
+    if (format->mFmt == NULL) {
+        // first use of this format, so check that it can be logged in binary form
+        for (const char *p = fmt; *p != '\0'; ) {
+            if (*p++ != '%') {
+                continue;
+            }
+            if (*p == '%') {
+                p++;
+                continue;
+            }
+            char conversion, modifier;
+            p = parseConversion(p, &conversion, &modifier);
+            if (p == NULL) {
+                return -1;
+            }
+        }
+        if (strlen(fmt) > 254) {
+            return -1;
+        }
+        format->mFmt = fmt;
+    } else if ((int32_t) (mRear - format->mRear) <= (int32_t) (mSize / 2)) {
+        // The format was logged recently enough that the Reader is sure to see it
+        // before any arguments that use it, even if the Reader has fallen behind.
+        return id;
+    }
+    uint8_t buffer[255];
+    size_t length = strlen(fmt);
+    buffer[0] = id;
+    memcpy(&buffer[1], fmt, length);
+    log(EVENT_FORMAT_STRING, buffer, length + 1);
+    format->mRear = mRear;
+    return id;
+}
+
+void NBLog::Writer::logPerformance(PerformanceEvent event, const struct timespec& ts)
+{
+    if (!mEnabled) {
+        return;
+    }
+    uint8_t buffer[1 + sizeof(int64_t)];
+    int64_t ns = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    buffer[0] = event;
+    memcpy(&buffer[1], &ns, sizeof(ns));
+    log(EVENT_PERFORMANCE, buffer, sizeof(buffer));
+}
+
 void NBLog::Writer::log(Event event, const void *data, size_t length)
 {
     if (!mEnabled) {
@@ -157,6 +381,9 @@ void NBLog::Writer::log(Event event, const void *data, size_t length)
     switch (event) {
     case EVENT_STRING:
     case EVENT_TIMESTAMP:
+    case EVENT_FORMAT_STRING:
+    case EVENT_FORMAT_ARGS:
+    case EVENT_PERFORMANCE:
         break;
     case EVENT_RESERVED:
     default:
@@ -257,6 +484,27 @@ void NBLog::LockedWriter::logTimestamp(const struct timespec& ts)
     Writer::logTimestamp(ts);
 }
 
+void NBLog::LockedWriter::logFormat(const char *fmt, ...)
+{
+    Mutex::Autolock _l(mLock);
+    va_list ap;
+    va_start(ap, fmt);
+    Writer::logvFormat(fmt, ap);
+    va_end(ap);
+}
+
+void NBLog::LockedWriter::logvFormat(const char *fmt, va_list ap)
+{
+    Mutex::Autolock _l(mLock);
+    Writer::logvFormat(fmt, ap);
+}
+
+void NBLog::LockedWriter::logPerformance(PerformanceEvent event, const struct timespec& ts)
+{
+    Mutex::Autolock _l(mLock);
+    Writer::logPerformance(event, ts);
+}
+
 bool NBLog::LockedWriter::isEnabled() const
 {
     Mutex::Autolock _l(mLock);
@@ -282,27 +530,29 @@ NBLog::Reader::Reader(size_t size, const sp<IMemory>& iMemory)
 {
 }
 
-void NBLog::Reader::dump(int fd, size_t indent)
+uint8_t *NBLog::Reader::copyEntries(size_t *avail, size_t *lost, size_t *start, time_t *maxSec)
 {
+    if (maxSec != NULL) {
+        *maxSec = -1;
+    }
     int32_t rear = android_atomic_acquire_load(&mShared->mRear);
-    size_t avail = rear - mFront;
-    if (avail == 0) {
-        return;
+    size_t available = rear - mFront;
+    if (available == 0) {
+        return NULL;
     }
-    size_t lost = 0;
-    if (avail > mSize) {
-        lost = avail - mSize;
-        mFront += lost;
-        avail = mSize;
+    if (available > mSize) {
+        *lost += available - mSize;
+        mFront += available - mSize;
+        available = mSize;
     }
-    size_t remaining = avail;       // remaining = number of bytes left to read
+    size_t remaining = available;   // remaining = number of bytes left to read
     size_t front = mFront & (mSize - 1);
     size_t read = mSize - front;    // read = number of bytes that have been read so far
     if (read > remaining) {
         read = remaining;
     }
     // make a copy to avoid race condition with writer
-    uint8_t *copy = new uint8_t[avail];
+    uint8_t *copy = new uint8_t[available];
     // copy first part of circular buffer up until the wraparound point
     memcpy(copy, &mShared->mBuffer[front], read);
     if (front + read == mSize) {
@@ -314,37 +564,53 @@ void NBLog::Reader::dump(int fd, size_t indent)
         }
     }
     mFront += read;
-    size_t i = avail;
-    Event event;
-    size_t length;
-    struct timespec ts;
-    time_t maxSec = -1;
+    // scan backwards from the most recent entry, as the oldest may have been partly overwritten
+    size_t i = available;
     while (i >= 3) {
-        length = copy[i - 1];
+        size_t length = copy[i - 1];
         if (length + 3 > i || copy[i - length - 2] != length) {
             break;
         }
-        event = (Event) copy[i - length - 3];
+        Event event = (Event) copy[i - length - 3];
         if (event == EVENT_TIMESTAMP) {
             if (length != sizeof(struct timespec)) {
                 // corrupt
                 break;
             }
+            struct timespec ts;
             memcpy(&ts, &copy[i - length - 1], sizeof(struct timespec));
-            if (ts.tv_sec > maxSec) {
-                maxSec = ts.tv_sec;
+            if (maxSec != NULL && ts.tv_sec > *maxSec) {
+                *maxSec = ts.tv_sec;
             }
         }
         i -= length + 3;
     }
-    if (i > 0) {
-        lost += i;
+    *lost += i;
+    *avail = available;
+    *start = i;
+    return copy;
+}
+
+void NBLog::Reader::dump(int fd, size_t indent)
+{
+    size_t avail;
+    size_t lost = 0;
+    size_t i;
+    time_t maxSec;
+    uint8_t *copy = copyEntries(&avail, &lost, &i, &maxSec);
+    if (copy == NULL) {
+        return;
+    }
+    if (lost > 0) {
         if (fd >= 0) {
             fdprintf(fd, "%*swarning: lost %zu bytes worth of events\n", indent, "", lost);
         } else {
             ALOGI("%*swarning: lost %u bytes worth of events\n", indent, "", lost);
         }
     }
+    Event event;
+    size_t length;
+    struct timespec ts;
     size_t width = 1;
     while (maxSec >= 10) {
         ++width;
@@ -368,6 +634,25 @@ void NBLog::Reader::dump(int fd, size_t indent)
             } else {
                 ALOGI("%*s%s%.*s", indent, "", prefix, length, (const char *) data);
             } break;
+        case EVENT_FORMAT_STRING:
+            if (length >= 1 && copy[i + 2] < kMaxFormats) {
+                mFormats[copy[i + 2]].setTo((const char *) &copy[i + 3], length - 1);
+            }
+            break;
+        case EVENT_FORMAT_ARGS: {
+            String8 out;
+            if (!formatArgs((const uint8_t *) data, length, out)) {
+                out.append("warning: corrupt formatted event");
+            }
+            if (fd >= 0) {
+                fdprintf(fd, "%*s%s%s\n", indent, "", prefix, out.string());
+            } else {
+                ALOGI("%*s%s%s", indent, "", prefix, out.string());
+            }
+            } break;
+        case EVENT_PERFORMANCE:
+            // these are only of interest to readPerformance()
+            break;
         case EVENT_TIMESTAMP: {
             // already checked that length == sizeof(struct timespec);
             memcpy(&ts, data, sizeof(struct timespec));
@@ -439,6 +724,140 @@ void NBLog::Reader::dump(int fd, size_t indent)
     delete[] copy;
 }
 
+bool NBLog::Reader::readPerformance(Vector<PerformanceEntry>& entries)
+{
+    size_t avail;
+    size_t lost = 0;
+    size_t i;
+    uint8_t *copy = copyEntries(&avail, &lost, &i, NULL);
+    if (copy == NULL) {
+        return false;
+    }
+    while (i < avail) {
+        size_t length = copy[i + 1];
+        if ((Event) copy[i] == EVENT_PERFORMANCE && length == 1 + sizeof(int64_t)) {
+            PerformanceEntry entry;
+            entry.mEvent = (PerformanceEvent) copy[i + 2];
+            memcpy(&entry.mNs, &copy[i + 3], sizeof(int64_t));
+            entries.add(entry);
+        }
+        i += length + 3;
+    }
+    delete[] copy;
+    return lost > 0;
+}
+
+bool NBLog::Reader::formatArgs(const uint8_t *data, size_t length, String8& out) const
+{
+    if (length < 1 || data[0] >= kMaxFormats) {
+        return false;
+    }
+    if (mFormats[data[0]].isEmpty()) {
+        // the format string was lost before we could read it
+        out.appendFormat("warning: format %u not available", data[0]);
+        return true;
+    }
+    size_t i = 1;
+    const char *p = mFormats[data[0]].string();
+    for (;;) {
+        const char *percent = strchr(p, '%');
+        if (percent == NULL) {
+            out.append(p);
+            break;
+        }
+        out.append(p, percent - p);
+        if (percent[1] == '%') {
+            out.append("%");
+            p = percent + 2;
+            continue;
+        }
+        char conversion, modifier;
+        p = parseConversion(percent + 1, &conversion, &modifier);
+        if (p == NULL || i >= length) {
+            return false;
+        }
+        // rebuild the conversion specification with a length modifier matching the argument
+        char spec[32];
+        size_t n = 0;
+        for (const char *q = percent; q < p - 1; q++) {
+            if (strchr("hlLqjzt", *q) == NULL) {
+                if (n >= sizeof(spec) - 4) {
+                    return false;
+                }
+                spec[n++] = *q;
+            }
+        }
+        uint8_t type = data[i++];
+        // don't trust the argument type to match the conversion
+        bool isString = conversion == 's';
+        bool isPointer = conversion == 'p';
+        bool isDouble = strchr("fFeEgGaA", conversion) != NULL;
+        if ((type == ARG_STRING) != isString || (type == ARG_POINTER) != isPointer ||
+                (type == ARG_DOUBLE) != isDouble) {
+            return false;
+        }
+        switch (type) {
+        case ARG_INT32: {
+            int32_t value;
+            if (i + sizeof(value) > length) {
+                return false;
+            }
+            memcpy(&value, &data[i], sizeof(value));
+            i += sizeof(value);
+            spec[n++] = conversion;
+            spec[n] = '\0';
+            out.appendFormat(spec, value);
+            } break;
+        case ARG_INT64: {
+            int64_t value;
+            if (i + sizeof(value) > length) {
+                return false;
+            }
+            memcpy(&value, &data[i], sizeof(value));
+            i += sizeof(value);
+            spec[n++] = 'l';
+            spec[n++] = 'l';
+            spec[n++] = conversion;
+            spec[n] = '\0';
+            out.appendFormat(spec, (long long) value);
+            } break;
+        case ARG_DOUBLE: {
+            double value;
+            if (i + sizeof(value) > length) {
+                return false;
+            }
+            memcpy(&value, &data[i], sizeof(value));
+            i += sizeof(value);
+            spec[n++] = conversion;
+            spec[n] = '\0';
+            out.appendFormat(spec, value);
+            } break;
+        case ARG_POINTER: {
+            uint64_t value;
+            if (i + sizeof(value) > length) {
+                return false;
+            }
+            memcpy(&value, &data[i], sizeof(value));
+            i += sizeof(value);
+            out.appendFormat("%#llx", (unsigned long long) value);
+            } break;
+        case ARG_STRING: {
+            if (i >= length || i + 1 + data[i] > length) {
+                return false;
+            }
+            String8 string((const char *) &data[i + 1], data[i]);
+            i += 1 + data[i];
+            spec[n++] = 's';
+            spec[n] = '\0';
+            out.appendFormat(spec, string.string());
+            } break;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
 bool NBLog::Reader::isIMemory(const sp<IMemory>& iMemory) const
 {
     return iMemory.get() == mIMemory.get();
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "BackgroundIndexer"
+#include <utils/Log.h>
+
+#include "include/BackgroundIndexer.h"
+
+#include <media/stagefright/foundation/ADebug.h>
+#include <media/stagefright/foundation/ALooper.h>
+#include <media/stagefright/foundation/AMessage.h>
+
+namespace android {
+
+Mutex BackgroundIndexer::sLock;
+sp<ALooper> BackgroundIndexer::sLooper;
+sp<BackgroundIndexer> BackgroundIndexer::sIndexer;
+
+// static
+sp<AMessage> BackgroundIndexer::newWork(Work work, const sp<RefBase> &target) {
+    Mutex::Autolock autoLock(sLock);
+    if (sLooper == NULL) {
+        sLooper = new ALooper;
+        sLooper->setName("BackgroundIndexer");
+        sLooper->start(false /* runOnCallingThread */, false /* canCallJava */,
+                PRIORITY_BACKGROUND);
+        sIndexer = new BackgroundIndexer;
+        sLooper->registerHandler(sIndexer);
+    }
+
+    sp<AMessage> msg = new AMessage(kWhatWork, sIndexer->id());
+    msg->setPointer("work", (void *)work);
+    msg->setObject("target", target);
+    return msg;
+}
+
+void BackgroundIndexer::onMessageReceived(const sp<AMessage> &msg) {
+    CHECK_EQ(msg->what(), (uint32_t)kWhatWork);
+
+    void *work;
+    sp<RefBase> target;
+    CHECK(msg->findPointer("work", &work));
+    CHECK(msg->findObject("target", &target));
+    msg->setObject("target", NULL);
+
+    // nothing to do if the extractor and its sources are gone already
+    if (target->getStrongCount() == 1) {
+        return;
+    }
+
+    ((Work)work)(target, msg);
+}
+
+}  // namespace android
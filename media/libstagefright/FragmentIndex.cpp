@@ -0,0 +1,344 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "FragmentIndex"
+#include <utils/Log.h>
+
+#include "include/FragmentIndex.h"
+#include "include/BackgroundIndexer.h"
+
+#include <stdlib.h>
+
+#include <media/stagefright/foundation/ADebug.h>
+#include <media/stagefright/foundation/AMessage.h>
+#include <media/stagefright/DataSource.h>
+#include <media/stagefright/MediaErrors.h>
+#include <media/stagefright/Utils.h>
+
+namespace android {
+
+// static
+const size_t FragmentIndex::kMaxMoofSize = 1024 * 1024;
+
+// Steps through the boxes contained in data, returning false after the last one
+// or at the first one that doesn't fit.
+static bool nextBox(
+        const uint8_t *data, size_t size, size_t *pos,
+        uint32_t *type, const uint8_t **payload, size_t *payloadSize) {
+    if (*pos + 8 > size) {
+        return false;
+    }
+
+    uint32_t boxSize = U32_AT(&data[*pos]);
+    if (boxSize < 8 || boxSize > size - *pos) {
+        return false;
+    }
+
+    *type = U32_AT(&data[*pos + 4]);
+    *payload = &data[*pos + 8];
+    *payloadSize = boxSize - 8;
+    *pos += boxSize;
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+FragmentIndex::FragmentIndex(
+        const sp<DataSource> &source,
+        uint32_t trackId, off64_t firstMoofOffset)
+    : mDataSource(source),
+      mTrackId(trackId),
+      mFirstMoofOffset(firstMoofOffset),
+      // NuCachedSource2 reads ahead on its own, and reading far ahead of the
+      // player would only make it drop the data the player is about to read.
+      mCanPrefetch(!(source->flags() & DataSource::kIsCachingDataSource)),
+      mFirstMediaTime(-1),
+      mPrefetchGeneration(0) {
+    Fragment first;
+    first.mOffset = firstMoofOffset;
+    first.mTime = 0;
+    mFragments.push(first);
+}
+
+FragmentIndex::~FragmentIndex() {
+}
+
+void FragmentIndex::addFragment(off64_t offset, uint64_t time) {
+    Mutex::Autolock autoLock(mLock);
+
+    // the first fragment starting after "time"
+    size_t lo = 0;
+    size_t hi = mFragments.size();
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (mFragments[mid].mTime <= time) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    // The same fragment may come with a slightly different time from each
+    // source, but it can't be out of order with its neighbours.
+    if (lo > 0 && mFragments[lo - 1].mOffset >= offset) {
+        ALOGV_IF(mFragments[lo - 1].mOffset > offset,
+                "fragment at %lld out of order", offset);
+        return;
+    }
+    if (lo < mFragments.size() && mFragments[lo].mOffset <= offset) {
+        ALOGV_IF(mFragments[lo].mOffset < offset,
+                "fragment at %lld out of order", offset);
+        return;
+    }
+
+    Fragment fragment;
+    fragment.mOffset = offset;
+    fragment.mTime = time;
+    mFragments.insertAt(fragment, lo);
+}
+
+void FragmentIndex::addMediaTimeFragment(off64_t offset, uint64_t mediaTime) {
+    int64_t firstMediaTime;
+    {
+        Mutex::Autolock autoLock(mLock);
+        firstMediaTime = mFirstMediaTime;
+    }
+
+    if (firstMediaTime < 0 || mediaTime < (uint64_t)firstMediaTime) {
+        return;
+    }
+
+    addFragment(offset, mediaTime - firstMediaTime);
+}
+
+void FragmentIndex::setFirstMediaTime(uint64_t mediaTime) {
+    Mutex::Autolock autoLock(mLock);
+
+    if (mFirstMediaTime < 0) {
+        mFirstMediaTime = mediaTime;
+    }
+}
+
+size_t FragmentIndex::countFragments() const {
+    Mutex::Autolock autoLock(mLock);
+
+    return mFragments.size();
+}
+
+status_t FragmentIndex::findFragment(
+        uint64_t time, MediaSource::ReadOptions::SeekMode mode,
+        off64_t *offset, uint64_t *fragmentTime) const {
+    Mutex::Autolock autoLock(mLock);
+
+    if (mFragments.isEmpty()) {
+        return ERROR_END_OF_STREAM;
+    }
+
+    // the last fragment starting at or before "time", if any
+    size_t lo = 0;
+    size_t hi = mFragments.size();
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (mFragments[mid].mTime <= time) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    size_t i = (lo > 0) ? lo - 1 : 0;
+
+    if (i + 1 < mFragments.size() && mFragments[i].mTime < time) {
+        uint64_t before = time - mFragments[i].mTime;
+        uint64_t after = mFragments[i + 1].mTime - time;
+        if (mode == MediaSource::ReadOptions::SEEK_NEXT_SYNC
+                || (mode == MediaSource::ReadOptions::SEEK_CLOSEST_SYNC
+                    && before > after)) {
+            ++i;
+        }
+    }
+
+    *offset = mFragments[i].mOffset;
+    *fragmentTime = mFragments[i].mTime;
+
+    return OK;
+}
+
+void FragmentIndex::prefetch(off64_t offset, size_t count) {
+    if (!mCanPrefetch || count == 0) {
+        return;
+    }
+
+    int32_t generation;
+    {
+        Mutex::Autolock autoLock(mLock);
+        generation = ++mPrefetchGeneration;
+    }
+
+    sp<AMessage> msg = BackgroundIndexer::newWork(onPrefetch, this);
+    msg->setInt64("offset", offset);
+    msg->setSize("count", count);
+    msg->setInt32("generation", generation);
+    msg->post();
+}
+
+// static
+void FragmentIndex::onPrefetch(const sp<RefBase> &target, const sp<AMessage> &msg) {
+    sp<FragmentIndex> index = static_cast<FragmentIndex *>(target.get());
+
+    int64_t offset;
+    size_t count;
+    int32_t generation;
+    CHECK(msg->findInt64("offset", &offset));
+    CHECK(msg->findSize("count", &count));
+    CHECK(msg->findInt32("generation", &generation));
+
+    index->prefetchFragments(offset, count, generation);
+}
+
+void FragmentIndex::prefetchFragments(
+        off64_t offset, size_t count, int32_t generation) {
+    bool needFirstMediaTime;
+    {
+        Mutex::Autolock autoLock(mLock);
+        needFirstMediaTime = (mFirstMediaTime < 0);
+    }
+
+    FragmentInfo info;
+    if (needFirstMediaTime
+            && scanFragment(mFirstMoofOffset, &info) == OK
+            && info.mMediaTime >= 0) {
+        setFirstMediaTime(info.mMediaTime);
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        {
+            Mutex::Autolock autoLock(mLock);
+            if (generation != mPrefetchGeneration) {
+                // the track moved on, or seeked elsewhere
+                return;
+            }
+        }
+
+        if (scanFragment(offset, &info) != OK) {
+            return;
+        }
+
+        if (info.mMediaTime >= 0) {
+            addMediaTimeFragment(offset, info.mMediaTime);
+        }
+
+        offset = info.mNextOffset;
+    }
+}
+
+status_t FragmentIndex::scanFragment(off64_t offset, FragmentInfo *info) {
+    uint8_t header[16];
+    if (mDataSource->readAt(offset, header, 8) < 8) {
+        return ERROR_END_OF_STREAM;
+    }
+
+    uint64_t size = U32_AT(header);
+    uint32_t type = U32_AT(&header[4]);
+    size_t headerSize = 8;
+    if (size == 1) {
+        if (mDataSource->readAt(offset + 8, &header[8], 8) < 8) {
+            return ERROR_IO;
+        }
+        size = U64_AT(&header[8]);
+        headerSize = 16;
+    }
+
+    if (type != FOURCC('m', 'o', 'o', 'f')
+            || size < headerSize || size > kMaxMoofSize) {
+        return ERROR_MALFORMED;
+    }
+
+    size_t moofSize = size - headerSize;
+    uint8_t *moof = (uint8_t *)malloc(moofSize);
+    if (moof == NULL) {
+        return ERROR_IO;
+    }
+
+    if (mDataSource->readAt(offset + headerSize, moof, moofSize)
+            < (ssize_t)moofSize) {
+        free(moof);
+        return ERROR_IO;
+    }
+
+    info->mMediaTime = -1;
+
+    size_t pos = 0;
+    const uint8_t *traf;
+    size_t trafSize;
+    while (info->mMediaTime < 0
+            && nextBox(moof, moofSize, &pos, &type, &traf, &trafSize)) {
+        if (type != FOURCC('t', 'r', 'a', 'f')) {
+            continue;
+        }
+
+        bool isTrack = false;
+        int64_t mediaTime = -1;
+
+        size_t trafPos = 0;
+        const uint8_t *box;
+        size_t boxSize;
+        while (nextBox(traf, trafSize, &trafPos, &type, &box, &boxSize)) {
+            if (type == FOURCC('t', 'f', 'h', 'd') && boxSize >= 8) {
+                isTrack = (U32_AT(&box[4]) == mTrackId);
+            } else if (type == FOURCC('t', 'f', 'd', 't') && boxSize >= 8) {
+                if (box[0] == 1 && boxSize >= 12) {
+                    mediaTime = U64_AT(&box[4]);
+                } else if (box[0] == 0) {
+                    mediaTime = U32_AT(&box[4]);
+                }
+            }
+        }
+
+        if (isTrack) {
+            info->mMediaTime = mediaTime;
+        }
+    }
+
+    free(moof);
+
+    // the moof box is followed by its mdat box
+    off64_t dataOffset = offset + size;
+    if (mDataSource->readAt(dataOffset, header, 8) < 8) {
+        return ERROR_END_OF_STREAM;
+    }
+
+    size = U32_AT(header);
+    headerSize = 8;
+    if (size == 1) {
+        if (mDataSource->readAt(dataOffset + 8, &header[8], 8) < 8) {
+            return ERROR_IO;
+        }
+        size = U64_AT(&header[8]);
+        headerSize = 16;
+    }
+
+    if (size < headerSize) {
+        return ERROR_MALFORMED;
+    }
+
+    info->mNextOffset = dataOffset + size;
+
+    return OK;
+}
+
+}  // namespace android
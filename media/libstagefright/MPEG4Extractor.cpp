@@ -19,6 +19,7 @@
 #include <utils/Log.h>
 
 #include "include/MPEG4Extractor.h"
+#include "include/FragmentIndex.h"
 #include "include/SampleTable.h"
 #include "include/ESDS.h"
 
@@ -50,7 +51,7 @@ public:
                 const sp<DataSource> &dataSource,
                 int32_t timeScale,
                 const sp<SampleTable> &sampleTable,
-                Vector<SidxEntry> &sidx,
+                const sp<FragmentIndex> &fragmentIndex,
                 off64_t firstMoofOffset);
 
     virtual status_t start(MetaData *params = NULL);
@@ -73,11 +74,11 @@ private:
     sp<SampleTable> mSampleTable;
     uint32_t mCurrentSampleIndex;
     uint32_t mCurrentFragmentIndex;
-    Vector<SidxEntry> &mSegments;
+    sp<FragmentIndex> mFragmentIndex;
     off64_t mFirstMoofOffset;
     off64_t mCurrentMoofOffset;
     off64_t mNextMoofOffset;
-    uint32_t mCurrentTime;
+    uint64_t mCurrentTime;
     int32_t mLastParsedTrackId;
     int32_t mTrackId;
 
@@ -104,10 +105,14 @@ private:
     MediaBuffer *mBuffer;
 
     bool mWantsNALFragments;
+    bool mWantsLengthPrefixedNALs;
 
     uint8_t *mSrcBuffer;
 
     size_t parseNALSize(const uint8_t *data) const;
+    status_t readWholeNALs(off64_t offset, size_t size);
+    status_t moveToFragment(off64_t offset, uint64_t time);
+    uint64_t getFragmentDuration() const;
     status_t parseChunk(off64_t *offset);
     status_t parseTrackFragmentHeader(off64_t offset, off64_t size);
     status_t parseTrackFragmentRun(off64_t offset, off64_t size);
@@ -341,6 +346,7 @@ static bool AdjustChannelsAndRate(uint32_t fourcc, uint32_t *channels, uint32_t
 MPEG4Extractor::MPEG4Extractor(const sp<DataSource> &source)
     : mSidxDuration(0),
       mMoofOffset(0),
+      mHasFragmentRandomAccess(false),
       mDataSource(source),
       mInitCheck(NO_INIT),
       mHasVideo(false),
@@ -378,7 +384,8 @@ MPEG4Extractor::~MPEG4Extractor() {
 
 uint32_t MPEG4Extractor::flags() const {
     return CAN_PAUSE |
-            ((mMoofOffset == 0 || mSidxEntries.size() != 0) ?
+            ((mMoofOffset == 0 || mSidxEntries.size() != 0
+                    || mHasFragmentRandomAccess) ?
                     (CAN_SEEK_BACKWARD | CAN_SEEK_FORWARD | CAN_SEEK) : 0);
 }
 
@@ -506,6 +513,18 @@ status_t MPEG4Extractor::readMetaData() {
             mFileMetaData->setCString(kKeyMIMEType, "audio/mp4");
         }
 
+        // The tracks can be read now; the rest of their sample tables is
+        // indexed in the background.
+        for (Track *track = mFirstTrack; track != NULL; track = track->next) {
+            if (track->sampleTable != NULL) {
+                track->sampleTable->buildIndexAsync();
+            }
+        }
+
+        if (mMoofOffset > 0) {
+            buildFragmentIndexes();
+        }
+
         mInitCheck = OK;
     } else {
         mInitCheck = err;
@@ -1943,6 +1962,209 @@ status_t MPEG4Extractor::parseSegmentIndex(off64_t offset, size_t size) {
     return OK;
 }
 
+void MPEG4Extractor::buildFragmentIndexes() {
+    for (Track *track = mFirstTrack; track != NULL; track = track->next) {
+        int32_t trackId;
+        if (!track->meta->findInt32(kKeyTrackID, &trackId)) {
+            // no tkhd box, so its fragments can't be told apart from the others
+            ALOGW("not indexing the fragments of a track without an ID");
+            continue;
+        }
+
+        track->fragmentIndex =
+            new FragmentIndex(mDataSource, trackId, mMoofOffset);
+
+        // The segments listed by the sidx box follow each other from the
+        // first moof box on.
+        uint64_t timeUs = 0;
+        off64_t offset = mMoofOffset;
+        for (size_t i = 0; i < mSidxEntries.size(); i++) {
+            track->fragmentIndex->addFragment(
+                    offset, timeUs * track->timescale / 1000000ll);
+            timeUs += mSidxEntries[i].mDurationUs;
+            offset += mSidxEntries[i].mSize;
+        }
+    }
+
+    // The mfra box is at the end of the file, which is only cheap to get to
+    // if the file is local.
+    if (!(mDataSource->flags() & DataSource::kIsCachingDataSource)) {
+        status_t err = parseMovieFragmentRandomAccess();
+        if (err != OK && err != NAME_NOT_FOUND) {
+            ALOGW("ignoring mfra box (%d)", err);
+        }
+    }
+}
+
+status_t MPEG4Extractor::parseMovieFragmentRandomAccess() {
+    off64_t fileSize;
+    if (mDataSource->getSize(&fileSize) != OK || fileSize < 16) {
+        return NAME_NOT_FOUND;
+    }
+
+    // The mfro box ends the file, and gives the size of the mfra box it
+    // closes.
+    uint32_t mfro[4];
+    if (mDataSource->readAt(fileSize - 16, mfro, 16) < 16) {
+        return ERROR_IO;
+    }
+
+    if (ntohl(mfro[0]) != 16 || ntohl(mfro[1]) != FOURCC('m', 'f', 'r', 'o')) {
+        return NAME_NOT_FOUND;
+    }
+
+    off64_t mfraSize = ntohl(mfro[3]);
+    if (mfraSize < 24 || mfraSize > fileSize) {
+        return ERROR_MALFORMED;
+    }
+
+    off64_t offset = fileSize - mfraSize;
+    uint32_t hdr[2];
+    if (mDataSource->readAt(offset, hdr, 8) < 8) {
+        return ERROR_IO;
+    }
+
+    if (ntohl(hdr[0]) != mfraSize || ntohl(hdr[1]) != FOURCC('m', 'f', 'r', 'a')) {
+        return ERROR_MALFORMED;
+    }
+
+    offset += 8;
+    while (offset + 8 <= fileSize) {
+        if (mDataSource->readAt(offset, hdr, 8) < 8) {
+            return ERROR_IO;
+        }
+
+        off64_t size = ntohl(hdr[0]);
+        if (size < 8 || size > fileSize - offset) {
+            return ERROR_MALFORMED;
+        }
+
+        if (ntohl(hdr[1]) == FOURCC('t', 'f', 'r', 'a')) {
+            status_t err = parseTrackFragmentRandomAccess(offset + 8, size - 8);
+            if (err != OK) {
+                return err;
+            }
+        }
+
+        offset += size;
+    }
+
+    return OK;
+}
+
+static uint32_t readVariableLength(const uint8_t *data, size_t length) {
+    uint32_t value = 0;
+    for (size_t i = 0; i < length; ++i) {
+        value = (value << 8) | data[i];
+    }
+    return value;
+}
+
+status_t MPEG4Extractor::parseTrackFragmentRandomAccess(
+        off64_t offset, size_t size) {
+    ALOGV("MPEG4Extractor::parseTrackFragmentRandomAccess");
+
+    if (size < 16) {
+        return ERROR_MALFORMED;
+    }
+
+    uint32_t flags, trackId, lengths, numEntries;
+    if (!mDataSource->getUInt32(offset, &flags)
+            || !mDataSource->getUInt32(offset + 4, &trackId)
+            || !mDataSource->getUInt32(offset + 8, &lengths)
+            || !mDataSource->getUInt32(offset + 12, &numEntries)) {
+        return ERROR_IO;
+    }
+    offset += 16;
+    size -= 16;
+
+    Track *track = mFirstTrack;
+    while (track != NULL) {
+        int32_t id;
+        if (track->meta->findInt32(kKeyTrackID, &id) && (uint32_t)id == trackId) {
+            break;
+        }
+        track = track->next;
+    }
+
+    if (track == NULL || track->fragmentIndex == NULL) {
+        return OK;
+    }
+
+    uint32_t version = flags >> 24;
+    size_t timeSize = (version == 1) ? 8 : 4;
+    size_t trafNumberSize = ((lengths >> 4) & 3) + 1;
+    size_t trunNumberSize = ((lengths >> 2) & 3) + 1;
+    size_t sampleNumberSize = (lengths & 3) + 1;
+    size_t entrySize =
+        2 * timeSize + trafNumberSize + trunNumberSize + sampleNumberSize;
+
+    if (numEntries > size / entrySize) {
+        return ERROR_MALFORMED;
+    }
+
+    // read the entries in blocks rather than all at once, since the box can
+    // be as large as the file claims it is
+    static const uint32_t kEntriesPerRead = 1024;
+    uint8_t *entries = new uint8_t[kEntriesPerRead * entrySize];
+
+    // The times count from the start of the media, so the first moof box
+    // has to be found before any of them can be used.  Only the entries
+    // for the first sample of a fragment tell where the fragment starts.
+    for (int pass = 0; pass < 2; ++pass) {
+        for (uint32_t i = 0; i < numEntries; ++i) {
+            uint32_t j = i % kEntriesPerRead;
+            if (j == 0) {
+                uint32_t n = numEntries - i;
+                if (n > kEntriesPerRead) {
+                    n = kEntriesPerRead;
+                }
+                if (mDataSource->readAt(
+                            offset + (off64_t)i * entrySize, entries, n * entrySize)
+                        < (ssize_t)(n * entrySize)) {
+                    delete[] entries;
+                    return ERROR_IO;
+                }
+            }
+            const uint8_t *entry = &entries[j * entrySize];
+
+            uint64_t time = (version == 1) ? U64_AT(entry) : U32_AT(entry);
+            uint64_t moofOffset = (version == 1)
+                    ? U64_AT(&entry[8]) : U32_AT(&entry[4]);
+            const uint8_t *numbers = &entry[2 * timeSize];
+            uint32_t trunNumber = readVariableLength(
+                    &numbers[trafNumberSize], trunNumberSize);
+            uint32_t sampleNumber = readVariableLength(
+                    &numbers[trafNumberSize + trunNumberSize], sampleNumberSize);
+
+            if (trunNumber != 1 || sampleNumber != 1) {
+                continue;
+            }
+
+            if (pass == 0) {
+                if ((off64_t)moofOffset == mMoofOffset) {
+                    track->fragmentIndex->setFirstMediaTime(time);
+                    break;
+                }
+            } else {
+                track->fragmentIndex->addMediaTimeFragment(moofOffset, time);
+            }
+        }
+    }
+
+    delete[] entries;
+
+    size_t numFragments = track->fragmentIndex->countFragments();
+    if (numFragments > 1) {
+        mHasFragmentRandomAccess = true;
+    }
+
+    ALOGV("track %u: %u tfra entries, %zu fragments indexed",
+            trackId, numEntries, numFragments);
+
+    return OK;
+}
+
 
 
 status_t MPEG4Extractor::parseTrackHeader(
@@ -2409,7 +2631,7 @@ sp<MediaSource> MPEG4Extractor::getTrack(size_t index) {
 
     return new MPEG4Source(
             track->meta, mDataSource, track->timescale, track->sampleTable,
-            mSidxEntries, mMoofOffset);
+            track->fragmentIndex, mMoofOffset);
 }
 
 // static
@@ -2570,12 +2792,15 @@ status_t MPEG4Extractor::updateAudioTrackInfoFromESDS_MPEG4Audio(
 
 ////////////////////////////////////////////////////////////////////////////////
 
+// Moof boxes to index ahead of the one being played from.
+static const size_t kFragmentsToPrefetch = 2;
+
 MPEG4Source::MPEG4Source(
         const sp<MetaData> &format,
         const sp<DataSource> &dataSource,
         int32_t timeScale,
         const sp<SampleTable> &sampleTable,
-        Vector<SidxEntry> &sidx,
+        const sp<FragmentIndex> &fragmentIndex,
         off64_t firstMoofOffset)
     : mFormat(format),
       mDataSource(dataSource),
@@ -2583,9 +2808,10 @@ MPEG4Source::MPEG4Source(
       mSampleTable(sampleTable),
       mCurrentSampleIndex(0),
       mCurrentFragmentIndex(0),
-      mSegments(sidx),
+      mFragmentIndex(fragmentIndex),
       mFirstMoofOffset(firstMoofOffset),
       mCurrentMoofOffset(firstMoofOffset),
+      mNextMoofOffset(0),
       mCurrentTime(0),
       mCurrentSampleInfoAllocSize(0),
       mCurrentSampleInfoSizes(NULL),
@@ -2597,6 +2823,7 @@ MPEG4Source::MPEG4Source(
       mGroup(NULL),
       mBuffer(NULL),
       mWantsNALFragments(false),
+      mWantsLengthPrefixedNALs(false),
       mSrcBuffer(NULL) {
 
     mFormat->findInt32(kKeyCryptoMode, &mCryptoMode);
@@ -2661,6 +2888,13 @@ status_t MPEG4Source::start(MetaData *params) {
         mWantsNALFragments = false;
     }
 
+    if (params && params->findInt32(kKeyWantsLengthPrefixedNALs, &val)
+        && val != 0) {
+        mWantsLengthPrefixedNALs = true;
+    } else {
+        mWantsLengthPrefixedNALs = false;
+    }
+
     mGroup = new MediaBufferGroup;
 
     int32_t max_size;
@@ -2668,7 +2902,16 @@ status_t MPEG4Source::start(MetaData *params) {
 
     mGroup->add_buffer(new MediaBuffer(max_size));
 
-    mSrcBuffer = new uint8_t[max_size];
+    // Only samples with 1 to 3 byte NAL lengths are converted through
+    // a separate buffer, the others are read straight into mBuffer.
+    if (mIsAVC && !mWantsNALFragments && !mWantsLengthPrefixedNALs
+            && mNALLengthSize != 4) {
+        mSrcBuffer = new uint8_t[max_size];
+    }
+
+    if (mFirstMoofOffset != 0 && mFragmentIndex != NULL) {
+        mFragmentIndex->prefetch(mNextMoofOffset, kFragmentsToPrefetch);
+    }
 
     mStarted = true;
 
@@ -3245,6 +3488,77 @@ size_t MPEG4Source::parseNALSize(const uint8_t *data) const {
     return 0;
 }
 
+status_t MPEG4Source::readWholeNALs(off64_t offset, size_t size) {
+    CHECK(mBuffer != NULL);
+
+    int32_t drm = 0;
+    bool usesDRM = (mFormat->findInt32(kKeyIsDRM, &drm) && drm != 0);
+    bool inPlace = usesDRM || mWantsLengthPrefixedNALs || mNALLengthSize == 4;
+
+    uint8_t *dstData = (uint8_t *)mBuffer->data();
+    ssize_t num_bytes_read =
+        mDataSource->readAt(offset, inPlace ? dstData : mSrcBuffer, size);
+
+    if (num_bytes_read < (ssize_t)size) {
+        mBuffer->release();
+        mBuffer = NULL;
+
+        ALOGV("i/o error");
+        return ERROR_IO;
+    }
+
+    if (usesDRM || mWantsLengthPrefixedNALs) {
+        mBuffer->set_range(0, size);
+        return OK;
+    }
+
+    // With 4 byte lengths the start codes take exactly the place of the
+    // length fields, so the sample is rewritten where it was read and only
+    // moves if empty NAL units have to be dropped.
+    const uint8_t *srcData = inPlace ? dstData : mSrcBuffer;
+    size_t srcOffset = 0;
+    size_t dstOffset = 0;
+
+    while (srcOffset < size) {
+        bool isMalFormed = (srcOffset + mNALLengthSize > size);
+        size_t nalLength = 0;
+        if (!isMalFormed) {
+            nalLength = parseNALSize(&srcData[srcOffset]);
+            srcOffset += mNALLengthSize;
+            isMalFormed = srcOffset + nalLength > size;
+        }
+
+        if (isMalFormed) {
+            ALOGE("Video is malformed");
+            mBuffer->release();
+            mBuffer = NULL;
+            return ERROR_MALFORMED;
+        }
+
+        if (nalLength == 0) {
+            continue;
+        }
+
+        CHECK(dstOffset + 4 <= mBuffer->size());
+
+        dstData[dstOffset++] = 0;
+        dstData[dstOffset++] = 0;
+        dstData[dstOffset++] = 0;
+        dstData[dstOffset++] = 1;
+        if (!inPlace) {
+            memcpy(&dstData[dstOffset], &srcData[srcOffset], nalLength);
+        } else if (dstOffset != srcOffset) {
+            memmove(&dstData[dstOffset], &srcData[srcOffset], nalLength);
+        }
+        srcOffset += nalLength;
+        dstOffset += nalLength;
+    }
+    CHECK_EQ(srcOffset, size);
+    mBuffer->set_range(0, dstOffset);
+
+    return OK;
+}
+
 status_t MPEG4Source::read(
         MediaBuffer **out, const ReadOptions *options) {
     Mutex::Autolock autoLock(mLock);
@@ -3439,66 +3753,11 @@ status_t MPEG4Source::read(
         return OK;
     } else {
         // Whole NAL units are returned but each fragment is prefixed by
-        // the start code (0x00 00 00 01).
-        ssize_t num_bytes_read = 0;
-        int32_t drm = 0;
-        bool usesDRM = (mFormat->findInt32(kKeyIsDRM, &drm) && drm != 0);
-        if (usesDRM) {
-            num_bytes_read =
-                mDataSource->readAt(offset, (uint8_t*)mBuffer->data(), size);
-        } else {
-            num_bytes_read = mDataSource->readAt(offset, mSrcBuffer, size);
-        }
-
-        if (num_bytes_read < (ssize_t)size) {
-            mBuffer->release();
-            mBuffer = NULL;
-
-            return ERROR_IO;
-        }
-
-        if (usesDRM) {
-            CHECK(mBuffer != NULL);
-            mBuffer->set_range(0, size);
-
-        } else {
-            uint8_t *dstData = (uint8_t *)mBuffer->data();
-            size_t srcOffset = 0;
-            size_t dstOffset = 0;
-
-            while (srcOffset < size) {
-                bool isMalFormed = (srcOffset + mNALLengthSize > size);
-                size_t nalLength = 0;
-                if (!isMalFormed) {
-                    nalLength = parseNALSize(&mSrcBuffer[srcOffset]);
-                    srcOffset += mNALLengthSize;
-                    isMalFormed = srcOffset + nalLength > size;
-                }
-
-                if (isMalFormed) {
-                    ALOGE("Video is malformed");
-                    mBuffer->release();
-                    mBuffer = NULL;
-                    return ERROR_MALFORMED;
-                }
-
-                if (nalLength == 0) {
-                    continue;
-                }
-
-                CHECK(dstOffset + 4 <= mBuffer->size());
-
-                dstData[dstOffset++] = 0;
-                dstData[dstOffset++] = 0;
-                dstData[dstOffset++] = 0;
-                dstData[dstOffset++] = 1;
-                memcpy(&dstData[dstOffset], &mSrcBuffer[srcOffset], nalLength);
-                srcOffset += nalLength;
-                dstOffset += nalLength;
-            }
-            CHECK_EQ(srcOffset, size);
-            CHECK(mBuffer != NULL);
-            mBuffer->set_range(0, dstOffset);
+        // the start code (0x00 00 00 01), unless the length prefixes
+        // were asked for.
+        status_t err = readWholeNALs(offset, size);
+        if (err != OK) {
+            return err;
         }
 
         mBuffer->meta_data()->clear();
@@ -3523,6 +3782,31 @@ status_t MPEG4Source::read(
     }
 }
 
+status_t MPEG4Source::moveToFragment(off64_t offset, uint64_t time) {
+    mCurrentMoofOffset = offset;
+    mCurrentSamples.clear();
+    mCurrentSampleIndex = 0;
+    mCurrentTime = time;
+
+    parseChunk(&offset);
+    if (mCurrentSamples.isEmpty()) {
+        return ERROR_END_OF_STREAM;
+    }
+
+    if (mFragmentIndex != NULL) {
+        mFragmentIndex->addFragment(mCurrentMoofOffset, time);
+    }
+    return OK;
+}
+
+uint64_t MPEG4Source::getFragmentDuration() const {
+    uint64_t duration = 0;
+    for (size_t i = 0; i < mCurrentSamples.size(); ++i) {
+        duration += mCurrentSamples[i].duration;
+    }
+    return duration;
+}
+
 status_t MPEG4Source::fragmentedRead(
         MediaBuffer **out, const ReadOptions *options) {
 
@@ -3538,32 +3822,39 @@ status_t MPEG4Source::fragmentedRead(
     ReadOptions::SeekMode mode;
     if (options && options->getSeekTo(&seekTimeUs, &mode)) {
 
-        int numSidxEntries = mSegments.size();
-        if (numSidxEntries != 0) {
-            int64_t totalTime = 0;
-            off64_t totalOffset = mFirstMoofOffset;
-            for (int i = 0; i < numSidxEntries; i++) {
-                const SidxEntry *se = &mSegments[i];
-                if (totalTime + se->mDurationUs > seekTimeUs) {
-                    // The requested time is somewhere in this segment
-                    if ((mode == ReadOptions::SEEK_NEXT_SYNC) ||
-                        (mode == ReadOptions::SEEK_CLOSEST_SYNC &&
-                        (seekTimeUs - totalTime) > (totalTime + se->mDurationUs - seekTimeUs))) {
-                        // requested next sync, or closest sync and it was closer to the end of
-                        // this segment
-                        totalTime += se->mDurationUs;
-                        totalOffset += se->mSize;
-                    }
-                    break;
-                }
-                totalTime += se->mDurationUs;
-                totalOffset += se->mSize;
+        uint64_t seekTime =
+            (seekTimeUs > 0) ? seekTimeUs * mTimescale / 1000000ll : 0;
+
+        // without an index, the moof boxes are walked from the first one
+        off64_t moofOffset = mFirstMoofOffset;
+        uint64_t moofTime = 0;
+        status_t err = OK;
+        if (mFragmentIndex != NULL) {
+            err = mFragmentIndex->findFragment(
+                    seekTime, mode, &moofOffset, &moofTime);
+        }
+        if (err == OK) {
+            err = moveToFragment(moofOffset, moofTime);
+        }
+
+        // The fragments past the last indexed one before seekTime are found
+        // by walking their moof boxes, which indexes them for next time.
+        while (err == OK) {
+            uint64_t endTime = mCurrentTime + getFragmentDuration();
+            bool next = (endTime <= seekTime);
+            if (!next && mCurrentTime < seekTime) {
+                next = (mode == ReadOptions::SEEK_NEXT_SYNC)
+                        || (mode == ReadOptions::SEEK_CLOSEST_SYNC
+                            && seekTime - mCurrentTime > endTime - seekTime);
             }
-        mCurrentMoofOffset = totalOffset;
-        mCurrentSamples.clear();
-        mCurrentSampleIndex = 0;
-        parseChunk(&totalOffset);
-        mCurrentTime = totalTime * mTimescale / 1000000ll;
+            if (!next) {
+                break;
+            }
+            err = moveToFragment(mNextMoofOffset, endTime);
+        }
+
+        if (mFragmentIndex != NULL) {
+            mFragmentIndex->prefetch(mNextMoofOffset, kFragmentsToPrefetch);
         }
 
         if (mBuffer != NULL) {
@@ -3576,7 +3867,7 @@ status_t MPEG4Source::fragmentedRead(
 
     off64_t offset = 0;
     size_t size;
-    uint32_t cts = 0;
+    uint64_t cts = 0;
     bool isSyncSample = false;
     bool newBuffer = false;
     if (mBuffer == NULL) {
@@ -3584,15 +3875,12 @@ status_t MPEG4Source::fragmentedRead(
 
         if (mCurrentSampleIndex >= mCurrentSamples.size()) {
             // move to next fragment
-            Sample lastSample = mCurrentSamples[mCurrentSamples.size() - 1];
-            off64_t nextMoof = mNextMoofOffset; // lastSample.offset + lastSample.size;
-            mCurrentMoofOffset = nextMoof;
-            mCurrentSamples.clear();
-            mCurrentSampleIndex = 0;
-            parseChunk(&nextMoof);
-                if (mCurrentSampleIndex >= mCurrentSamples.size()) {
-                    return ERROR_END_OF_STREAM;
-                }
+            if (moveToFragment(mNextMoofOffset, mCurrentTime) != OK) {
+                return ERROR_END_OF_STREAM;
+            }
+            if (mFragmentIndex != NULL) {
+                mFragmentIndex->prefetch(mNextMoofOffset, kFragmentsToPrefetch);
+            }
         }
 
         const Sample *smpl = &mCurrentSamples[mCurrentSampleIndex];
@@ -3701,67 +3989,11 @@ status_t MPEG4Source::fragmentedRead(
     } else {
         ALOGV("whole NAL");
         // Whole NAL units are returned but each fragment is prefixed by
-        // the start code (0x00 00 00 01).
-        ssize_t num_bytes_read = 0;
-        int32_t drm = 0;
-        bool usesDRM = (mFormat->findInt32(kKeyIsDRM, &drm) && drm != 0);
-        if (usesDRM) {
-            num_bytes_read =
-                mDataSource->readAt(offset, (uint8_t*)mBuffer->data(), size);
-        } else {
-            num_bytes_read = mDataSource->readAt(offset, mSrcBuffer, size);
-        }
-
-        if (num_bytes_read < (ssize_t)size) {
-            mBuffer->release();
-            mBuffer = NULL;
-
-            ALOGV("i/o error");
-            return ERROR_IO;
-        }
-
-        if (usesDRM) {
-            CHECK(mBuffer != NULL);
-            mBuffer->set_range(0, size);
-
-        } else {
-            uint8_t *dstData = (uint8_t *)mBuffer->data();
-            size_t srcOffset = 0;
-            size_t dstOffset = 0;
-
-            while (srcOffset < size) {
-                bool isMalFormed = (srcOffset + mNALLengthSize > size);
-                size_t nalLength = 0;
-                if (!isMalFormed) {
-                    nalLength = parseNALSize(&mSrcBuffer[srcOffset]);
-                    srcOffset += mNALLengthSize;
-                    isMalFormed = srcOffset + nalLength > size;
-                }
-
-                if (isMalFormed) {
-                    ALOGE("Video is malformed");
-                    mBuffer->release();
-                    mBuffer = NULL;
-                    return ERROR_MALFORMED;
-                }
-
-                if (nalLength == 0) {
-                    continue;
-                }
-
-                CHECK(dstOffset + 4 <= mBuffer->size());
-
-                dstData[dstOffset++] = 0;
-                dstData[dstOffset++] = 0;
-                dstData[dstOffset++] = 0;
-                dstData[dstOffset++] = 1;
-                memcpy(&dstData[dstOffset], &mSrcBuffer[srcOffset], nalLength);
-                srcOffset += nalLength;
-                dstOffset += nalLength;
-            }
-            CHECK_EQ(srcOffset, size);
-            CHECK(mBuffer != NULL);
-            mBuffer->set_range(0, dstOffset);
+        // the start code (0x00 00 00 01), unless the length prefixes
+        // were asked for.
+        status_t err = readWholeNALs(offset, size);
+        if (err != OK) {
+            return err;
         }
 
         mBuffer->meta_data()->setInt64(
@@ -186,6 +186,11 @@ status_t SampleIterator::getChunkOffset(uint32_t chunk, off64_t *offset) {
         return ERROR_OUT_OF_RANGE;
     }
 
+    if (mTable->mChunkOffsets != NULL) {
+        *offset = mTable->mChunkOffsetBase + mTable->mChunkOffsets[chunk];
+        return OK;
+    }
+
     if (mTable->mChunkOffsetType == SampleTable::kChunkOffsetType32) {
         uint32_t offset32;
 
@@ -227,6 +232,11 @@ status_t SampleIterator::getSampleSizeDirect(
         return OK;
     }
 
+    if (mTable->mSampleSizes != NULL) {
+        *size = mTable->getIndexedSampleSize(sampleIndex);
+        return OK;
+    }
+
     switch (mTable->mSampleSizeFieldSize) {
         case 32:
         {
@@ -19,11 +19,13 @@
 #include <utils/Log.h>
 
 #include "include/SampleTable.h"
+#include "include/BackgroundIndexer.h"
 #include "include/SampleIterator.h"
 
 #include <arpa/inet.h>
 
 #include <media/stagefright/foundation/ADebug.h>
+#include <media/stagefright/foundation/AMessage.h>
 #include <media/stagefright/DataSource.h>
 #include <media/stagefright/Utils.h>
 
@@ -37,6 +39,44 @@ const uint32_t SampleTable::kChunkOffsetType64 = FOURCC('c', 'o', '6', '4');
 const uint32_t SampleTable::kSampleSizeType32 = FOURCC('s', 't', 's', 'z');
 // static
 const uint32_t SampleTable::kSampleSizeTypeCompact = FOURCC('s', 't', 'z', '2');
+// static
+const size_t SampleTable::kMaxIndexBytes = 32 * 1024 * 1024;
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Appends values of a fixed number of bits to an array of words, starting from the lsb of
+// each word.  The array may be the one the values are read from, as long as each value is
+// read before it is added, since the packed data never gets ahead of the 32-bit values.
+struct BitPacker {
+    BitPacker(uint32_t *words, uint32_t bits)
+        : mWords(words), mNumWords(0), mBits(bits), mPending(0), mPendingBits(0) {
+    }
+
+    void add(uint32_t value) {
+        mPending |= (uint64_t)value << mPendingBits;
+        mPendingBits += mBits;
+        if (mPendingBits >= 32) {
+            mWords[mNumWords++] = (uint32_t)mPending;
+            mPending >>= 32;
+            mPendingBits -= 32;
+        }
+    }
+
+    // Flushes the last partial word, followed by a zero word so that a value can always be
+    // extracted from two consecutive words.  Returns the number of words used.
+    size_t finish() {
+        mWords[mNumWords++] = (uint32_t)mPending;
+        mWords[mNumWords++] = 0;
+        return mNumWords;
+    }
+
+private:
+    uint32_t *mWords;
+    size_t mNumWords;
+    uint32_t mBits;
+    uint64_t mPending;
+    uint32_t mPendingBits;
+};
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -116,9 +156,11 @@ SampleTable::SampleTable(const sp<DataSource> &source)
       mSampleSizeFieldSize(0),
       mDefaultSampleSize(0),
       mNumSampleSizes(0),
+      mTimeToSampleOffset(-1),
       mTimeToSampleCount(0),
       mTimeToSample(NULL),
       mSampleTimeEntries(NULL),
+      mCompositionTimeDeltaOffset(-1),
       mCompositionTimeDeltaEntries(NULL),
       mNumCompositionTimeDeltaEntries(0),
       mCompositionDeltaLookup(new CompositionDeltaLookup),
@@ -126,11 +168,28 @@ SampleTable::SampleTable(const sp<DataSource> &source)
       mNumSyncSamples(0),
       mSyncSamples(NULL),
       mLastSyncSampleIndex(0),
-      mSampleToChunkEntries(NULL) {
+      mSampleToChunkEntries(NULL),
+      mChunkOffsetBase(0),
+      mChunkOffsets(NULL),
+      mSampleSizes(NULL),
+      mSampleSizeBits(0),
+      mMaxSampleSize(0),
+      mSyncSampleBits(NULL),
+      mNumSyncSampleBits(0),
+      mTablesLoaded(false) {
     mSampleIterator = new SampleIterator(this);
 }
 
 SampleTable::~SampleTable() {
+    free(mSyncSampleBits);
+    mSyncSampleBits = NULL;
+
+    free(mSampleSizes);
+    mSampleSizes = NULL;
+
+    free(mChunkOffsets);
+    mChunkOffsets = NULL;
+
     delete[] mSampleToChunkEntries;
     mSampleToChunkEntries = NULL;
 
@@ -157,7 +216,7 @@ bool SampleTable::isValid() const {
     return mChunkOffsetOffset >= 0
         && mSampleToChunkOffset >= 0
         && mSampleSizeOffset >= 0
-        && mTimeToSample != NULL;
+        && mTimeToSampleOffset >= 0;
 }
 
 status_t SampleTable::setChunkOffsetParams(
@@ -201,6 +260,69 @@ status_t SampleTable::setChunkOffsetParams(
     return OK;
 }
 
+void SampleTable::buildChunkOffsetIndex() {
+    size_t entrySize = (mChunkOffsetType == kChunkOffsetType32) ? 4 : 8;
+    if (mNumChunkOffsets == 0 || mNumChunkOffsets > kMaxIndexBytes / entrySize) {
+        return;
+    }
+
+    size_t size = mNumChunkOffsets * entrySize;
+    uint8_t *table = (uint8_t *)malloc(size);
+    if (table == NULL) {
+        return;
+    }
+    if (mDataSource->readAt(mChunkOffsetOffset + 8, table, size) < (ssize_t)size) {
+        free(table);
+        return;
+    }
+
+    uint32_t *offsets = (uint32_t *)table;
+    off64_t base = 0;
+    if (entrySize == 4) {
+        for (uint32_t i = 0; i < mNumChunkOffsets; ++i) {
+            offsets[i] = ntohl(offsets[i]);
+        }
+    } else {
+        // store the 64-bit offsets relative to the smallest one, if they all fit in 32 bits
+        uint64_t minOffset = 0;
+        uint64_t maxOffset = 0;
+        for (uint32_t i = 0; i < mNumChunkOffsets; ++i) {
+            uint64_t offset;
+            memcpy(&offset, &table[8 * i], sizeof(offset));
+            offset = ntoh64(offset);
+            memcpy(&table[8 * i], &offset, sizeof(offset));
+            if (i == 0 || offset < minOffset) {
+                minOffset = offset;
+            }
+            if (offset > maxOffset) {
+                maxOffset = offset;
+            }
+        }
+        if (maxOffset - minOffset > 0xffffffffULL) {
+            free(table);
+            return;
+        }
+        for (uint32_t i = 0; i < mNumChunkOffsets; ++i) {
+            // entry i is read before it is overwritten, as 4 * i <= 8 * i
+            uint64_t offset;
+            memcpy(&offset, &table[8 * i], sizeof(offset));
+            offsets[i] = offset - minOffset;
+        }
+        offsets = (uint32_t *)realloc(table, mNumChunkOffsets * sizeof(uint32_t));
+        if (offsets == NULL) {
+            free(table);
+            return;
+        }
+        base = minOffset;
+    }
+
+    Mutex::Autolock autoLock(mLock);
+    mChunkOffsetBase = base;
+    mChunkOffsets = offsets;
+    ALOGV("chunk offset index: %u chunks, %u bytes (peak %u)",
+            mNumChunkOffsets, mNumChunkOffsets * sizeof(uint32_t), size);
+}
+
 status_t SampleTable::setSampleToChunkParams(
         off64_t data_offset, size_t data_size) {
     if (mSampleToChunkOffset >= 0) {
@@ -226,29 +348,11 @@ status_t SampleTable::setSampleToChunkParams(
 
     mNumSampleToChunkOffsets = U32_AT(&header[4]);
 
-    if (data_size < 8 + mNumSampleToChunkOffsets * 12) {
+    if (data_size < 8 + (uint64_t)mNumSampleToChunkOffsets * 12) {
         return ERROR_MALFORMED;
     }
 
-    mSampleToChunkEntries =
-        new SampleToChunkEntry[mNumSampleToChunkOffsets];
-
-    for (uint32_t i = 0; i < mNumSampleToChunkOffsets; ++i) {
-        uint8_t buffer[12];
-        if (mDataSource->readAt(
-                    mSampleToChunkOffset + 8 + i * 12, buffer, sizeof(buffer))
-                != (ssize_t)sizeof(buffer)) {
-            return ERROR_IO;
-        }
-
-        CHECK(U32_AT(buffer) >= 1);  // chunk index is 1 based in the spec.
-
-        // We want the chunk index to be 0-based.
-        mSampleToChunkEntries[i].startChunk = U32_AT(buffer) - 1;
-        mSampleToChunkEntries[i].samplesPerChunk = U32_AT(&buffer[4]);
-        mSampleToChunkEntries[i].chunkDesc = U32_AT(&buffer[8]);
-    }
-
+    // the entries are read by loadTables()
     return OK;
 }
 
@@ -309,12 +413,109 @@ status_t SampleTable::setSampleSizeParams(
         }
     }
 
+    buildSampleSizeIndex();
+
     return OK;
 }
 
+void SampleTable::buildSampleSizeIndex() {
+    if (mNumSampleSizes == 0
+            || mNumSampleSizes > kMaxIndexBytes / sizeof(uint32_t) - 2) {
+        return;
+    }
+
+    // room for one 32-bit value per sample, plus the two words BitPacker::finish() may add
+    size_t peakSize = (mNumSampleSizes + 2) * sizeof(uint32_t);
+    uint32_t *words = (uint32_t *)malloc(peakSize);
+    if (words == NULL) {
+        return;
+    }
+
+    uint32_t bits;
+    size_t maxSize = 0;
+    size_t numWords;
+    if (mSampleSizeFieldSize == 32) {
+        size_t size = mNumSampleSizes * sizeof(uint32_t);
+        if (mDataSource->readAt(mSampleSizeOffset + 12, words, size) < (ssize_t)size) {
+            free(words);
+            return;
+        }
+        for (uint32_t i = 0; i < mNumSampleSizes; ++i) {
+            words[i] = ntohl(words[i]);
+            if (words[i] > maxSize) {
+                maxSize = words[i];
+            }
+        }
+
+        // repack in place with just enough bits for the largest sample
+        bits = 1;
+        while (bits < 32 && (maxSize >> bits) != 0) {
+            ++bits;
+        }
+        BitPacker packer(words, bits);
+        for (uint32_t i = 0; i < mNumSampleSizes; ++i) {
+            packer.add(words[i]);
+        }
+        numWords = packer.finish();
+    } else {
+        // stz2 is already packed: keep its field size, but in host order
+        size_t size = ((size_t)mNumSampleSizes * mSampleSizeFieldSize + 7) / 8;
+        uint8_t *table = (uint8_t *)malloc(size);
+        if (table == NULL) {
+            free(words);
+            return;
+        }
+        if (mDataSource->readAt(mSampleSizeOffset + 12, table, size) < (ssize_t)size) {
+            free(table);
+            free(words);
+            return;
+        }
+        bits = mSampleSizeFieldSize;
+        BitPacker packer(words, bits);
+        for (uint32_t i = 0; i < mNumSampleSizes; ++i) {
+            uint32_t x;
+            if (bits == 16) {
+                x = (table[2 * i] << 8) | table[2 * i + 1];
+            } else if (bits == 8) {
+                x = table[i];
+            } else {
+                x = (i & 1) ? table[i / 2] & 0x0f : table[i / 2] >> 4;
+            }
+            if (x > maxSize) {
+                maxSize = x;
+            }
+            packer.add(x);
+        }
+        numWords = packer.finish();
+        free(table);
+        peakSize += size;
+    }
+
+    uint32_t *packed = (uint32_t *)realloc(words, numWords * sizeof(uint32_t));
+    mSampleSizes = packed != NULL ? packed : words;
+    mSampleSizeBits = bits;
+    mMaxSampleSize = maxSize;
+
+    size_t indexSize = numWords * sizeof(uint32_t);
+    if (indexSize >= 1024 * 1024) {
+        ALOGI("sample size index: %u samples, %u bits each, %u bytes (peak %u)",
+                mNumSampleSizes, bits, indexSize, peakSize);
+    } else {
+        ALOGV("sample size index: %u samples, %u bits each, %u bytes (peak %u)",
+                mNumSampleSizes, bits, indexSize, peakSize);
+    }
+}
+
+size_t SampleTable::getIndexedSampleSize(uint32_t sampleIndex) const {
+    uint64_t bit = (uint64_t)sampleIndex * mSampleSizeBits;
+    size_t word = bit >> 5;
+    uint64_t x = mSampleSizes[word] | ((uint64_t)mSampleSizes[word + 1] << 32);
+    return (x >> (bit & 31)) & ((1ULL << mSampleSizeBits) - 1);
+}
+
 status_t SampleTable::setTimeToSampleParams(
         off64_t data_offset, size_t data_size) {
-    if (mTimeToSample != NULL || data_size < 8) {
+    if (mTimeToSampleOffset >= 0 || data_size < 8) {
         return ERROR_MALFORMED;
     }
 
@@ -330,17 +531,13 @@ status_t SampleTable::setTimeToSampleParams(
     }
 
     mTimeToSampleCount = U32_AT(&header[4]);
-    mTimeToSample = new uint32_t[mTimeToSampleCount * 2];
 
-    size_t size = sizeof(uint32_t) * mTimeToSampleCount * 2;
-    if (mDataSource->readAt(
-                data_offset + 8, mTimeToSample, size) < (ssize_t)size) {
-        return ERROR_IO;
+    if (data_size < 8 + (uint64_t)mTimeToSampleCount * 8) {
+        return ERROR_MALFORMED;
     }
 
-    for (uint32_t i = 0; i < mTimeToSampleCount * 2; ++i) {
-        mTimeToSample[i] = ntohl(mTimeToSample[i]);
-    }
+    // the entries are read by loadTables()
+    mTimeToSampleOffset = data_offset;
 
     return OK;
 }
@@ -349,7 +546,7 @@ status_t SampleTable::setCompositionTimeToSampleParams(
         off64_t data_offset, size_t data_size) {
     ALOGI("There are reordered frames present.");
 
-    if (mCompositionTimeDeltaEntries != NULL || data_size < 8) {
+    if (mCompositionTimeDeltaOffset >= 0 || data_size < 8) {
         return ERROR_MALFORMED;
     }
 
@@ -371,24 +568,9 @@ status_t SampleTable::setCompositionTimeToSampleParams(
         return ERROR_MALFORMED;
     }
 
+    // the entries are read by loadTables()
+    mCompositionTimeDeltaOffset = data_offset;
     mNumCompositionTimeDeltaEntries = numEntries;
-    mCompositionTimeDeltaEntries = new uint32_t[2 * numEntries];
-
-    if (mDataSource->readAt(
-                data_offset + 8, mCompositionTimeDeltaEntries, numEntries * 8)
-            < (ssize_t)numEntries * 8) {
-        delete[] mCompositionTimeDeltaEntries;
-        mCompositionTimeDeltaEntries = NULL;
-
-        return ERROR_IO;
-    }
-
-    for (size_t i = 0; i < 2 * numEntries; ++i) {
-        mCompositionTimeDeltaEntries[i] = ntohl(mCompositionTimeDeltaEntries[i]);
-    }
-
-    mCompositionDeltaLookup->setEntries(
-            mCompositionTimeDeltaEntries, mNumCompositionTimeDeltaEntries);
 
     return OK;
 }
@@ -417,20 +599,138 @@ status_t SampleTable::setSyncSampleParams(off64_t data_offset, size_t data_size)
         ALOGV("Table of sync samples is empty or has only a single entry!");
     }
 
-    mSyncSamples = new uint32_t[mNumSyncSamples];
-    size_t size = mNumSyncSamples * sizeof(uint32_t);
-    if (mDataSource->readAt(mSyncSampleOffset + 8, mSyncSamples, size)
-            != (ssize_t)size) {
-        return ERROR_IO;
+    if (data_size < 8 + (uint64_t)mNumSyncSamples * 4) {
+        return ERROR_MALFORMED;
     }
 
-    for (size_t i = 0; i < mNumSyncSamples; ++i) {
-        mSyncSamples[i] = ntohl(mSyncSamples[i]) - 1;
+    // the entries are read by loadTables()
+    return OK;
+}
+
+// static
+status_t SampleTable::readWords(
+        const sp<DataSource> &source, off64_t offset, size_t count, uint32_t **words) {
+    *words = NULL;
+    if (count == 0) {
+        return OK;
     }
 
+    uint32_t *table = new uint32_t[count];
+    size_t size = count * sizeof(uint32_t);
+    if (source->readAt(offset, table, size) < (ssize_t)size) {
+        delete[] table;
+        return ERROR_IO;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        table[i] = ntohl(table[i]);
+    }
+    *words = table;
     return OK;
 }
 
+status_t SampleTable::loadTables() {
+    {
+        Mutex::Autolock autoLock(mLock);
+        if (mTablesLoaded) {
+            return OK;
+        }
+    }
+
+    // The tables are read without holding mLock, as for the chunk offset index.  If the
+    // BackgroundIndexer and a reader of the track both load them, the first one wins.
+    uint32_t *sampleToChunk = NULL;
+    uint32_t *timeToSample = NULL;
+    uint32_t *compositionTimeDeltas = NULL;
+    uint32_t *syncSamples = NULL;
+
+    status_t err = readWords(mDataSource, mSampleToChunkOffset + 8,
+            (size_t)mNumSampleToChunkOffsets * 3, &sampleToChunk);
+    if (err == OK) {
+        err = readWords(mDataSource, mTimeToSampleOffset + 8,
+                (size_t)mTimeToSampleCount * 2, &timeToSample);
+    }
+    if (err == OK && mCompositionTimeDeltaOffset >= 0) {
+        err = readWords(mDataSource, mCompositionTimeDeltaOffset + 8,
+                mNumCompositionTimeDeltaEntries * 2, &compositionTimeDeltas);
+    }
+    if (err == OK && mSyncSampleOffset >= 0) {
+        err = readWords(mDataSource, mSyncSampleOffset + 8, mNumSyncSamples, &syncSamples);
+    }
+
+    SampleToChunkEntry *sampleToChunkEntries = NULL;
+    if (err == OK) {
+        sampleToChunkEntries = new SampleToChunkEntry[mNumSampleToChunkOffsets];
+        for (uint32_t i = 0; i < mNumSampleToChunkOffsets; ++i) {
+            const uint32_t *entry = &sampleToChunk[3 * i];
+            if (entry[0] < 1) {
+                // chunk index is 1 based in the spec.
+                err = ERROR_MALFORMED;
+                break;
+            }
+
+            // We want the chunk index to be 0-based.
+            sampleToChunkEntries[i].startChunk = entry[0] - 1;
+            sampleToChunkEntries[i].samplesPerChunk = entry[1];
+            sampleToChunkEntries[i].chunkDesc = entry[2];
+        }
+        for (uint32_t i = 0; i < mNumSyncSamples && syncSamples != NULL; ++i) {
+            syncSamples[i] -= 1;
+        }
+    }
+    delete[] sampleToChunk;
+
+    Mutex::Autolock autoLock(mLock);
+    if (err == OK && !mTablesLoaded) {
+        mSampleToChunkEntries = sampleToChunkEntries;
+        mTimeToSample = timeToSample;
+        mCompositionTimeDeltaEntries = compositionTimeDeltas;
+        mCompositionDeltaLookup->setEntries(
+                mCompositionTimeDeltaEntries, mNumCompositionTimeDeltaEntries);
+        mSyncSamples = syncSamples;
+        buildSyncSampleIndex();
+        mTablesLoaded = true;
+    } else {
+        delete[] sampleToChunkEntries;
+        delete[] timeToSample;
+        delete[] compositionTimeDeltas;
+        delete[] syncSamples;
+    }
+    return mTablesLoaded ? OK : err;
+}
+
+void SampleTable::buildSyncSampleIndex() {
+    // An entry of 0 in the file was stored as 0xffffffff, which no sample index can match,
+    // so it is left out of the bitmap along with any entry past a known sample count.
+    uint64_t numBits = 0;
+    for (uint32_t i = 0; i < mNumSyncSamples; ++i) {
+        uint32_t sample = mSyncSamples[i];
+        if (sample == 0xffffffff || (mNumSampleSizes > 0 && sample >= mNumSampleSizes)) {
+            continue;
+        }
+        if (sample >= numBits) {
+            numBits = (uint64_t)sample + 1;
+        }
+    }
+    if (numBits == 0 || numBits / 8 > kMaxIndexBytes) {
+        return;
+    }
+
+    size_t numWords = numBits / 32 + 1;
+    mSyncSampleBits = (uint32_t *)calloc(numWords, sizeof(uint32_t));
+    if (mSyncSampleBits == NULL) {
+        return;
+    }
+    for (uint32_t i = 0; i < mNumSyncSamples; ++i) {
+        uint32_t sample = mSyncSamples[i];
+        if (sample < numBits) {
+            mSyncSampleBits[sample >> 5] |= 1u << (sample & 31);
+        }
+    }
+    mNumSyncSampleBits = numBits;
+    ALOGV("sync sample index: %u sync samples, %u bytes",
+            mNumSyncSamples, numWords * sizeof(uint32_t));
+}
+
 uint32_t SampleTable::countChunkOffsets() const {
     return mNumChunkOffsets;
 }
@@ -444,6 +744,16 @@ status_t SampleTable::getMaxSampleSize(size_t *max_size) {
 
     *max_size = 0;
 
+    if (mDefaultSampleSize > 0) {
+        *max_size = mDefaultSampleSize;
+        return OK;
+    }
+
+    if (mSampleSizes != NULL) {
+        *max_size = mMaxSampleSize;
+        return OK;
+    }
+
     for (uint32_t i = 0; i < mNumSampleSizes; ++i) {
         size_t sample_size;
         status_t err = getSampleSize_l(i, &sample_size);
@@ -479,17 +789,27 @@ int SampleTable::CompareIncreasingTime(const void *_a, const void *_b) {
 }
 
 void SampleTable::buildSampleEntriesTable() {
-    Mutex::Autolock autoLock(mLock);
+    {
+        Mutex::Autolock autoLock(mLock);
 
-    if (mSampleTimeEntries != NULL) {
-        return;
+        if (mSampleTimeEntries != NULL) {
+            return;
+        }
     }
 
-    mSampleTimeEntries = new SampleTimeEntry[mNumSampleSizes];
+    // The table is built without holding mLock, which would stall sample lookups for as long
+    // as the build takes.  If two seeks both build it, the first one wins.
+    SampleTimeEntry *entries = new SampleTimeEntry[mNumSampleSizes];
 
     uint32_t sampleIndex = 0;
     uint32_t sampleTime = 0;
 
+    // walk the composition time deltas alongside, rather than through the shared
+    // CompositionDeltaLookup whose position playback relies on
+    size_t deltaEntry = 0;
+    uint32_t deltaEntryEnd = mNumCompositionTimeDeltaEntries > 0
+            ? mCompositionTimeDeltaEntries[0] : 0;
+
     for (uint32_t i = 0; i < mTimeToSampleCount; ++i) {
         uint32_t n = mTimeToSample[2 * i];
         uint32_t delta = mTimeToSample[2 * i + 1];
@@ -500,13 +820,19 @@ void SampleTable::buildSampleEntriesTable() {
                 // is well-formed, but you know... there's (gasp) malformed
                 // content out there.
 
-                mSampleTimeEntries[sampleIndex].mSampleIndex = sampleIndex;
+                entries[sampleIndex].mSampleIndex = sampleIndex;
 
-                uint32_t compTimeDelta =
-                    mCompositionDeltaLookup->getCompositionTimeOffset(
-                            sampleIndex);
+                while (deltaEntry < mNumCompositionTimeDeltaEntries
+                        && sampleIndex >= deltaEntryEnd) {
+                    ++deltaEntry;
+                    if (deltaEntry < mNumCompositionTimeDeltaEntries) {
+                        deltaEntryEnd += mCompositionTimeDeltaEntries[2 * deltaEntry];
+                    }
+                }
+                uint32_t compTimeDelta = deltaEntry < mNumCompositionTimeDeltaEntries
+                        ? mCompositionTimeDeltaEntries[2 * deltaEntry + 1] : 0;
 
-                mSampleTimeEntries[sampleIndex].mCompositionTime =
+                entries[sampleIndex].mCompositionTime =
                     sampleTime + compTimeDelta;
             }
 
@@ -515,12 +841,38 @@ void SampleTable::buildSampleEntriesTable() {
         }
     }
 
-    qsort(mSampleTimeEntries, mNumSampleSizes, sizeof(SampleTimeEntry),
+    qsort(entries, mNumSampleSizes, sizeof(SampleTimeEntry),
           CompareIncreasingTime);
+
+    Mutex::Autolock autoLock(mLock);
+    if (mSampleTimeEntries == NULL) {
+        mSampleTimeEntries = entries;
+    } else {
+        delete[] entries;
+    }
+}
+
+void SampleTable::buildIndexAsync() {
+    BackgroundIndexer::newWork(onBuildIndex, this)->post();
+}
+
+// static
+void SampleTable::onBuildIndex(const sp<RefBase> &target, const sp<AMessage> & /* msg */) {
+    sp<SampleTable> table = static_cast<SampleTable *>(target.get());
+
+    // The seek table is left to the first seek: most tracks are played from the start, and
+    // it costs 8 bytes per sample for as long as the table lives.
+    (void)table->loadTables();
+    table->buildChunkOffsetIndex();
 }
 
 status_t SampleTable::findSampleAtTime(
         uint32_t req_time, uint32_t *sample_index, uint32_t flags) {
+    status_t err = loadTables();
+    if (err != OK) {
+        return err;
+    }
+
     buildSampleEntriesTable();
 
     uint32_t left = 0;
@@ -602,6 +954,11 @@ status_t SampleTable::findSampleAtTime(
 
 status_t SampleTable::findSyncSampleNear(
         uint32_t start_sample_index, uint32_t *sample_index, uint32_t flags) {
+    status_t err = loadTables();
+    if (err != OK) {
+        return err;
+    }
+
     Mutex::Autolock autoLock(mLock);
 
     *sample_index = 0;
@@ -651,7 +1008,7 @@ status_t SampleTable::findSyncSampleNear(
 
         // our sample lies between sync samples x and y.
 
-        status_t err = mSampleIterator->seekTo(start_sample_index);
+        err = mSampleIterator->seekTo(start_sample_index);
         if (err != OK) {
             return err;
         }
@@ -725,6 +1082,11 @@ status_t SampleTable::findSyncSampleNear(
 }
 
 status_t SampleTable::findThumbnailSample(uint32_t *sample_index) {
+    status_t err = loadTables();
+    if (err != OK) {
+        return err;
+    }
+
     Mutex::Autolock autoLock(mLock);
 
     if (mSyncSampleOffset < 0) {
@@ -751,7 +1113,7 @@ status_t SampleTable::findThumbnailSample(uint32_t *sample_index) {
 
         // Now x is a sample index.
         size_t sampleSize;
-        status_t err = getSampleSize_l(x, &sampleSize);
+        err = getSampleSize_l(x, &sampleSize);
         if (err != OK) {
             return err;
         }
@@ -779,9 +1141,13 @@ status_t SampleTable::getMetaDataForSample(
         size_t *size,
         uint32_t *compositionTime,
         bool *isSyncSample) {
+    status_t err = loadTables();
+    if (err != OK) {
+        return err;
+    }
+
     Mutex::Autolock autoLock(mLock);
 
-    status_t err;
     if ((err = mSampleIterator->seekTo(sampleIndex)) != OK) {
         return err;
     }
@@ -803,6 +1169,9 @@ status_t SampleTable::getMetaDataForSample(
         if (mSyncSampleOffset < 0) {
             // Every sample is a sync sample.
             *isSyncSample = true;
+        } else if (mSyncSampleBits != NULL) {
+            *isSyncSample = sampleIndex < mNumSyncSampleBits
+                    && (mSyncSampleBits[sampleIndex >> 5] & (1u << (sampleIndex & 31)));
         } else {
             size_t i = (mLastSyncSampleIndex < mNumSyncSamples)
                     && (mSyncSamples[mLastSyncSampleIndex] <= sampleIndex)
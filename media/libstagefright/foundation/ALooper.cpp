@@ -51,6 +51,10 @@ struct ALooper::LooperThread : public Thread {
         return mThreadId == androidGetThreadId();
     }
 
+    bool isExiting() const {
+        return exitPending();
+    }
+
 protected:
     virtual ~LooperThread() {}
 
@@ -67,7 +71,8 @@ int64_t ALooper::GetNowUs() {
 }
 
 ALooper::ALooper()
-    : mRunningLocally(false) {
+    : mNextSeqNo(0),
+      mRunningLocally(false) {
 }
 
 ALooper::~ALooper() {
@@ -158,6 +163,14 @@ status_t ALooper::stop() {
     return OK;
 }
 
+// static
+bool ALooper::isEarlier(const Event &a, const Event &b) {
+    if (a.mWhenUs != b.mWhenUs) {
+        return a.mWhenUs < b.mWhenUs;
+    }
+    return (int32_t)(a.mSeqNo - b.mSeqNo) < 0;
+}
+
 void ALooper::post(const sp<AMessage> &msg, int64_t delayUs) {
     Mutex::Autolock autoLock(mLock);
 
@@ -168,35 +181,77 @@ void ALooper::post(const sp<AMessage> &msg, int64_t delayUs) {
         whenUs = GetNowUs();
     }
 
-    List<Event>::iterator it = mEventQueue.begin();
-    while (it != mEventQueue.end() && (*it).mWhenUs <= whenUs) {
-        ++it;
-    }
-
     Event event;
     event.mWhenUs = whenUs;
+    event.mSeqNo = mNextSeqNo++;
     event.mMessage = msg;
 
-    if (it == mEventQueue.begin()) {
+    pushEvent_l(event);
+}
+
+void ALooper::pushEvent_l(const Event &event) {
+    // sift the new event up from the end of the heap
+    size_t i = mEventQueue.size();
+    mEventQueue.push();
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!isEarlier(event, mEventQueue[parent])) {
+            break;
+        }
+        mEventQueue.editItemAt(i) = mEventQueue[parent];
+        i = parent;
+    }
+    mEventQueue.editItemAt(i) = event;
+
+    if (i == 0) {
         mQueueChangedCondition.signal();
     }
+}
+
+void ALooper::popEvent_l(Event *event) {
+    *event = mEventQueue[0];
+
+    size_t n = mEventQueue.size() - 1;
+    Event last = mEventQueue[n];
+    mEventQueue.pop();
+
+    if (n == 0) {
+        return;
+    }
 
-    mEventQueue.insert(it, event);
+    // sift the last event down from the top of the heap
+    size_t i = 0;
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= n) {
+            break;
+        }
+        if (child + 1 < n && isEarlier(mEventQueue[child + 1], mEventQueue[child])) {
+            ++child;
+        }
+        if (!isEarlier(mEventQueue[child], last)) {
+            break;
+        }
+        mEventQueue.editItemAt(i) = mEventQueue[child];
+        i = child;
+    }
+    mEventQueue.editItemAt(i) = last;
 }
 
 bool ALooper::loop() {
-    Event event;
+    Vector<Event> events;
+    sp<LooperThread> thread;
 
     {
         Mutex::Autolock autoLock(mLock);
         if (mThread == NULL && !mRunningLocally) {
             return false;
         }
-        if (mEventQueue.empty()) {
+        if (mEventQueue.isEmpty()) {
             mQueueChangedCondition.wait(mLock);
             return true;
         }
-        int64_t whenUs = (*mEventQueue.begin()).mWhenUs;
+        int64_t whenUs = mEventQueue[0].mWhenUs;
         int64_t nowUs = GetNowUs();
 
         if (whenUs > nowUs) {
@@ -206,16 +261,51 @@ bool ALooper::loop() {
             return true;
         }
 
-        event = *mEventQueue.begin();
-        mEventQueue.erase(mEventQueue.begin());
+        // Take everything that is due now, so that a busy looper
+        // doesn't have to come back here for each message.
+        do {
+            events.push();
+            popEvent_l(&events.editTop());
+        } while (!mEventQueue.isEmpty() && mEventQueue[0].mWhenUs <= nowUs);
+
+        thread = mThread;
     }
 
-    gLooperRoster.deliverMessage(event.mMessage);
+    // One roster lookup for the whole batch.
+    Vector<sp<AHandler> > handlers;
+    gLooperRoster.findHandlers(events, &handlers);
+
+    // A handler may release the last reference to this looper, which must
+    // survive until the end of the batch to requeue what was not delivered.
+    // The promotion fails if the looper is already being destroyed on
+    // another thread, which then waits for this one to exit.
+    sp<ALooper> self = wp<ALooper>(this).promote();
+
+    for (size_t i = 0; i < events.size(); ++i) {
+        // One of the handlers may have stopped the looper.  The events it
+        // didn't get to are put back in the queue, for a later start().
+        if (i > 0) {
+            Mutex::Autolock autoLock(mLock);
+            bool stopped = (thread != NULL)
+                    ? thread->isExiting() : !mRunningLocally;
+            if (stopped) {
+                for (size_t j = i; self != NULL && j < events.size(); ++j) {
+                    pushEvent_l(events[j]);
+                }
+                break;
+            }
+        }
+
+        if (handlers[i] != NULL) {
+            handlers[i]->onMessageReceived(events[i].mMessage);
+            // as before batching, the handler isn't kept alive any longer
+            handlers.editItemAt(i).clear();
+        }
+    }
 
-    // NOTE: It's important to note that at this point our "ALooper" object
-    // may no longer exist (its final reference may have gone away while
-    // delivering the message). We have made sure, however, that loop()
-    // won't be called again.
+    // NOTE: If the handlers released all other references to this looper,
+    // it is destroyed here, on its own thread.  Its destructor stops it, so
+    // that loop() won't be called again.
 
     return true;
 }
@@ -119,33 +119,36 @@ status_t ALooperRoster::postMessage_l(
     return OK;
 }
 
-void ALooperRoster::deliverMessage(const sp<AMessage> &msg) {
-    sp<AHandler> handler;
+void ALooperRoster::findHandlers(
+        const Vector<ALooper::Event> &events,
+        Vector<sp<AHandler> > *handlers) {
+    handlers->clear();
+    handlers->setCapacity(events.size());
 
-    {
-        Mutex::Autolock autoLock(mLock);
+    Mutex::Autolock autoLock(mLock);
+
+    for (size_t i = 0; i < events.size(); ++i) {
+        ALooper::handler_id target = events[i].mMessage->target();
+        sp<AHandler> handler;
 
-        ssize_t index = mHandlers.indexOfKey(msg->target());
+        ssize_t index = mHandlers.indexOfKey(target);
 
         if (index < 0) {
             ALOGW("failed to deliver message. Target handler not registered.");
-            return;
-        }
+        } else {
+            handler = mHandlers.valueAt(index).mHandler.promote();
 
-        const HandlerInfo &info = mHandlers.valueAt(index);
-        handler = info.mHandler.promote();
+            if (handler == NULL) {
+                ALOGW("failed to deliver message. "
+                     "Target handler %d registered, but object gone.",
+                     target);
 
-        if (handler == NULL) {
-            ALOGW("failed to deliver message. "
-                 "Target handler %d registered, but object gone.",
-                 msg->target());
-
-            mHandlers.removeItemsAt(index);
-            return;
+                mHandlers.removeItemsAt(index);
+            }
         }
-    }
 
-    handler->onMessageReceived(msg);
+        handlers->push(handler);
+    }
 }
 
 sp<ALooper> ALooperRoster::findLooper(ALooper::handler_id handlerID) {
@@ -31,3 +31,17 @@ LOCAL_MODULE:= libstagefright_foundation
 
 
 include $(BUILD_SHARED_LIBRARY)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= bench-looper.cpp
+
+LOCAL_SHARED_LIBRARIES := libstagefright_foundation libutils liblog
+
+LOCAL_CFLAGS += -Wno-multichar
+
+LOCAL_MODULE:= bench-looper
+
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_EXECUTABLE)
@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Benchmark of ALooper message delivery.
+ *
+ * The calling thread posts messages as fast as it can to a handler on another looper,
+ * optionally each with a pseudo-random delay so that the queue holds many pending events.
+ * Reported are the messages delivered per second, and the latency from the time each
+ * message was due to the time its handler received it.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <media/stagefright/foundation/ADebug.h>
+#include <media/stagefright/foundation/AHandler.h>
+#include <media/stagefright/foundation/ALooper.h>
+#include <media/stagefright/foundation/AMessage.h>
+#include <utils/threads.h>
+
+using namespace android;
+
+// ----------------------------------------------------------------------------
+
+class Sink : public AHandler {
+public:
+    explicit Sink(size_t expected)
+        : mExpected(expected), mReceived(0), mLatenciesUs(new int64_t[expected]) {
+    }
+
+    enum {
+        kWhatPing = 'ping',
+    };
+
+    // Returns when all the expected messages were received
+    void wait() {
+        Mutex::Autolock _l(mLock);
+        while (mReceived < mExpected) {
+            mDone.wait(mLock);
+        }
+    }
+
+    // Sorts the latencies and returns the given percentile
+    int64_t percentileUs(uint32_t percent) {
+        Mutex::Autolock _l(mLock);
+        if (mReceived == 0) {
+            return 0;
+        }
+        qsort(mLatenciesUs, mReceived, sizeof(int64_t), compare);
+        size_t i = (mReceived * percent) / 100;
+        return mLatenciesUs[i < mReceived ? i : mReceived - 1];
+    }
+
+protected:
+    virtual ~Sink() {
+        delete[] mLatenciesUs;
+    }
+
+    virtual void onMessageReceived(const sp<AMessage> &msg) {
+        int64_t dueUs;
+        CHECK(msg->findInt64("due", &dueUs));
+        int64_t latencyUs = ALooper::GetNowUs() - dueUs;
+
+        Mutex::Autolock _l(mLock);
+        if (mReceived < mExpected) {
+            mLatenciesUs[mReceived] = latencyUs;
+            if (++mReceived == mExpected) {
+                mDone.signal();
+            }
+        }
+    }
+
+private:
+    static int compare(const void *a, const void *b) {
+        int64_t x = *(const int64_t *) a;
+        int64_t y = *(const int64_t *) b;
+        return x < y ? -1 : x > y ? 1 : 0;
+    }
+
+    Mutex mLock;
+    Condition mDone;
+    const size_t mExpected;
+    size_t mReceived;
+    int64_t *mLatenciesUs;
+};
+
+// ----------------------------------------------------------------------------
+
+// Parses a whole decimal number that fits in "max", rejecting signs, which strtoul() accepts
+static bool parseCount(const char* s, unsigned long max, unsigned long* value) {
+    if (*s < '0' || *s > '9') {
+        return false;
+    }
+    char* end;
+    errno = 0;
+    unsigned long v = strtoul(s, &end, 10);
+    if (errno != 0 || *end != '\0' || v > max) {
+        return false;
+    }
+    *value = v;
+    return true;
+}
+
+static int usage(const char* name) {
+    fprintf(stderr, "Usage: %s [-n messages] [-d max_delay_us]\n", name);
+    fprintf(stderr, "    -n    number of messages posted (default 100000)\n");
+    fprintf(stderr, "    -d    messages are posted with delays up to this (default 0)\n");
+    return -1;
+}
+
+int main(int argc, char* argv[]) {
+    const char* const progname = argv[0];
+    size_t count = 100000;
+    int64_t maxDelayUs = 0;
+
+    int ch;
+    unsigned long value;
+    while ((ch = getopt(argc, argv, "n:d:")) != -1) {
+        switch (ch) {
+        case 'n':
+            // each message keeps a latency slot, so bound the count to what can be allocated
+            if (!parseCount(optarg, ((size_t) -1) / sizeof(int64_t), &value)) {
+                return usage(progname);
+            }
+            count = value;
+            break;
+        case 'd':
+            // one hour
+            if (!parseCount(optarg, 3600000000UL, &value)) {
+                return usage(progname);
+            }
+            maxDelayUs = value;
+            break;
+        case '?':
+        default:
+            return usage(progname);
+        }
+    }
+    if (count == 0) {
+        return usage(progname);
+    }
+
+    sp<ALooper> looper = new ALooper;
+    looper->setName("bench-looper");
+    looper->start();
+    sp<Sink> sink = new Sink(count);
+    looper->registerHandler(sink);
+
+    // a fixed linear congruential sequence, so that runs can be compared
+    uint32_t seed = 1;
+    const int64_t startUs = ALooper::GetNowUs();
+    for (size_t i = 0; i < count; i++) {
+        int64_t delayUs = 0;
+        if (maxDelayUs > 0) {
+            seed = seed * 1103515245 + 12345;
+            delayUs = (seed >> 8) % (maxDelayUs + 1);
+        }
+        sp<AMessage> msg = new AMessage(Sink::kWhatPing, sink->id());
+        msg->setInt64("due", ALooper::GetNowUs() + delayUs);
+        msg->post(delayUs);
+    }
+    const int64_t postedUs = ALooper::GetNowUs();
+    sink->wait();
+    const int64_t doneUs = ALooper::GetNowUs();
+
+    looper->unregisterHandler(sink->id());
+    looper->stop();
+
+    // with delays, the delivery rate is bounded by the longest delay
+    printf("%zu messages, delays up to %lld us\n", count, (long long) maxDelayUs);
+    printf("  post:      %.0f messages/s\n",
+            postedUs > startUs ? count * 1e6 / (postedUs - startUs) : 0.0);
+    printf("  delivery:  %.0f messages/s\n",
+            doneUs > startUs ? count * 1e6 / (doneUs - startUs) : 0.0);
+    printf("  latency us: p50=%lld p90=%lld p99=%lld max=%lld\n",
+            (long long) sink->percentileUs(50), (long long) sink->percentileUs(90),
+            (long long) sink->percentileUs(99), (long long) sink->percentileUs(100));
+    return 0;
+}
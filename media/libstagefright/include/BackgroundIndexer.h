@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BACKGROUND_INDEXER_H_
+
+#define BACKGROUND_INDEXER_H_
+
+#include <media/stagefright/foundation/AHandler.h>
+#include <utils/RefBase.h>
+#include <utils/threads.h>
+
+namespace android {
+
+struct ALooper;
+struct AMessage;
+
+// Runs the indexing that MPEG4Extractor leaves for after parsing, such as
+// loading sample tables and prefetching fragments, for all open files on one
+// background looper.
+struct BackgroundIndexer : public AHandler {
+    typedef void (*Work)(const sp<RefBase> &target, const sp<AMessage> &msg);
+
+    // Returns a message that calls work(target, msg) on the looper once it is
+    // posted.  The caller adds its own arguments to it.  The work is skipped
+    // if the message holds the last reference to target by then.
+    static sp<AMessage> newWork(Work work, const sp<RefBase> &target);
+
+protected:
+    virtual void onMessageReceived(const sp<AMessage> &msg);
+
+private:
+    enum {
+        kWhatWork = 'work',
+    };
+
+    static Mutex sLock;
+    static sp<ALooper> sLooper;
+    static sp<BackgroundIndexer> sIndexer;
+};
+
+}  // namespace android
+
+#endif  // BACKGROUND_INDEXER_H_
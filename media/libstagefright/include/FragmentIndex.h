@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FRAGMENT_INDEX_H_
+
+#define FRAGMENT_INDEX_H_
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#include <media/stagefright/MediaSource.h>
+#include <utils/RefBase.h>
+#include <utils/threads.h>
+#include <utils/Vector.h>
+
+namespace android {
+
+struct AMessage;
+class DataSource;
+
+// Maps decoding times to the moof boxes of one track of a fragmented MP4 file.
+// It starts out with the fragments listed by the sidx and tfra boxes, and
+// learns about the others as they are read or prefetched.  Times are in the
+// track's timescale and count from the first moof box.
+class FragmentIndex : public RefBase {
+public:
+    FragmentIndex(const sp<DataSource> &source,
+                  uint32_t trackId, off64_t firstMoofOffset);
+
+    // Adds the fragment whose moof box is at "offset" and whose first sample
+    // is decoded at "time".  Known fragments are ignored.
+    void addFragment(off64_t offset, uint64_t time);
+
+    // Same, for a decoding time from a tfra or tfdt box, which counts from the
+    // start of the media instead.  Such times are dropped until the time of
+    // the first moof box has been set.
+    void addMediaTimeFragment(off64_t offset, uint64_t mediaTime);
+    void setFirstMediaTime(uint64_t mediaTime);
+
+    size_t countFragments() const;
+
+    // Finds the indexed fragment to seek to in order to reach "time".
+    status_t findFragment(
+            uint64_t time, MediaSource::ReadOptions::SeekMode mode,
+            off64_t *offset, uint64_t *fragmentTime) const;
+
+    // Reads and indexes up to "count" moof boxes starting at "offset" on a
+    // background looper, so that seeks past the fragments read so far don't
+    // have to walk them.  A new request cancels the previous one.
+    void prefetch(off64_t offset, size_t count);
+
+protected:
+    virtual ~FragmentIndex();
+
+private:
+    struct Fragment {
+        off64_t mOffset;
+        uint64_t mTime;
+    };
+
+    struct FragmentInfo {
+        off64_t mNextOffset;    // of the box after the mdat
+        int64_t mMediaTime;     // from the tfdt box of the track, or -1
+    };
+
+    static const size_t kMaxMoofSize;
+
+    sp<DataSource> mDataSource;
+    uint32_t mTrackId;
+    off64_t mFirstMoofOffset;
+    bool mCanPrefetch;
+
+    mutable Mutex mLock;
+    Vector<Fragment> mFragments;    // sorted by time
+    int64_t mFirstMediaTime;        // -1 if unknown
+    int32_t mPrefetchGeneration;
+
+    static void onPrefetch(const sp<RefBase> &target, const sp<AMessage> &msg);
+    void prefetchFragments(off64_t offset, size_t count, int32_t generation);
+    status_t scanFragment(off64_t offset, FragmentInfo *info);
+
+    FragmentIndex(const FragmentIndex &);
+    FragmentIndex &operator=(const FragmentIndex &);
+};
+
+}  // namespace android
+
+#endif  // FRAGMENT_INDEX_H_
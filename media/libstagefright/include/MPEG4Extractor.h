@@ -31,6 +31,7 @@ namespace android {
 
 struct AMessage;
 class DataSource;
+class FragmentIndex;
 class SampleTable;
 class String8;
 
@@ -69,6 +70,7 @@ private:
         sp<MetaData> meta;
         uint32_t timescale;
         sp<SampleTable> sampleTable;
+        sp<FragmentIndex> fragmentIndex;
         bool includes_expensive_metadata;
         bool skipTrack;
     };
@@ -76,6 +78,7 @@ private:
     Vector<SidxEntry> mSidxEntries;
     uint64_t mSidxDuration;
     off64_t mMoofOffset;
+    bool mHasFragmentRandomAccess;
 
     Vector<PsshInfo> mPssh;
 
@@ -121,6 +124,10 @@ private:
 
     status_t parseSegmentIndex(off64_t data_offset, size_t data_size);
 
+    void buildFragmentIndexes();
+    status_t parseMovieFragmentRandomAccess();
+    status_t parseTrackFragmentRandomAccess(off64_t data_offset, size_t data_size);
+
     Track *findTrackByMimePrefix(const char *mimePrefix);
 
     MPEG4Extractor(const MPEG4Extractor &);
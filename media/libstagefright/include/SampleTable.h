@@ -27,6 +27,7 @@
 
 namespace android {
 
+struct AMessage;
 class DataSource;
 struct SampleIterator;
 
@@ -53,6 +54,11 @@ public:
 
     status_t setSyncSampleParams(off64_t data_offset, size_t data_size);
 
+    // Once all tables have been set, loads them and builds the chunk offset index on a
+    // background looper.  Lookups load the tables themselves if they get there first, and
+    // read the chunk offsets from the DataSource until the index is ready.
+    void buildIndexAsync();
+
     ////////////////////////////////////////////////////////////////////////////
 
     uint32_t countChunkOffsets() const;
@@ -93,6 +99,9 @@ private:
     static const uint32_t kSampleSizeType32;
     static const uint32_t kSampleSizeTypeCompact;
 
+    // Tables larger than this are not indexed in memory, and are read on demand instead.
+    static const size_t kMaxIndexBytes;
+
     sp<DataSource> mDataSource;
     Mutex mLock;
 
@@ -108,6 +117,7 @@ private:
     uint32_t mDefaultSampleSize;
     uint32_t mNumSampleSizes;
 
+    off64_t mTimeToSampleOffset;
     uint32_t mTimeToSampleCount;
     uint32_t *mTimeToSample;
 
@@ -117,6 +127,7 @@ private:
     };
     SampleTimeEntry *mSampleTimeEntries;
 
+    off64_t mCompositionTimeDeltaOffset;
     uint32_t *mCompositionTimeDeltaEntries;
     size_t mNumCompositionTimeDeltaEntries;
     CompositionDeltaLookup *mCompositionDeltaLookup;
@@ -135,8 +146,33 @@ private:
     };
     SampleToChunkEntry *mSampleToChunkEntries;
 
+    // In-memory index of the chunk offset, sample size and sync sample tables, built when
+    // the tables are set or loaded so that SampleIterator doesn't read the DataSource for each sample.
+    // Each part is NULL if its table was too large or couldn't be read.
+    off64_t mChunkOffsetBase;       // the chunk offsets are relative to this
+    uint32_t *mChunkOffsets;
+    uint32_t *mSampleSizes;         // mSampleSizeBits per sample, packed from the lsb of each word
+    uint32_t mSampleSizeBits;
+    size_t mMaxSampleSize;
+    uint32_t *mSyncSampleBits;      // bit i of the bitmap is set if sample i is a sync sample
+    uint32_t mNumSyncSampleBits;
+
+    // The stts, ctts, stss and stsc entries are only read by loadTables(), on the first access
+    // to the samples or in the background after the moov box is parsed.  stsz is still read
+    // when it is set, for getMaxSampleSize().
+    bool mTablesLoaded;
+
     friend struct SampleIterator;
 
+    void buildChunkOffsetIndex();
+    void buildSampleSizeIndex();
+    void buildSyncSampleIndex();
+    status_t loadTables();
+    static void onBuildIndex(const sp<RefBase> &target, const sp<AMessage> &msg);
+    static status_t readWords(
+            const sp<DataSource> &source, off64_t offset, size_t count, uint32_t **words);
+    size_t getIndexedSampleSize(uint32_t sampleIndex) const;
+
     status_t getSampleSize_l(uint32_t sample_index, size_t *sample_size);
     uint32_t getCompositionTimeOffset(uint32_t sampleIndex);
 
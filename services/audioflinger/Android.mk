@@ -52,6 +52,8 @@ LOCAL_MODULE:= libaudioflinger
 LOCAL_32_BIT_ONLY := true
 
 LOCAL_SRC_FILES += FastMixer.cpp FastMixerState.cpp AudioWatchdog.cpp
+LOCAL_SRC_FILES += TrackStatistics.cpp
+LOCAL_SRC_FILES += FastCapture.cpp FastCaptureState.cpp
 
 LOCAL_CFLAGS += -DSTATE_QUEUE_INSTANTIATIONS='"StateQueueInstantiations.cpp"'
 
@@ -83,12 +85,44 @@ LOCAL_MODULE_TAGS := optional
 
 include $(BUILD_EXECUTABLE)
 
+#
+# build AudioMixer and resampler benchmark
+# This is device only: AudioMixer.cpp needs libcommon_time_client, libeffects and libnbaio,
+# which are not built for the host.
+#
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:=               \
+    bench-mixer.cpp             \
+    AudioMixer.cpp.arm          \
+
+LOCAL_C_INCLUDES := \
+    $(call include-path-for, audio-effects) \
+    $(call include-path-for, audio-utils)
+
+LOCAL_SHARED_LIBRARIES := \
+    libaudioresampler \
+    libaudioutils \
+    libcommon_time_client \
+    libcutils \
+    libutils \
+    liblog \
+    libnbaio \
+    libeffects
+
+LOCAL_MODULE:= bench-mixer
+
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_EXECUTABLE)
+
 include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES:= \
     AudioResampler.cpp.arm \
     AudioResamplerCubic.cpp.arm \
-    AudioResamplerSinc.cpp.arm
+    AudioResamplerSinc.cpp.arm \
+    AudioResamplerDyn.cpp.arm
 
 LOCAL_SHARED_LIBRARIES := \
     libcutils \
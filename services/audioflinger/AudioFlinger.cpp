@@ -259,7 +259,7 @@ void AudioFlinger::dumpClients(int fd, const Vector<String16>& args)
     for (size_t i = 0; i < mClients.size(); ++i) {
         sp<Client> client = mClients.valueAt(i).promote();
         if (client != 0) {
-            snprintf(buffer, SIZE, "  pid: %d\n", client->pid());
+            client->dump(buffer, SIZE);
             result.append(buffer);
         }
     }
@@ -1158,7 +1158,12 @@ AudioFlinger::Client::Client(const sp<AudioFlinger>& audioFlinger, pid_t pid)
         // FIXME should be a "k" constant not hard-coded, in .h or ro. property, see 4 lines below
         mMemoryDealer(new MemoryDealer(1024*1024, "AudioFlinger::Client")),
         mPid(pid),
-        mTimedTrackCount(0)
+        mTimedTrackCount(0),
+        mPooledBytes(0),
+        mPoolHits(0),
+        mPoolMisses(0),
+        mPoolTrims(0),
+        mPoolFailures(0)
 {
     // 1 MB of address space is good for 32 tracks, 8 buffers each, 4 KB/buffer
 }
@@ -1174,6 +1179,81 @@ sp<MemoryDealer> AudioFlinger::Client::heap() const
     return mMemoryDealer;
 }
 
+sp<IMemory> AudioFlinger::Client::allocateTrackMemory(size_t size)
+{
+    // whole pages, so that blocks of different tracks are interchangeable and don't leave
+    // small holes in the heap
+    const size_t pageSize = 4096;
+    size = (size + pageSize - 1) & ~(pageSize - 1);
+
+    Mutex::Autolock _l(mPoolLock);
+    reclaimTrackMemory_l();
+    // reuse the smallest free block that is at most 25% larger than needed
+    ssize_t best = -1;
+    for (size_t i = 0; i < mFreeMemory.size(); i++) {
+        size_t blockSize = mFreeMemory[i]->size();
+        if (blockSize >= size && blockSize <= size + size / 4 &&
+                (best < 0 || blockSize < mFreeMemory[best]->size())) {
+            best = i;
+        }
+    }
+    if (best >= 0) {
+        sp<IMemory> memory = mFreeMemory[best];
+        mFreeMemory.removeAt(best);
+        mPooledBytes -= memory->size();
+        mPoolHits++;
+        return memory;
+    }
+
+    mPoolMisses++;
+    sp<IMemory> memory = mMemoryDealer->allocate(size);
+    if (memory == 0 && mPooledBytes != 0) {
+        // pooled blocks may be what fragments the heap: give them back and try again
+        mPoolTrims++;
+        mReleasedMemory.clear();
+        mFreeMemory.clear();
+        mPooledBytes = 0;
+        memory = mMemoryDealer->allocate(size);
+    }
+    if (memory == 0) {
+        mPoolFailures++;
+    }
+    return memory;
+}
+
+void AudioFlinger::Client::releaseTrackMemory(const sp<IMemory>& memory)
+{
+    Mutex::Autolock _l(mPoolLock);
+    if (memory == 0 || mPooledBytes + memory->size() > kMaxPooledBytes) {
+        return;
+    }
+    mReleasedMemory.add(memory);
+    mPooledBytes += memory->size();
+}
+
+void AudioFlinger::Client::reclaimTrackMemory_l()
+{
+    // The client process holds a strong reference to a block through binder until its
+    // AudioTrack or AudioRecord lets go of it.  Until then the block can't be given to another
+    // track, as the old track's client side could still write to it.
+    for (size_t i = 0; i < mReleasedMemory.size(); ) {
+        if (mReleasedMemory[i]->getStrongCount() == 1) {
+            mFreeMemory.add(mReleasedMemory[i]);
+            mReleasedMemory.removeAt(i);
+        } else {
+            i++;
+        }
+    }
+}
+
+void AudioFlinger::Client::dump(char* buffer, size_t size)
+{
+    Mutex::Autolock _l(mPoolLock);
+    snprintf(buffer, size, "  pid: %d, track memory pool: %u hits, %u misses, %u trims, "
+            "%u failures, %u bytes in %u blocks\n", mPid, mPoolHits, mPoolMisses, mPoolTrims,
+            mPoolFailures, mPooledBytes, mReleasedMemory.size() + mFreeMemory.size());
+}
+
 // Reserve one of the limited slots for a timed audio track associated
 // with this client
 bool AudioFlinger::Client::reserveTimedTrack()
@@ -50,6 +50,8 @@
 #include <media/AudioBufferProvider.h>
 #include <media/ExtendedAudioBufferProvider.h>
 #include "FastMixer.h"
+#include "FastCapture.h"
+#include "TrackStatistics.h"
 #include <media/nbaio/NBAIO.h>
 #include "AudioWatchdog.h"
 
@@ -235,7 +237,7 @@ public:
     sp<NBLog::Writer>   newWriter_l(size_t size, const char *name);
     void                unregisterWriter(const sp<NBLog::Writer>& writer);
 private:
-    static const size_t kLogMemorySize = 10 * 1024;
+    static const size_t kLogMemorySize = 40 * 1024;
     sp<MemoryDealer>    mLogMemoryDealer;   // == 0 when NBLog is disabled
 public:
 
@@ -325,18 +327,39 @@ private:
         pid_t               pid() const { return mPid; }
         sp<AudioFlinger>    audioFlinger() const { return mAudioFlinger; }
 
+        // Allocates the control block and buffer of a track, preferably by recycling the
+        // memory of a destroyed track of similar size, otherwise from heap().
+        sp<IMemory>         allocateTrackMemory(size_t size);
+        // Offers the memory of a destroyed track for recycling
+        void                releaseTrackMemory(const sp<IMemory>& memory);
+        void                dump(char* buffer, size_t size);
+
         bool reserveTimedTrack();
         void releaseTimedTrack();
 
     private:
                             Client(const Client&);
                             Client& operator = (const Client&);
+
+        // moves released blocks which the client process no longer references to mFreeMemory
+        void                reclaimTrackMemory_l();
+
         const sp<AudioFlinger> mAudioFlinger;
         const sp<MemoryDealer> mMemoryDealer;
         const pid_t         mPid;
 
         Mutex               mTimedTrackLock;
         int                 mTimedTrackCount;
+
+        static const size_t kMaxPooledBytes = 256 * 1024;
+        Mutex               mPoolLock;
+        Vector< sp<IMemory> > mReleasedMemory;  // maybe still mapped by the client process
+        Vector< sp<IMemory> > mFreeMemory;      // ready for reuse by a new track
+        size_t              mPooledBytes;       // total size of both
+        uint32_t            mPoolHits;
+        uint32_t            mPoolMisses;
+        uint32_t            mPoolTrims;         // pool emptied to retry a failed allocation
+        uint32_t            mPoolFailures;      // allocations which failed even after a trim
     };
 
     // --- Notification Client ---
@@ -40,6 +40,7 @@
 #include <media/EffectsFactoryApi.h>
 
 #include "AudioMixer.h"
+#include "AudioMixerOps.h"
 
 namespace android {
 
@@ -88,6 +89,85 @@ void AudioMixer::DownmixerBufferProvider::releaseBuffer(AudioBufferProvider::Buf
     }
 }
 
+// ----------------------------------------------------------------------------
+AudioMixer::ReformatBufferProvider::ReformatBufferProvider(uint32_t channelCount)
+    : AudioBufferProvider(), mTrackBufferProvider(NULL), mChannelCount(channelCount),
+      mLocalBuffer(NULL), mLocalBufferFrameCount(0), mConsumed(0)
+{
+    mBuffer.raw = NULL;
+    mBuffer.frameCount = 0;
+}
+
+AudioMixer::ReformatBufferProvider::~ReformatBufferProvider()
+{
+    ALOGV("AudioMixer deleting ReformatBufferProvider (%p)", this);
+    reset();
+    free(mLocalBuffer);
+}
+
+status_t AudioMixer::ReformatBufferProvider::getNextBuffer(AudioBufferProvider::Buffer *pBuffer,
+        int64_t pts)
+{
+    if (mTrackBufferProvider == NULL) {
+        ALOGE("ReformatBufferProvider::getNextBuffer() error: NULL track buffer provider");
+        pBuffer->raw = NULL;
+        pBuffer->frameCount = 0;
+        return NO_INIT;
+    }
+    if (mBuffer.frameCount == 0) {
+        mBuffer.frameCount = pBuffer->frameCount;
+        status_t res = mTrackBufferProvider->getNextBuffer(&mBuffer, pts);
+        if (res != OK || mBuffer.frameCount == 0 || mBuffer.raw == NULL) {
+            mBuffer.raw = NULL;
+            mBuffer.frameCount = 0;
+            pBuffer->raw = NULL;
+            pBuffer->frameCount = 0;
+            return res;
+        }
+        if (mBuffer.frameCount > mLocalBufferFrameCount) {
+            free(mLocalBuffer);
+            mLocalBufferFrameCount = mBuffer.frameCount;
+            mLocalBuffer = (int16_t *) malloc(
+                    mLocalBufferFrameCount * mChannelCount * sizeof(int16_t));
+        }
+        clampFloatToPcm16(mLocalBuffer, (const float *) mBuffer.raw,
+                mBuffer.frameCount * mChannelCount);
+        mConsumed = 0;
+    }
+    size_t available = mBuffer.frameCount - mConsumed;
+    if (pBuffer->frameCount > available) {
+        pBuffer->frameCount = available;
+    }
+    pBuffer->i16 = mLocalBuffer + mConsumed * mChannelCount;
+    return OK;
+}
+
+void AudioMixer::ReformatBufferProvider::releaseBuffer(AudioBufferProvider::Buffer *pBuffer)
+{
+    mConsumed += pBuffer->frameCount;
+    ALOG_ASSERT(mConsumed <= mBuffer.frameCount, "released %u frames, obtained %u",
+            mConsumed, mBuffer.frameCount);
+    if (mConsumed >= mBuffer.frameCount && mBuffer.frameCount != 0) {
+        mTrackBufferProvider->releaseBuffer(&mBuffer);
+        mBuffer.raw = NULL;
+        mBuffer.frameCount = 0;
+        mConsumed = 0;
+    }
+    pBuffer->raw = NULL;
+    pBuffer->frameCount = 0;
+}
+
+void AudioMixer::ReformatBufferProvider::reset()
+{
+    if (mBuffer.frameCount != 0 && mTrackBufferProvider != NULL) {
+        // release only what was consumed, the track keeps the rest
+        mBuffer.frameCount = mConsumed;
+        mTrackBufferProvider->releaseBuffer(&mBuffer);
+    }
+    mBuffer.raw = NULL;
+    mBuffer.frameCount = 0;
+    mConsumed = 0;
+}
 
 // ----------------------------------------------------------------------------
 bool AudioMixer::isMultichannelCapable = false;
@@ -101,8 +181,8 @@ AudioMixer::AudioMixer(size_t frameCount, uint32_t sampleRate, uint32_t maxNumTr
     :   mTrackNames(0), mConfiguredNames((maxNumTracks >= 32 ? 0 : 1 << maxNumTracks) - 1),
         mSampleRate(sampleRate)
 {
-    // AudioMixer is not yet capable of multi-channel beyond stereo
-    COMPILE_TIME_ASSERT_FUNCTION_SCOPE(2 == MAX_NUM_CHANNELS);
+    // the integer mix path and the resampler output are stereo only
+    COMPILE_TIME_ASSERT_FUNCTION_SCOPE(2 == MAX_NUM_VOLUMES);
 
     ALOG_ASSERT(maxNumTracks <= MAX_NUM_TRACKS, "maxNumTracks %u > MAX_NUM_TRACKS %u",
             maxNumTracks, MAX_NUM_TRACKS);
@@ -110,8 +190,8 @@ AudioMixer::AudioMixer(size_t frameCount, uint32_t sampleRate, uint32_t maxNumTr
     // AudioMixer is not yet capable of more than 32 active track inputs
     ALOG_ASSERT(32 >= MAX_NUM_TRACKS, "bad MAX_NUM_TRACKS %d", MAX_NUM_TRACKS);
 
-    // AudioMixer is not yet capable of multi-channel output beyond stereo
-    ALOG_ASSERT(2 == MAX_NUM_CHANNELS, "bad MAX_NUM_CHANNELS %d", MAX_NUM_CHANNELS);
+    // AudioMixer is not yet capable of multi-channel output beyond 8 channels
+    ALOG_ASSERT(8 >= MAX_NUM_CHANNELS, "bad MAX_NUM_CHANNELS %d", MAX_NUM_CHANNELS);
 
     LocalClock lc;
 
@@ -133,6 +213,7 @@ AudioMixer::AudioMixer(size_t frameCount, uint32_t sampleRate, uint32_t maxNumTr
     for (unsigned i=0 ; i < MAX_NUM_TRACKS ; i++) {
         t->resampler = NULL;
         t->downmixerBufferProvider = NULL;
+        t->mReformatBufferProvider = NULL;
         t++;
     }
 
@@ -165,6 +246,7 @@ AudioMixer::~AudioMixer()
     for (unsigned i=0 ; i < MAX_NUM_TRACKS ; i++) {
         delete t->resampler;
         delete t->downmixerBufferProvider;
+        delete t->mReformatBufferProvider;
         t++;
     }
     delete [] mState.outputTemp;
@@ -205,10 +287,15 @@ int AudioMixer::getTrackName(audio_channel_mask_t channelMask, int sessionId)
         t->sessionId = sessionId;
         // setBufferProvider(name, AudioBufferProvider *) is required before enable(name)
         t->bufferProvider = NULL;
+        t->mInputBufferProvider = NULL;
         t->buffer.raw = NULL;
         // no initialization needed
         // t->buffer.frameCount
         t->hook = NULL;
+        t->hookFloat = NULL;
+        t->mStatistics = NULL;
+        t->mHookNs = 0;
+        t->mResamplerNs = 0;
         t->in = NULL;
         t->resampler = NULL;
         t->sampleRate = mSampleRate;
@@ -216,9 +303,25 @@ int AudioMixer::getTrackName(audio_channel_mask_t channelMask, int sessionId)
         t->mainBuffer = NULL;
         t->auxBuffer = NULL;
         t->downmixerBufferProvider = NULL;
+        t->mReformatBufferProvider = NULL;
+        for (uint32_t i = 0; i < MAX_NUM_CHANNELS; i++) {
+            t->mVolume[i] = 1.0f;
+            t->mPrevVolume[i] = 1.0f;
+            t->mVolumeInc[i] = 0;
+        }
+        t->mAuxLevel = 0;
+        t->mAuxInc = 0;
+        // no initialization needed
+        // t->mPrevAuxLevel
+        t->mFormat = AUDIO_FORMAT_PCM_16_BIT;
+        t->mMixerInFormat = AUDIO_FORMAT_PCM_16_BIT;
+        t->mMixerFormat = AUDIO_FORMAT_PCM_16_BIT;
+        t->mMixerChannelMask = AUDIO_CHANNEL_OUT_STEREO;
+        t->mMixerChannelCount = 2;
 
         status_t status = initTrackDownmix(&mState.tracks[n], n, channelMask);
         if (status == OK) {
+            updateChannelMap(&mState.tracks[n]);
             return TRACK0 + n;
         }
         ALOGE("AudioMixer::getTrackName(0x%x) failed, error preparing track for downmix",
@@ -240,27 +343,127 @@ status_t AudioMixer::initTrackDownmix(track_t* pTrack, int trackNum, audio_chann
     uint32_t channelCount = popcount(mask);
     ALOG_ASSERT((channelCount <= MAX_NUM_CHANNELS_TO_DOWNMIX) && channelCount);
     status_t status = OK;
-    if (channelCount > MAX_NUM_CHANNELS) {
+    // A track is mixed without downmix when the output has all of its channels.
+    // The resampler handles at most 2 channels, so a wider track is downmixed when resampled.
+    if (channelCount > MAX_NUM_VOLUMES &&
+            (pTrack->doesResample() || (mask & ~pTrack->mMixerChannelMask) != 0)) {
         pTrack->channelMask = mask;
         pTrack->channelCount = channelCount;
-        ALOGV("initTrackDownmix(track=%d, mask=0x%x) calls prepareTrackForDownmix()",
-                trackNum, mask);
-        status = prepareTrackForDownmix(pTrack, trackNum);
+        if (pTrack->downmixerBufferProvider == NULL ||
+                pTrack->downmixerBufferProvider->mDownmixConfig.inputCfg.channels != mask) {
+            ALOGV("initTrackDownmix(track=%d, mask=0x%x) calls prepareTrackForDownmix()",
+                    trackNum, mask);
+            status = prepareTrackForDownmix(pTrack, trackNum);
+        }
     } else {
         unprepareTrackForDownmix(pTrack, trackNum);
     }
     return status;
 }
 
+// output channels that follow the left and right volumes respectively,
+// the other output channels follow their average
+static const uint32_t kLeftChannels = AUDIO_CHANNEL_OUT_FRONT_LEFT |
+        AUDIO_CHANNEL_OUT_BACK_LEFT | AUDIO_CHANNEL_OUT_FRONT_LEFT_OF_CENTER |
+        AUDIO_CHANNEL_OUT_SIDE_LEFT | AUDIO_CHANNEL_OUT_TOP_FRONT_LEFT |
+        AUDIO_CHANNEL_OUT_TOP_BACK_LEFT;
+static const uint32_t kRightChannels = AUDIO_CHANNEL_OUT_FRONT_RIGHT |
+        AUDIO_CHANNEL_OUT_BACK_RIGHT | AUDIO_CHANNEL_OUT_FRONT_RIGHT_OF_CENTER |
+        AUDIO_CHANNEL_OUT_SIDE_RIGHT | AUDIO_CHANNEL_OUT_TOP_FRONT_RIGHT |
+        AUDIO_CHANNEL_OUT_TOP_BACK_RIGHT;
+
+// returns the index of the channel 'bit' within 'mask', or -1 if mask doesn't have it
+static inline int channelIndex(uint32_t mask, uint32_t bit)
+{
+    return (mask & bit) ? popcount(mask & (bit - 1)) : -1;
+}
+
+void AudioMixer::updateChannelMap(track_t* pTrack)
+{
+    // the resampler and the downmixer both deliver stereo, the resampler up-channels mono
+    const uint32_t inMask = (pTrack->doesResample() || pTrack->downmixerBufferProvider != NULL) ?
+            AUDIO_CHANNEL_OUT_STEREO : pTrack->channelMask;
+    const uint32_t outMask = pTrack->mMixerChannelMask;
+    pTrack->mMixerInChannelCount = popcount(inMask);
+
+    if (inMask == AUDIO_CHANNEL_OUT_MONO || inMask == AUDIO_CHANNEL_OUT_STEREO) {
+        // mono is played on the front left and right channels, as on a stereo output;
+        // fall back to the first two output channels if the output has no front pair
+        int left = channelIndex(outMask, AUDIO_CHANNEL_OUT_FRONT_LEFT);
+        int right = channelIndex(outMask, AUDIO_CHANNEL_OUT_FRONT_RIGHT);
+        pTrack->mChannelMap[0] = left >= 0 ? left : 0;
+        pTrack->mChannelMap[1] = right >= 0 ? right : 1;
+        return;
+    }
+    uint32_t mask = inMask;
+    for (uint32_t i = 0; i < pTrack->mMixerInChannelCount; i++) {
+        const uint32_t bit = mask & -mask;
+        mask &= ~bit;
+        pTrack->mChannelMap[i] = channelIndex(outMask, bit);
+    }
+}
+
+void AudioMixer::setFloatVolume(track_t& track, uint32_t channel, float volume, bool ramp)
+{
+    if (track.mVolume[channel] == volume && (ramp || track.mVolumeInc[channel] == 0)) {
+        return;
+    }
+    track.mPrevVolume[channel] = track.mVolume[channel];
+    track.mVolume[channel] = volume;
+    if (ramp) {
+        track.mVolumeInc[channel] = (volume - track.mPrevVolume[channel]) /
+                float(mState.frameCount);
+        if (track.mVolumeInc[channel] == 0) {
+            track.mPrevVolume[channel] = volume;
+        }
+    } else {
+        track.mPrevVolume[channel] = volume;
+        track.mVolumeInc[channel] = 0;
+    }
+}
+
+void AudioMixer::setFloatVolumesFromStereo(track_t& track, bool ramp)
+{
+    const float left = track.volume[0] / float(UNITY_GAIN);
+    const float right = track.volume[1] / float(UNITY_GAIN);
+    uint32_t mask = track.mMixerChannelMask;
+    for (uint32_t i = 0; i < track.mMixerChannelCount; i++) {
+        const uint32_t bit = mask & -mask;
+        mask &= ~bit;
+        float volume;
+        if (bit & kLeftChannels) {
+            volume = left;
+        } else if (bit & kRightChannels) {
+            volume = right;
+        } else {
+            volume = (left + right) * 0.5f;
+        }
+        setFloatVolume(track, i, volume, ramp);
+    }
+}
+
+bool AudioMixer::track_t::isMuted() const
+{
+    if (isStereoMix()) {
+        return volumeRL == 0;
+    }
+    for (uint32_t i = 0; i < mMixerChannelCount; i++) {
+        if (mVolume[i] != 0 || mVolumeInc[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
 void AudioMixer::unprepareTrackForDownmix(track_t* pTrack, int trackName) {
     ALOGV("AudioMixer::unprepareTrackForDownmix(%d)", trackName);
 
     if (pTrack->downmixerBufferProvider != NULL) {
         // this track had previously been configured with a downmixer, delete it
         ALOGV(" deleting old downmixer");
-        pTrack->bufferProvider = pTrack->downmixerBufferProvider->mTrackBufferProvider;
         delete pTrack->downmixerBufferProvider;
         pTrack->downmixerBufferProvider = NULL;
+        reconfigureBufferProviders(pTrack);
     } else {
         ALOGV(" nothing to do, no downmixer to delete");
     }
@@ -354,21 +557,61 @@ status_t AudioMixer::prepareTrackForDownmix(track_t* pTrack, int trackName)
     }// end of scope for local variables that are not used in goto label "noDownmixForActiveTrack"
 
     // initialization successful:
-    // - keep track of the real buffer provider in case it was set before
-    pDbp->mTrackBufferProvider = pTrack->bufferProvider;
     // - we'll use the downmix effect integrated inside this
     //    track's buffer provider, and we'll use it as the track's buffer provider
     pTrack->downmixerBufferProvider = pDbp;
-    pTrack->bufferProvider = pDbp;
+    reconfigureBufferProviders(pTrack);
 
     return NO_ERROR;
 
 noDownmixForActiveTrack:
     delete pDbp;
     pTrack->downmixerBufferProvider = NULL;
+    reconfigureBufferProviders(pTrack);
     return NO_INIT;
 }
 
+void AudioMixer::prepareTrackForReformat(track_t* pTrack, int trackName)
+{
+    // the resampler and the downmixer only accept 16 bit input
+    const bool needsReformat = pTrack->mFormat == AUDIO_FORMAT_PCM_FLOAT &&
+            (pTrack->doesResample() || pTrack->downmixerBufferProvider != NULL);
+    if (!needsReformat) {
+        unprepareTrackForReformat(pTrack, trackName);
+        return;
+    }
+    if (pTrack->mReformatBufferProvider == NULL) {
+        ALOGV("AudioMixer::prepareTrackForReformat(%d)", trackName);
+        pTrack->mReformatBufferProvider = new ReformatBufferProvider(pTrack->channelCount);
+    }
+    pTrack->mMixerInFormat = AUDIO_FORMAT_PCM_16_BIT;
+    reconfigureBufferProviders(pTrack);
+}
+
+void AudioMixer::unprepareTrackForReformat(track_t* pTrack, int trackName)
+{
+    if (pTrack->mReformatBufferProvider != NULL) {
+        ALOGV("AudioMixer::unprepareTrackForReformat(%d)", trackName);
+        delete pTrack->mReformatBufferProvider;
+        pTrack->mReformatBufferProvider = NULL;
+        reconfigureBufferProviders(pTrack);
+    }
+    pTrack->mMixerInFormat = pTrack->mFormat;
+}
+
+void AudioMixer::reconfigureBufferProviders(track_t* pTrack)
+{
+    pTrack->bufferProvider = pTrack->mInputBufferProvider;
+    if (pTrack->mReformatBufferProvider != NULL) {
+        pTrack->mReformatBufferProvider->mTrackBufferProvider = pTrack->bufferProvider;
+        pTrack->bufferProvider = pTrack->mReformatBufferProvider;
+    }
+    if (pTrack->downmixerBufferProvider != NULL) {
+        pTrack->downmixerBufferProvider->mTrackBufferProvider = pTrack->bufferProvider;
+        pTrack->bufferProvider = pTrack->downmixerBufferProvider;
+    }
+}
+
 void AudioMixer::deleteTrackName(int name)
 {
     ALOGV("AudioMixer::deleteTrackName(%d)", name);
@@ -385,6 +628,8 @@ void AudioMixer::deleteTrackName(int name)
     track.resampler = NULL;
     // delete the downmixer
     unprepareTrackForDownmix(&mState.tracks[name], name);
+    // delete the reformatter
+    unprepareTrackForReformat(&mState.tracks[name], name);
 
     mTrackNames &= ~(1<<name);
 }
@@ -438,6 +683,10 @@ void AudioMixer::setParameter(int name, int target, int param, void *value)
                 track.channelCount = channelCount;
                 // the mask has changed, does this track need a downmixer?
                 initTrackDownmix(&mState.tracks[name], name, mask);
+                // the reformatter depends on the channel count and the downmixer
+                unprepareTrackForReformat(&mState.tracks[name], name);
+                prepareTrackForReformat(&mState.tracks[name], name);
+                updateChannelMap(&mState.tracks[name]);
                 ALOGV("setParameter(TRACK, CHANNEL_MASK, %x)", mask);
                 invalidateState(1 << name);
             }
@@ -456,9 +705,51 @@ void AudioMixer::setParameter(int name, int target, int param, void *value)
                 invalidateState(1 << name);
             }
             break;
-        case FORMAT:
-            ALOG_ASSERT(valueInt == AUDIO_FORMAT_PCM_16_BIT);
+        case FORMAT: {
+            audio_format_t format = static_cast<audio_format_t>(valueInt);
+            ALOG_ASSERT(format == AUDIO_FORMAT_PCM_16_BIT || format == AUDIO_FORMAT_PCM_FLOAT,
+                    "bad format %#x", format);
+            if (track.mFormat != format) {
+                track.mFormat = format;
+                ALOGV("setParameter(TRACK, FORMAT, %#x)", format);
+                unprepareTrackForReformat(&mState.tracks[name], name);
+                prepareTrackForReformat(&mState.tracks[name], name);
+                invalidateState(1 << name);
+            }
+            } break;
+        case MIXER_FORMAT: {
+            audio_format_t format = static_cast<audio_format_t>(valueInt);
+            ALOG_ASSERT(format == AUDIO_FORMAT_PCM_16_BIT || format == AUDIO_FORMAT_PCM_FLOAT,
+                    "bad mixer format %#x", format);
+            if (track.mMixerFormat != format) {
+                track.mMixerFormat = format;
+                ALOGV("setParameter(TRACK, MIXER_FORMAT, %#x)", format);
+                invalidateState(1 << name);
+            }
+            } break;
+        case STATISTICS:
+            track.mStatistics = reinterpret_cast<TrackStatistics*>(value);
+            track.mHookNs = 0;
+            track.mResamplerNs = 0;
             break;
+        case MIXER_CHANNEL_MASK: {
+            audio_channel_mask_t mask =
+                static_cast<audio_channel_mask_t>(reinterpret_cast<uintptr_t>(value));
+            if (track.mMixerChannelMask != mask) {
+                uint32_t channelCount = popcount(mask);
+                ALOG_ASSERT(channelCount >= 2 && channelCount <= MAX_NUM_CHANNELS,
+                        "bad mixer channel mask %#x", mask);
+                track.mMixerChannelMask = mask;
+                track.mMixerChannelCount = channelCount;
+                // the output may now have all the track channels, or lack some of them
+                initTrackDownmix(&mState.tracks[name], name, track.channelMask);
+                prepareTrackForReformat(&mState.tracks[name], name);
+                updateChannelMap(&mState.tracks[name]);
+                setFloatVolumesFromStereo(track, false /*ramp*/);
+                ALOGV("setParameter(TRACK, MIXER_CHANNEL_MASK, %#x)", mask);
+                invalidateState(1 << name);
+            }
+            } break;
         // FIXME do we want to support setting the downmix type from AudioFlinger?
         //         for a specific track? or per mixer?
         /* case DOWNMIX_TYPE:
@@ -475,17 +766,27 @@ void AudioMixer::setParameter(int name, int target, int param, void *value)
             if (track.setResampler(uint32_t(valueInt), mSampleRate)) {
                 ALOGV("setParameter(RESAMPLE, SAMPLE_RATE, %u)",
                         uint32_t(valueInt));
+                // a resampled track of more than 2 channels must be downmixed
+                initTrackDownmix(&mState.tracks[name], name, track.channelMask);
+                prepareTrackForReformat(&mState.tracks[name], name);
+                updateChannelMap(&mState.tracks[name]);
                 invalidateState(1 << name);
             }
             break;
         case RESET:
             track.resetResampler();
+            if (track.mReformatBufferProvider != NULL) {
+                track.mReformatBufferProvider->reset();
+            }
             invalidateState(1 << name);
             break;
         case REMOVE:
             delete track.resampler;
             track.resampler = NULL;
             track.sampleRate = mSampleRate;
+            initTrackDownmix(&mState.tracks[name], name, track.channelMask);
+            prepareTrackForReformat(&mState.tracks[name], name);
+            updateChannelMap(&mState.tracks[name]);
             invalidateState(1 << name);
             break;
         default:
@@ -513,24 +814,48 @@ void AudioMixer::setParameter(int name, int target, int param, void *value)
                         track.prevVolume[param-VOLUME0] = valueInt << 16;
                     }
                 }
+                setFloatVolumesFromStereo(track, target == RAMP_VOLUME);
                 invalidateState(1 << name);
             }
             break;
+        case VOLUME0 + 2:
+        case VOLUME0 + 3:
+        case VOLUME0 + 4:
+        case VOLUME0 + 5:
+        case VOLUME0 + 6:
+        case VOLUME7: {
+            // per output channel volume, float mix path only
+            const uint32_t channel = param - VOLUME0;
+            const float volume = valueInt / float(UNITY_GAIN);
+            if (channel < track.mMixerChannelCount && track.mVolume[channel] != volume) {
+                ALOGV("setParameter(VOLUME, VOLUME%u: %04x)", channel, valueInt);
+                setFloatVolume(track, channel, volume, target == RAMP_VOLUME);
+                invalidateState(1 << name);
+            }
+            } break;
         case AUXLEVEL:
             //ALOG_ASSERT(0 <= valueInt && valueInt <= MAX_GAIN_INT, "bad aux level %d", valueInt);
             if (track.auxLevel != valueInt) {
                 ALOGV("setParameter(VOLUME, AUXLEVEL: %04x)", valueInt);
+                const float auxLevelF = valueInt / float(UNITY_GAIN);
                 track.prevAuxLevel = track.auxLevel << 16;
+                track.mPrevAuxLevel = track.mAuxLevel;
                 track.auxLevel = valueInt;
+                track.mAuxLevel = auxLevelF;
                 if (target == VOLUME) {
                     track.prevAuxLevel = valueInt << 16;
                     track.auxInc = 0;
+                    track.mPrevAuxLevel = auxLevelF;
+                    track.mAuxInc = 0;
                 } else {
                     int32_t d = (valueInt<<16) - track.prevAuxLevel;
                     int32_t volInc = d / int32_t(mState.frameCount);
                     track.auxInc = volInc;
+                    track.mAuxInc = (auxLevelF - track.mPrevAuxLevel) / float(mState.frameCount);
                     if (volInc == 0) {
                         track.prevAuxLevel = valueInt << 16;
+                        track.mPrevAuxLevel = auxLevelF;
+                        track.mAuxInc = 0;
                     }
                 }
                 invalidateState(1 << name);
@@ -566,8 +891,9 @@ bool AudioMixer::track_t::setResampler(uint32_t value, uint32_t devSampleRate)
                 }
                 resampler = AudioResampler::create(
                         format,
-                        // the resampler sees the number of channels after the downmixer, if any
-                        downmixerBufferProvider != NULL ? MAX_NUM_CHANNELS : channelCount,
+                        // the resampler sees the number of channels after the downmixer, if any;
+                        // tracks of more than 2 channels are always downmixed when resampled
+                        channelCount > MAX_NUM_VOLUMES ? MAX_NUM_VOLUMES : channelCount,
                         devSampleRate, quality);
                 resampler->setLocalTimeFreq(sLocalTimeFreq);
             }
@@ -577,14 +903,18 @@ bool AudioMixer::track_t::setResampler(uint32_t value, uint32_t devSampleRate)
     return false;
 }
 
+// The integer and float ramps are advanced by different mix paths; when either of them
+// completes, the other one is completed as well so that both stay in sync.
 inline
 void AudioMixer::track_t::adjustVolumeRamp(bool aux)
 {
-    for (uint32_t i=0 ; i<MAX_NUM_CHANNELS ; i++) {
+    for (uint32_t i=0 ; i<MAX_NUM_VOLUMES ; i++) {
         if (((volumeInc[i]>0) && (((prevVolume[i]+volumeInc[i])>>16) >= volume[i])) ||
             ((volumeInc[i]<0) && (((prevVolume[i]+volumeInc[i])>>16) <= volume[i]))) {
             volumeInc[i] = 0;
             prevVolume[i] = volume[i]<<16;
+            mVolumeInc[i] = 0;
+            mPrevVolume[i] = mVolume[i];
         }
     }
     if (aux) {
@@ -592,6 +922,33 @@ void AudioMixer::track_t::adjustVolumeRamp(bool aux)
             ((auxInc<0) && (((prevAuxLevel+auxInc)>>16) <= auxLevel))) {
             auxInc = 0;
             prevAuxLevel = auxLevel<<16;
+            mAuxInc = 0;
+            mPrevAuxLevel = mAuxLevel;
+        }
+    }
+}
+
+inline
+void AudioMixer::track_t::adjustVolumeRampFloat(bool aux)
+{
+    for (uint32_t i=0 ; i<mMixerChannelCount ; i++) {
+        if (((mVolumeInc[i]>0) && (mPrevVolume[i]+mVolumeInc[i] >= mVolume[i])) ||
+            ((mVolumeInc[i]<0) && (mPrevVolume[i]+mVolumeInc[i] <= mVolume[i]))) {
+            mVolumeInc[i] = 0;
+            mPrevVolume[i] = mVolume[i];
+            if (i < MAX_NUM_VOLUMES) {
+                volumeInc[i] = 0;
+                prevVolume[i] = volume[i]<<16;
+            }
+        }
+    }
+    if (aux) {
+        if (((mAuxInc>0) && (mPrevAuxLevel+mAuxInc >= mAuxLevel)) ||
+            ((mAuxInc<0) && (mPrevAuxLevel+mAuxInc <= mAuxLevel))) {
+            mAuxInc = 0;
+            mPrevAuxLevel = mAuxLevel;
+            auxInc = 0;
+            prevAuxLevel = auxLevel<<16;
         }
     }
 }
@@ -609,21 +966,20 @@ void AudioMixer::setBufferProvider(int name, AudioBufferProvider* bufferProvider
 {
     name -= TRACK0;
     ALOG_ASSERT(uint32_t(name) < MAX_NUM_TRACKS, "bad track name %d", name);
+    track_t& track = mState.tracks[name];
 
-    if (mState.tracks[name].downmixerBufferProvider != NULL) {
-        // update required?
-        if (mState.tracks[name].downmixerBufferProvider->mTrackBufferProvider != bufferProvider) {
-            ALOGV("AudioMixer::setBufferProvider(%p) for downmix", bufferProvider);
-            // setting the buffer provider for a track that gets downmixed consists in:
-            //  1/ setting the buffer provider to the "downmix / buffer provider" wrapper
-            //     so it's the one that gets called when the buffer provider is needed,
-            mState.tracks[name].bufferProvider = mState.tracks[name].downmixerBufferProvider;
-            //  2/ saving the buffer provider for the track so the wrapper can use it
-            //     when it downmixes.
-            mState.tracks[name].downmixerBufferProvider->mTrackBufferProvider = bufferProvider;
+    // update required?
+    if (track.mInputBufferProvider != bufferProvider) {
+        ALOGV("AudioMixer::setBufferProvider(%p)", bufferProvider);
+        // data obtained from the previous provider must not be handed out any more
+        if (track.mReformatBufferProvider != NULL) {
+            track.mReformatBufferProvider->reset();
         }
-    } else {
-        mState.tracks[name].bufferProvider = bufferProvider;
+        // setting the buffer provider for a track that gets reformatted and/or downmixed
+        // consists in saving the buffer provider for the track so the wrappers can use it,
+        // and using the outermost wrapper as the buffer provider seen by the hooks.
+        track.mInputBufferProvider = bufferProvider;
+        reconfigureBufferProviders(&track);
     }
 }
 
@@ -631,6 +987,24 @@ void AudioMixer::setBufferProvider(int name, AudioBufferProvider* bufferProvider
 void AudioMixer::process(int64_t pts)
 {
     mState.hook(&mState, pts);
+#ifdef TRACK_MIX_STATISTICS
+    // publish once per cycle the times accumulated by the hooks, which may be called
+    // several times per cycle for each track
+    uint32_t en = mState.enabledTracks;
+    while (en) {
+        const int i = 31 - __builtin_clz(en);
+        en &= ~(1 << i);
+        track_t& t = mState.tracks[i];
+        if (t.mStatistics != NULL) {
+            t.mStatistics->mMix.add(t.mHookNs);
+            if (t.resampler != NULL) {
+                t.mStatistics->mResampler.add(t.mResamplerNs);
+            }
+            t.mHookNs = 0;
+            t.mResamplerNs = 0;
+        }
+    }
+#endif
 }
 
 
@@ -655,12 +1029,27 @@ void AudioMixer::process__validate(state_t* state, int64_t pts)
     state->enabledTracks &= ~disabled;
     state->enabledTracks |=  enabled;
 
+    // the float mix path is used for all tracks as soon as one enabled track
+    // either provides float data, mixes into a float buffer or into more than 2 channels
+    bool useFloat = false;
+    uint32_t en = state->enabledTracks;
+    while (en) {
+        const int i = 31 - __builtin_clz(en);
+        en &= ~(1<<i);
+        const track_t& t = state->tracks[i];
+        if (t.mMixerInFormat == AUDIO_FORMAT_PCM_FLOAT ||
+                t.mMixerFormat == AUDIO_FORMAT_PCM_FLOAT || !t.isStereoMix()) {
+            useFloat = true;
+            break;
+        }
+    }
+
     // compute everything we need...
     int countActiveTracks = 0;
-    bool all16BitsStereoNoResample = true;
+    bool all16BitsStereoNoResample = !useFloat;
     bool resampling = false;
     bool volumeRamp = false;
-    uint32_t en = state->enabledTracks;
+    en = state->enabledTracks;
     while (en) {
         const int i = 31 - __builtin_clz(en);
         en &= ~(1<<i);
@@ -669,7 +1058,7 @@ void AudioMixer::process__validate(state_t* state, int64_t pts)
         track_t& t = state->tracks[i];
         uint32_t n = 0;
         n |= NEEDS_CHANNEL_1 + t.channelCount - 1;
-        n |= NEEDS_FORMAT_16;
+        n |= t.mMixerInFormat == AUDIO_FORMAT_PCM_FLOAT ? NEEDS_FORMAT_FLOAT : NEEDS_FORMAT_16;
         n |= t.doesResample() ? NEEDS_RESAMPLE_ENABLED : NEEDS_RESAMPLE_DISABLED;
         if (t.auxLevel != 0 && t.auxBuffer != NULL) {
             n |= NEEDS_AUX_ENABLED;
@@ -677,13 +1066,14 @@ void AudioMixer::process__validate(state_t* state, int64_t pts)
 
         if (t.volumeInc[0]|t.volumeInc[1]) {
             volumeRamp = true;
-        } else if (!t.doesResample() && t.volumeRL == 0) {
+        } else if (!t.doesResample() && t.isMuted()) {
             n |= NEEDS_MUTE_ENABLED;
         }
         t.needs = n;
 
         if ((n & NEEDS_MUTE__MASK) == NEEDS_MUTE_ENABLED) {
             t.hook = track__nop;
+            t.hookFloat = trackFloat__nop;
         } else {
             if ((n & NEEDS_AUX__MASK) == NEEDS_AUX_ENABLED) {
                 all16BitsStereoNoResample = false;
@@ -692,17 +1082,38 @@ void AudioMixer::process__validate(state_t* state, int64_t pts)
                 all16BitsStereoNoResample = false;
                 resampling = true;
                 t.hook = track__genericResample;
+                t.hookFloat = trackFloat__genericResample;
                 ALOGV_IF((n & NEEDS_CHANNEL_COUNT__MASK) > NEEDS_CHANNEL_2,
                         "Track %d needs downmix + resample", i);
             } else {
+                const bool floatIn = (n & NEEDS_FORMAT__MASK) == NEEDS_FORMAT_FLOAT;
                 if ((n & NEEDS_CHANNEL_COUNT__MASK) == NEEDS_CHANNEL_1){
                     t.hook = track__16BitsMono;
+                    t.hookFloat = floatIn ? trackFloat__Mono<float> : trackFloat__Mono<int16_t>;
                     all16BitsStereoNoResample = false;
                 }
                 if ((n & NEEDS_CHANNEL_COUNT__MASK) >= NEEDS_CHANNEL_2){
                     t.hook = track__16BitsStereo;
-                    ALOGV_IF((n & NEEDS_CHANNEL_COUNT__MASK) > NEEDS_CHANNEL_2,
-                            "Track %d needs downmix", i);
+                    t.hookFloat = floatIn ?
+                            trackFloat__Stereo<float> : trackFloat__Stereo<int16_t>;
+                    ALOGV_IF(t.downmixerBufferProvider != NULL, "Track %d needs downmix", i);
+                }
+                if (!t.isStereoMix()) {
+                    // output of more than 2 channels: pick the hook for the channel mapping
+                    if (t.mMixerInChannelCount == 1) {
+                        t.hookFloat = floatIn ? trackFloat__Multi<MIXTYPE_MONO, float> :
+                                trackFloat__Multi<MIXTYPE_MONO, int16_t>;
+                    } else if (t.downmixerBufferProvider != NULL ||
+                            t.channelMask == AUDIO_CHANNEL_OUT_STEREO) {
+                        t.hookFloat = floatIn ? trackFloat__Multi<MIXTYPE_STEREO, float> :
+                                trackFloat__Multi<MIXTYPE_STEREO, int16_t>;
+                    } else if (t.channelMask == t.mMixerChannelMask) {
+                        t.hookFloat = floatIn ? trackFloat__Multi<MIXTYPE_SAME, float> :
+                                trackFloat__Multi<MIXTYPE_SAME, int16_t>;
+                    } else {
+                        t.hookFloat = floatIn ? trackFloat__Multi<MIXTYPE_REMAP, float> :
+                                trackFloat__Multi<MIXTYPE_REMAP, int16_t>;
+                    }
                 }
             }
         }
@@ -716,9 +1127,10 @@ void AudioMixer::process__validate(state_t* state, int64_t pts)
                 state->outputTemp = new int32_t[MAX_NUM_CHANNELS * state->frameCount];
             }
             if (!state->resampleTemp) {
-                state->resampleTemp = new int32_t[MAX_NUM_CHANNELS * state->frameCount];
+                state->resampleTemp = new int32_t[MAX_NUM_VOLUMES * state->frameCount];
             }
-            state->hook = process__genericResampling;
+            state->hook = useFloat ? process__genericResamplingFloat :
+                    process__genericResampling;
         } else {
             if (state->outputTemp) {
                 delete [] state->outputTemp;
@@ -728,7 +1140,8 @@ void AudioMixer::process__validate(state_t* state, int64_t pts)
                 delete [] state->resampleTemp;
                 state->resampleTemp = NULL;
             }
-            state->hook = process__genericNoResampling;
+            state->hook = useFloat ? process__genericNoResamplingFloat :
+                    process__genericNoResampling;
             if (all16BitsStereoNoResample && !volumeRamp) {
                 if (countActiveTracks == 1) {
                     state->hook = process__OneTrack16BitsStereoNoResampling;
@@ -738,9 +1151,9 @@ void AudioMixer::process__validate(state_t* state, int64_t pts)
     }
 
     ALOGV("mixer configuration change: %d activeTracks (%08x) "
-        "all16BitsStereoNoResample=%d, resampling=%d, volumeRamp=%d",
+        "all16BitsStereoNoResample=%d, resampling=%d, volumeRamp=%d, useFloat=%d",
         countActiveTracks, state->enabledTracks,
-        all16BitsStereoNoResample, resampling, volumeRamp);
+        all16BitsStereoNoResample, resampling, volumeRamp, useFloat);
 
    state->hook(state, pts);
 
@@ -753,10 +1166,11 @@ void AudioMixer::process__validate(state_t* state, int64_t pts)
             const int i = 31 - __builtin_clz(en);
             en &= ~(1<<i);
             track_t& t = state->tracks[i];
-            if (!t.doesResample() && t.volumeRL == 0)
+            if (!t.doesResample() && t.isMuted())
             {
                 t.needs |= NEEDS_MUTE_ENABLED;
                 t.hook = track__nop;
+                t.hookFloat = trackFloat__nop;
             } else {
                 allMuted = false;
             }
@@ -783,8 +1197,11 @@ void AudioMixer::track__genericResample(track_t* t, int32_t* out, size_t outFram
         // to apply send level after resampling
         // TODO: modify each resampler to support aux channel?
         t->resampler->setVolume(UNITY_GAIN, UNITY_GAIN);
-        memset(temp, 0, outFrameCount * MAX_NUM_CHANNELS * sizeof(int32_t));
-        t->resampler->resample(temp, outFrameCount, t->bufferProvider);
+        memset(temp, 0, outFrameCount * MAX_NUM_VOLUMES * sizeof(int32_t));
+        {
+            ScopedStatisticsTimer timer(t->mStatistics, t->mResamplerNs);
+            t->resampler->resample(temp, outFrameCount, t->bufferProvider);
+        }
         if (CC_UNLIKELY(t->volumeInc[0]|t->volumeInc[1]|t->auxInc)) {
             volumeRampStereo(t, out, outFrameCount, temp, aux);
         } else {
@@ -793,14 +1210,18 @@ void AudioMixer::track__genericResample(track_t* t, int32_t* out, size_t outFram
     } else {
         if (CC_UNLIKELY(t->volumeInc[0]|t->volumeInc[1])) {
             t->resampler->setVolume(UNITY_GAIN, UNITY_GAIN);
-            memset(temp, 0, outFrameCount * MAX_NUM_CHANNELS * sizeof(int32_t));
-            t->resampler->resample(temp, outFrameCount, t->bufferProvider);
+            memset(temp, 0, outFrameCount * MAX_NUM_VOLUMES * sizeof(int32_t));
+            {
+                ScopedStatisticsTimer timer(t->mStatistics, t->mResamplerNs);
+                t->resampler->resample(temp, outFrameCount, t->bufferProvider);
+            }
             volumeRampStereo(t, out, outFrameCount, temp, aux);
         }
 
         // constant gain
         else {
             t->resampler->setVolume(t->volume[0], t->volume[1]);
+            ScopedStatisticsTimer timer(t->mStatistics, t->mResamplerNs);
             t->resampler->resample(out, outFrameCount, t->bufferProvider);
         }
     }
@@ -1061,11 +1482,220 @@ void AudioMixer::track__16BitsMono(track_t* t, int32_t* out, size_t frameCount,
     t->in = in;
 }
 
+void AudioMixer::trackFloat__genericResample(track_t* t, float* out, size_t outFrameCount,
+        int32_t* temp, int32_t* aux)
+{
+    t->resampler->setSampleRate(t->sampleRate);
+
+    // the resampler accumulates in 4.27 fixed point, so always resample with unity gain
+    // to the temp buffer, then apply the float gains while mixing in the 2nd step
+    t->resampler->setVolume(UNITY_GAIN, UNITY_GAIN);
+    memset(temp, 0, outFrameCount * MAX_NUM_VOLUMES * sizeof(int32_t));
+    {
+        ScopedStatisticsTimer timer(t->mStatistics, t->mResamplerNs);
+        t->resampler->resample(temp, outFrameCount, t->bufferProvider);
+    }
+    if (t->isStereoMix()) {
+        mixFloat<MAX_NUM_VOLUMES>(t, out, outFrameCount, temp, aux);
+    } else {
+        mixMulti<MIXTYPE_STEREO>(t, out, outFrameCount, temp, aux);
+    }
+}
+
+void AudioMixer::trackFloat__nop(track_t* t, float* out, size_t outFrameCount, int32_t* temp,
+        int32_t* aux)
+{
+}
+
+template <typename TI>
+void AudioMixer::trackFloat__Stereo(track_t* t, float* out, size_t frameCount, int32_t* temp,
+        int32_t* aux)
+{
+    const TI *in = static_cast<const TI *>(t->in);
+    mixFloat<2>(t, out, frameCount, in, aux);
+    t->in = in + frameCount * 2;
+}
+
+template <typename TI>
+void AudioMixer::trackFloat__Mono(track_t* t, float* out, size_t frameCount, int32_t* temp,
+        int32_t* aux)
+{
+    const TI *in = static_cast<const TI *>(t->in);
+    mixFloat<1>(t, out, frameCount, in, aux);
+    t->in = in + frameCount;
+}
+
+template <int NCHAN, typename TI>
+void AudioMixer::mixFloat(track_t* t, float* out, size_t frameCount, const TI* in, int32_t* aux)
+{
+    if (CC_UNLIKELY(aux != NULL)) {
+        // ramp gain
+        if (CC_UNLIKELY(t->mVolumeInc[0] != 0 || t->mVolumeInc[1] != 0 || t->mAuxInc != 0)) {
+            float vl = t->mPrevVolume[0];
+            float vr = t->mPrevVolume[1];
+            float va = t->mPrevAuxLevel;
+            const float vlInc = t->mVolumeInc[0];
+            const float vrInc = t->mVolumeInc[1];
+            const float vaInc = t->mAuxInc;
+
+            do {
+                const float l = floatFromSample(*in++);
+                const float r = NCHAN == 1 ? l : floatFromSample(*in++);
+                *out++ += vl * l;
+                *out++ += vr * r;
+                *aux++ += q4_27FromFloat(va * (NCHAN == 1 ? l : (l + r) * 0.5f));
+                vl += vlInc;
+                vr += vrInc;
+                va += vaInc;
+            } while (--frameCount);
+
+            t->mPrevVolume[0] = vl;
+            t->mPrevVolume[1] = vr;
+            t->mPrevAuxLevel = va;
+            t->adjustVolumeRampFloat(true);
+        }
+
+        // constant gain
+        else {
+            const float vl = t->mVolume[0];
+            const float vr = t->mVolume[1];
+            const float va = t->mAuxLevel;
+            do {
+                const float l = floatFromSample(*in++);
+                const float r = NCHAN == 1 ? l : floatFromSample(*in++);
+                out[0] += vl * l;
+                out[1] += vr * r;
+                out += 2;
+                *aux++ += q4_27FromFloat(va * (NCHAN == 1 ? l : (l + r) * 0.5f));
+            } while (--frameCount);
+        }
+    } else {
+        // ramp gain
+        if (CC_UNLIKELY(t->mVolumeInc[0] != 0 || t->mVolumeInc[1] != 0)) {
+            float vl = t->mPrevVolume[0];
+            float vr = t->mPrevVolume[1];
+            const float vlInc = t->mVolumeInc[0];
+            const float vrInc = t->mVolumeInc[1];
+
+            do {
+                const float l = floatFromSample(*in++);
+                const float r = NCHAN == 1 ? l : floatFromSample(*in++);
+                *out++ += vl * l;
+                *out++ += vr * r;
+                vl += vlInc;
+                vr += vrInc;
+            } while (--frameCount);
+
+            t->mPrevVolume[0] = vl;
+            t->mPrevVolume[1] = vr;
+            t->adjustVolumeRampFloat(false);
+        }
+
+        // constant gain, a straight multiply-accumulate the compiler can vectorize
+        else {
+            const float vl = t->mVolume[0];
+            const float vr = t->mVolume[1];
+            do {
+                const float l = floatFromSample(*in++);
+                const float r = NCHAN == 1 ? l : floatFromSample(*in++);
+                out[0] += vl * l;
+                out[1] += vr * r;
+                out += 2;
+            } while (--frameCount);
+        }
+    }
+}
+
+template <int MIXTYPE, typename TI>
+void AudioMixer::trackFloat__Multi(track_t* t, float* out, size_t frameCount, int32_t* temp,
+        int32_t* aux)
+{
+    const TI *in = static_cast<const TI *>(t->in);
+    mixMulti<MIXTYPE>(t, out, frameCount, in, aux);
+    t->in = in + frameCount * t->mMixerInChannelCount;
+}
+
+template <int MIXTYPE, typename TI>
+void AudioMixer::mixMulti(track_t* t, float* out, size_t frameCount, const TI* in, int32_t* aux)
+{
+    const uint32_t outChannels = t->mMixerChannelCount;
+    const uint32_t inChannels = t->mMixerInChannelCount;
+    const int8_t* const map = t->mChannelMap;
+
+    // local copies of the per channel gains; mPrevVolume equals mVolume when not ramping
+    float vol[MAX_NUM_CHANNELS];
+    float volInc[MAX_NUM_CHANNELS];
+    bool ramp = false;
+    for (uint32_t i = 0; i < outChannels; i++) {
+        vol[i] = t->mPrevVolume[i];
+        volInc[i] = t->mVolumeInc[i];
+        ramp |= volInc[i] != 0;
+    }
+    float va = t->mPrevAuxLevel;
+    const float vaInc = t->mAuxInc;
+    // the send level applies to the average of the input channels
+    const float auxScale = 1.0f / inChannels;
+
+    do {
+        float sum = 0;
+        switch (MIXTYPE) {
+        case MIXTYPE_MONO: {
+            const float s = floatFromSample(*in++);
+            out[map[0]] += vol[map[0]] * s;
+            out[map[1]] += vol[map[1]] * s;
+            sum = s;
+            } break;
+        case MIXTYPE_STEREO: {
+            const float l = floatFromSample(*in++);
+            const float r = floatFromSample(*in++);
+            out[map[0]] += vol[map[0]] * l;
+            out[map[1]] += vol[map[1]] * r;
+            sum = l + r;
+            } break;
+        case MIXTYPE_SAME:
+            for (uint32_t i = 0; i < outChannels; i++) {
+                const float s = floatFromSample(*in++);
+                out[i] += vol[i] * s;
+                sum += s;
+            }
+            break;
+        case MIXTYPE_REMAP:
+            for (uint32_t i = 0; i < inChannels; i++) {
+                const float s = floatFromSample(*in++);
+                if (map[i] >= 0) {
+                    out[map[i]] += vol[map[i]] * s;
+                }
+                sum += s;
+            }
+            break;
+        }
+        if (CC_UNLIKELY(aux != NULL)) {
+            *aux++ += q4_27FromFloat(va * sum * auxScale);
+            va += vaInc;
+        }
+        if (CC_UNLIKELY(ramp)) {
+            for (uint32_t i = 0; i < outChannels; i++) {
+                vol[i] += volInc[i];
+            }
+        }
+        out += outChannels;
+    } while (--frameCount);
+
+    if (ramp || (aux != NULL && vaInc != 0)) {
+        for (uint32_t i = 0; i < outChannels; i++) {
+            t->mPrevVolume[i] = vol[i];
+        }
+        if (aux != NULL) {
+            t->mPrevAuxLevel = va;
+        }
+        t->adjustVolumeRampFloat(aux != NULL);
+    }
+}
+
 // no-op case
 void AudioMixer::process__nop(state_t* state, int64_t pts)
 {
     uint32_t e0 = state->enabledTracks;
-    size_t bufSize = state->frameCount * sizeof(int16_t) * MAX_NUM_CHANNELS;
     while (e0) {
         // process by group of tracks with same output buffer to
         // avoid multiple memset() on same buffer
@@ -1084,7 +1714,8 @@ void AudioMixer::process__nop(state_t* state, int64_t pts)
             }
             e0 &= ~(e1);
 
-            memset(t1.mainBuffer, 0, bufSize);
+            memset(t1.mainBuffer, 0, state->frameCount * t1.mMixerChannelCount *
+                    (t1.mMixerFormat == AUDIO_FORMAT_PCM_FLOAT ? sizeof(float) : sizeof(int16_t)));
         }
 
         while (e1) {
@@ -1110,7 +1741,7 @@ void AudioMixer::process__nop(state_t* state, int64_t pts)
 // generic code without resampling
 void AudioMixer::process__genericNoResampling(state_t* state, int64_t pts)
 {
-    int32_t outTemp[BLOCKSIZE * MAX_NUM_CHANNELS] __attribute__((aligned(32)));
+    int32_t outTemp[BLOCKSIZE * MAX_NUM_VOLUMES] __attribute__((aligned(32)));
 
     // acquire each track's buffer
     uint32_t enabledTracks = state->enabledTracks;
@@ -1144,6 +1775,7 @@ void AudioMixer::process__genericNoResampling(state_t* state, int64_t pts)
         e0 &= ~(e1);
         // this assumes output 16 bits stereo, no resampling
         int32_t *out = t1.mainBuffer;
+        const uint32_t numBlocks = (state->frameCount + BLOCKSIZE - 1) / BLOCKSIZE;
         size_t numFrames = 0;
         do {
             memset(outTemp, 0, sizeof(outTemp));
@@ -1167,7 +1799,11 @@ void AudioMixer::process__genericNoResampling(state_t* state, int64_t pts)
                     }
                     size_t inFrames = (t.frameCount > outFrames)?outFrames:t.frameCount;
                     if (inFrames) {
-                        t.hook(&t, outTemp + (BLOCKSIZE-outFrames)*MAX_NUM_CHANNELS, inFrames,
+                        // time the first block only, to keep the clock reads out of
+                        // the block loop, and extrapolate to the whole mix cycle
+                        ScopedStatisticsTimer timer(numFrames == 0 ? t.mStatistics : NULL,
+                                t.mHookNs, numBlocks);
+                        t.hook(&t, outTemp + (BLOCKSIZE-outFrames)*MAX_NUM_VOLUMES, inFrames,
                                 state->resampleTemp, aux);
                         t.frameCount -= inFrames;
                         outFrames -= inFrames;
@@ -1214,7 +1850,7 @@ void AudioMixer::process__genericResampling(state_t* state, int64_t pts)
 {
     // this const just means that local variable outTemp doesn't change
     int32_t* const outTemp = state->outputTemp;
-    const size_t size = sizeof(int32_t) * MAX_NUM_CHANNELS * state->frameCount;
+    const size_t size = sizeof(int32_t) * MAX_NUM_VOLUMES * state->frameCount;
 
     size_t numFrames = state->frameCount;
 
@@ -1251,10 +1887,13 @@ void AudioMixer::process__genericResampling(state_t* state, int64_t pts)
             // the resampler.
             if ((t.needs & NEEDS_RESAMPLE__MASK) == NEEDS_RESAMPLE_ENABLED) {
                 t.resampler->setPTS(pts);
+                ScopedStatisticsTimer timer(t.mStatistics, t.mHookNs);
                 t.hook(&t, outTemp, numFrames, state->resampleTemp, aux);
             } else {
 
                 size_t outFrames = 0;
+                // once for the track, including the obtains between its hook calls
+                ScopedStatisticsTimer timer(t.mStatistics, t.mHookNs);
 
                 while (outFrames < numFrames) {
                     t.buffer.frameCount = numFrames - outFrames;
@@ -1268,7 +1907,7 @@ void AudioMixer::process__genericResampling(state_t* state, int64_t pts)
                     if (CC_UNLIKELY(aux != NULL)) {
                         aux += outFrames;
                     }
-                    t.hook(&t, outTemp + outFrames*MAX_NUM_CHANNELS, t.buffer.frameCount,
+                    t.hook(&t, outTemp + outFrames*MAX_NUM_VOLUMES, t.buffer.frameCount,
                             state->resampleTemp, aux);
                     outFrames += t.buffer.frameCount;
                     t.bufferProvider->releaseBuffer(&t.buffer);
@@ -1279,6 +1918,199 @@ void AudioMixer::process__genericResampling(state_t* state, int64_t pts)
     }
 }
 
+// generic code without resampling, float mix
+void AudioMixer::process__genericNoResamplingFloat(state_t* state, int64_t pts)
+{
+    float outTemp[BLOCKSIZE * MAX_NUM_CHANNELS] __attribute__((aligned(32)));
+
+    // acquire each track's buffer
+    uint32_t enabledTracks = state->enabledTracks;
+    uint32_t e0 = enabledTracks;
+    while (e0) {
+        const int i = 31 - __builtin_clz(e0);
+        e0 &= ~(1<<i);
+        track_t& t = state->tracks[i];
+        t.buffer.frameCount = state->frameCount;
+        t.bufferProvider->getNextBuffer(&t.buffer, pts);
+        t.frameCount = t.buffer.frameCount;
+        t.in = t.buffer.raw;
+    }
+
+    e0 = enabledTracks;
+    while (e0) {
+        // process by group of tracks with same output buffer to
+        // optimize cache use
+        uint32_t e1 = e0, e2 = e0;
+        int j = 31 - __builtin_clz(e1);
+        track_t& t1 = state->tracks[j];
+        e2 &= ~(1<<j);
+        while (e2) {
+            j = 31 - __builtin_clz(e2);
+            e2 &= ~(1<<j);
+            track_t& t2 = state->tracks[j];
+            if (CC_UNLIKELY(t2.mainBuffer != t1.mainBuffer)) {
+                e1 &= ~(1<<j);
+            }
+        }
+        e0 &= ~(e1);
+        // tracks sharing an output buffer share its mixer format and channel count
+        const audio_format_t mixerFormat = t1.mMixerFormat;
+        const uint32_t channels = t1.mMixerChannelCount;
+        const size_t outBlockSize = BLOCKSIZE * channels *
+                (mixerFormat == AUDIO_FORMAT_PCM_FLOAT ? sizeof(float) : sizeof(int16_t));
+        int8_t *out = reinterpret_cast<int8_t *>(t1.mainBuffer);
+        const uint32_t numBlocks = (state->frameCount + BLOCKSIZE - 1) / BLOCKSIZE;
+        size_t numFrames = 0;
+        do {
+            memset(outTemp, 0, BLOCKSIZE * channels * sizeof(float));
+            e2 = e1;
+            while (e2) {
+                const int i = 31 - __builtin_clz(e2);
+                e2 &= ~(1<<i);
+                track_t& t = state->tracks[i];
+                size_t outFrames = BLOCKSIZE;
+                int32_t *aux = NULL;
+                if (CC_UNLIKELY((t.needs & NEEDS_AUX__MASK) == NEEDS_AUX_ENABLED)) {
+                    aux = t.auxBuffer + numFrames;
+                }
+                while (outFrames) {
+                    // t.in == NULL can happen if the track was flushed just after having
+                    // been enabled for mixing.
+                    if (t.in == NULL) {
+                        enabledTracks &= ~(1<<i);
+                        e1 &= ~(1<<i);
+                        break;
+                    }
+                    size_t inFrames = (t.frameCount > outFrames)?outFrames:t.frameCount;
+                    if (inFrames) {
+                        // time the first block only, to keep the clock reads out of
+                        // the block loop, and extrapolate to the whole mix cycle
+                        ScopedStatisticsTimer timer(numFrames == 0 ? t.mStatistics : NULL,
+                                t.mHookNs, numBlocks);
+                        t.hookFloat(&t, outTemp + (BLOCKSIZE-outFrames)*channels,
+                                inFrames, state->resampleTemp, aux);
+                        t.frameCount -= inFrames;
+                        outFrames -= inFrames;
+                        if (CC_UNLIKELY(aux != NULL)) {
+                            aux += inFrames;
+                        }
+                    }
+                    if (t.frameCount == 0 && outFrames) {
+                        t.bufferProvider->releaseBuffer(&t.buffer);
+                        t.buffer.frameCount = (state->frameCount - numFrames) -
+                                (BLOCKSIZE - outFrames);
+                        int64_t outputPTS = calculateOutputPTS(
+                            t, pts, numFrames + (BLOCKSIZE - outFrames));
+                        t.bufferProvider->getNextBuffer(&t.buffer, outputPTS);
+                        t.in = t.buffer.raw;
+                        if (t.in == NULL) {
+                            enabledTracks &= ~(1<<i);
+                            e1 &= ~(1<<i);
+                            break;
+                        }
+                        t.frameCount = t.buffer.frameCount;
+                    }
+                }
+            }
+            convertMixerFormat(out, mixerFormat, outTemp, BLOCKSIZE * channels);
+            out += outBlockSize;
+            numFrames += BLOCKSIZE;
+        } while (numFrames < state->frameCount);
+    }
+
+    // release each track's buffer
+    e0 = enabledTracks;
+    while (e0) {
+        const int i = 31 - __builtin_clz(e0);
+        e0 &= ~(1<<i);
+        track_t& t = state->tracks[i];
+        t.bufferProvider->releaseBuffer(&t.buffer);
+    }
+}
+
+// generic code with resampling, float mix
+void AudioMixer::process__genericResamplingFloat(state_t* state, int64_t pts)
+{
+    // outputTemp is allocated as int32_t, which has the size of a float
+    float* const outTemp = reinterpret_cast<float *>(state->outputTemp);
+
+    size_t numFrames = state->frameCount;
+
+    uint32_t e0 = state->enabledTracks;
+    while (e0) {
+        // process by group of tracks with same output buffer
+        // to optimize cache use
+        uint32_t e1 = e0, e2 = e0;
+        int j = 31 - __builtin_clz(e1);
+        track_t& t1 = state->tracks[j];
+        e2 &= ~(1<<j);
+        while (e2) {
+            j = 31 - __builtin_clz(e2);
+            e2 &= ~(1<<j);
+            track_t& t2 = state->tracks[j];
+            if (CC_UNLIKELY(t2.mainBuffer != t1.mainBuffer)) {
+                e1 &= ~(1<<j);
+            }
+        }
+        e0 &= ~(e1);
+        void *out = t1.mainBuffer;
+        const audio_format_t mixerFormat = t1.mMixerFormat;
+        const uint32_t channels = t1.mMixerChannelCount;
+        memset(outTemp, 0, sizeof(float) * channels * numFrames);
+        while (e1) {
+            const int i = 31 - __builtin_clz(e1);
+            e1 &= ~(1<<i);
+            track_t& t = state->tracks[i];
+            int32_t *aux = NULL;
+            if (CC_UNLIKELY((t.needs & NEEDS_AUX__MASK) == NEEDS_AUX_ENABLED)) {
+                aux = t.auxBuffer;
+            }
+
+            // as in process__genericResampling(), the resampler acquires and
+            // releases the buffers itself
+            if ((t.needs & NEEDS_RESAMPLE__MASK) == NEEDS_RESAMPLE_ENABLED) {
+                t.resampler->setPTS(pts);
+                ScopedStatisticsTimer timer(t.mStatistics, t.mHookNs);
+                t.hookFloat(&t, outTemp, numFrames, state->resampleTemp, aux);
+            } else {
+
+                size_t outFrames = 0;
+                // once for the track, including the obtains between its hook calls
+                ScopedStatisticsTimer timer(t.mStatistics, t.mHookNs);
+
+                while (outFrames < numFrames) {
+                    t.buffer.frameCount = numFrames - outFrames;
+                    int64_t outputPTS = calculateOutputPTS(t, pts, outFrames);
+                    t.bufferProvider->getNextBuffer(&t.buffer, outputPTS);
+                    t.in = t.buffer.raw;
+                    // t.in == NULL can happen if the track was flushed just after having
+                    // been enabled for mixing.
+                    if (t.in == NULL) break;
+
+                    if (CC_UNLIKELY(aux != NULL)) {
+                        aux += outFrames;
+                    }
+                    t.hookFloat(&t, outTemp + outFrames*channels, t.buffer.frameCount,
+                            state->resampleTemp, aux);
+                    outFrames += t.buffer.frameCount;
+                    t.bufferProvider->releaseBuffer(&t.buffer);
+                }
+            }
+        }
+        convertMixerFormat(out, mixerFormat, outTemp, numFrames * channels);
+    }
+}
+
+void AudioMixer::convertMixerFormat(void* out, audio_format_t mixerFormat, const float* in,
+        size_t sampleCount)
+{
+    if (mixerFormat == AUDIO_FORMAT_PCM_FLOAT) {
+        memcpy(out, in, sampleCount * sizeof(float));
+    } else {
+        clampFloatToPcm16(static_cast<int16_t *>(out), in, sampleCount);
+    }
+}
+
 // one track, 16 bits stereo without resampling is the most common case
 void AudioMixer::process__OneTrack16BitsStereoNoResampling(state_t* state,
                                                            int64_t pts)
@@ -1292,6 +2124,8 @@ void AudioMixer::process__OneTrack16BitsStereoNoResampling(state_t* state,
     const track_t& t = state->tracks[i];
 
     AudioBufferProvider::Buffer& b(t.buffer);
+    // includes the buffer provider calls, as there is no separate hook
+    ScopedStatisticsTimer timer(t.mStatistics, t.mHookNs);
 
     int32_t* out = t.mainBuffer;
     size_t numFrames = state->frameCount;
@@ -1308,7 +2142,7 @@ void AudioMixer::process__OneTrack16BitsStereoNoResampling(state_t* state,
         // in == NULL can happen if the track was flushed just after having
         // been enabled for mixing.
         if (in == NULL || ((unsigned long)in & 3)) {
-            memset(out, 0, numFrames*MAX_NUM_CHANNELS*sizeof(int16_t));
+            memset(out, 0, numFrames*MAX_NUM_VOLUMES*sizeof(int16_t));
             ALOGE_IF(((unsigned long)in & 3), "process stereo track: input buffer alignment pb: "
                                               "buffer %p track %d, channels %d, needs %08x",
                     in, i, t.channelCount, t.needs);
@@ -1387,7 +2221,7 @@ void AudioMixer::process__TwoTracks16BitsStereoNoResampling(state_t* state,
             t0.bufferProvider->getNextBuffer(&b0, outputPTS);
             if (b0.i16 == NULL) {
                 if (buff == NULL) {
-                    buff = new int16_t[MAX_NUM_CHANNELS * state->frameCount];
+                    buff = new int16_t[MAX_NUM_VOLUMES * state->frameCount];
                 }
                 in0 = buff;
                 b0.frameCount = numFrames;
@@ -1403,7 +2237,7 @@ void AudioMixer::process__TwoTracks16BitsStereoNoResampling(state_t* state,
             t1.bufferProvider->getNextBuffer(&b1, outputPTS);
             if (b1.i16 == NULL) {
                 if (buff == NULL) {
-                    buff = new int16_t[MAX_NUM_CHANNELS * state->frameCount];
+                    buff = new int16_t[MAX_NUM_VOLUMES * state->frameCount];
                 }
                 in1 = buff;
                 b1.frameCount = numFrames;
@@ -25,6 +25,7 @@
 
 #include <media/AudioBufferProvider.h>
 #include "AudioResampler.h"
+#include "TrackStatistics.h"
 
 #include <audio_effects/effect_downmix.h>
 #include <system/audio.h>
@@ -46,12 +47,15 @@ public:
     // This mixer has a hard-coded upper limit of 32 active track inputs.
     // Adding support for > 32 tracks would require more than simply changing this value.
     static const uint32_t MAX_NUM_TRACKS = 32;
-    // maximum number of channels supported by the mixer
-
-    // This mixer has a hard-coded upper limit of 2 channels for output.
-    // There is support for > 2 channel tracks down-mixed to 2 channel output via a down-mix effect.
-    // Adding support for > 2 channel output would require more than simply changing this value.
-    static const uint32_t MAX_NUM_CHANNELS = 2;
+    // maximum number of channels supported by the mixer, for both the tracks and the output.
+    // Tracks are mixed into an output of up to 8 channels by the float mix path, which
+    // remaps track channels to output channels at mix time.  A down-mix effect is used
+    // only when the track has channels that the output does not have, or when a track of
+    // more than 2 channels is resampled.
+    static const uint32_t MAX_NUM_CHANNELS = 8;
+    // maximum number of channels of the 16 bit integer mix path, which is stereo only and has
+    // one 3.12 fixed point volume per channel; also the number of resampler output channels.
+    static const uint32_t MAX_NUM_VOLUMES = 2;
     // maximum number of channels supported for the content
     static const uint32_t MAX_NUM_CHANNELS_TO_DOWNMIX = 8;
 
@@ -77,6 +81,12 @@ public:
         MAIN_BUFFER     = 0x4002,
         AUX_BUFFER      = 0x4003,
         DOWNMIX_TYPE    = 0X4004,
+        MIXER_FORMAT    = 0x4005, // AUDIO_FORMAT_PCM_16_BIT (default) or AUDIO_FORMAT_PCM_FLOAT;
+                                  // format of the data written to MAIN_BUFFER.
+        MIXER_CHANNEL_MASK = 0x4006, // channel mask of MAIN_BUFFER, AUDIO_CHANNEL_OUT_STEREO by
+                                  // default; up to MAX_NUM_CHANNELS channels.
+        STATISTICS      = 0x4007, // TrackStatistics* updated at each process() if
+                                  // TRACK_MIX_STATISTICS is defined, or NULL (default).
         // for target RESAMPLE
         SAMPLE_RATE     = 0x4100, // Configure sample rate conversion on this track name;
                                   // parameter 'value' is the new sample rate in Hz.
@@ -90,8 +100,12 @@ public:
         REMOVE          = 0x4102, // Remove the sample rate converter on this track name;
                                   // the track is restored to the mix sample rate.
         // for target RAMP_VOLUME and VOLUME (8 channels max)
+        // VOLUME0 and VOLUME1 are the left and right volumes: they also set the volume of
+        // every other output channel on the same side, and center channels get their average.
+        // VOLUME0 + n with n >= 2 then overrides the volume of output channel n.
         VOLUME0         = 0x4200,
         VOLUME1         = 0x4201,
+        VOLUME7         = 0x4207,
         AUXLEVEL        = 0x4210,
     };
 
@@ -120,7 +134,7 @@ public:
 private:
 
     enum {
-        NEEDS_CHANNEL_COUNT__MASK   = 0x00000007,
+        NEEDS_CHANNEL_COUNT__MASK   = 0x00000007,   // channel count - 1
         NEEDS_FORMAT__MASK          = 0x000000F0,
         NEEDS_MUTE__MASK            = 0x00000100,
         NEEDS_RESAMPLE__MASK        = 0x00001000,
@@ -132,6 +146,7 @@ private:
         NEEDS_CHANNEL_2             = 0x00000001,
 
         NEEDS_FORMAT_16             = 0x00000010,
+        NEEDS_FORMAT_FLOAT          = 0x00000020,
 
         NEEDS_MUTE_DISABLED         = 0x00000000,
         NEEDS_MUTE_ENABLED          = 0x00000100,
@@ -146,24 +161,29 @@ private:
     struct state_t;
     struct track_t;
     class DownmixerBufferProvider;
+    class ReformatBufferProvider;
 
     typedef void (*hook_t)(track_t* t, int32_t* output, size_t numOutFrames, int32_t* temp,
                            int32_t* aux);
+    // track hook used when the mix is accumulated in float; aux stays in the
+    // int32_t format expected by the auxiliary effect input
+    typedef void (*hook_float_t)(track_t* t, float* output, size_t numOutFrames, int32_t* temp,
+                           int32_t* aux);
     static const int BLOCKSIZE = 16; // 4 cache lines
 
     struct track_t {
         uint32_t    needs;
 
         union {
-        int16_t     volume[MAX_NUM_CHANNELS]; // [0]3.12 fixed point
+        int16_t     volume[MAX_NUM_VOLUMES]; // [0]3.12 fixed point
         int32_t     volumeRL;
         };
 
-        int32_t     prevVolume[MAX_NUM_CHANNELS];
+        int32_t     prevVolume[MAX_NUM_VOLUMES];
 
         // 16-byte boundary
 
-        int32_t     volumeInc[MAX_NUM_CHANNELS];
+        int32_t     volumeInc[MAX_NUM_VOLUMES];
         int32_t     auxInc;
         int32_t     prevAuxLevel;
 
@@ -172,7 +192,7 @@ private:
         int16_t     auxLevel;       // 0 <= auxLevel <= MAX_GAIN_INT, but signed for mul performance
         uint16_t    frameCount;
 
-        uint8_t     channelCount;   // 1 or 2, redundant with (needs & NEEDS_CHANNEL_COUNT__MASK)
+        uint8_t     channelCount;   // 1 to 8, redundant with (needs & NEEDS_CHANNEL_COUNT__MASK)
         uint8_t     format;         // always 16
         uint16_t    enabled;        // actually bool
         audio_channel_mask_t channelMask;
@@ -205,10 +225,50 @@ private:
 
         // 16-byte boundary
 
+        // float mix path, one volume per output channel; the volumes of output channels 0 and 1
+        // are kept in sync with the 3.12 fixed point values above
+        float       mVolume[MAX_NUM_CHANNELS];
+        float       mPrevVolume[MAX_NUM_CHANNELS];
+        float       mVolumeInc[MAX_NUM_CHANNELS];
+
+        // 16-byte boundary
+
+        float       mAuxLevel;
+        float       mPrevAuxLevel;
+        float       mAuxInc;
+        audio_format_t mFormat;         // format of the track buffer: 16 bit or float
+        audio_format_t mMixerInFormat;  // format seen by the track hooks, after reformatting
+        audio_format_t mMixerFormat;    // format of mainBuffer: 16 bit or float
+
+        // 16-byte boundary
+
+        hook_float_t hookFloat;
+        // buffer provider set by the client, before any reformatting or downmixing
+        AudioBufferProvider* mInputBufferProvider;
+        // converts float track data to 16 bit when the resampler or downmixer needs it
+        ReformatBufferProvider* mReformatBufferProvider;
+
+        audio_channel_mask_t mMixerChannelMask;    // channel mask of mainBuffer
+        uint8_t     mMixerChannelCount;     // 2 to 8, channel count of mainBuffer
+        uint8_t     mMixerInChannelCount;   // channels seen by the hooks, after downmix/resample
+        // output channel of each channel seen by the hooks, -1 if the output lacks that channel
+        int8_t      mChannelMap[MAX_NUM_CHANNELS];
+
+        // 16-byte boundary
+
+        TrackStatistics*    mStatistics;    // optional, written at the end of each process()
+        mutable uint32_t    mHookNs;        // time in the hooks during the current process()
+        mutable uint32_t    mResamplerNs;   // part of mHookNs spent in the resampler
+
         bool        setResampler(uint32_t sampleRate, uint32_t devSampleRate);
         bool        doesResample() const { return resampler != NULL; }
         void        resetResampler() { if (resampler != NULL) resampler->reset(); }
         void        adjustVolumeRamp(bool aux);
+        void        adjustVolumeRampFloat(bool aux);
+        // true if the integer path can mix this track: stereo output, 16 bit data
+        bool        isStereoMix() const { return mMixerChannelCount == MAX_NUM_VOLUMES; }
+        // true if all output channels have a zero volume and no ramp in progress
+        bool        isMuted() const;
         size_t      getUnreleasedFrames() const { return resampler != NULL ?
                                                     resampler->getUnreleasedFrames() : 0; };
     };
@@ -219,7 +279,7 @@ private:
         uint32_t        needsChanged;
         size_t          frameCount;
         void            (*hook)(state_t* state, int64_t pts);   // one of process__*, never NULL
-        int32_t         *outputTemp;
+        int32_t         *outputTemp;    // also used as float storage by the float mix path
         int32_t         *resampleTemp;
         NBLog::Writer*  mLog;
         int32_t         reserved[1];
@@ -240,6 +300,28 @@ private:
         effect_config_t    mDownmixConfig;
     };
 
+    // AudioBufferProvider that wraps a float track AudioBufferProvider and converts its
+    // data to 16 bit into a local buffer, for the consumers that only handle 16 bit:
+    // the resampler and the downmix effect.
+    class ReformatBufferProvider : public AudioBufferProvider {
+    public:
+        virtual status_t getNextBuffer(Buffer* buffer, int64_t pts);
+        virtual void releaseBuffer(Buffer* buffer);
+        ReformatBufferProvider(uint32_t channelCount);
+        virtual ~ReformatBufferProvider();
+
+        // discard any data obtained from the track but not yet released
+        void reset();
+
+        AudioBufferProvider* mTrackBufferProvider;
+    private:
+        const uint32_t  mChannelCount;
+        Buffer          mBuffer;            // buffer obtained from mTrackBufferProvider
+        int16_t*        mLocalBuffer;       // 16 bit copy of mBuffer
+        size_t          mLocalBufferFrameCount;
+        size_t          mConsumed;          // frames of mBuffer released by the consumer
+    };
+
     // bitmask of allocated track names, where bit 0 corresponds to TRACK0 etc.
     uint32_t        mTrackNames;
 
@@ -265,8 +347,18 @@ private:
     void invalidateState(uint32_t mask);
 
     static status_t initTrackDownmix(track_t* pTrack, int trackNum, audio_channel_mask_t mask);
+    // recomputes mMixerInChannelCount and mChannelMap for the current configuration
+    static void updateChannelMap(track_t* pTrack);
+    // sets the float volume of output channel 'channel', ramped or not
+    void setFloatVolume(track_t& track, uint32_t channel, float volume, bool ramp);
+    // derives the float volumes of all output channels from the left and right volumes
+    void setFloatVolumesFromStereo(track_t& track, bool ramp);
     static status_t prepareTrackForDownmix(track_t* pTrack, int trackNum);
     static void unprepareTrackForDownmix(track_t* pTrack, int trackName);
+    static void prepareTrackForReformat(track_t* pTrack, int trackName);
+    static void unprepareTrackForReformat(track_t* pTrack, int trackName);
+    // rebuilds the chain input provider -> [reformat] -> [downmix] used by the track hooks
+    static void reconfigureBufferProviders(track_t* pTrack);
 
     static void track__genericResample(track_t* t, int32_t* out, size_t numFrames, int32_t* temp,
             int32_t* aux);
@@ -280,12 +372,47 @@ private:
     static void volumeStereo(track_t* t, int32_t* out, size_t frameCount, int32_t* temp,
             int32_t* aux);
 
+    // float mix path track hooks, TI is the input sample type: int16_t or float
+    static void trackFloat__genericResample(track_t* t, float* out, size_t numFrames,
+            int32_t* temp, int32_t* aux);
+    static void trackFloat__nop(track_t* t, float* out, size_t numFrames, int32_t* temp,
+            int32_t* aux);
+    template <typename TI>
+    static void trackFloat__Stereo(track_t* t, float* out, size_t numFrames, int32_t* temp,
+            int32_t* aux);
+    template <typename TI>
+    static void trackFloat__Mono(track_t* t, float* out, size_t numFrames, int32_t* temp,
+            int32_t* aux);
+    // accumulates NCHAN (1 or 2) channel input into the stereo float mix with the track gains,
+    // TI is int16_t or float for track data, and int32_t for 4.27 resampler output
+    template <int NCHAN, typename TI>
+    static void mixFloat(track_t* t, float* out, size_t frameCount, const TI* in, int32_t* aux);
+
+    // how the channels seen by the hooks are mapped to an output of more than 2 channels
+    enum {
+        MIXTYPE_MONO,       // 1 -> N, the single channel goes to the front left and right
+        MIXTYPE_STEREO,     // 2 -> N, front left and right only
+        MIXTYPE_SAME,       // N -> N, identical channel masks
+        MIXTYPE_REMAP,      // M -> N, through mChannelMap
+    };
+    template <int MIXTYPE, typename TI>
+    static void mixMulti(track_t* t, float* out, size_t frameCount, const TI* in, int32_t* aux);
+    template <int MIXTYPE, typename TI>
+    static void trackFloat__Multi(track_t* t, float* out, size_t numFrames, int32_t* temp,
+            int32_t* aux);
+
     static void process__validate(state_t* state, int64_t pts);
     static void process__nop(state_t* state, int64_t pts);
     static void process__genericNoResampling(state_t* state, int64_t pts);
     static void process__genericResampling(state_t* state, int64_t pts);
     static void process__OneTrack16BitsStereoNoResampling(state_t* state,
                                                           int64_t pts);
+    static void process__genericNoResamplingFloat(state_t* state, int64_t pts);
+    static void process__genericResamplingFloat(state_t* state, int64_t pts);
+
+    // writes the float mix in 'in' to 'out' in the mixer format of the track
+    static void convertMixerFormat(void* out, audio_format_t mixerFormat, const float* in,
+                                   size_t sampleCount);
 #if 0
     static void process__TwoTracks16BitsStereoNoResampling(state_t* state,
                                                            int64_t pts);
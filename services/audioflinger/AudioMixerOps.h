@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_AUDIO_MIXER_OPS_H
+#define ANDROID_AUDIO_MIXER_OPS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+namespace android {
+
+// Sample conversions used by the float mix path of AudioMixer and by the threads
+// that own a float mix buffer.  A float sample has a nominal range of [-1.0, 1.0).
+
+// scale of a 16 bit sample relative to a float sample
+static const float kFloatFromPcm16 = 1.0f / (1 << 15);
+
+// the 32 bit accumulators of the integer mixer and of the auxiliary effect input
+// hold a 16 bit sample multiplied by a 3.12 fixed point gain, i.e. 4.27 fixed point
+static const float kFloatFromQ4_27 = 1.0f / (1 << 27);
+static const float kQ4_27FromFloat = (float) (1 << 27);
+
+// converts a 16 bit sample to float
+static inline float floatFromPcm16(int16_t i)
+{
+    return i * kFloatFromPcm16;
+}
+
+// pass-through for float input, so the float track hooks can be templated on input type
+static inline float floatFromSample(float f)
+{
+    return f;
+}
+
+static inline float floatFromSample(int16_t i)
+{
+    return floatFromPcm16(i);
+}
+
+// converts a 4.27 fixed point accumulator to float
+static inline float floatFromSample(int32_t i)
+{
+    return i * kFloatFromQ4_27;
+}
+
+// converts a float sample to 16 bit, rounding to nearest and clamping
+static inline int16_t clamp16FromFloat(float f)
+{
+    float scaled = f * (1 << 15);
+    if (scaled >= 32767.0f) {
+        return 32767;
+    }
+    if (scaled <= -32768.0f) {
+        return -32768;
+    }
+    return (int16_t) (scaled >= 0 ? scaled + 0.5f : scaled - 0.5f);
+}
+
+// converts a float sample to the 4.27 fixed point format of the auxiliary effect input
+static inline int32_t q4_27FromFloat(float f)
+{
+    return (int32_t) (f * kQ4_27FromFloat);
+}
+
+// converts count float samples to 16 bit, clamping; in-place conversion is allowed
+static inline void clampFloatToPcm16(int16_t* dst, const float* src, size_t count)
+{
+    while (count--) {
+        *dst++ = clamp16FromFloat(*src++);
+    }
+}
+
+// converts count 16 bit samples to float; dst must not overlap src
+static inline void convertPcm16ToFloat(float* dst, const int16_t* src, size_t count)
+{
+    while (count--) {
+        *dst++ = floatFromPcm16(*src++);
+    }
+}
+
+}; // namespace android
+
+#endif // ANDROID_AUDIO_MIXER_OPS_H
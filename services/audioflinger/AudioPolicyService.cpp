@@ -696,41 +696,59 @@ bool AudioPolicyService::AudioCommandThread::threadLoop()
     {
         while (!mAudioCommands.isEmpty()) {
             nsecs_t curTime = systemTime();
-            // commands are sorted by increasing time stamp: execute them from index 0 and up
+            // commands are sorted by increasing time stamp: execute them from index 0 and up,
+            // except that the first due command of the urgent lane goes before due bulk commands
             if (mAudioCommands[0]->mTime <= curTime) {
-                AudioCommand *command = mAudioCommands[0];
-                mAudioCommands.removeAt(0);
+                size_t index = 0;
+                for (size_t i = 0; i < mAudioCommands.size() &&
+                        mAudioCommands[i]->mTime <= curTime; i++) {
+                    if (mAudioCommands[i]->mLane == LANE_URGENT) {
+                        index = i;
+                        break;
+                    }
+                }
+                AudioCommand *command = mAudioCommands[index];
+                mAudioCommands.removeAt(index);
                 mLastCommand = *command;
 
+                // only the call itself is timed, not the handshake with a waiting caller
+                nsecs_t execStart;
+                nsecs_t execTime = 0;
                 switch (command->mCommand) {
                 case START_TONE: {
                     mLock.unlock();
                     ToneData *data = (ToneData *)command->mParam;
                     ALOGV("AudioCommandThread() processing start tone %d on stream %d",
                             data->mType, data->mStream);
+                    execStart = systemTime();
                     delete mpToneGenerator;
                     mpToneGenerator = new ToneGenerator(data->mStream, 1.0);
                     mpToneGenerator->startTone(data->mType);
+                    execTime = systemTime() - execStart;
                     delete data;
                     mLock.lock();
                     }break;
                 case STOP_TONE: {
                     mLock.unlock();
                     ALOGV("AudioCommandThread() processing stop tone");
+                    execStart = systemTime();
                     if (mpToneGenerator != NULL) {
                         mpToneGenerator->stopTone();
                         delete mpToneGenerator;
                         mpToneGenerator = NULL;
                     }
+                    execTime = systemTime() - execStart;
                     mLock.lock();
                     }break;
                 case SET_VOLUME: {
                     VolumeData *data = (VolumeData *)command->mParam;
                     ALOGV("AudioCommandThread() processing set volume stream %d, \
                             volume %f, output %d", data->mStream, data->mVolume, data->mIO);
+                    execStart = systemTime();
                     command->mStatus = AudioSystem::setStreamVolume(data->mStream,
                                                                     data->mVolume,
                                                                     data->mIO);
+                    execTime = systemTime() - execStart;
                     if (command->mWaitStatus) {
                         command->mCond.signal();
                         command->mCond.waitRelative(mLock, kAudioCommandTimeout);
@@ -741,7 +759,9 @@ bool AudioPolicyService::AudioCommandThread::threadLoop()
                     ParametersData *data = (ParametersData *)command->mParam;
                     ALOGV("AudioCommandThread() processing set parameters string %s, io %d",
                             data->mKeyValuePairs.string(), data->mIO);
+                    execStart = systemTime();
                     command->mStatus = AudioSystem::setParameters(data->mIO, data->mKeyValuePairs);
+                    execTime = systemTime() - execStart;
                     if (command->mWaitStatus) {
                         command->mCond.signal();
                         command->mCond.waitRelative(mLock, kAudioCommandTimeout);
@@ -752,7 +772,9 @@ bool AudioPolicyService::AudioCommandThread::threadLoop()
                     VoiceVolumeData *data = (VoiceVolumeData *)command->mParam;
                     ALOGV("AudioCommandThread() processing set voice volume volume %f",
                             data->mVolume);
+                    execStart = systemTime();
                     command->mStatus = AudioSystem::setVoiceVolume(data->mVolume);
+                    execTime = systemTime() - execStart;
                     if (command->mWaitStatus) {
                         command->mCond.signal();
                         command->mCond.waitRelative(mLock, kAudioCommandTimeout);
@@ -768,7 +790,9 @@ bool AudioPolicyService::AudioCommandThread::threadLoop()
                         break;
                     }
                     mLock.unlock();
+                    execStart = systemTime();
                     svc->doStopOutput(data->mIO, data->mStream, data->mSession);
+                    execTime = systemTime() - execStart;
                     mLock.lock();
                     delete data;
                     }break;
@@ -781,13 +805,18 @@ bool AudioPolicyService::AudioCommandThread::threadLoop()
                         break;
                     }
                     mLock.unlock();
+                    execStart = systemTime();
                     svc->doReleaseOutput(data->mIO);
+                    execTime = systemTime() - execStart;
                     mLock.lock();
                     delete data;
                     }break;
                 default:
                     ALOGW("AudioCommandThread() unknown command %d", command->mCommand);
                 }
+                if (command->mCommand >= 0 && command->mCommand < kNumCommands) {
+                    mStats[command->mCommand].add(curTime - command->mTime, execTime);
+                }
                 delete command;
                 waitTime = INT64_MAX;
             } else {
@@ -825,7 +854,7 @@ status_t AudioPolicyService::AudioCommandThread::dump(int fd)
 
     snprintf(buffer, SIZE, "- Commands:\n");
     result = String8(buffer);
-    result.append("   Command Time        Wait pParam\n");
+    result.append("   Command Time        Wait Lane pParam\n");
     for (size_t i = 0; i < mAudioCommands.size(); i++) {
         mAudioCommands[i]->dump(buffer, SIZE);
         result.append(buffer);
@@ -833,6 +862,14 @@ status_t AudioPolicyService::AudioCommandThread::dump(int fd)
     result.append("  Last Command\n");
     mLastCommand.dump(buffer, SIZE);
     result.append(buffer);
+    result.append("  Statistics\n");
+    result.append("   Command Count    Coalesced Avg late ms Max late ms Avg exec ms Max exec ms\n");
+    for (int i = 0; i < kNumCommands; i++) {
+        if (mStats[i].mCount != 0 || mStats[i].mCoalesced != 0) {
+            mStats[i].dump(i, buffer, SIZE);
+            result.append(buffer);
+        }
+    }
 
     write(fd, result.string(), result.size());
 
@@ -906,6 +943,12 @@ status_t AudioPolicyService::AudioCommandThread::parametersCommand(audio_io_hand
     data->mIO = ioHandle;
     data->mKeyValuePairs = String8(keyValuePairs);
     command->mParam = data;
+    // routing changes must not wait behind other parameters
+    AudioParameter param = AudioParameter(data->mKeyValuePairs);
+    String8 routing;
+    if (param.get(String8(AudioParameter::keyRouting), routing) != NO_ERROR) {
+        command->mLane = LANE_BULK;
+    }
     Mutex::Autolock _l(mLock);
     insertCommand_l(command, delayMs);
     ALOGV("AudioCommandThread() adding set parameter string %s, io %d ,delay %d",
@@ -970,6 +1013,26 @@ void AudioPolicyService::AudioCommandThread::releaseOutputCommand(audio_io_handl
     mWaitWorkCV.signal();
 }
 
+// Removes from param2 the keys which are also in param
+static void filterParameters(AudioParameter& param2, AudioParameter& param)
+{
+    for (size_t j = 0; j < param.size(); j++) {
+        String8 key;
+        String8 value;
+        param.getAt(j, key, value);
+        for (size_t k = 0; k < param2.size(); k++) {
+            String8 key2;
+            String8 value2;
+            param2.getAt(k, key2, value2);
+            if (key2 == key) {
+                param2.remove(key2);
+                ALOGV("Filtering out parameter %s", key2.string());
+                break;
+            }
+        }
+    }
+}
+
 // insertCommand_l() must be called with mLock held
 void AudioPolicyService::AudioCommandThread::insertCommand_l(AudioCommand *command, int delayMs)
 {
@@ -998,21 +1061,7 @@ void AudioPolicyService::AudioCommandThread::insertCommand_l(AudioCommand *comma
                     data2->mKeyValuePairs.string(), data->mKeyValuePairs.string());
             AudioParameter param = AudioParameter(data->mKeyValuePairs);
             AudioParameter param2 = AudioParameter(data2->mKeyValuePairs);
-            for (size_t j = 0; j < param.size(); j++) {
-                String8 key;
-                String8 value;
-                param.getAt(j, key, value);
-                for (size_t k = 0; k < param2.size(); k++) {
-                    String8 key2;
-                    String8 value2;
-                    param2.getAt(k, key2, value2);
-                    if (key2 == key) {
-                        param2.remove(key2);
-                        ALOGV("Filtering out parameter %s", key2.string());
-                        break;
-                    }
-                }
-            }
+            filterParameters(param2, param);
             // if all keys have been filtered out, remove the command.
             // otherwise, update the key value pairs
             if (param2.size() == 0) {
@@ -1046,13 +1095,55 @@ void AudioPolicyService::AudioCommandThread::insertCommand_l(AudioCommand *comma
         }
     }
 
-    // remove filtered commands
+    // A command due now also supersedes the same settings in earlier commands which are due
+    // but not yet executed, because the thread is busy: drop them so that a backlog only applies
+    // the latest value of each key.  Commands with a waiting caller are left alone.
+    if (delayMs == 0) {
+        for (ssize_t j = i; j >= 0; j--) {
+            AudioCommand *command2 = mAudioCommands[j];
+            if (command2->mCommand != command->mCommand || command2->mWaitStatus) continue;
+
+            if (command->mCommand == SET_PARAMETERS) {
+                ParametersData *data = (ParametersData *)command->mParam;
+                ParametersData *data2 = (ParametersData *)command2->mParam;
+                if (data->mIO != data2->mIO) continue;
+                AudioParameter param = AudioParameter(data->mKeyValuePairs);
+                AudioParameter param2 = AudioParameter(data2->mKeyValuePairs);
+                filterParameters(param2, param);
+                if (param2.size() == 0) {
+                    removedCommands.add(command2);
+                } else {
+                    data2->mKeyValuePairs = param2.toString();
+                }
+            } else if (command->mCommand == SET_VOLUME) {
+                VolumeData *data = (VolumeData *)command->mParam;
+                VolumeData *data2 = (VolumeData *)command2->mParam;
+                if (data->mIO != data2->mIO || data->mStream != data2->mStream) continue;
+                ALOGV("Filtering out earlier volume command on output %d for stream %d",
+                        data->mIO, data->mStream);
+                removedCommands.add(command2);
+            }
+        }
+    }
+
+    // remove filtered commands: only SET_PARAMETERS and SET_VOLUME commands are filtered,
+    // and nobody waits for their status
     for (size_t j = 0; j < removedCommands.size(); j++) {
-        // removed commands always have time stamps greater than current command
-        for (size_t k = i + 1; k < mAudioCommands.size(); k++) {
+        for (size_t k = 0; k < mAudioCommands.size(); k++) {
             if (mAudioCommands[k] == removedCommands[j]) {
-                ALOGV("suppressing command: %d", mAudioCommands[k]->mCommand);
+                AudioCommand *command2 = mAudioCommands[k];
+                ALOGV("suppressing command: %d", command2->mCommand);
                 mAudioCommands.removeAt(k);
+                if ((ssize_t)k <= i) {
+                    i--;
+                }
+                mStats[command2->mCommand].mCoalesced++;
+                if (command2->mCommand == SET_PARAMETERS) {
+                    delete (ParametersData *)command2->mParam;
+                } else {
+                    delete (VolumeData *)command2->mParam;
+                }
+                delete command2;
                 break;
             }
         }
@@ -1085,14 +1176,42 @@ void AudioPolicyService::AudioCommandThread::exit()
 
 void AudioPolicyService::AudioCommandThread::AudioCommand::dump(char* buffer, size_t size)
 {
-    snprintf(buffer, size, "   %02d      %06d.%03d  %01u    %p\n",
+    snprintf(buffer, size, "   %02d      %06d.%03d  %01u    %01d    %p\n",
             mCommand,
             (int)ns2s(mTime),
             (int)ns2ms(mTime)%1000,
             mWaitStatus,
+            mLane,
             mParam);
 }
 
+void AudioPolicyService::AudioCommandThread::CommandStats::add(nsecs_t latency, nsecs_t duration)
+{
+    mCount++;
+    mTotalLatency += latency;
+    if (latency > mMaxLatency) {
+        mMaxLatency = latency;
+    }
+    mTotalDuration += duration;
+    if (duration > mMaxDuration) {
+        mMaxDuration = duration;
+    }
+}
+
+void AudioPolicyService::AudioCommandThread::CommandStats::dump(int command, char* buffer,
+                                                                size_t size)
+{
+    double count = mCount != 0 ? mCount : 1;
+    snprintf(buffer, size, "   %02d      %-8u %-9u %11.3f %11.3f %11.3f %11.3f\n",
+            command,
+            mCount,
+            mCoalesced,
+            mTotalLatency / count * 1e-6,
+            mMaxLatency * 1e-6,
+            mTotalDuration / count * 1e-6,
+            mMaxDuration * 1e-6);
+}
+
 /******* helpers for the service_ops callbacks defined below *********/
 void AudioPolicyService::setParameters(audio_io_handle_t ioHandle,
                                        const char *keyValuePairs,
@@ -171,6 +171,13 @@ private:
             RELEASE_OUTPUT
         };
 
+        // priority lanes: a due command of the urgent lane runs before any due bulk command,
+        // so that volume and routing changes are not held up behind a burst of parameters
+        enum {
+            LANE_URGENT,
+            LANE_BULK
+        };
+
         AudioCommandThread (String8 name, const wp<AudioPolicyService>& service);
         virtual             ~AudioCommandThread();
 
@@ -202,11 +209,12 @@ private:
 
         public:
             AudioCommand()
-            : mCommand(-1) {}
+            : mCommand(-1), mLane(LANE_URGENT) {}
 
             void dump(char* buffer, size_t size);
 
             int mCommand;   // START_TONE, STOP_TONE ...
+            int mLane;      // LANE_URGENT or LANE_BULK
             nsecs_t mTime;  // time stamp
             Condition mCond; // condition for status return
             status_t mStatus; // command status
@@ -250,11 +258,32 @@ private:
             audio_io_handle_t mIO;
         };
 
+        // latency and execution time of one command type, for dump
+        class CommandStats {
+        public:
+            CommandStats()
+            : mCount(0), mCoalesced(0), mTotalLatency(0), mMaxLatency(0),
+              mTotalDuration(0), mMaxDuration(0) {}
+
+            void add(nsecs_t latency, nsecs_t duration);
+            void dump(int command, char* buffer, size_t size);
+
+            uint32_t mCount;        // number of commands executed
+            uint32_t mCoalesced;    // number of commands merged into a later one
+            nsecs_t mTotalLatency;  // sum of the delays between time stamp and execution
+            nsecs_t mMaxLatency;
+            nsecs_t mTotalDuration; // sum of the times spent in the executing call
+            nsecs_t mMaxDuration;
+        };
+
+        static const int kNumCommands = RELEASE_OUTPUT + 1;
+
         Mutex   mLock;
         Condition mWaitWorkCV;
         Vector <AudioCommand *> mAudioCommands; // list of pending commands
         ToneGenerator *mpToneGenerator;     // the tone generator
         AudioCommand mLastCommand;          // last processed command (used by dump)
+        CommandStats mStats[kNumCommands];  // per command type statistics (used by dump)
         String8 mName;                      // string used by wake lock fo delayed commands
         wp<AudioPolicyService> mService;
     };
@@ -35,12 +35,17 @@ public:
     // NOTE: high quality SRC will only be supported for
     // certain fixed rate conversions. Sample rate cannot be
     // changed dynamically.
+    //  DYN_LOW_QUALITY, DYN_MED_QUALITY, DYN_HIGH_QUALITY: multi-tap FIR with
+    // a filter bank designed for the actual conversion ratio (16, 32 and 64 taps)
     enum src_quality {
         DEFAULT_QUALITY=0,
         LOW_QUALITY=1,
         MED_QUALITY=2,
         HIGH_QUALITY=3,
         VERY_HIGH_QUALITY=4,
+        DYN_LOW_QUALITY=5,
+        DYN_MED_QUALITY=6,
+        DYN_HIGH_QUALITY=7,
     };
 
     static AudioResampler* create(int bitDepth, int inChannelCount,
@@ -0,0 +1,565 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "AudioResamplerDyn"
+//#define LOG_NDEBUG 0
+
+#include <malloc.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cutils/atomic.h>
+#include <cutils/compiler.h>
+#include <cutils/log.h>
+#include <utils/AndroidThreads.h>
+
+#include "AudioResamplerDyn.h"
+
+namespace android {
+// ----------------------------------------------------------------------------
+
+// filter design parameters for each quality level
+struct DynQuality {
+    uint32_t halfNumCoefs;  // taps on each side of the filter, when not downsampling
+    double beta;            // Kaiser window shape, sets the stopband attenuation
+    double passband;        // cutoff relative to the Nyquist frequency of the lower rate
+};
+
+// The stopband attenuation is set by beta alone.  The transition band is kept at the same
+// fraction of the cutoff by scaling the taps with the downsampling ratio, up to
+// kMaxHalfNumCoefs; beyond that the transition band widens and reaches into the stopband.
+static const DynQuality kDynLowQuality  = {  8,  6.0, 0.80 };   // ~60 dB stopband
+static const DynQuality kDynMedQuality  = { 16,  8.0, 0.88 };   // ~80 dB stopband
+static const DynQuality kDynHighQuality = { 32, 10.0, 0.92 };   // ~100 dB stopband
+
+static const DynQuality& dynQuality(AudioResampler::src_quality quality)
+{
+    switch (quality) {
+    case AudioResampler::DYN_LOW_QUALITY:
+        return kDynLowQuality;
+    case AudioResampler::DYN_MED_QUALITY:
+        return kDynMedQuality;
+    default:
+    case AudioResampler::DYN_HIGH_QUALITY:
+        return kDynHighQuality;
+    }
+}
+
+// number of fraction bits of the cutoff in the cache key
+static const int kCutoffBits = 16;
+// banks for ratios that need phase interpolation are shared between nearby ratios,
+// by rounding their cutoff down to a multiple of 2^-(kCutoffBits - kCutoffShareShift)
+static const int kCutoffShareShift = 6;
+
+struct AudioResamplerDyn::FilterBank {
+    // cache key
+    uint32_t phases;
+    uint32_t cutoff;                // in cycles per input sample, kCutoffBits fraction bits
+    uint32_t halfNumCoefs;
+    src_quality quality;
+
+    // (phases + 1) rows of 2 * halfNumCoefs coefficients in Q1.30; the extra row lets the
+    // interpolated banks read the phase following the last one
+    int32_t* coefs;
+    volatile int32_t ready;         // coefs are designed, see isFilterBankReady()
+
+    int refCount;
+    FilterBank* next;
+    FilterBank* nextPending;        // in the design queue
+};
+
+// ----------------------------------------------------------------------------
+
+// zeroth order modified Bessel function of the first kind, for the Kaiser window
+static double besselI0(double x)
+{
+    const double y = x * x / 4;
+    double sum = 1;
+    double term = 1;
+    for (int k = 1; term > sum * 1e-12; k++) {
+        term *= y / (double(k) * k);
+        sum += term;
+    }
+    return sum;
+}
+
+static void designFilterBank(AudioResamplerDyn::FilterBank* bank, double beta)
+{
+    const uint32_t halfNumCoefs = bank->halfNumCoefs;
+    const uint32_t numCoefs = 2 * halfNumCoefs;
+    const double fc = double(bank->cutoff) / (1 << kCutoffBits);
+    const double i0Beta = besselI0(beta);
+
+    for (uint32_t p = 0; p <= bank->phases; p++) {
+        // distance between the output position and the tap's input frame
+        const double frac = double(p) / bank->phases;
+        int32_t* row = bank->coefs + p * numCoefs;
+        for (uint32_t j = 0; j < numCoefs; j++) {
+            const double t = frac - (double(j) - (halfNumCoefs - 1));
+            const double x = t / halfNumCoefs;
+            double h = 0;
+            if (x > -1 && x < 1) {
+                const double arg = 2 * M_PI * fc * t;
+                const double sinc = (t == 0) ? 1 : sin(arg) / arg;
+                h = 2 * fc * sinc * besselI0(beta * sqrt(1 - x * x)) / i0Beta;
+            }
+            row[j] = int32_t(floor(h * (1 << 30) + 0.5));
+        }
+    }
+    android_atomic_release_store(1, &bank->ready);
+}
+
+static bool isFilterBankReady(const AudioResamplerDyn::FilterBank* bank)
+{
+    return android_atomic_acquire_load(&bank->ready) != 0;
+}
+
+// Process-wide cache of filter banks, most recently used first.  Banks in use are never
+// freed; up to kMaxUnusedBanks unreferenced banks are kept so that a track being recreated
+// with the same rate does not redesign its filter.
+static const int kMaxUnusedBanks = 4;
+static pthread_mutex_t sBankLock = PTHREAD_MUTEX_INITIALIZER;
+static AudioResamplerDyn::FilterBank* sBanks = NULL;
+
+// Banks waiting to be designed by the design thread, oldest first.  Each queued bank holds
+// a reference until it is designed.
+static pthread_cond_t sPendingCond = PTHREAD_COND_INITIALIZER;
+static AudioResamplerDyn::FilterBank* sPendingHead = NULL;
+static AudioResamplerDyn::FilterBank* sPendingTail = NULL;
+static bool sDesignThreadStarted = false;
+
+static void freeFilterBank(AudioResamplerDyn::FilterBank* bank)
+{
+    free(bank->coefs);
+    delete bank;
+}
+
+// must be called with sBankLock held
+static void trimFilterBanks_l()
+{
+    int unused = 0;
+    for (AudioResamplerDyn::FilterBank** pp = &sBanks; *pp != NULL; ) {
+        AudioResamplerDyn::FilterBank* bank = *pp;
+        if (bank->refCount == 0 && ++unused > kMaxUnusedBanks) {
+            *pp = bank->next;
+            freeFilterBank(bank);
+        } else {
+            pp = &bank->next;
+        }
+    }
+}
+
+// must be called with sBankLock held
+static AudioResamplerDyn::FilterBank* findFilterBank_l(uint32_t phases, uint32_t cutoff,
+        uint32_t halfNumCoefs, AudioResampler::src_quality quality)
+{
+    for (AudioResamplerDyn::FilterBank** pp = &sBanks; *pp != NULL; pp = &(*pp)->next) {
+        AudioResamplerDyn::FilterBank* bank = *pp;
+        if (bank->phases == phases && bank->cutoff == cutoff &&
+                bank->halfNumCoefs == halfNumCoefs && bank->quality == quality) {
+            // move to front
+            *pp = bank->next;
+            bank->next = sBanks;
+            sBanks = bank;
+            bank->refCount++;
+            return bank;
+        }
+    }
+    return NULL;
+}
+
+// Designs the queued banks, one at a time, at normal priority rather than at the priority of
+// the mixer thread that asked for them.
+static void* designThreadLoop(void* /*arg*/)
+{
+    androidSetThreadPriority(0, ANDROID_PRIORITY_NORMAL);
+    pthread_mutex_lock(&sBankLock);
+    for (;;) {
+        while (sPendingHead == NULL) {
+            pthread_cond_wait(&sPendingCond, &sBankLock);
+        }
+        AudioResamplerDyn::FilterBank* bank = sPendingHead;
+        sPendingHead = bank->nextPending;
+        if (sPendingHead == NULL) {
+            sPendingTail = NULL;
+        }
+        pthread_mutex_unlock(&sBankLock);
+
+        designFilterBank(bank, dynQuality(bank->quality).beta);
+        ALOGV("designed filter bank: %u phases, cutoff %#x, %u taps, quality %d",
+                bank->phases, bank->cutoff, 2 * bank->halfNumCoefs, bank->quality);
+
+        pthread_mutex_lock(&sBankLock);
+        bank->refCount--;
+        trimFilterBanks_l();
+    }
+    return NULL;
+}
+
+// must be called with sBankLock held
+static void queueFilterBank_l(AudioResamplerDyn::FilterBank* bank)
+{
+    if (!sDesignThreadStarted) {
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        sDesignThreadStarted = pthread_create(&thread, &attr, designThreadLoop, NULL) == 0;
+        pthread_attr_destroy(&attr);
+        if (!sDesignThreadStarted) {
+            ALOGE("failed to start the filter design thread");
+            designFilterBank(bank, dynQuality(bank->quality).beta);
+            return;
+        }
+    }
+    bank->refCount++;
+    bank->nextPending = NULL;
+    if (sPendingTail != NULL) {
+        sPendingTail->nextPending = bank;
+    } else {
+        sPendingHead = bank;
+    }
+    sPendingTail = bank;
+    pthread_cond_signal(&sPendingCond);
+}
+
+// Returns the bank from the cache, or adds it.  A new bank is designed right away if "wait",
+// and otherwise by the design thread; isFilterBankReady() tells when it can be used.
+static const AudioResamplerDyn::FilterBank* acquireFilterBank(uint32_t phases, uint32_t cutoff,
+        uint32_t halfNumCoefs, AudioResampler::src_quality quality, bool wait)
+{
+    pthread_mutex_lock(&sBankLock);
+    AudioResamplerDyn::FilterBank* bank =
+            findFilterBank_l(phases, cutoff, halfNumCoefs, quality);
+    pthread_mutex_unlock(&sBankLock);
+    if (bank != NULL) {
+        return bank;
+    }
+
+    AudioResamplerDyn::FilterBank* newBank = new AudioResamplerDyn::FilterBank;
+    newBank->phases = phases;
+    newBank->cutoff = cutoff;
+    newBank->halfNumCoefs = halfNumCoefs;
+    newBank->quality = quality;
+    newBank->coefs = (int32_t*) memalign(32,
+            (phases + 1) * 2 * halfNumCoefs * sizeof(int32_t));
+    newBank->ready = 0;
+    newBank->refCount = 1;
+    newBank->nextPending = NULL;
+    if (wait) {
+        // design outside of the lock, so other resamplers are not blocked meanwhile
+        designFilterBank(newBank, dynQuality(quality).beta);
+        ALOGV("designed filter bank: %u phases, cutoff %#x, %u taps, quality %d",
+                phases, cutoff, 2 * halfNumCoefs, quality);
+    }
+
+    pthread_mutex_lock(&sBankLock);
+    // another resampler may have added the same bank in the meantime
+    bank = findFilterBank_l(phases, cutoff, halfNumCoefs, quality);
+    if (bank == NULL) {
+        newBank->next = sBanks;
+        sBanks = newBank;
+        bank = newBank;
+        newBank = NULL;
+        if (!wait) {
+            queueFilterBank_l(bank);
+        }
+        trimFilterBanks_l();
+    }
+    pthread_mutex_unlock(&sBankLock);
+    if (newBank != NULL) {
+        freeFilterBank(newBank);
+    }
+    return bank;
+}
+
+static void releaseFilterBank(const AudioResamplerDyn::FilterBank* bank)
+{
+    if (bank == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&sBankLock);
+    const_cast<AudioResamplerDyn::FilterBank*>(bank)->refCount--;
+    trimFilterBanks_l();
+    pthread_mutex_unlock(&sBankLock);
+}
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+    while (b != 0) {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// ----------------------------------------------------------------------------
+
+AudioResamplerDyn::AudioResamplerDyn(int bitDepth,
+        int inChannelCount, int32_t sampleRate, src_quality quality)
+    : AudioResampler(bitDepth, inChannelCount, sampleRate, quality),
+    mBank(NULL), mPendingBank(NULL), mHalfNumCoefs(dynQuality(quality).halfNumCoefs),
+    mL(1), mM(1), mPhase(0), mConsume(0),
+    mState(NULL), mHead(0), mCoefs(NULL)
+{
+}
+
+AudioResamplerDyn::~AudioResamplerDyn()
+{
+    releaseFilterBank(mBank);
+    releaseFilterBank(mPendingBank);
+    free(mState);
+    free(mCoefs);
+}
+
+void AudioResamplerDyn::init()
+{
+    // sized for the longest filter, so that a rate change never reallocates
+    const size_t numCoefs = 2 * kMaxHalfNumCoefs;
+    const size_t stateSize = 2 * numCoefs * mChannelCount;
+    mState = (int16_t*) memalign(32, stateSize * sizeof(int16_t));
+    memset(mState, 0, stateSize * sizeof(int16_t));
+    mHead = 0;
+    mCoefs = (int32_t*) memalign(32, numCoefs * sizeof(int32_t));
+}
+
+void AudioResamplerDyn::reset()
+{
+    AudioResampler::reset();
+    memset(mState, 0, 2 * 2 * kMaxHalfNumCoefs * mChannelCount * sizeof(int16_t));
+    mHead = 0;
+    mPhase = 0;
+    mConsume = 0;
+}
+
+void AudioResamplerDyn::setHalfNumCoefs(uint32_t halfNumCoefs)
+{
+    if (halfNumCoefs == mHalfNumCoefs) {
+        return;
+    }
+    // Keep the most recent frames, padded with silence when the filter gets longer.  The
+    // delay of the filter changes with its length, so the output shifts by the difference.
+    const uint32_t oldNumCoefs = 2 * mHalfNumCoefs;
+    const uint32_t numCoefs = 2 * halfNumCoefs;
+    const uint32_t kept = oldNumCoefs < numCoefs ? oldNumCoefs : numCoefs;
+    int16_t window[2 * kMaxHalfNumCoefs * 2];
+    memset(window, 0, (numCoefs - kept) * mChannelCount * sizeof(int16_t));
+    memcpy(window + (numCoefs - kept) * mChannelCount,
+            mState + (mHead + oldNumCoefs - kept) * mChannelCount,
+            kept * mChannelCount * sizeof(int16_t));
+    memcpy(mState, window, numCoefs * mChannelCount * sizeof(int16_t));
+    memcpy(mState + numCoefs * mChannelCount, window, numCoefs * mChannelCount * sizeof(int16_t));
+    mHead = 0;
+    mHalfNumCoefs = halfNumCoefs;
+}
+
+void AudioResamplerDyn::setSampleRate(int32_t inSampleRate)
+{
+    // called on every mix cycle, so only redesign when the ratio actually changes
+    if (mBank != NULL && inSampleRate == mInSampleRate) {
+        return;
+    }
+    AudioResampler::setSampleRate(inSampleRate);
+
+    const uint32_t g = gcd(inSampleRate, mSampleRate);
+    const uint32_t L = mSampleRate / g;
+    const uint32_t M = inSampleRate / g;
+    const DynQuality& q(dynQuality(getQuality()));
+
+    // anti-aliasing cutoff in cycles per input sample, and taps to match
+    double fc = 0.5 * q.passband;
+    uint32_t halfNumCoefs = q.halfNumCoefs;
+    if (M > L) {
+        fc = fc * L / M;
+        const uint64_t scaled = (uint64_t(q.halfNumCoefs) * M + L - 1) / L;
+        halfNumCoefs = kMaxHalfNumCoefs;
+        if (scaled < kMaxHalfNumCoefs) {
+            halfNumCoefs = uint32_t(scaled);
+        }
+    }
+    uint32_t cutoff = uint32_t(fc * (1 << kCutoffBits));
+
+    uint32_t phases = L;
+    if (L > kMaxExactPhases) {
+        phases = kMaxInterpPhases;
+        cutoff = (cutoff >> kCutoffShareShift) << kCutoffShareShift;
+    }
+
+    // Small banks are designed here.  Larger ones take too long for the mixer thread, which
+    // interpolates a small bank with the same filter until the design thread is done with
+    // them.  A phase count is always designed the same way, so a cached small bank is ready.
+    const FilterBank* bank;
+    const FilterBank* pendingBank = NULL;
+    if (phases <= kFallbackPhases) {
+        bank = acquireFilterBank(phases, cutoff, halfNumCoefs, getQuality(), true /*wait*/);
+    } else {
+        bank = acquireFilterBank(phases, cutoff, halfNumCoefs, getQuality(), false /*wait*/);
+        if (!isFilterBankReady(bank)) {
+            pendingBank = bank;
+            bank = acquireFilterBank(kFallbackPhases, cutoff, halfNumCoefs, getQuality(),
+                    true /*wait*/);
+        }
+    }
+    releaseFilterBank(mBank);
+    releaseFilterBank(mPendingBank);
+    mBank = bank;
+    mPendingBank = pendingBank;
+    setHalfNumCoefs(halfNumCoefs);
+
+    // keep the current position within the input frame
+    mPhase = uint32_t((uint64_t(mPhase) * L) / mL);
+    mL = L;
+    mM = M;
+}
+
+template<int CHANNELS>
+void AudioResamplerDyn::push(const int16_t* frame)
+{
+    const uint32_t numCoefs = 2 * mHalfNumCoefs;
+    int16_t* s = mState + mHead * CHANNELS;
+    for (int i = 0; i < CHANNELS; i++) {
+        s[i] = s[numCoefs * CHANNELS + i] = frame[i];
+    }
+    if (++mHead >= numCoefs) {
+        mHead = 0;
+    }
+}
+
+void AudioResamplerDyn::resample(int32_t* out, size_t outFrameCount,
+        AudioBufferProvider* provider)
+{
+    if (CC_UNLIKELY(mBank == NULL)) {
+        setSampleRate(mInSampleRate);
+    }
+    // switch to the full bank once the design thread is done with it; it has the same taps
+    if (mPendingBank != NULL && isFilterBankReady(mPendingBank)) {
+        releaseFilterBank(mBank);
+        mBank = mPendingBank;
+        mPendingBank = NULL;
+    }
+    const bool interpolate = mBank->phases != mL;
+
+    // select the appropriate resampler
+    switch (mChannelCount) {
+    case 1:
+        if (interpolate) {
+            resample<1, true>(out, outFrameCount, provider);
+        } else {
+            resample<1, false>(out, outFrameCount, provider);
+        }
+        break;
+    case 2:
+        if (interpolate) {
+            resample<2, true>(out, outFrameCount, provider);
+        } else {
+            resample<2, false>(out, outFrameCount, provider);
+        }
+        break;
+    }
+}
+
+template<int CHANNELS, bool INTERPOLATE>
+void AudioResamplerDyn::resample(int32_t* out, size_t outFrameCount,
+        AudioBufferProvider* provider)
+{
+    const uint32_t numCoefs = 2 * mHalfNumCoefs;
+    const int32_t* const bankCoefs = mBank->coefs;
+    const uint32_t bankPhases = mBank->phases;
+    const uint32_t L = mL;
+    const uint32_t M = mM;
+    const int32_t vl = mVolume[0];
+    const int32_t vr = mVolume[1];
+
+    size_t inputIndex = mInputIndex;
+    uint32_t phase = mPhase;
+    uint32_t consume = mConsume;
+    size_t outputIndex = 0;
+    size_t inFrameCount = (outFrameCount * mInSampleRate) / mSampleRate;
+    if (inFrameCount == 0) {
+        inFrameCount = 1;
+    }
+
+    while (outputIndex < outFrameCount) {
+        // bring the input frames needed by this output frame into the history
+        while (consume > 0) {
+            if (mBuffer.frameCount == 0) {
+                mBuffer.frameCount = inFrameCount;
+                provider->getNextBuffer(&mBuffer, calculateOutputPTS(outputIndex));
+                if (mBuffer.raw == NULL) {
+                    goto resample_exit;
+                }
+            }
+            push<CHANNELS>(mBuffer.i16 + inputIndex * CHANNELS);
+            consume--;
+            if (++inputIndex >= mBuffer.frameCount) {
+                inputIndex -= mBuffer.frameCount;
+                provider->releaseBuffer(&mBuffer);
+            }
+        }
+
+        const int32_t* coefs;
+        if (INTERPOLATE) {
+            const uint64_t pos = uint64_t(phase) * bankPhases;
+            const uint32_t index = uint32_t(pos / L);
+            const int32_t frac = int32_t(((pos - uint64_t(index) * L) << kInterpBits) / L);
+            const int32_t* c0 = bankCoefs + index * numCoefs;
+            const int32_t* c1 = c0 + numCoefs;
+            for (uint32_t j = 0; j < numCoefs; j++) {
+                mCoefs[j] = c0[j] + int32_t((int64_t(c1[j] - c0[j]) * frac) >> kInterpBits);
+            }
+            coefs = mCoefs;
+        } else {
+            coefs = bankCoefs + phase * numCoefs;
+        }
+
+        // the history holds the numCoefs most recent frames, oldest first
+        const int16_t* s = mState + mHead * CHANNELS;
+        int64_t l = 0;
+        int64_t r = 0;
+        for (uint32_t j = 0; j < numCoefs; j++) {
+            l += int64_t(s[0]) * coefs[j];
+            if (CHANNELS == 2) {
+                r += int64_t(s[1]) * coefs[j];
+            }
+            s += CHANNELS;
+        }
+        if (CHANNELS == 1) {
+            r = l;
+        }
+        // Q15.30 sum times Q4.12 volume, accumulated as Q19.12
+        out[outputIndex * 2] += int32_t(((l >> 14) * vl) >> 16);
+        out[outputIndex * 2 + 1] += int32_t(((r >> 14) * vr) >> 16);
+        outputIndex++;
+
+        // rational phase step: advance M/L input frames
+        phase += M;
+        if (phase >= L) {
+            consume = phase / L;
+            phase -= consume * L;
+        }
+    }
+
+resample_exit:
+    mInputIndex = inputIndex;
+    mPhase = phase;
+    mConsume = consume;
+}
+
+// ----------------------------------------------------------------------------
+}; // namespace android
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_AUDIO_RESAMPLER_DYN_H
+#define ANDROID_AUDIO_RESAMPLER_DYN_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <cutils/log.h>
+
+#include "AudioResampler.h"
+
+namespace android {
+// ----------------------------------------------------------------------------
+
+/*
+ * Polyphase FIR resampler whose Kaiser windowed sinc filter bank is designed at run time
+ * for the actual input/output ratio, instead of using a fixed coefficient table.
+ *
+ * The ratio is reduced to L/M (output/input); when L is small enough the bank has exactly
+ * L phases and the phase is stepped rationally, so the output never drifts.  For ratios with
+ * a large L, a bank with kMaxInterpPhases phases is used and adjacent phases are linearly
+ * interpolated, with the phase itself still tracked exactly.
+ *
+ * When downsampling, the cutoff and the transition band scale with L/M, and the number of
+ * taps with M/L up to kMaxHalfNumCoefs on each side.
+ *
+ * Banks are cached process-wide, keyed by phase count, cutoff, taps and quality, and shared
+ * by all resamplers using the same conversion.  Banks with more than kFallbackPhases phases
+ * are designed on a separate thread; until they are ready, the resampler interpolates a
+ * kFallbackPhases bank of the same filter.
+ */
+class AudioResamplerDyn : public AudioResampler {
+public:
+    AudioResamplerDyn(int bitDepth, int inChannelCount, int32_t sampleRate,
+            src_quality quality);
+
+    virtual ~AudioResamplerDyn();
+
+    virtual void init();
+    virtual void setSampleRate(int32_t inSampleRate);
+    virtual void resample(int32_t* out, size_t outFrameCount,
+            AudioBufferProvider* provider);
+    virtual void reset();
+
+    struct FilterBank;
+
+private:
+    // largest phase count for which the exact L phase bank is used
+    static const uint32_t kMaxExactPhases = 512;
+    // phase count of the interpolated bank used for larger L
+    static const uint32_t kMaxInterpPhases = 256;
+    // number of fraction bits used to interpolate between phases
+    static const int kInterpBits = 15;
+    // largest phase count designed on the mixer thread, and used while a larger bank is pending
+    static const uint32_t kFallbackPhases = 16;
+    // cap on the taps on each side of the filter when downsampling
+    static const uint32_t kMaxHalfNumCoefs = 128;
+
+    template<int CHANNELS, bool INTERPOLATE>
+    void resample(int32_t* out, size_t outFrameCount,
+            AudioBufferProvider* provider);
+
+    // appends one input frame to the filter history
+    template<int CHANNELS>
+    inline void push(const int16_t* frame);
+
+    // changes the filter length, keeping as much of the history as fits
+    void setHalfNumCoefs(uint32_t halfNumCoefs);
+
+    const FilterBank* mBank;
+    const FilterBank* mPendingBank; // bank being designed for the current ratio, or NULL
+    uint32_t mHalfNumCoefs;     // taps on each side of the filter
+    uint32_t mL;                // output rate / gcd
+    uint32_t mM;                // input rate / gcd
+    uint32_t mPhase;            // current phase numerator, in [0, mL)
+    uint32_t mConsume;          // input frames to push before the next output frame
+
+    // Filter history, 2 * numCoefs frames, allocated for kMaxHalfNumCoefs.  Each frame is
+    // written twice, numCoefs frames apart, so the most recent numCoefs frames are always
+    // contiguous at mState + mHead.
+    int16_t* mState;
+    uint32_t mHead;
+    int32_t* mCoefs;            // scratch buffer for interpolated coefficients
+};
+
+// ----------------------------------------------------------------------------
+}; // namespace android
+
+#endif /*ANDROID_AUDIO_RESAMPLER_DYN_H*/
@@ -43,6 +43,15 @@
 #define USE_NEON (false)
 #endif
 
+// x86 vector kernels are compiled with per-function target attributes and selected at runtime,
+// so the library still runs on processors without SSE4.1 or AVX2
+#if (defined(__i386__) || defined(__x86_64__)) && defined(__GNUC__)
+#define USE_X86_SIMD (true)
+#include <immintrin.h>
+#else
+#define USE_X86_SIMD (false)
+#endif
+
 
 namespace android {
 // ----------------------------------------------------------------------------
@@ -328,11 +337,28 @@ static const int pLerpBits = 15;
 static pthread_once_t once_control = PTHREAD_ONCE_INIT;
 static readCoefficientsFn readResampleCoefficients = NULL;
 
+// Vectorized FIR kernels, selected once by init_routine() according to the CPU features.
+// A kernel accumulates both sides of the filter into l and r exactly like the scalar loop in
+// filterCoefficient(), and requires halfNumCoefs to be a multiple of its vector width.
+
+struct SincKernel {
+    sincKernelFn mono;
+    sincKernelFn stereo;
+    unsigned int width;     // number of taps processed per iteration
+};
+
+static SincKernel sincKernel;
+
 /*static*/ AudioResamplerSinc::Constants AudioResamplerSinc::highQualityConstants;
 /*static*/ AudioResamplerSinc::Constants AudioResamplerSinc::veryHighQualityConstants;
 
+// forward declarations, the kernels are defined after the scalar helpers
+static void selectSincKernel();
+
 void AudioResamplerSinc::init_routine()
 {
+    selectSincKernel();
+
     // for high quality resampler, the parameters for coefficients are compile-time constants
     Constants *c = &highQualityConstants;
     c->coefsBits = RESAMPLE_FIR_LERP_INT_BITS;
@@ -447,12 +473,187 @@ int32_t mulAddRL(int left, uint32_t inRL, int32_t v, int32_t a)
 #endif
 }
 
+#if USE_X86_SIMD
+
+// The x86 kernels reproduce the scalar fixed point arithmetic lane by lane: each product is
+// computed in 64 bits and truncated to bits [16, 48), and the partial sums wrap like the
+// scalar int32_t accumulators, so the result is bit-exact with the C implementation.
+// SSE2 has no signed 32x32->64 multiply, hence the SSE4.1 baseline.
+
+// returns (int64_t(a) * b) >> 16 in each 32-bit lane
+static inline __attribute__((target("sse4.1")))
+__m128i mulShift16_sse41(__m128i a, __m128i b)
+{
+    __m128i even = _mm_srli_epi64(_mm_mul_epi32(a, b), 16);
+    __m128i odd = _mm_mul_epi32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    odd = _mm_slli_epi64(_mm_srli_epi64(odd, 16), 32);
+    return _mm_blend_epi16(even, odd, 0xCC);
+}
+
+// interpolates 4 coefficients between two adjacent phases, see interpolate()
+static inline __attribute__((target("sse4.1")))
+__m128i interpolateCoefs_sse41(const int32_t* coefs, size_t offset, __m128i lerp)
+{
+    __m128i c0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(coefs));
+    __m128i c1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(coefs + offset));
+    __m128i d = _mm_slli_epi32(_mm_sub_epi32(c1, c0), 1);
+    return _mm_add_epi32(c0, mulShift16_sse41(d, lerp));
+}
+
+static inline __attribute__((target("sse4.1")))
+int32_t horizontalAdd_sse41(__m128i v)
+{
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(v);
+}
+
+template<int CHANNELS>
+static __attribute__((target("sse4.1")))
+void sincKernel_sse41(int32_t& l, int32_t& r,
+        const int32_t* coefsP, const int32_t* coefsN, size_t offset,
+        int32_t lerpP, int32_t lerpN, const int16_t* sP, const int16_t* sN)
+{
+    const __m128i vLerpP = _mm_set1_epi32(lerpP);
+    const __m128i vLerpN = _mm_set1_epi32(lerpN);
+    __m128i accL = _mm_setzero_si128();
+    __m128i accR = _mm_setzero_si128();
+    // the positive side walks the samples backwards
+    sP -= 3 * CHANNELS;
+    for (size_t i = 0; i < offset; i += 4) {
+        const __m128i sincP = interpolateCoefs_sse41(coefsP + i, offset, vLerpP);
+        const __m128i sincN = interpolateCoefs_sse41(coefsN + i, offset, vLerpN);
+        if (CHANNELS == 2) {
+            const __m128i inP = _mm_shuffle_epi32(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(sP)), _MM_SHUFFLE(0, 1, 2, 3));
+            const __m128i inN = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sN));
+            accL = _mm_add_epi32(accL, mulShift16_sse41(sincP,
+                    _mm_srai_epi32(_mm_slli_epi32(inP, 16), 16)));
+            accR = _mm_add_epi32(accR, mulShift16_sse41(sincP, _mm_srai_epi32(inP, 16)));
+            accL = _mm_add_epi32(accL, mulShift16_sse41(sincN,
+                    _mm_srai_epi32(_mm_slli_epi32(inN, 16), 16)));
+            accR = _mm_add_epi32(accR, mulShift16_sse41(sincN, _mm_srai_epi32(inN, 16)));
+        } else {
+            const __m128i inP = _mm_shuffle_epi32(_mm_cvtepi16_epi32(
+                    _mm_loadl_epi64(reinterpret_cast<const __m128i*>(sP))),
+                    _MM_SHUFFLE(0, 1, 2, 3));
+            const __m128i inN = _mm_cvtepi16_epi32(
+                    _mm_loadl_epi64(reinterpret_cast<const __m128i*>(sN)));
+            accL = _mm_add_epi32(accL, mulShift16_sse41(sincP, inP));
+            accL = _mm_add_epi32(accL, mulShift16_sse41(sincN, inN));
+        }
+        sP -= 4 * CHANNELS;
+        sN += 4 * CHANNELS;
+    }
+    l = horizontalAdd_sse41(accL);
+    r = CHANNELS == 2 ? horizontalAdd_sse41(accR) : l;
+}
+
+static inline __attribute__((target("avx2")))
+__m256i mulShift16_avx2(__m256i a, __m256i b)
+{
+    __m256i even = _mm256_srli_epi64(_mm256_mul_epi32(a, b), 16);
+    __m256i odd = _mm256_mul_epi32(_mm256_srli_epi64(a, 32), _mm256_srli_epi64(b, 32));
+    odd = _mm256_slli_epi64(_mm256_srli_epi64(odd, 16), 32);
+    return _mm256_blend_epi32(even, odd, 0xAA);
+}
+
+static inline __attribute__((target("avx2")))
+__m256i interpolateCoefs_avx2(const int32_t* coefs, size_t offset, __m256i lerp)
+{
+    __m256i c0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(coefs));
+    __m256i c1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(coefs + offset));
+    __m256i d = _mm256_slli_epi32(_mm256_sub_epi32(c1, c0), 1);
+    return _mm256_add_epi32(c0, mulShift16_avx2(d, lerp));
+}
+
+static inline __attribute__((target("avx2")))
+int32_t horizontalAdd_avx2(__m256i v)
+{
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(s);
+}
+
+template<int CHANNELS>
+static __attribute__((target("avx2")))
+void sincKernel_avx2(int32_t& l, int32_t& r,
+        const int32_t* coefsP, const int32_t* coefsN, size_t offset,
+        int32_t lerpP, int32_t lerpN, const int16_t* sP, const int16_t* sN)
+{
+    const __m256i vLerpP = _mm256_set1_epi32(lerpP);
+    const __m256i vLerpN = _mm256_set1_epi32(lerpN);
+    const __m256i reverse = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+    __m256i accL = _mm256_setzero_si256();
+    __m256i accR = _mm256_setzero_si256();
+    // the positive side walks the samples backwards
+    sP -= 7 * CHANNELS;
+    for (size_t i = 0; i < offset; i += 8) {
+        const __m256i sincP = interpolateCoefs_avx2(coefsP + i, offset, vLerpP);
+        const __m256i sincN = interpolateCoefs_avx2(coefsN + i, offset, vLerpN);
+        if (CHANNELS == 2) {
+            const __m256i inP = _mm256_permutevar8x32_epi32(
+                    _mm256_loadu_si256(reinterpret_cast<const __m256i*>(sP)), reverse);
+            const __m256i inN = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(sN));
+            accL = _mm256_add_epi32(accL, mulShift16_avx2(sincP,
+                    _mm256_srai_epi32(_mm256_slli_epi32(inP, 16), 16)));
+            accR = _mm256_add_epi32(accR, mulShift16_avx2(sincP, _mm256_srai_epi32(inP, 16)));
+            accL = _mm256_add_epi32(accL, mulShift16_avx2(sincN,
+                    _mm256_srai_epi32(_mm256_slli_epi32(inN, 16), 16)));
+            accR = _mm256_add_epi32(accR, mulShift16_avx2(sincN, _mm256_srai_epi32(inN, 16)));
+        } else {
+            const __m256i inP = _mm256_permutevar8x32_epi32(_mm256_cvtepi16_epi32(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(sP))), reverse);
+            const __m256i inN = _mm256_cvtepi16_epi32(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(sN)));
+            accL = _mm256_add_epi32(accL, mulShift16_avx2(sincP, inP));
+            accL = _mm256_add_epi32(accL, mulShift16_avx2(sincN, inN));
+        }
+        sP -= 8 * CHANNELS;
+        sN += 8 * CHANNELS;
+    }
+    l = horizontalAdd_avx2(accL);
+    r = CHANNELS == 2 ? horizontalAdd_avx2(accR) : l;
+}
+
+#endif // USE_X86_SIMD
+
+static void selectSincKernel()
+{
+    sincKernel.mono = NULL;
+    sincKernel.stereo = NULL;
+    sincKernel.width = 0;
+
+    // af.resampler.simd = 0 forces the scalar implementation, useful for comparisons
+    char value[PROPERTY_VALUE_MAX];
+    if (property_get("af.resampler.simd", value, NULL) > 0 && !strcmp(value, "0")) {
+        ALOGD("vector sinc kernels disabled by property");
+        return;
+    }
+
+#if USE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        sincKernel.mono = sincKernel_avx2<1>;
+        sincKernel.stereo = sincKernel_avx2<2>;
+        sincKernel.width = 8;
+        ALOGV("using AVX2 sinc kernel");
+    } else if (__builtin_cpu_supports("sse4.1")) {
+        sincKernel.mono = sincKernel_sse41<1>;
+        sincKernel.stereo = sincKernel_sse41<2>;
+        sincKernel.width = 4;
+        ALOGV("using SSE4.1 sinc kernel");
+    }
+#endif
+}
+
 // ----------------------------------------------------------------------------
 
 AudioResamplerSinc::AudioResamplerSinc(int bitDepth,
         int inChannelCount, int32_t sampleRate, src_quality quality)
     : AudioResampler(bitDepth, inChannelCount, sampleRate, quality),
-    mState(0), mImpulse(0), mRingFull(0), mFirCoefs(0)
+    mState(0), mImpulse(0), mRingFull(0), mFirCoefs(0), mKernel(NULL)
 {
     /*
      * Layout of the state buffer for 32 tap:
@@ -480,6 +681,14 @@ AudioResamplerSinc::AudioResamplerSinc(int bitDepth,
     }
     mConstants = (quality == VERY_HIGH_QUALITY) ?
             &veryHighQualityConstants : &highQualityConstants;
+
+    // the vector kernels process a fixed number of taps per iteration
+    const unsigned int width = sincKernel.width;
+    if (width != 0 && (mConstants->halfNumCoefs % width) == 0) {
+        mKernel = (inChannelCount == 2) ? sincKernel.stereo : sincKernel.mono;
+    } else {
+        mKernel = NULL;
+    }
 }
 
 
@@ -665,11 +874,15 @@ void AudioResamplerSinc::filterCoefficient(
     if (!USE_NEON) {
         int32_t l = 0;
         int32_t r = 0;
-        for (size_t i=0 ; i<count ; i++) {
-            interpolate<CHANNELS>(l, r, coefsP++, offset, lerpP, sP);
-            sP -= CHANNELS;
-            interpolate<CHANNELS>(l, r, coefsN++, offset, lerpN, sN);
-            sN += CHANNELS;
+        if (mKernel != NULL) {
+            mKernel(l, r, coefsP, coefsN, offset, lerpP, lerpN, sP, sN);
+        } else {
+            for (size_t i=0 ; i<count ; i++) {
+                interpolate<CHANNELS>(l, r, coefsP++, offset, lerpP, sP);
+                sP -= CHANNELS;
+                interpolate<CHANNELS>(l, r, coefsN++, offset, lerpN, sN);
+                sN += CHANNELS;
+            }
         }
         out[0] += 2 * mulRL(1, l, vRL);
         out[1] += 2 * mulRL(0, r, vRL);
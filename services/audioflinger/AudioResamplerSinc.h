@@ -29,6 +29,9 @@ namespace android {
 typedef const int32_t * (*readCoefficientsFn)(bool upDownSample);
 typedef int32_t (*readResampleFirNumCoeffFn)();
 typedef int32_t (*readResampleFirLerpIntBitsFn)();
+typedef void (*sincKernelFn)(int32_t& l, int32_t& r,
+        const int32_t* coefsP, const int32_t* coefsN, size_t offset,
+        int32_t lerpP, int32_t lerpN, const int16_t* sP, const int16_t* sN);
 
 // ----------------------------------------------------------------------------
 
@@ -42,6 +45,8 @@ public:
     virtual void resample(int32_t* out, size_t outFrameCount,
             AudioBufferProvider* provider);
 private:
+    friend class AudioResamplerSincTest;
+
     void init();
 
     virtual void setVolume(int16_t left, int16_t right);
@@ -70,6 +75,8 @@ private:
     int32_t mVolumeSIMD[2];
 
     const int32_t * mFirCoefs;
+    // vector FIR kernel selected at runtime, or NULL for the scalar/NEON implementation
+    sincKernelFn mKernel;
     static const uint32_t mFirCoefsDown[];
     static const uint32_t mFirCoefsUp[];
 
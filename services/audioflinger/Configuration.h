@@ -32,6 +32,9 @@
 // uncomment to enable fast mixer to take performance samples for later statistical analysis
 #define FAST_MIXER_STATISTICS
 
+// uncomment to collect per-track mixer CPU time statistics for dumpsys
+//#define TRACK_MIX_STATISTICS
+
 // uncomment for debugging timing problems related to StateQueue::push()
 //#define STATE_QUEUE_DUMP
 
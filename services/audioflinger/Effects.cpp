@@ -27,6 +27,7 @@
 #include <media/EffectsFactoryApi.h>
 
 #include "AudioFlinger.h"
+#include "AudioMixerOps.h"
 #include "ServiceUtilities.h"
 
 // ----------------------------------------------------------------------------
@@ -66,7 +67,8 @@ AudioFlinger::EffectModule::EffectModule(ThreadBase *thread,
       mStatus(NO_INIT), mState(IDLE),
       // mMaxDisableWaitCnt is set by configure() and not used before then
       // mDisableWaitCnt is set by process() and updateState() and not used before then
-      mSuspended(false)
+      mSuspended(false),
+      mFloatBuffer(NULL), mFloatRejected(false)
 {
     ALOGV("Constructor %p", this);
     int lStatus;
@@ -262,10 +264,19 @@ void AudioFlinger::EffectModule::process()
                                         mConfig.inputCfg.buffer.frameCount/2);
         }
 
+        audio_buffer_t *inBuffer = &mConfig.inputCfg.buffer;
+        audio_buffer_t *outBuffer = &mConfig.outputCfg.buffer;
+        audio_buffer_t floatBuffer;
+        if (isFloat()) {
+            // the chain has converted its input to float for this effect, which is in place
+            floatBuffer.frameCount = mConfig.inputCfg.buffer.frameCount;
+            floatBuffer.raw = mFloatBuffer;
+            inBuffer = &floatBuffer;
+            outBuffer = &floatBuffer;
+        }
+
         // do the actual processing in the effect engine
-        int ret = (*mEffectInterface)->process(mEffectInterface,
-                                               &mConfig.inputCfg.buffer,
-                                               &mConfig.outputCfg.buffer);
+        int ret = (*mEffectInterface)->process(mEffectInterface, inBuffer, outBuffer);
 
         // force transition to IDLE state when engine is ready
         if (mState == STOPPED && ret == -ENODATA) {
@@ -340,11 +351,9 @@ status_t AudioFlinger::EffectModule::configure()
     mConfig.outputCfg.bufferProvider.releaseBuffer = NULL;
     mConfig.inputCfg.accessMode = EFFECT_BUFFER_ACCESS_READ;
     // Insert effect:
-    // - in session AUDIO_SESSION_OUTPUT_MIX or AUDIO_SESSION_OUTPUT_STAGE,
-    // always overwrites output buffer: input buffer == output buffer
-    // - in other sessions:
-    //      last effect in the chain accumulates in output buffer: input buffer != output buffer
-    //      other effect: overwrites output buffer: input buffer == output buffer
+    //      always overwrites output buffer: input buffer == output buffer.
+    //      In sessions other than AUDIO_SESSION_OUTPUT_MIX and AUDIO_SESSION_OUTPUT_STAGE,
+    //      the chain accumulates the result in its output buffer.
     // Auxiliary effect:
     //      accumulates in output buffer: input buffer != output buffer
     // Therefore: accumulate <=> input buffer != output buffer
@@ -362,6 +371,32 @@ status_t AudioFlinger::EffectModule::configure()
             this, thread.get(), mConfig.inputCfg.buffer.raw, mConfig.inputCfg.buffer.frameCount);
 
     status_t cmdStatus;
+    // Offer float samples first to insert effects of a chain with a float buffer.
+    // Such effects always process in place.
+    if (mFloatBuffer != NULL && !mFloatRejected &&
+            (mDescriptor.flags & EFFECT_FLAG_TYPE_MASK) == EFFECT_FLAG_TYPE_INSERT &&
+            mConfig.inputCfg.buffer.raw == mConfig.outputCfg.buffer.raw) {
+        effect_config_t config = mConfig;
+        config.inputCfg.format = AUDIO_FORMAT_PCM_FLOAT;
+        config.outputCfg.format = AUDIO_FORMAT_PCM_FLOAT;
+        config.inputCfg.buffer.raw = mFloatBuffer;
+        config.outputCfg.buffer.raw = mFloatBuffer;
+        size = sizeof(int);
+        status = (*mEffectInterface)->command(mEffectInterface,
+                                                       EFFECT_CMD_SET_CONFIG,
+                                                       sizeof(effect_config_t),
+                                                       &config,
+                                                       &size,
+                                                       &cmdStatus);
+        if (status == 0 && cmdStatus == 0) {
+            mConfig.inputCfg.format = AUDIO_FORMAT_PCM_FLOAT;
+            mConfig.outputCfg.format = AUDIO_FORMAT_PCM_FLOAT;
+            goto configured;
+        }
+        ALOGV("configure() effect %s does not accept float samples", mDescriptor.name);
+        mFloatRejected = true;
+    }
+
     size = sizeof(int);
     status = (*mEffectInterface)->command(mEffectInterface,
                                                    EFFECT_CMD_SET_CONFIG,
@@ -373,6 +408,8 @@ status_t AudioFlinger::EffectModule::configure()
         status = cmdStatus;
     }
 
+configured:
+
     if (status == 0 &&
             (memcmp(&mDescriptor.type, SL_IID_VISUALIZATION, sizeof(effect_uuid_t)) == 0)) {
         uint32_t buf32[sizeof(effect_param_t) / sizeof(uint32_t) + 2];
@@ -1202,7 +1239,8 @@ void AudioFlinger::EffectHandle::dump(char* buffer, size_t size)
 
 AudioFlinger::EffectChain::EffectChain(ThreadBase *thread,
                                         int sessionId)
-    : mThread(thread), mSessionId(sessionId), mActiveTrackCnt(0), mTrackCnt(0), mTailBufferCount(0),
+    : mThread(thread), mSessionId(sessionId), mFloatBuffer(NULL), mFloatBufferSamples(0),
+      mActiveTrackCnt(0), mTrackCnt(0), mTailBufferCount(0),
       mOwnInBuffer(false), mVolumeCtrlIdx(-1), mLeftVolume(UINT_MAX), mRightVolume(UINT_MAX),
       mNewLeftVolume(UINT_MAX), mNewRightVolume(UINT_MAX)
 {
@@ -1219,6 +1257,7 @@ AudioFlinger::EffectChain::~EffectChain()
     if (mOwnInBuffer) {
         delete mInBuffer;
     }
+    delete[] mFloatBuffer;
 
 }
 
@@ -1316,9 +1355,43 @@ void AudioFlinger::EffectChain::process_l()
 
     size_t size = mEffects.size();
     if (doProcess) {
+#ifdef TRACK_MIX_STATISTICS
+        int64_t processStart = statisticsTimeNs();
+#endif
+        // Insert effects all process in place, in mInBuffer or in mFloatBuffer depending on the
+        // format they accepted.  The chain input is converted only where consecutive enabled
+        // effects use different formats, and idle effects are skipped.
+        const size_t sampleCount = thread->frameCount() * thread->channelCount();
+        bool isFloat = false;
         for (size_t i = 0; i < size; i++) {
-            mEffects[i]->process();
+            const sp<EffectModule>& effect = mEffects[i];
+            if ((effect->desc().flags & EFFECT_FLAG_TYPE_MASK) == EFFECT_FLAG_TYPE_INSERT) {
+                if (!effect->isProcessEnabled()) {
+                    continue;
+                }
+                if (effect->isFloat() != isFloat) {
+                    if (isFloat) {
+                        clampFloatToPcm16(mInBuffer, mFloatBuffer, sampleCount);
+                    } else {
+                        convertPcm16ToFloat(mFloatBuffer, mInBuffer, sampleCount);
+                    }
+                    isFloat = !isFloat;
+                }
+            }
+            effect->process();
+        }
+        if (isFloat) {
+            clampFloatToPcm16(mInBuffer, mFloatBuffer, sampleCount);
         }
+        // the output of a session chain is accumulated with the output of the other sessions
+        if (mInBuffer != mOutBuffer) {
+            for (size_t i = 0; i < sampleCount; i++) {
+                mOutBuffer[i] = clamp16((int32_t)mOutBuffer[i] + (int32_t)mInBuffer[i]);
+            }
+        }
+#ifdef TRACK_MIX_STATISTICS
+        mProcessStatistics.add((uint32_t) (statisticsTimeNs() - processStart));
+#endif
     }
     for (size_t i = 0; i < size; i++) {
         mEffects[i]->updateState();
@@ -1418,19 +1491,30 @@ status_t AudioFlinger::EffectChain::addEffect_l(const sp<EffectModule>& effect)
             }
         }
 
-        // always read samples from chain input buffer
+        // insert effects process in place in the chain input buffer, and process_l()
+        // accumulates the result in the chain output buffer when they differ
         effect->setInBuffer(mInBuffer);
+        effect->setOutBuffer(mInBuffer);
 
-        // if last effect in the chain, output samples to chain
-        // output buffer, otherwise to chain input buffer
-        if (idx_insert == size) {
-            if (idx_insert != 0) {
-                mEffects[idx_insert-1]->setOutBuffer(mInBuffer);
-                mEffects[idx_insert-1]->configure();
+        // only the normal mixers can take advantage of float processing
+        if (thread->type() == ThreadBase::MIXER || thread->type() == ThreadBase::DUPLICATING) {
+            size_t samples = thread->frameCount() * thread->channelCount();
+            if (mFloatBuffer == NULL || mFloatBufferSamples != samples) {
+                delete[] mFloatBuffer;
+                mFloatBuffer = new float[samples];
+                mFloatBufferSamples = samples;
+                // a new buffer must be configured in the effects already in the chain
+                for (size_t i = 0; i < size; i++) {
+                    if ((mEffects[i]->desc().flags & EFFECT_FLAG_TYPE_MASK) ==
+                            EFFECT_FLAG_TYPE_INSERT) {
+                        mEffects[i]->setFloatBuffer(mFloatBuffer);
+                        mEffects[i]->configure();
+                    }
+                }
             }
-            effect->setOutBuffer(mOutBuffer);
+            effect->setFloatBuffer(mFloatBuffer);
         } else {
-            effect->setOutBuffer(mInBuffer);
+            effect->setFloatBuffer(NULL);
         }
         mEffects.insertAt(effect, idx_insert);
 
@@ -1459,11 +1543,6 @@ size_t AudioFlinger::EffectChain::removeEffect_l(const sp<EffectModule>& effect)
             }
             if (type == EFFECT_FLAG_TYPE_AUXILIARY) {
                 delete[] effect->inBuffer();
-            } else {
-                if (i == size - 1 && i != 0) {
-                    mEffects[i - 1]->setOutBuffer(mOutBuffer);
-                    mEffects[i - 1]->configure();
-                }
             }
             mEffects.removeAt(i);
             ALOGV("removeEffect_l() effect %p, removed from chain %p at rank %d", effect.get(),
@@ -1584,6 +1663,11 @@ void AudioFlinger::EffectChain::dump(int fd, const Vector<String16>& args)
             mOutBuffer,
             mActiveTrackCnt);
     result.append(buffer);
+#ifdef TRACK_MIX_STATISTICS
+    // make a copy so that the statistics don't change underneath us
+    const DurationHistogram processStatistics(mProcessStatistics);
+    processStatistics.dump(result, "Process time");
+#endif
     write(fd, result.string(), result.size());
 
     for (size_t i = 0; i < mEffects.size(); ++i) {
@@ -88,6 +88,12 @@ public:
     int16_t     *inBuffer() { return mConfig.inputCfg.buffer.s16; }
     void        setOutBuffer(int16_t *buffer) { mConfig.outputCfg.buffer.s16 = buffer; }
     int16_t     *outBuffer() { return mConfig.outputCfg.buffer.s16; }
+    // Float work buffer of the chain, offered to insert effects by configure();
+    // NULL if the chain processes in 16 bit only
+    void        setFloatBuffer(float *buffer) { mFloatBuffer = buffer; }
+    // true if the effect engine accepted float samples, and processes in place in the
+    // float buffer rather than in the 16 bit input buffer
+    bool        isFloat() const { return mConfig.inputCfg.format == AUDIO_FORMAT_PCM_FLOAT; }
     void        setChain(const wp<EffectChain>& chain) { mChain = chain; }
     void        setThread(const wp<ThreadBase>& thread) { mThread = thread; }
     const wp<ThreadBase>& thread() { return mThread; }
@@ -153,6 +159,8 @@ mutable Mutex               mLock;      // mutex for process, commands and handl
     uint32_t mDisableWaitCnt;       // current process() calls count during disable period.
     bool     mSuspended;            // effect is suspended: temporarily disabled by framework
     bool     mOffloaded;            // effect is currently offloaded to the audio DSP
+    float   *mFloatBuffer;          // float work buffer owned by the chain, or NULL
+    bool     mFloatRejected;        // effect engine rejected a float configuration: don't retry
 };
 
 // The EffectHandle class implements the IEffect interface. It provides resources
@@ -351,6 +359,13 @@ protected:
     int mSessionId;             // audio session ID
     int16_t *mInBuffer;         // chain input buffer
     int16_t *mOutBuffer;        // chain output buffer
+    // Insert effects that accept float samples process in place in this buffer, so that a
+    // sequence of such effects is converted from and to 16 bit only once.
+    // Allocated for playback mixer threads only.
+    float   *mFloatBuffer;
+    size_t   mFloatBufferSamples;   // size of mFloatBuffer in samples
+    // CPU time of each process_l() call that processed effects, for dumpsys
+    DurationHistogram mProcessStatistics;
 
     // 'volatile' here means these are accessed with atomic operations instead of mutex
     volatile int32_t mActiveTrackCnt;    // number of active tracks connected
@@ -0,0 +1,402 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// <IMPORTANT_WARNING>
+// Design rules for threadLoop() are given in the comments at section "Fast mixer thread" of
+// StateQueue.h, and apply equally to the fast capture thread.  In particular, avoid library and
+// system calls except at well-known points.
+// The design rules are only for threadLoop(), and don't apply to FastCaptureDumpState methods.
+// </IMPORTANT_WARNING>
+
+#define LOG_TAG "FastCapture"
+//#define LOG_NDEBUG 0
+
+#define ATRACE_TAG ATRACE_TAG_AUDIO
+
+#include "Configuration.h"
+#include <sys/atomics.h>
+#include <time.h>
+#include <utils/Log.h>
+#include <utils/Trace.h>
+#include <media/AudioBufferProvider.h>
+#include "FastCapture.h"
+
+#define FAST_HOT_IDLE_NS     1000000L   // 1 ms: time to sleep while hot idling
+#define FAST_DEFAULT_NS    999999999L   // ~1 sec: default time to sleep
+#define MIN_WARMUP_CYCLES          2    // minimum number of loop cycles to wait for warmup
+#define MAX_WARMUP_CYCLES         10    // maximum number of loop cycles to wait for warmup
+
+namespace android {
+
+// Fast capture thread
+bool FastCapture::threadLoop()
+{
+    static const FastCaptureState initial;
+    const FastCaptureState *previous = &initial, *current = &initial;
+    FastCaptureState preIdle;   // copy of state before we went into idle
+    struct timespec oldTs = {0, 0};
+    bool oldTsValid = false;
+    long sleepNs = -1;  // -1: busy wait, 0: sched_yield, > 0: nanosleep
+    NBAIO_Source *inputSource = NULL;
+    int inputSourceGen = 0;
+    NBAIO_Sink *pipeSink = NULL;
+    int pipeSinkGen = 0;
+    short *readBuffer = NULL;
+    ssize_t readBufferFrames = 0;   // number of valid frames in readBuffer, 0 if none
+    NBAIO_Format format = Format_Invalid;
+    unsigned sampleRate = 0;
+    long periodNs = 0;      // expected period; the time required to capture one buffer
+    long underrunNs = 0;    // underrun likely when read cycle is greater than this value
+    long overrunNs = 0;     // overrun likely when read cycle is less than this value
+    long warmupNs = 0;      // warmup complete when read cycle is greater than this value
+    FastCaptureDumpState dummyDumpState, *dumpState = &dummyDumpState;
+    bool ignoreNextOverrun = true;  // used to ignore initial overrun and first after an underrun
+    unsigned coldGen = 0;   // last observed mColdGen
+    bool isWarm = false;    // true means HAL is delivering at its steady-state rate
+    struct timespec measuredWarmupTs = {0, 0};  // how long did it take for warmup to complete
+    uint32_t warmupCycles = 0;  // counter of number of loop cycles required to warmup
+    NBLog::Writer dummyLogWriter, *logWriter = &dummyLogWriter;
+    // performance events go to a log of their own, so that they don't push out the text entries
+    NBLog::Writer *perfLogWriter = &dummyLogWriter;
+    uint32_t totalNativeFramesRead = 0;     // copied to dumpState->mFramesRead
+
+    for (;;) {
+
+        // either nanosleep, sched_yield, or busy wait
+        if (sleepNs >= 0) {
+            if (sleepNs > 0) {
+                ALOG_ASSERT(sleepNs < 1000000000);
+                const struct timespec req = {0, sleepNs};
+                nanosleep(&req, NULL);
+            } else {
+                sched_yield();
+            }
+        }
+        // default to long sleep for next cycle
+        sleepNs = FAST_DEFAULT_NS;
+
+        // poll for state change
+        const FastCaptureState *next = mSQ.poll();
+        if (next == NULL) {
+            // continue to use the default initial state until a real state is available
+            ALOG_ASSERT(current == &initial && previous == &initial);
+            next = current;
+        }
+
+        FastCaptureState::Command command = next->mCommand;
+        if (next != current) {
+
+            // As soon as possible of learning of a new dump area, start using it
+            dumpState = next->mDumpState != NULL ? next->mDumpState : &dummyDumpState;
+            logWriter = next->mNBLogWriter != NULL ? next->mNBLogWriter : &dummyLogWriter;
+            perfLogWriter = next->mPerfNBLogWriter != NULL ?
+                    next->mPerfNBLogWriter : &dummyLogWriter;
+
+            // See FastMixer::threadLoop() for the idle transitions
+            if (!(current->mCommand & FastCaptureState::IDLE)) {
+                if (command & FastCaptureState::IDLE) {
+                    preIdle = *current;
+                    current = &preIdle;
+                    oldTsValid = false;
+                    ignoreNextOverrun = true;
+                }
+                previous = current;
+            }
+            current = next;
+        }
+#if !LOG_NDEBUG
+        next = NULL;    // not referenced again
+#endif
+
+        dumpState->mCommand = command;
+
+        switch (command) {
+        case FastCaptureState::INITIAL:
+        case FastCaptureState::HOT_IDLE:
+            sleepNs = FAST_HOT_IDLE_NS;
+            continue;
+        case FastCaptureState::COLD_IDLE:
+            // only perform a cold idle command once
+            if (current->mColdGen != coldGen) {
+                int32_t *coldFutexAddr = current->mColdFutexAddr;
+                ALOG_ASSERT(coldFutexAddr != NULL);
+                int32_t old = android_atomic_dec(coldFutexAddr);
+                if (old <= 0) {
+                    __futex_syscall4(coldFutexAddr, FUTEX_WAIT_PRIVATE, old - 1, NULL);
+                }
+                int policy = sched_getscheduler(0);
+                if (!(policy == SCHED_FIFO || policy == SCHED_RR)) {
+                    ALOGE("did not receive expected priority boost");
+                }
+                // the input HAL was put into standby while we were idle
+                isWarm = false;
+                measuredWarmupTs.tv_sec = 0;
+                measuredWarmupTs.tv_nsec = 0;
+                warmupCycles = 0;
+                sleepNs = -1;
+                coldGen = current->mColdGen;
+                readBufferFrames = 0;
+                oldTsValid = !clock_gettime(CLOCK_MONOTONIC, &oldTs);
+            } else {
+                sleepNs = FAST_HOT_IDLE_NS;
+            }
+            continue;
+        case FastCaptureState::EXIT:
+            delete[] readBuffer;
+            return false;
+        case FastCaptureState::READ:
+        case FastCaptureState::WRITE:
+        case FastCaptureState::READ_WRITE:
+            break;
+        default:
+            LOG_FATAL("bad command %d", command);
+        }
+
+        // there is a non-idle state available to us; did the state change?
+        size_t frameCount = current->mFrameCount;
+        if (current != previous) {
+
+            // check for change in input HAL configuration
+            NBAIO_Format previousFormat = format;
+            if (current->mInputSourceGen != inputSourceGen) {
+                inputSource = current->mInputSource;
+                inputSourceGen = current->mInputSourceGen;
+                if (inputSource == NULL) {
+                    format = Format_Invalid;
+                    sampleRate = 0;
+                } else {
+                    format = inputSource->format();
+                    sampleRate = Format_sampleRate(format);
+                }
+                dumpState->mSampleRate = sampleRate;
+            }
+
+            // check for change in pipe
+            if (current->mPipeSinkGen != pipeSinkGen) {
+                pipeSink = current->mPipeSink;
+                pipeSinkGen = current->mPipeSinkGen;
+            }
+
+            if ((format != previousFormat) || (frameCount != previous->mFrameCount)) {
+                // FIXME to avoid priority inversion, don't delete here
+                delete[] readBuffer;
+                readBuffer = NULL;
+                if (frameCount > 0 && sampleRate > 0) {
+                    // FIXME new may block for unbounded time at internal mutex of the heap
+                    //       implementation; it would be better to have RecordThread allocate for us
+                    //       to avoid blocking here and to prevent possible priority inversion
+                    readBuffer = new short[frameCount * Format_channelCount(format)];
+                    periodNs = (frameCount * 1000000000LL) / sampleRate;    // 1.00
+                    underrunNs = (frameCount * 1750000000LL) / sampleRate;  // 1.75
+                    overrunNs = (frameCount * 500000000LL) / sampleRate;    // 0.50
+                    warmupNs = (frameCount * 500000000LL) / sampleRate;     // 0.50
+                } else {
+                    periodNs = 0;
+                    underrunNs = 0;
+                    overrunNs = 0;
+                    warmupNs = 0;
+                }
+                readBufferFrames = 0;
+                dumpState->mFrameCount = frameCount;
+            }
+
+            // only process state change once
+            previous = current;
+        }
+
+        // do work using current state here
+        bool attemptedRead = false;
+        bool didBlock = false;  // whether the HAL read supplied data, and so paced this cycle
+        if ((command & FastCaptureState::READ) && (inputSource != NULL) && (readBuffer != NULL)) {
+            // the HAL read blocks until a period of input is available, and so paces this loop
+            dumpState->mReadSequence++;
+            ATRACE_BEGIN("read");
+            ssize_t framesRead = inputSource->read(readBuffer, frameCount,
+                    AudioBufferProvider::kInvalidPTS);
+            ATRACE_END();
+            dumpState->mReadSequence++;
+            if (framesRead >= 0) {
+                ALOG_ASSERT((size_t) framesRead <= frameCount);
+                totalNativeFramesRead += framesRead;
+                dumpState->mFramesRead = totalNativeFramesRead;
+                readBufferFrames = framesRead;
+                didBlock = framesRead > 0;
+            } else {
+                dumpState->mReadErrors++;
+                readBufferFrames = 0;
+            }
+            attemptedRead = true;
+        }
+
+        if ((command & FastCaptureState::WRITE) && (pipeSink != NULL) && (readBufferFrames > 0)) {
+            // The pipe is non-blocking: if the normal thread has fallen behind, the excess is
+            // dropped here rather than stalling the capture.
+            ssize_t framesWritten = pipeSink->write(readBuffer, readBufferFrames);
+            if (framesWritten < 0) {
+                framesWritten = 0;
+            }
+            if (framesWritten < readBufferFrames) {
+                dumpState->mFramesDropped += readBufferFrames - framesWritten;
+            }
+            readBufferFrames = 0;
+        }
+
+        // The HAL read is blocking, so the cycle time is only measured for the dump.
+        struct timespec newTs;
+        int rc = clock_gettime(CLOCK_MONOTONIC, &newTs);
+        if (rc == 0) {
+            if (oldTsValid) {
+                time_t sec = newTs.tv_sec - oldTs.tv_sec;
+                long nsec = newTs.tv_nsec - oldTs.tv_nsec;
+                ALOGE_IF(sec < 0 || (sec == 0 && nsec < 0),
+                        "clock_gettime(CLOCK_MONOTONIC) failed: was %ld.%09ld but now %ld.%09ld",
+                        oldTs.tv_sec, oldTs.tv_nsec, newTs.tv_sec, newTs.tv_nsec);
+                if (nsec < 0) {
+                    --sec;
+                    nsec += 1000000000;
+                }
+                // After exiting standby, the input HAL may return the first few buffers
+                // immediately.  Don't count those as overruns; warmup is considered complete
+                // after the earlier of MIN_WARMUP_CYCLES reads with the last one blocking for
+                // at least warmupNs, or MAX_WARMUP_CYCLES reads.
+                if (!isWarm && attemptedRead) {
+                    measuredWarmupTs.tv_sec += sec;
+                    measuredWarmupTs.tv_nsec += nsec;
+                    if (measuredWarmupTs.tv_nsec >= 1000000000) {
+                        measuredWarmupTs.tv_sec++;
+                        measuredWarmupTs.tv_nsec -= 1000000000;
+                    }
+                    ++warmupCycles;
+                    if ((nsec > warmupNs && warmupCycles >= MIN_WARMUP_CYCLES) ||
+                            (warmupCycles >= MAX_WARMUP_CYCLES)) {
+                        isWarm = true;
+                        dumpState->mMeasuredWarmupTs = measuredWarmupTs;
+                        dumpState->mWarmupCycles = warmupCycles;
+                        perfLogWriter->logPerformance(NBLog::PERF_WARMUP, measuredWarmupTs);
+                    }
+                }
+                sleepNs = -1;
+                if (isWarm) {
+                    struct timespec cycleTs;
+                    cycleTs.tv_sec = sec;
+                    cycleTs.tv_nsec = nsec;
+                    perfLogWriter->logPerformance(NBLog::PERF_CYCLE, cycleTs);
+                    if (sec > 0 || nsec > underrunNs) {
+                        ATRACE_NAME("underrun");
+                        perfLogWriter->logPerformance(NBLog::PERF_UNDERRUN, cycleTs);
+                        // FIXME only log occasionally
+                        ALOGV("underrun: time since last cycle %d.%03ld sec",
+                                (int) sec, nsec / 1000000L);
+                        logWriter->logFormat("underrun: time since last cycle %d.%03ld sec",
+                                (int) sec, nsec / 1000000L);
+                        dumpState->mUnderruns++;
+                        ignoreNextOverrun = true;
+                    } else if (nsec < overrunNs) {
+                        if (ignoreNextOverrun) {
+                            ignoreNextOverrun = false;
+                        } else {
+                            // FIXME only log occasionally
+                            ALOGV("overrun: time since last cycle %d.%03ld sec",
+                                    (int) sec, nsec / 1000000L);
+                            dumpState->mOverruns++;
+                        }
+                    } else {
+                        ignoreNextOverrun = false;
+                    }
+                }
+            } else {
+                // first time through the loop
+                oldTsValid = true;
+                sleepNs = -1;
+                ignoreNextOverrun = true;
+            }
+            oldTs = newTs;
+        } else {
+            // monotonic clock is broken
+            oldTsValid = false;
+            sleepNs = periodNs;
+        }
+        if (!didBlock) {
+            // nothing to read from, or the read failed: sleep for a period rather than spinning
+            sleepNs = periodNs > 0 ? periodNs : FAST_HOT_IDLE_NS;
+        }
+
+    }   // for (;;)
+
+    // never return 'true'; Thread::_threadLoop() locks mutex which can result in priority inversion
+}
+
+FastCaptureDumpState::FastCaptureDumpState() :
+    mCommand(FastCaptureState::INITIAL), mReadSequence(0), mFramesRead(0), mReadErrors(0),
+    mFramesDropped(0), mUnderruns(0), mOverruns(0), mSampleRate(0), mFrameCount(0),
+    /* mMeasuredWarmupTs({0, 0}), */ mWarmupCycles(0)
+{
+    mMeasuredWarmupTs.tv_sec = 0;
+    mMeasuredWarmupTs.tv_nsec = 0;
+}
+
+FastCaptureDumpState::~FastCaptureDumpState()
+{
+}
+
+void FastCaptureDumpState::dump(int fd) const
+{
+    if (mCommand == FastCaptureState::INITIAL) {
+        fdprintf(fd, "FastCapture not initialized\n");
+        return;
+    }
+#define COMMAND_MAX 32
+    char string[COMMAND_MAX];
+    switch (mCommand) {
+    case FastCaptureState::INITIAL:
+        strcpy(string, "INITIAL");
+        break;
+    case FastCaptureState::HOT_IDLE:
+        strcpy(string, "HOT_IDLE");
+        break;
+    case FastCaptureState::COLD_IDLE:
+        strcpy(string, "COLD_IDLE");
+        break;
+    case FastCaptureState::EXIT:
+        strcpy(string, "EXIT");
+        break;
+    case FastCaptureState::READ:
+        strcpy(string, "READ");
+        break;
+    case FastCaptureState::WRITE:
+        strcpy(string, "WRITE");
+        break;
+    case FastCaptureState::READ_WRITE:
+        strcpy(string, "READ_WRITE");
+        break;
+    default:
+        snprintf(string, COMMAND_MAX, "%d", mCommand);
+        break;
+    }
+    double measuredWarmupMs = (mMeasuredWarmupTs.tv_sec * 1000.0) +
+            (mMeasuredWarmupTs.tv_nsec / 1000000.0);
+    double periodSec = mSampleRate != 0 ? (double) mFrameCount / (double) mSampleRate : 0.0;
+    fdprintf(fd, "FastCapture command=%s readSequence=%u framesRead=%u\n"
+                 "            readErrors=%u framesDropped=%u underruns=%u overruns=%u\n"
+                 "            sampleRate=%u frameCount=%zu measuredWarmup=%.3g ms, warmupCycles=%u\n"
+                 "            period=%.2f ms\n",
+                 string, mReadSequence, mFramesRead,
+                 mReadErrors, mFramesDropped, mUnderruns, mOverruns,
+                 mSampleRate, mFrameCount, measuredWarmupMs, mWarmupCycles,
+                 periodSec * 1e3);
+}
+
+}   // namespace android
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_AUDIO_FAST_CAPTURE_STATE_H
+#define ANDROID_AUDIO_FAST_CAPTURE_STATE_H
+
+#include <media/nbaio/NBAIO.h>
+#include <media/nbaio/NBLog.h>
+
+namespace android {
+
+struct FastCaptureDumpState;
+
+// Represents a single state of the fast capture
+struct FastCaptureState {
+                FastCaptureState();
+    /*virtual*/ ~FastCaptureState();
+
+    // all pointer fields use raw pointers; objects are owned and ref-counted by RecordThread
+    NBAIO_Source* mInputSource;     // HAL input device, must already be negotiated
+    int           mInputSourceGen;  // increment when mInputSource is assigned
+    NBAIO_Sink*   mPipeSink;        // after reading from input source, write to this pipe sink
+    int           mPipeSinkGen;     // increment when mPipeSink is assigned
+    size_t        mFrameCount;      // number of frames per fast capture buffer
+    enum Command {
+        INITIAL = 0,            // used only for the initial state
+        HOT_IDLE = 1,           // do nothing
+        COLD_IDLE = 2,          // wait for the futex
+        IDLE = 3,               // either HOT_IDLE or COLD_IDLE
+        EXIT = 4,               // exit from thread
+        // The following commands also process configuration changes, and can be "or"ed:
+        READ = 0x8,             // read from input source
+        WRITE = 0x10,           // write to pipe sink
+        READ_WRITE = 0x18,      // read from input source and write to pipe sink
+    } mCommand;
+    int32_t*      mColdFutexAddr;   // for COLD_IDLE only, pointer to the associated futex
+    unsigned      mColdGen;         // increment when COLD_IDLE is requested so it's only done once
+    // This might be a one-time configuration rather than per-state
+    FastCaptureDumpState* mDumpState; // if non-NULL, then update dump state periodically
+    NBLog::Writer* mNBLogWriter;    // non-blocking logger
+    NBLog::Writer* mPerfNBLogWriter; // non-blocking logger for the per-cycle performance events
+};  // struct FastCaptureState
+
+}   // namespace android
+
+#endif  // ANDROID_AUDIO_FAST_CAPTURE_STATE_H
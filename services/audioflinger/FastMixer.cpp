@@ -96,6 +96,8 @@ bool FastMixer::threadLoop()
     uint32_t warmupCycles = 0;  // counter of number of loop cycles required to warmup
     NBAIO_Sink* teeSink = NULL; // if non-NULL, then duplicate write() to this non-blocking sink
     NBLog::Writer dummyLogWriter, *logWriter = &dummyLogWriter;
+    // performance events go to a log of their own, so that they don't push out the text entries
+    NBLog::Writer *perfLogWriter = &dummyLogWriter;
     uint32_t totalNativeFramesWritten = 0;  // copied to dumpState->mFramesWritten
 
     // next 2 fields are valid only when timestampStatus == NO_ERROR
@@ -133,6 +135,8 @@ bool FastMixer::threadLoop()
             dumpState = next->mDumpState != NULL ? next->mDumpState : &dummyDumpState;
             teeSink = next->mTeeSink;
             logWriter = next->mNBLogWriter != NULL ? next->mNBLogWriter : &dummyLogWriter;
+            perfLogWriter = next->mPerfNBLogWriter != NULL ?
+                    next->mPerfNBLogWriter : &dummyLogWriter;
             if (mixer != NULL) {
                 mixer->setLog(logWriter);
             }
@@ -287,7 +291,7 @@ bool FastMixer::threadLoop()
                 unsigned removedTracks = previousTrackMask & ~currentTrackMask;
                 while (removedTracks != 0) {
                     i = __builtin_ctz(removedTracks);
-                    removedTracks &= ~(1 << i);
+                    removedTracks &= ~(1U << i);
                     const FastTrack* fastTrack = &current->mFastTracks[i];
                     ALOG_ASSERT(fastTrack->mBufferProvider == NULL);
                     if (mixer != NULL) {
@@ -306,7 +310,7 @@ bool FastMixer::threadLoop()
                 unsigned addedTracks = currentTrackMask & ~previousTrackMask;
                 while (addedTracks != 0) {
                     i = __builtin_ctz(addedTracks);
-                    addedTracks &= ~(1 << i);
+                    addedTracks &= ~(1U << i);
                     const FastTrack* fastTrack = &current->mFastTracks[i];
                     AudioBufferProvider *bufferProvider = fastTrack->mBufferProvider;
                     ALOG_ASSERT(bufferProvider != NULL && fastTrackNames[i] == -1);
@@ -322,6 +326,8 @@ bool FastMixer::threadLoop()
                         // newly allocated track names default to full scale volume
                         mixer->setParameter(name, AudioMixer::TRACK, AudioMixer::CHANNEL_MASK,
                                 (void *)(uintptr_t)fastTrack->mChannelMask);
+                        mixer->setParameter(name, AudioMixer::TRACK, AudioMixer::STATISTICS,
+                                (void *) fastTrack->mStatistics);
                         mixer->enable(name);
                     }
                     generations[i] = fastTrack->mGeneration;
@@ -332,7 +338,7 @@ bool FastMixer::threadLoop()
                 unsigned modifiedTracks = currentTrackMask & previousTrackMask;
                 while (modifiedTracks != 0) {
                     i = __builtin_ctz(modifiedTracks);
-                    modifiedTracks &= ~(1 << i);
+                    modifiedTracks &= ~(1U << i);
                     const FastTrack* fastTrack = &current->mFastTracks[i];
                     if (fastTrack->mGeneration != generations[i]) {
                         // this track was actually modified
@@ -352,6 +358,8 @@ bool FastMixer::threadLoop()
                                     AudioMixer::REMOVE, NULL);
                             mixer->setParameter(name, AudioMixer::TRACK, AudioMixer::CHANNEL_MASK,
                                     (void *)(uintptr_t) fastTrack->mChannelMask);
+                            mixer->setParameter(name, AudioMixer::TRACK, AudioMixer::STATISTICS,
+                                    (void *) fastTrack->mStatistics);
                             // already enabled
                         }
                         generations[i] = fastTrack->mGeneration;
@@ -361,6 +369,9 @@ bool FastMixer::threadLoop()
                 fastTracksGen = current->mFastTracksGen;
 
                 dumpState->mNumTracks = popcount(currentTrackMask);
+                if (dumpState->mNumTracks > dumpState->mMaxNumTracks) {
+                    dumpState->mMaxNumTracks = dumpState->mNumTracks;
+                }
             }
 
 #if 1   // FIXME shouldn't need this
@@ -376,7 +387,7 @@ bool FastMixer::threadLoop()
             unsigned currentTrackMask = current->mTrackMask;
             while (currentTrackMask != 0) {
                 i = __builtin_ctz(currentTrackMask);
-                currentTrackMask &= ~(1 << i);
+                currentTrackMask &= ~(1U << i);
                 const FastTrack* fastTrack = &current->mFastTracks[i];
 
                 // Refresh the per-track timestamp
@@ -528,15 +539,23 @@ bool FastMixer::threadLoop()
                         isWarm = true;
                         dumpState->mMeasuredWarmupTs = measuredWarmupTs;
                         dumpState->mWarmupCycles = warmupCycles;
+                        perfLogWriter->logPerformance(NBLog::PERF_WARMUP, measuredWarmupTs);
                     }
                 }
                 sleepNs = -1;
                 if (isWarm) {
+                    struct timespec cycleTs;
+                    cycleTs.tv_sec = sec;
+                    cycleTs.tv_nsec = nsec;
+                    perfLogWriter->logPerformance(NBLog::PERF_CYCLE, cycleTs);
                     if (sec > 0 || nsec > underrunNs) {
                         ATRACE_NAME("underrun");
+                        perfLogWriter->logPerformance(NBLog::PERF_UNDERRUN, cycleTs);
                         // FIXME only log occasionally
                         ALOGV("underrun: time since last cycle %d.%03ld sec",
                                 (int) sec, nsec / 1000000L);
+                        logWriter->logFormat("underrun: time since last cycle %d.%03ld sec",
+                                (int) sec, nsec / 1000000L);
                         dumpState->mUnderruns++;
                         ignoreNextOverrun = true;
                     } else if (nsec < overrunNs) {
@@ -642,7 +661,7 @@ FastMixerDumpState::FastMixerDumpState(
 #endif
         ) :
     mCommand(FastMixerState::INITIAL), mWriteSequence(0), mFramesWritten(0),
-    mNumTracks(0), mWriteErrors(0), mUnderruns(0), mOverruns(0),
+    mNumTracks(0), mMaxNumTracks(0), mWriteErrors(0), mUnderruns(0), mOverruns(0),
     mSampleRate(0), mFrameCount(0), /* mMeasuredWarmupTs({0, 0}), */ mWarmupCycles(0),
     mTrackMask(0)
 #ifdef FAST_MIXER_STATISTICS
@@ -730,11 +749,11 @@ void FastMixerDumpState::dump(int fd) const
             (mMeasuredWarmupTs.tv_nsec / 1000000.0);
     double mixPeriodSec = (double) mFrameCount / (double) mSampleRate;
     fdprintf(fd, "FastMixer command=%s writeSequence=%u framesWritten=%u\n"
-                 "          numTracks=%u writeErrors=%u underruns=%u overruns=%u\n"
+                 "          numTracks=%u maxNumTracks=%u writeErrors=%u underruns=%u overruns=%u\n"
                  "          sampleRate=%u frameCount=%zu measuredWarmup=%.3g ms, warmupCycles=%u\n"
                  "          mixPeriod=%.2f ms\n",
                  string, mWriteSequence, mFramesWritten,
-                 mNumTracks, mWriteErrors, mUnderruns, mOverruns,
+                 mNumTracks, mMaxNumTracks, mWriteErrors, mUnderruns, mOverruns,
                  mSampleRate, mFrameCount, measuredWarmupMs, mWarmupCycles,
                  mixPeriodSec * 1e3);
 #ifdef FAST_MIXER_STATISTICS
@@ -820,8 +839,8 @@ void FastMixerDumpState::dump(int fd) const
     // The active track mask and track states are updated non-atomically.
     // So if we relied on isActive to decide whether to display,
     // then we might display an obsolete track or omit an active track.
-    // Instead we always display all tracks, with an indication
-    // of whether we think the track is active.
+    // Instead we display all tracks that have ever been used, with an indication
+    // of whether we think the track is active; slots never used are omitted.
     uint32_t trackMask = mTrackMask;
     fdprintf(fd, "Fast tracks: kMaxFastTracks=%u activeMask=%#x\n",
             FastMixerState::kMaxFastTracks, trackMask);
@@ -830,6 +849,10 @@ void FastMixerDumpState::dump(int fd) const
         bool isActive = trackMask & 1;
         const FastTrackDump *ftDump = &mTracks[i];
         const FastTrackUnderruns& underruns = ftDump->mUnderruns;
+        if (!isActive && underruns.mBitFields.mFull == 0 && underruns.mBitFields.mPartial == 0 &&
+                underruns.mBitFields.mEmpty == 0) {
+            continue;
+        }
         const char *mostRecent;
         switch (underruns.mBitFields.mMostRecent) {
         case UNDERRUN_FULL:
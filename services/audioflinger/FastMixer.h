@@ -98,6 +98,7 @@ struct FastMixerDumpState {
     uint32_t mWriteSequence;    // incremented before and after each write()
     uint32_t mFramesWritten;    // total number of frames written successfully
     uint32_t mNumTracks;        // total number of active fast tracks
+    uint32_t mMaxNumTracks;     // largest number of simultaneously active fast tracks
     uint32_t mWriteErrors;      // total number of write() errors
     uint32_t mUnderruns;        // total number of underruns
     uint32_t mOverruns;         // total number of overruns
@@ -15,13 +15,15 @@
  */
 
 #include "Configuration.h"
+#include <utils/Debug.h>
 #include "FastMixerState.h"
+#include "StateQueue.h"
 
 namespace android {
 
 FastTrack::FastTrack() :
     mBufferProvider(NULL), mVolumeProvider(NULL),
-    mChannelMask(AUDIO_CHANNEL_OUT_STEREO), mGeneration(0)
+    mChannelMask(AUDIO_CHANNEL_OUT_STEREO), mStatistics(NULL), mGeneration(0)
 {
 }
 
@@ -30,14 +32,58 @@ FastTrack::~FastTrack()
 }
 
 FastMixerState::FastMixerState() :
-    mFastTracksGen(0), mTrackMask(0), mOutputSink(NULL), mOutputSinkGen(0),
+    mFastTracksGen(0), mTrackMask(0), mModifiedTracks(0), mOutputSink(NULL), mOutputSinkGen(0),
     mFrameCount(0), mCommand(INITIAL), mColdFutexAddr(NULL), mColdGen(0),
-    mDumpState(NULL), mTeeSink(NULL), mNBLogWriter(NULL)
+    mDumpState(NULL), mTeeSink(NULL), mNBLogWriter(NULL), mPerfNBLogWriter(NULL)
 {
+    COMPILE_TIME_ASSERT_FUNCTION_SCOPE(kModifiedHistory + 1 >= StateQueue<FastMixerState>::kN);
+    for (unsigned i = 0; i < kModifiedHistory; ++i) {
+        mPrevModifiedTracks[i] = 0;
+    }
 }
 
 FastMixerState::~FastMixerState()
 {
 }
 
+FastMixerState& FastMixerState::operator=(const FastMixerState& other)
+{
+    if (this == &other) {
+        return *this;
+    }
+    // All states start out identical, and a recycled state is overwritten by the state pushed
+    // kModifiedHistory pushes after it.  So it is stale only in the tracks modified by other
+    // and by the states that preceded other since then.
+    unsigned modified = other.mModifiedTracks;
+    for (unsigned i = 0; i < kModifiedHistory; ++i) {
+        modified |= other.mPrevModifiedTracks[i];
+    }
+    while (modified != 0) {
+        unsigned i = __builtin_ctz(modified);
+        modified &= ~(1U << i);
+        mFastTracks[i] = other.mFastTracks[i];
+    }
+
+    // this becomes the new mutable state, so shift the change records
+    mModifiedTracks = 0;
+    mPrevModifiedTracks[0] = other.mModifiedTracks;
+    for (unsigned i = 1; i < kModifiedHistory; ++i) {
+        mPrevModifiedTracks[i] = other.mPrevModifiedTracks[i - 1];
+    }
+
+    mFastTracksGen = other.mFastTracksGen;
+    mTrackMask = other.mTrackMask;
+    mOutputSink = other.mOutputSink;
+    mOutputSinkGen = other.mOutputSinkGen;
+    mFrameCount = other.mFrameCount;
+    mCommand = other.mCommand;
+    mColdFutexAddr = other.mColdFutexAddr;
+    mColdGen = other.mColdGen;
+    mDumpState = other.mDumpState;
+    mTeeSink = other.mTeeSink;
+    mNBLogWriter = other.mNBLogWriter;
+    mPerfNBLogWriter = other.mPerfNBLogWriter;
+    return *this;
+}
+
 }   // namespace android
@@ -24,6 +24,8 @@
 
 namespace android {
 
+struct TrackStatistics;
+
 struct FastMixerDumpState;
 
 class VolumeProvider {
@@ -44,6 +46,7 @@ struct FastTrack {
     ExtendedAudioBufferProvider* mBufferProvider; // must be NULL if inactive, or non-NULL if active
     VolumeProvider*         mVolumeProvider; // optional; if NULL then full-scale
     audio_channel_mask_t    mChannelMask;    // AUDIO_CHANNEL_OUT_MONO or AUDIO_CHANNEL_OUT_STEREO
+    TrackStatistics*        mStatistics;     // optional; mixer CPU time of this track
     int                     mGeneration;     // increment when any field is assigned
 };
 
@@ -52,12 +55,29 @@ struct FastMixerState {
                 FastMixerState();
     /*virtual*/ ~FastMixerState();
 
-    static const unsigned kMaxFastTracks = 8;   // must be between 2 and 32 inclusive
+    static const unsigned kMaxFastTracks = 32;  // must be between 2 and 32 inclusive
+
+    // Number of preceding states whose modified track masks are remembered; must be at least
+    // the number of states in the StateQueue minus 1, see operator=.
+    static const unsigned kModifiedHistory = 3;
+
+    // The state queue recycles its states, and copies the most recently pushed state over the
+    // oldest one.  Only the fast tracks modified since the destination state was pushed are
+    // copied, so the cost of a push does not grow with kMaxFastTracks.
+    FastMixerState& operator=(const FastMixerState& other);
+
+    // Must be called by the mutator whenever it assigns a field of mFastTracks[i],
+    // along with incrementing mFastTracks[i].mGeneration.
+    void        trackModified(unsigned i) { mModifiedTracks |= 1U << i; }
 
     // all pointer fields use raw pointers; objects are owned and ref-counted by the normal mixer
     FastTrack   mFastTracks[kMaxFastTracks];
     int         mFastTracksGen; // increment when any mFastTracks[i].mGeneration is incremented
     unsigned    mTrackMask;     // bit i is set if and only if mFastTracks[i] is active
+    // change records: bit i is set if mFastTracks[i] was modified in this state, and in each
+    // of the kModifiedHistory preceding states (newest first)
+    unsigned    mModifiedTracks;
+    unsigned    mPrevModifiedTracks[kModifiedHistory];
     NBAIO_Sink* mOutputSink;    // HAL output device, must already be negotiated
     int         mOutputSinkGen; // increment when mOutputSink is assigned
     size_t      mFrameCount;    // number of frames per fast mix buffer
@@ -78,6 +98,7 @@ struct FastMixerState {
     FastMixerDumpState* mDumpState; // if non-NULL, then update dump state periodically
     NBAIO_Sink* mTeeSink;       // if non-NULL, then duplicate write()s to this non-blocking sink
     NBLog::Writer* mNBLogWriter; // non-blocking logger
+    NBLog::Writer* mPerfNBLogWriter; // non-blocking logger for the per-cycle performance events
 };  // struct FastMixerState
 
 }   // namespace android
@@ -113,6 +113,16 @@ public:
     bool isFastTrack() const { return (mFlags & IAudioFlinger::TRACK_FAST) != 0; }
     int fastIndex() const { return mFastIndex; }
 
+    // mixer CPU time statistics, written only by the thread that mixes this track
+    TrackStatistics* statistics() { return &mStatistics; }
+    // append a line of statistics matching TrackStatistics::appendDumpHeader(),
+    // followed by the histogram of the mix time if detailed
+    void dumpStatistics(String8& result, bool detailed) const;
+#ifdef TRACK_MIX_STATISTICS
+    // append the statistics as a "track:statistics" entry for getParameters()
+    void statisticsToParameterValue(String8& result) const;
+#endif
+
 protected:
 
     // FILLED state is used for suppressing volume ramp at begin of playing
@@ -142,7 +152,7 @@ private:
     // The following fields are only for fast tracks, and should be in a subclass
     int                 mFastIndex; // index within FastMixerState::mFastTracks[];
                                     // either mFastIndex == -1 if not isFastTrack()
-                                    // or 0 < mFastIndex < FastMixerState::kMaxFast because
+                                    // or 0 < mFastIndex < FastMixerState::kMaxFastTracks because
                                     // index 0 is reserved for normal mixer's submix;
                                     // index is allocated statically at track creation time
                                     // but the slot is only used if track is active
@@ -154,6 +164,9 @@ private:
     bool                mIsInvalid; // non-resettable latch, set by invalidate()
     AudioTrackServerProxy*  mAudioTrackServerProxy;
     bool                mResumeToStopping; // track was paused in stopping state.
+    String8             mOffloadParameters; // codec parameters deferred by
+                                        // OffloadThread::setTrackParameters(), under thread lock
+    TrackStatistics     mStatistics;
 };  // end of Track
 
 class TimedTrack : public Track {
@@ -259,7 +272,8 @@ public:
                                 audio_format_t format,
                                 audio_channel_mask_t channelMask,
                                 size_t frameCount,
-                                int uid);
+                                int uid,
+                                bool usePipe);
     virtual             ~OutputTrack();
 
     virtual status_t    start(AudioSystem::sync_event_t event =
@@ -271,7 +285,17 @@ public:
             bool        isActive() const { return mActive; }
     const wp<ThreadBase>& thread() const { return mThread; }
 
+    // In pipe mode, write() publishes into a pipe and the destination MixerThread adds its
+    // contents to the mix directly, rather than mixing them from the shared buffer again.
+    // Only used when the destination has the same sample rate and channel count.
+            bool        hasPipe() const { return mPipe != 0; }
+    virtual size_t      framesReady() const;
+            // called by the destination thread only, returns the number of frames read
+            ssize_t     readPipe(int16_t* buffer, size_t frames);
+            void        flushPipe();
+
 private:
+            bool        writePipe(int16_t* data, uint32_t frames);
 
     status_t            obtainBuffer(AudioBufferProvider::Buffer* buffer,
                                      uint32_t waitTimeMs);
@@ -285,4 +309,6 @@ private:
     bool                        mActive;
     DuplicatingThread* const mSourceThread; // for waitTimeMs() in write()
     AudioTrackClientProxy*      mClientProxy;
+    sp<NBAIO_Sink>              mPipe;          // written by the DuplicatingThread, if pipe mode
+    sp<NBAIO_Source>            mPipeReader;    // read by the destination thread, if pipe mode
 };  // end of OutputTrack
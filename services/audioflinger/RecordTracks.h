@@ -47,8 +47,11 @@ public:
     static  void        appendDumpHeader(String8& result);
             void        dump(char* buffer, size_t size);
 
+            void        clearSyncStartEvent();
+
 private:
     friend class AudioFlinger;  // for mState
+    friend class RecordThread;  // for the capture state below
 
                         RecordTrack(const RecordTrack&);
                         RecordTrack& operator = (const RecordTrack&);
@@ -58,6 +61,43 @@ private:
                                    int64_t pts = kInvalidPTS);
     // releaseBuffer() not overridden
 
+    // Supplies this track's resampler with input from the capture pipe
+    class ResamplerBufferProvider : public AudioBufferProvider {
+    public:
+                            ResamplerBufferProvider(RecordTrack* recordTrack) :
+                                mRecordTrack(recordTrack) { }
+        virtual             ~ResamplerBufferProvider() { }
+        // AudioBufferProvider interface
+        virtual status_t    getNextBuffer(AudioBufferProvider::Buffer* buffer, int64_t pts);
+        virtual void        releaseBuffer(AudioBufferProvider::Buffer* buffer);
+    private:
+        RecordTrack * const mRecordTrack;
+    };
+
     bool                mOverflow;  // overflow on most recent attempt to fill client buffer
     AudioRecordServerProxy* mAudioRecordServerProxy;
+
+    // Capture state, only accessed by the RecordThread.
+    // The pipe reader is attached while the track is active; the conversion buffers and the
+    // resampler are allocated on first use and kept until the input configuration changes.
+    sp<NBAIO_Source>    mPipeReader;        // this track's reader of the thread's capture pipe
+    bool                mDirectCapture;     // reads the HAL buffer directly, when there is no
+                                            // capture pipe
+    uint32_t            mRsmpInChannelCount;    // channel count of the capture pipe
+    int16_t*            mRsmpInBuffer;      // input staged for channel or rate conversion
+    size_t              mRsmpInFrames;      // capacity of mRsmpInBuffer in frames
+    size_t              mRsmpInFront;       // next frame of mRsmpInBuffer to be consumed
+    size_t              mRsmpInRear;        // number of frames in mRsmpInBuffer
+    AudioResampler*     mResampler;         // non-NULL if sample rate conversion is needed
+    int32_t*            mRsmpOutBuffer;     // resampler output, interleaved stereo Q19.12
+    size_t              mRsmpOutFrames;     // capacity of mRsmpOutBuffer in frames
+    ResamplerBufferProvider mResamplerBufferProvider;
+
+    // sync event triggering actual audio capture. Frames read before this event will
+    // be dropped and therefore not read by the application.
+    sp<SyncEvent>       mSyncStartEvent;
+    // number of captured frames to drop after the start sync event has been received.
+    // when < 0, maximum frames to drop before starting capture even if sync event is
+    // not received
+    ssize_t             mFramesToDrop;
 };
@@ -169,6 +169,10 @@ public:
     // Return whether the current state is dirty (modified and not pushed).
     bool    isDirty() const { return mIsDirty; }
 
+    // Number of states in the queue.  When a state is pushed, it is copied with T::operator=
+    // over the state that was pushed kN - 1 pushes earlier, which becomes the mutable state.
+    static const unsigned kN = 4;       // values < 4 are not supported by this code
+
 #ifdef STATE_QUEUE_DUMP
     // Register location of observer dump area
     void    setObserverDump(StateQueueObserverDump *dump)
@@ -180,7 +184,6 @@ public:
 #endif
 
 private:
-    static const unsigned kN = 4;       // values < 4 are not supported by this code
     T                 mStates[kN];      // written by mutator, read by observer
 
     // "volatile" is meaningless with SMP, but here it indicates that we're using atomic ops
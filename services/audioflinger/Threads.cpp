@@ -36,6 +36,7 @@
 #include <audio_utils/primitives.h>
 
 // NBAIO implementations
+#include <media/nbaio/AudioStreamInSource.h>
 #include <media/nbaio/AudioStreamOutSink.h>
 #include <media/nbaio/MonoPipe.h>
 #include <media/nbaio/MonoPipeReader.h>
@@ -50,6 +51,7 @@
 
 #include "AudioFlinger.h"
 #include "AudioMixer.h"
+#include "AudioMixerOps.h"
 #include "FastMixer.h"
 #include "ServiceUtilities.h"
 #include "SchedulingPolicyService.h"
@@ -129,9 +131,37 @@ static const enum {
     //  up large writes into smaller ones, and the wrapper would need to deal with scheduler.
 } kUseFastMixer = FastMixer_Static;
 
+// Whether to use fast capture
+static const enum {
+    FastCapture_Never,  // never initialize or use: for debugging only
+    FastCapture_Always, // always initialize and use, even if not needed: for debugging only
+    FastCapture_Static, // initialize if needed, then use all the time if initialized
+} kUseFastCapture = FastCapture_Static;
+
+// The input HAL period must be shorter than this for a RecordThread to use fast capture
+static const uint32_t kMaxFastCaptureBufferSizeMs = 20;
+
+// Depth of the pipe between the fast capture and the RecordThread, in HAL periods;
+// it compensates for the scheduling latency of the RecordThread
+static const size_t kFastCapturePipePeriods = 8;
+
+// Depth of the capture pipe shared by the record tracks of a RecordThread, in HAL periods;
+// a client that falls further behind than this loses input
+static const size_t kCapturePipePeriods = 4;
+
+// Whether the normal mixer of a MixerThread accumulates in float rather than in 16 bit,
+// so that headroom is kept until the single conversion to the HAL format
+static const bool kUseFloatMixerBuffer = true;
+
+// Whether a DuplicatingThread writes into a pipe which each destination MixerThread adds to its
+// mix directly, rather than through an ordinary track which the destination mixes again.
+// Destinations with a different sample rate or channel count always use an ordinary track.
+static const bool kUseDuplicatingPipe = true;
+
 // Priorities for requestPriority
 static const int kPriorityAudioApp = 2;
 static const int kPriorityFastMixer = 3;
+static const int kPriorityFastCapture = 3;
 
 // IAudioFlinger::createTrack() reports back to client the total size of shared memory area
 // for the track.  The client then sub-divides this into smaller buffers for its use.
@@ -1002,7 +1032,10 @@ AudioFlinger::PlaybackThread::PlaybackThread(const sp<AudioFlinger>& audioFlinge
                                              type_t type)
     :   ThreadBase(audioFlinger, id, device, AUDIO_DEVICE_NONE, type),
         mNormalFrameCount(0), mMixBuffer(NULL),
-        mAllocMixBuffer(NULL), mSuspended(0), mBytesWritten(0),
+        mAllocMixBuffer(NULL),
+        mMixerBufferEnabled(kUseFloatMixerBuffer && (type == MIXER || type == DUPLICATING)),
+        mMixerBuffer(NULL), mMixerBufferValid(false),
+        mSuspended(0), mBytesWritten(0),
         mActiveTracksGeneration(0),
         // mStreamTypes[] initialized in constructor body
         mOutput(output),
@@ -1018,7 +1051,7 @@ AudioFlinger::PlaybackThread::PlaybackThread(const sp<AudioFlinger>& audioFlinge
         mSignalPending(false),
         mScreenState(AudioFlinger::mScreenState),
         // index 0 is reserved for normal mixer's submix
-        mFastTrackAvailMask(((1 << FastMixerState::kMaxFastTracks) - 1) & ~1),
+        mFastTrackAvailMask((~0U >> (32 - FastMixerState::kMaxFastTracks)) & ~1U),
         // mLatchD, mLatchQ,
         mLatchDValid(false), mLatchQValid(false)
 {
@@ -1061,6 +1094,7 @@ AudioFlinger::PlaybackThread::~PlaybackThread()
 {
     mAudioFlinger->unregisterWriter(mNBLogWriter);
     delete [] mAllocMixBuffer;
+    delete [] mMixerBuffer;
 }
 
 void AudioFlinger::PlaybackThread::dump(int fd, const Vector<String16>& args)
@@ -1114,6 +1148,19 @@ void AudioFlinger::PlaybackThread::dumpTracks(int fd, const Vector<String16>& ar
     }
     write(fd, result.string(), result.size());
 
+#ifdef TRACK_MIX_STATISTICS
+    result.clear();
+    result.appendFormat("Output thread %p active track mixer statistics\n", this);
+    TrackStatistics::appendDumpHeader(result);
+    for (size_t i = 0; i < mActiveTracks.size(); ++i) {
+        sp<Track> track = mActiveTracks[i].promote();
+        if (track != 0) {
+            track->dumpStatistics(result, true /*detailed*/);
+        }
+    }
+    write(fd, result.string(), result.size());
+#endif
+
     // These values are "raw"; they will wrap around.  See prepareTracks_l() for a better way.
     FastTrackUnderruns underruns = getFastTrackUnderruns(0);
     fdprintf(fd, "Normal mixer raw underrun counters: partial=%u empty=%u\n",
@@ -1143,6 +1190,10 @@ void AudioFlinger::PlaybackThread::dumpInternals(int fd, const Vector<String16>&
     result.append(buffer);
     snprintf(buffer, SIZE, "mix buffer : %p\n", mMixBuffer);
     result.append(buffer);
+    if (mMixerBufferEnabled) {
+        snprintf(buffer, SIZE, "float mixer buffer : %p\n", mMixerBuffer);
+        result.append(buffer);
+    }
     write(fd, result.string(), result.size());
     fdprintf(fd, "Fast track availMask=%#x\n", mFastTrackAvailMask);
 
@@ -1503,8 +1554,8 @@ void AudioFlinger::PlaybackThread::removeTrack_l(const sp<Track>& track)
     if (track->isFastTrack()) {
         int index = track->mFastIndex;
         ALOG_ASSERT(0 < index && index < (int)FastMixerState::kMaxFastTracks);
-        ALOG_ASSERT(!(mFastTrackAvailMask & (1 << index)));
-        mFastTrackAvailMask |= 1 << index;
+        ALOG_ASSERT(!(mFastTrackAvailMask & (1U << index)));
+        mFastTrackAvailMask |= 1U << index;
         // redundant as track is about to be destroyed, for dumpsys only
         track->mFastIndex = -1;
     }
@@ -1531,9 +1582,43 @@ String8 AudioFlinger::PlaybackThread::getParameters(const String8& keys)
         return String8();
     }
 
-    char *s = mOutput->stream->common.get_parameters(&mOutput->stream->common, keys.string());
-    const String8 out_s8(s);
+    // the track statistics are answered here, and the other keys by the HAL
+    AudioParameter param = AudioParameter(keys);
+    String8 value;
+    String8 statistics;
+    String8 halKeys = keys;
+    if (param.get(String8(AudioParameter::keyTrackStatistics), value) == NO_ERROR) {
+        param.remove(String8(AudioParameter::keyTrackStatistics));
+        statistics.appendFormat("%s=", AudioParameter::keyTrackStatistics);
+#ifdef TRACK_MIX_STATISTICS
+        bool first = true;
+        for (size_t i = 0; i < mActiveTracks.size(); ++i) {
+            sp<Track> track = mActiveTracks[i].promote();
+            if (track != 0) {
+                if (!first) {
+                    statistics.append(",");
+                }
+                track->statisticsToParameterValue(statistics);
+                first = false;
+            }
+        }
+#endif
+        if (param.size() == 0) {
+            return statistics;
+        }
+        halKeys = param.toString();
+    }
+
+    char *s = mOutput->stream->common.get_parameters(&mOutput->stream->common,
+            halKeys.string());
+    String8 out_s8(s);
     free(s);
+    if (!statistics.isEmpty()) {
+        if (!out_s8.isEmpty()) {
+            out_s8.append(";");
+        }
+        out_s8.append(statistics);
+    }
     return out_s8;
 }
 
@@ -1627,11 +1712,19 @@ void AudioFlinger::PlaybackThread::readOutputParameters()
     if (!audio_is_output_channel(mChannelMask)) {
         LOG_FATAL("HAL channel mask %#x not valid for output", mChannelMask);
     }
-    if ((mType == MIXER || mType == DUPLICATING) && mChannelMask != AUDIO_CHANNEL_OUT_STEREO) {
+    mChannelCount = popcount(mChannelMask);
+    // a mixer thread with a float mix buffer can drive up to AudioMixer::MAX_NUM_CHANNELS,
+    // everything else that mixes is limited to stereo
+    if (mType == MIXER && mMixerBufferEnabled) {
+        if (mChannelCount > AudioMixer::MAX_NUM_CHANNELS) {
+            LOG_FATAL("HAL channel mask %#x not supported for mixed output; "
+                    "must have at most %u channels", mChannelMask, AudioMixer::MAX_NUM_CHANNELS);
+        }
+    } else if ((mType == MIXER || mType == DUPLICATING) &&
+            mChannelMask != AUDIO_CHANNEL_OUT_STEREO) {
         LOG_FATAL("HAL channel mask %#x not supported for mixed output; "
                 "must be AUDIO_CHANNEL_OUT_STEREO", mChannelMask);
     }
-    mChannelCount = popcount(mChannelMask);
     mFormat = mOutput->stream->common.get_format(&mOutput->stream->common);
     if (!audio_is_valid_format(mFormat)) {
         LOG_FATAL("HAL format %d not valid for output", mFormat);
@@ -1704,6 +1797,12 @@ void AudioFlinger::PlaybackThread::readOutputParameters()
     mMixBuffer = (int16_t *) ((((size_t)mAllocMixBuffer + align - 1) / align) * align);
     memset(mMixBuffer, 0, mNormalFrameCount * mFrameSize);
 
+    if (mMixerBufferEnabled) {
+        delete[] mMixerBuffer;
+        mMixerBuffer = new float[mNormalFrameCount * mChannelCount];
+        memset(mMixerBuffer, 0, mNormalFrameCount * mChannelCount * sizeof(float));
+    }
+
     // force reconfiguration of effect chains and engines to take new buffer size and audio
     // parameters into account
     // Note that mLock is not held when readOutputParameters() is called from the constructor
@@ -2452,7 +2551,9 @@ AudioFlinger::MixerThread::MixerThread(const sp<AudioFlinger>& audioFlinger, Aud
     :   PlaybackThread(audioFlinger, output, id, device, type),
         // mAudioMixer below
         // mFastMixer below
-        mFastMixerFutex(0)
+        mFastMixerFutex(0),
+        mMixBufferWritten(false), mPipeVolume(0), mPipeVolumePrev(0),
+        mPipeBuffer(NULL), mPipeBufferSamples(0)
         // mOutputSink below
         // mPipeSink below
         // mNormalSink below
@@ -2464,9 +2565,9 @@ AudioFlinger::MixerThread::MixerThread(const sp<AudioFlinger>& audioFlinger, Aud
             mNormalFrameCount);
     mAudioMixer = new AudioMixer(mNormalFrameCount, mSampleRate);
 
-    // FIXME - Current mixer implementation only supports stereo output
+    // FastMixer only supports stereo output; multichannel outputs are mixed by the normal mixer
     if (mChannelCount != FCC_2) {
-        ALOGE("Invalid audio hardware channel count %d", mChannelCount);
+        ALOGI("HAL output has %u channels, fast mixer disabled", mChannelCount);
     }
 
     // create an NBAIO sink for the HAL output stream, and negotiate
@@ -2490,6 +2591,9 @@ AudioFlinger::MixerThread::MixerThread(const sp<AudioFlinger>& audioFlinger, Aud
         initFastMixer = mFrameCount < mNormalFrameCount;
         break;
     }
+    if (mChannelCount != FCC_2) {
+        initFastMixer = false;
+    }
     if (initFastMixer) {
 
         // create a MonoPipe to connect our submix to FastMixer
@@ -2535,6 +2639,7 @@ AudioFlinger::MixerThread::MixerThread(const sp<AudioFlinger>& audioFlinger, Aud
         fastTrack->mBufferProvider = new SourceAudioBufferProvider(new MonoPipeReader(monoPipe));
         fastTrack->mVolumeProvider = NULL;
         fastTrack->mGeneration++;
+        state->trackModified(0);
         state->mFastTracksGen++;
         state->mTrackMask = 1;
         // fast mixer will use the HAL output sink
@@ -2552,6 +2657,9 @@ AudioFlinger::MixerThread::MixerThread(const sp<AudioFlinger>& audioFlinger, Aud
 #endif
         mFastMixerNBLogWriter = audioFlinger->newWriter_l(kFastMixerLogSize, "FastMixer");
         state->mNBLogWriter = mFastMixerNBLogWriter.get();
+        mFastMixerPerfNBLogWriter = audioFlinger->newWriter_l(kFastMixerPerfLogSize,
+                "FastMixer perf");
+        state->mPerfNBLogWriter = mFastMixerPerfNBLogWriter.get();
         sq->end();
         sq->push(FastMixerStateQueue::BLOCK_UNTIL_PUSHED);
 
@@ -2629,7 +2737,9 @@ AudioFlinger::MixerThread::~MixerThread()
 #endif
     }
     mAudioFlinger->unregisterWriter(mFastMixerNBLogWriter);
+    mAudioFlinger->unregisterWriter(mFastMixerPerfNBLogWriter);
     delete mAudioMixer;
+    delete[] mPipeBuffer;
 }
 
 
@@ -2767,6 +2877,13 @@ void AudioFlinger::MixerThread::threadLoop_mix()
 
     // mix buffers...
     mAudioMixer->process(pts);
+    // convert the float mix to the HAL format; effect chains accumulate into mMixBuffer later
+    if (mMixerBufferValid) {
+        clampFloatToPcm16(mMixBuffer, mMixerBuffer, mNormalFrameCount * mChannelCount);
+    }
+    if (!mPipeOutputTracks.isEmpty()) {
+        mixPipeOutputTracks();
+    }
     mCurrentWriteLength = mixBufferSize;
     // increase sleep time progressively when application underrun condition clears.
     // Only increase sleep time if the mixer is ready for two consecutive times to avoid
@@ -2780,6 +2897,61 @@ void AudioFlinger::MixerThread::threadLoop_mix()
     //TODO: delay standby when effects have a tail
 }
 
+void AudioFlinger::MixerThread::mixPipeOutputTracks()
+{
+    size_t samples = mNormalFrameCount * mChannelCount;
+    for (size_t i = 0; i < mPipeOutputTracks.size(); i++) {
+        // the first pipe read goes straight into mMixBuffer if the mixer didn't write it
+        int16_t *dst = mMixBuffer;
+        if (mMixBufferWritten) {
+            if (mPipeBufferSamples < samples) {
+                delete[] mPipeBuffer;
+                mPipeBuffer = new int16_t[samples];
+                mPipeBufferSamples = samples;
+            }
+            dst = mPipeBuffer;
+        }
+        ssize_t framesRead = mPipeOutputTracks[i]->readPipe(dst, mNormalFrameCount);
+        if (framesRead < 0) {
+            framesRead = 0;
+        }
+        size_t samplesRead = framesRead * mChannelCount;
+        if (samplesRead < samples) {
+            memset(dst + samplesRead, 0, (samples - samplesRead) * sizeof(int16_t));
+        }
+        if (mPipeVolume != mPipeVolumePrev) {
+            // ramp over the mix buffer like the mixer does for track volumes, to avoid a click
+            const int32_t volumeStart = mPipeVolumePrev;
+            const int32_t volumeDelta = (int32_t)mPipeVolume - volumeStart;
+            for (size_t f = 0, j = 0; f < (size_t)framesRead; f++) {
+                const int32_t volume = volumeStart +
+                        (volumeDelta * (int32_t)f) / (int32_t)mNormalFrameCount;
+                for (uint32_t c = 0; c < mChannelCount; c++, j++) {
+                    const int32_t sample = (dst[j] * volume) >> 12;
+                    mMixBuffer[j] = clamp16(dst == mMixBuffer ? sample : mMixBuffer[j] + sample);
+                }
+            }
+        } else if (dst == mMixBuffer) {
+            if (mPipeVolume != MAX_GAIN_INT) {
+                for (size_t j = 0; j < samplesRead; j++) {
+                    dst[j] = clamp16((dst[j] * (int32_t)mPipeVolume) >> 12);
+                }
+            }
+        } else if (mPipeVolume == MAX_GAIN_INT) {
+            for (size_t j = 0; j < samplesRead; j++) {
+                mMixBuffer[j] = clamp16(mMixBuffer[j] + dst[j]);
+            }
+        } else {
+            for (size_t j = 0; j < samplesRead; j++) {
+                mMixBuffer[j] = clamp16(mMixBuffer[j] + ((dst[j] * (int32_t)mPipeVolume) >> 12));
+            }
+        }
+        mMixBufferWritten = true;
+    }
+    mPipeOutputTracks.clear();
+    mPipeVolumePrev = mPipeVolume;
+}
+
 void AudioFlinger::MixerThread::threadLoop_sleepTime()
 {
     // If no tracks are ready, sleep once for the duration of an output
@@ -2823,6 +2995,11 @@ AudioFlinger::PlaybackThread::mixer_state AudioFlinger::MixerThread::prepareTrac
     size_t fastTracks = 0;
     uint32_t resetMask = 0; // bit mask of fast tracks that need to be reset
 
+    // set below if a track mixes into mMixerBuffer
+    mMixerBufferValid = false;
+    mMixBufferWritten = false;
+    mPipeOutputTracks.clear();
+
     float masterVolume = mMasterVolume;
     bool masterMute = mMasterMute;
 
@@ -2837,6 +3014,11 @@ AudioFlinger::PlaybackThread::mixer_state AudioFlinger::MixerThread::prepareTrac
         masterVolume = (float)((v + (1 << 23)) >> 24);
         chain.clear();
     }
+    // pipe output tracks were written at unity gain, as an ordinary track they get master volume
+    mPipeVolume = (uint32_t)(masterVolume * MAX_GAIN_INT + 0.5f);
+    if (mPipeVolume > MAX_GAIN_INT) {
+        mPipeVolume = MAX_GAIN_INT;
+    }
 
     // prepare a new state to push
     FastMixerStateQueue *sq = NULL;
@@ -2868,7 +3050,7 @@ AudioFlinger::PlaybackThread::mixer_state AudioFlinger::MixerThread::prepareTrac
             // is impossible because the slot isn't marked available until the end of each cycle.
             int j = track->mFastIndex;
             ALOG_ASSERT(0 < j && j < (int)FastMixerState::kMaxFastTracks);
-            ALOG_ASSERT(!(mFastTrackAvailMask & (1 << j)));
+            ALOG_ASSERT(!(mFastTrackAvailMask & (1U << j)));
             FastTrack *fastTrack = &state->mFastTracks[j];
 
             // Determine whether the track is currently in underrun condition,
@@ -2971,14 +3153,16 @@ AudioFlinger::PlaybackThread::mixer_state AudioFlinger::MixerThread::prepareTrac
 
             if (isActive) {
                 // was it previously inactive?
-                if (!(state->mTrackMask & (1 << j))) {
+                if (!(state->mTrackMask & (1U << j))) {
                     ExtendedAudioBufferProvider *eabp = track;
                     VolumeProvider *vp = track;
                     fastTrack->mBufferProvider = eabp;
                     fastTrack->mVolumeProvider = vp;
                     fastTrack->mChannelMask = track->mChannelMask;
+                    fastTrack->mStatistics = track->statistics();
                     fastTrack->mGeneration++;
-                    state->mTrackMask |= 1 << j;
+                    state->trackModified(j);
+                    state->mTrackMask |= 1U << j;
                     didModify = true;
                     // no acknowledgement required for newly active tracks
                 }
@@ -2988,10 +3172,11 @@ AudioFlinger::PlaybackThread::mixer_state AudioFlinger::MixerThread::prepareTrac
                 ++fastTracks;
             } else {
                 // was it previously active?
-                if (state->mTrackMask & (1 << j)) {
+                if (state->mTrackMask & (1U << j)) {
                     fastTrack->mBufferProvider = NULL;
                     fastTrack->mGeneration++;
-                    state->mTrackMask &= ~(1 << j);
+                    state->trackModified(j);
+                    state->mTrackMask &= ~(1U << j);
                     didModify = true;
                     // If any fast tracks were removed, we must wait for acknowledgement
                     // because we're about to decrement the last sp<> on those tracks.
@@ -3006,6 +3191,32 @@ AudioFlinger::PlaybackThread::mixer_state AudioFlinger::MixerThread::prepareTrac
             continue;
         }
 
+        // output tracks in pipe mode are not mixed, but added to mMixBuffer by threadLoop_mix()
+        if (track->isOutputTrack() && static_cast<OutputTrack *>(track)->hasPipe()) {
+            OutputTrack *outputTrack = static_cast<OutputTrack *>(track);
+            mAudioMixer->disable(track->name());
+            if (track->isStopped() || track->isTerminated()) {
+                outputTrack->flushPipe();
+                if (track->isStopped()) {
+                    track->reset();
+                }
+                tracksToRemove->add(track);
+            } else {
+                if (mStreamTypes[track->streamType()].mute) {
+                    mPipeVolume = 0;
+                }
+                // while the DuplicatingThread is late, its track contributes silence
+                // rather than making the whole mix wait for it
+                mPipeOutputTracks.add(outputTrack);
+                if (track->framesReady() >= mNormalFrameCount &&
+                        (mMixerStatusIgnoringFastTracks != MIXER_TRACKS_READY ||
+                        mixerStatus != MIXER_TRACKS_ENABLED)) {
+                    mixerStatus = MIXER_TRACKS_READY;
+                }
+            }
+            continue;
+        }
+
         {   // local variable scope to avoid goto warning
 
         audio_track_cblk_t* cblk = track->cblk();
@@ -3050,7 +3261,9 @@ AudioFlinger::PlaybackThread::mixer_state AudioFlinger::MixerThread::prepareTrac
             // track->mainBuffer() != mMixBuffer means there is an effect chain
             // connected to the track
             chain.clear();
-            if (track->mainBuffer() != mMixBuffer) {
+            if (track->mainBuffer() == mMixBuffer) {
+                mMixBufferWritten = true;
+            } else {
                 chain = getEffectChain_l(track->sessionId());
                 // Delegate volume control to effect in track effect chain if needed
                 if (chain != 0) {
@@ -3163,6 +3376,10 @@ AudioFlinger::PlaybackThread::mixer_state AudioFlinger::MixerThread::prepareTrac
                 name,
                 AudioMixer::TRACK,
                 AudioMixer::CHANNEL_MASK, (void *)(uintptr_t)track->channelMask());
+            mAudioMixer->setParameter(
+                name,
+                AudioMixer::TRACK,
+                AudioMixer::MIXER_CHANNEL_MASK, (void *)(uintptr_t)mChannelMask);
             // limit track sample rate to 2 x output sample rate, which changes at re-configuration
             uint32_t maxSampleRate = mSampleRate * 2;
             uint32_t reqSampleRate = track->mAudioTrackServerProxy->getSampleRate();
@@ -3176,14 +3393,36 @@ AudioFlinger::PlaybackThread::mixer_state AudioFlinger::MixerThread::prepareTrac
                 AudioMixer::RESAMPLE,
                 AudioMixer::SAMPLE_RATE,
                 (void *)(uintptr_t)reqSampleRate);
+            // tracks without an effect chain are mixed in float when mMixerBuffer is enabled;
+            // tracks with an effect chain mix into the 16 bit chain input buffer
+            if (mMixerBufferEnabled && track->mainBuffer() == mMixBuffer) {
+                mAudioMixer->setParameter(
+                    name,
+                    AudioMixer::TRACK,
+                    AudioMixer::MIXER_FORMAT, (void *)AUDIO_FORMAT_PCM_FLOAT);
+                mAudioMixer->setParameter(
+                    name,
+                    AudioMixer::TRACK,
+                    AudioMixer::MAIN_BUFFER, (void *)mMixerBuffer);
+                mMixerBufferValid = true;
+            } else {
+                mAudioMixer->setParameter(
+                    name,
+                    AudioMixer::TRACK,
+                    AudioMixer::MIXER_FORMAT, (void *)AUDIO_FORMAT_PCM_16_BIT);
+                mAudioMixer->setParameter(
+                    name,
+                    AudioMixer::TRACK,
+                    AudioMixer::MAIN_BUFFER, (void *)track->mainBuffer());
+            }
             mAudioMixer->setParameter(
                 name,
                 AudioMixer::TRACK,
-                AudioMixer::MAIN_BUFFER, (void *)track->mainBuffer());
+                AudioMixer::AUX_BUFFER, (void *)track->auxBuffer());
             mAudioMixer->setParameter(
                 name,
                 AudioMixer::TRACK,
-                AudioMixer::AUX_BUFFER, (void *)track->auxBuffer());
+                AudioMixer::STATISTICS, (void *)track->statistics());
 
             // reset retry count
             track->mRetryCount = kMaxTrackRetries;
@@ -3300,6 +3539,7 @@ track_is_ready: ;
             (mixedTracks == 0 && fastTracks > 0))) {
         // FIXME as a performance optimization, should remember previous zero status
         memset(mMixBuffer, 0, mNormalFrameCount * mChannelCount * sizeof(int16_t));
+        mMixBufferWritten = true;
     }
 
     // if any fast tracks, then status is ready
@@ -3967,6 +4207,20 @@ AudioFlinger::PlaybackThread::mixer_state AudioFlinger::OffloadThread::prepareTr
 
     ALOGV("OffloadThread::prepareTracks_l active tracks %d", count);
 
+    // Only consider the track that owns the output for volume and mixer state control.
+    // This is normally the last track started, but a track that was stopped keeps the output
+    // until all its data has been written and partially drained: a track started meanwhile is
+    // queued behind it, so that consecutive tracks play gapless without flushing the DSP.
+    // In theory an older track could underrun and restart after the new one starts
+    // but as we only care about the transition phase between two tracks on a
+    // direct output, it is not a problem to ignore the underrun case.
+    sp<Track> owner = mPreviousTrack.promote();
+    sp<Track> l = mLatestActiveTrack.promote();
+    if (owner == 0 || owner == l || !(owner->isStopping_1() || owner->isStopping_2()) ||
+            mActiveTracks.indexOf(owner) < 0) {
+        owner = l;
+    }
+
     // find out which tracks need to be processed
     for (size_t i = 0; i < count; i++) {
         sp<Track> t = mActiveTracks[i].promote();
@@ -3976,12 +4230,7 @@ AudioFlinger::PlaybackThread::mixer_state AudioFlinger::OffloadThread::prepareTr
         }
         Track* const track = t.get();
         audio_track_cblk_t* cblk = track->cblk();
-        // Only consider last track started for volume and mixer state control.
-        // In theory an older track could underrun and restart after the new one starts
-        // but as we only care about the transition phase between two tracks on a
-        // direct output, it is not a problem to ignore the underrun case.
-        sp<Track> l = mLatestActiveTrack.promote();
-        bool last = l.get() == track;
+        bool last = owner.get() == track;
 
         if (track->isPausing()) {
             track->setPaused();
@@ -4054,6 +4303,13 @@ AudioFlinger::PlaybackThread::mixer_state AudioFlinger::OffloadThread::prepareTr
                         }
                     }
                 }
+                if (!track->mOffloadParameters.isEmpty()) {
+                    // codec parameters of a queued track, e.g. its gapless encoder delay and
+                    // padding, must reach the HAL just before the track's first write
+                    mOutput->stream->common.set_parameters(&mOutput->stream->common,
+                            track->mOffloadParameters.string());
+                    track->mOffloadParameters.clear();
+                }
                 mPreviousTrack = track;
                 // reset retry count
                 track->mRetryCount = kMaxTrackRetriesOffload;
@@ -4100,6 +4356,11 @@ AudioFlinger::PlaybackThread::mixer_state AudioFlinger::OffloadThread::prepareTr
                     track->presentationComplete(framesWritten, audioHALFrames);
                     track->reset();
                     tracksToRemove->add(track);
+                    if (last) {
+                        // the track was played out, so a queued track takes over the output
+                        // without flushing it
+                        mPreviousTrack.clear();
+                    }
                 }
             } else {
                 // No buffers for this track. Give it a few chances to
@@ -4144,6 +4405,25 @@ AudioFlinger::PlaybackThread::mixer_state AudioFlinger::OffloadThread::prepareTr
     return mixerStatus;
 }
 
+status_t AudioFlinger::OffloadThread::setTrackParameters(const sp<Track>& track,
+        const String8& keyValuePairs)
+{
+    {
+        Mutex::Autolock _l(mLock);
+        sp<Track> previousTrack = mPreviousTrack.promote();
+        if (previousTrack != 0 && previousTrack != track) {
+            // the output is still playing another track: hold the parameters until this track
+            // takes over in prepareTracks_l(), so they don't apply to the other track's data
+            if (!track->mOffloadParameters.isEmpty()) {
+                track->mOffloadParameters.append(";");
+            }
+            track->mOffloadParameters.append(keyValuePairs);
+            return NO_ERROR;
+        }
+    }
+    return setParameters(keyValuePairs);
+}
+
 void AudioFlinger::OffloadThread::flushOutput_l()
 {
     mFlushPending = true;
@@ -4222,6 +4502,9 @@ void AudioFlinger::DuplicatingThread::threadLoop_mix()
     // mix buffers...
     if (outputsReady(outputTracks)) {
         mAudioMixer->process(AudioBufferProvider::kInvalidPTS);
+        if (mMixerBufferValid) {
+            clampFloatToPcm16(mMixBuffer, mMixerBuffer, mNormalFrameCount * mChannelCount);
+        }
     } else {
         memset(mMixBuffer, 0, mixBufferSize);
     }
@@ -4283,17 +4566,29 @@ void AudioFlinger::DuplicatingThread::addOutputTrack(MixerThread *thread)
     Mutex::Autolock _l(mLock);
     // FIXME explain this formula
     size_t frameCount = (3 * mNormalFrameCount * mSampleRate) / thread->sampleRate();
+    // the destination adds the pipe contents to its mix without resampling or remixing
+    // and the pipe needs a format NBAIO can describe; otherwise the track goes through the mixer
+    bool usePipe = kUseDuplicatingPipe && thread->sampleRate() == mSampleRate &&
+            thread->channelCount() == mChannelCount && thread->format() == mFormat &&
+            Format_from_SR_C(mSampleRate, mChannelCount) != Format_Invalid;
+    if (usePipe) {
+        // room for three buffers of whichever thread has the longer cycle
+        frameCount = 3 * (mNormalFrameCount > thread->frameCount() ?
+                mNormalFrameCount : thread->frameCount());
+    }
     OutputTrack *outputTrack = new OutputTrack(thread,
                                             this,
                                             mSampleRate,
                                             mFormat,
                                             mChannelMask,
                                             frameCount,
-                                            IPCThreadState::self()->getCallingUid());
+                                            IPCThreadState::self()->getCallingUid(),
+                                            usePipe);
     if (outputTrack->cblk() != NULL) {
         thread->setStreamVolume(AUDIO_STREAM_CNT, 1.0f);
         mOutputTracks.add(outputTrack);
-        ALOGV("addOutputTrack() track %p, on thread %p", outputTrack, thread);
+        ALOGV("addOutputTrack() track %p, on thread %p%s", outputTrack, thread,
+                outputTrack->hasPipe() ? " through pipe" : "");
         updateWaitTime_l();
     }
 }
@@ -4378,27 +4673,44 @@ AudioFlinger::RecordThread::RecordThread(const sp<AudioFlinger>& audioFlinger,
 #endif
                                          ) :
     ThreadBase(audioFlinger, id, outDevice, inDevice, RECORD),
-    mInput(input), mResampler(NULL), mRsmpOutBuffer(NULL), mRsmpInBuffer(NULL),
-    // mRsmpInIndex and mBufferSize set by readInputParameters()
+    mInput(input), mRsmpInBuffer(NULL),
+    // mBufferSize and mCapturePipe set by readInputParameters()
     mReqChannelCount(popcount(channelMask)),
-    mReqSampleRate(sampleRate)
+    mReqSampleRate(sampleRate),
+    mStartInputPending(false)
     // mBytesRead is only meaningful while active, and so is cleared in start()
     // (but might be better to also clear here for dump?)
 #ifdef TEE_SINK
     , mTeeSink(teeSink)
 #endif
+    , mFastCapture(NULL)
+    // mInputSource, mPipeSink, mPipeSource set by initFastCapture()
+    , mFastCaptureFutex(0)
 {
     snprintf(mName, kNameLength, "AudioIn_%X", id);
 
+    if (kUseFastCapture != FastCapture_Never) {
+        // the fast capture may be created or re-created later by readInputParameters(),
+        // without the AudioFlinger lock, so the log writer is allocated once here
+        mFastCaptureNBLogWriter = audioFlinger->newWriter_l(kFastCaptureLogSize, "FastCapture");
+        mFastCapturePerfNBLogWriter = audioFlinger->newWriter_l(kFastCapturePerfLogSize,
+                "FastCapture perf");
+    }
+
     readInputParameters();
 }
 
 
 AudioFlinger::RecordThread::~RecordThread()
 {
+    destroyFastCapture();
+    mAudioFlinger->unregisterWriter(mFastCaptureNBLogWriter);
+    mAudioFlinger->unregisterWriter(mFastCapturePerfNBLogWriter);
+    // tracks can outlive the thread, but their readers must not outlive the capture pipe
+    for (size_t i = 0; i < mTracks.size(); i++) {
+        mTracks[i]->mPipeReader.clear();
+    }
     delete[] mRsmpInBuffer;
-    delete mResampler;
-    delete[] mRsmpOutBuffer;
 }
 
 void AudioFlinger::RecordThread::onFirstRef()
@@ -4415,8 +4727,8 @@ status_t AudioFlinger::RecordThread::readyToRun()
 
 bool AudioFlinger::RecordThread::threadLoop()
 {
-    AudioBufferProvider::Buffer buffer;
-    sp<RecordTrack> activeTrack;
+    // local copy of mActiveTracks, so that the tracks can be filled without holding mLock
+    SortedVector< sp<RecordTrack> > activeTracks;
     Vector< sp<EffectChain> > effectChains;
 
     nsecs_t lastWarning = 0;
@@ -4424,8 +4736,7 @@ bool AudioFlinger::RecordThread::threadLoop()
     inputStandBy();
     {
         Mutex::Autolock _l(mLock);
-        activeTrack = mActiveTrack;
-        acquireWakeLock_l(activeTrack != 0 ? activeTrack->uid() : -1);
+        acquireWakeLock_l(!mActiveTracks.isEmpty() ? mActiveTracks[0]->uid() : -1);
     }
 
     // used to verify we've read at least once before evaluating how many bytes were read
@@ -4439,13 +4750,52 @@ bool AudioFlinger::RecordThread::threadLoop()
         { // scope for mLock
             Mutex::Autolock _l(mLock);
             checkForNewParameters_l();
-            if (mActiveTrack != 0 && activeTrack != mActiveTrack) {
-                SortedVector<int> tmp;
-                tmp.add(mActiveTrack->uid());
-                updateWakeLockUids_l(tmp);
+
+            bool activeTracksChanged = false;
+            for (size_t i = 0; i < mActiveTracks.size(); ) {
+                sp<RecordTrack> activeTrack = mActiveTracks[i];
+                if (activeTrack->isTerminated()) {
+                    detachCapture_l(activeTrack);
+                    removeTrack_l(activeTrack);
+                    mActiveTracks.removeAt(i);
+                    activeTracksChanged = true;
+                    continue;
+                }
+                if (activeTrack->mState == TrackBase::PAUSING) {
+                    detachCapture_l(activeTrack);
+                    mActiveTracks.removeAt(i);
+                    activeTracksChanged = true;
+                    mStartStopCond.broadcast();
+                    continue;
+                }
+                if (activeTrack->mState == TrackBase::RESUMING) {
+                    if (activeTrack->mPipeReader == 0 && !activeTrack->mDirectCapture) {
+                        // the input can't be converted to the format of this track
+                        mActiveTracks.removeAt(i);
+                        activeTracksChanged = true;
+                        mStartStopCond.broadcast();
+                        continue;
+                    }
+                    if (readOnce) {
+                        // record start succeeds only if first read from audio input
+                        // succeeds
+                        if (mBytesRead >= 0) {
+                            activeTrack->mState = TrackBase::ACTIVE;
+                        } else {
+                            detachCapture_l(activeTrack);
+                            mActiveTracks.removeAt(i);
+                            activeTracksChanged = true;
+                            mStartStopCond.broadcast();
+                            continue;
+                        }
+                        mStartStopCond.broadcast();
+                    }
+                    mStandby = false;
+                }
+                i++;
             }
-            activeTrack = mActiveTrack;
-            if (mActiveTrack == 0 && mConfigEvents.isEmpty()) {
+
+            if (mActiveTracks.isEmpty() && mConfigEvents.isEmpty()) {
                 standby();
 
                 if (exitPending()) {
@@ -4457,176 +4807,70 @@ bool AudioFlinger::RecordThread::threadLoop()
                 // go to sleep
                 mWaitWorkCV.wait(mLock);
                 ALOGV("RecordThread: loop starting");
-                acquireWakeLock_l(mActiveTrack != 0 ? mActiveTrack->uid() : -1);
+                acquireWakeLock_l(!mActiveTracks.isEmpty() ? mActiveTracks[0]->uid() : -1);
                 continue;
             }
-            if (mActiveTrack != 0) {
-                if (mActiveTrack->isTerminated()) {
-                    removeTrack_l(mActiveTrack);
-                    mActiveTrack.clear();
-                } else if (mActiveTrack->mState == TrackBase::PAUSING) {
-                    standby();
-                    mActiveTrack.clear();
-                    mStartStopCond.broadcast();
-                } else if (mActiveTrack->mState == TrackBase::RESUMING) {
-                    if (mReqChannelCount != mActiveTrack->channelCount()) {
-                        mActiveTrack.clear();
-                        mStartStopCond.broadcast();
-                    } else if (readOnce) {
-                        // record start succeeds only if first read from audio input
-                        // succeeds
-                        if (mBytesRead >= 0) {
-                            mActiveTrack->mState = TrackBase::ACTIVE;
-                        } else {
-                            mActiveTrack.clear();
-                        }
-                        mStartStopCond.broadcast();
-                    }
-                    mStandby = false;
+            if (activeTracksChanged && !mActiveTracks.isEmpty()) {
+                SortedVector<int> tmp;
+                for (size_t i = 0; i < mActiveTracks.size(); i++) {
+                    tmp.add(mActiveTracks[i]->uid());
                 }
+                updateWakeLockUids_l(tmp);
             }
+            activeTracks = mActiveTracks;
 
             lockEffectChains_l(effectChains);
         }
 
-        if (mActiveTrack != 0) {
-            if (mActiveTrack->mState != TrackBase::ACTIVE &&
-                mActiveTrack->mState != TrackBase::RESUMING) {
-                unlockEffectChains(effectChains);
-                usleep(kRecordThreadSleepUs);
-                continue;
-            }
+        if (!activeTracks.isEmpty()) {
             for (size_t i = 0; i < effectChains.size(); i ++) {
                 effectChains[i]->process_l();
             }
 
-            buffer.frameCount = mFrameCount;
-            status_t status = mActiveTrack->getNextBuffer(&buffer);
-            if (status == NO_ERROR) {
-                readOnce = true;
-                size_t framesOut = buffer.frameCount;
-                if (mResampler == NULL) {
-                    // no resampling
-                    while (framesOut) {
-                        size_t framesIn = mFrameCount - mRsmpInIndex;
-                        if (framesIn) {
-                            int8_t *src = (int8_t *)mRsmpInBuffer + mRsmpInIndex * mFrameSize;
-                            int8_t *dst = buffer.i8 + (buffer.frameCount - framesOut) *
-                                    mActiveTrack->mFrameSize;
-                            if (framesIn > framesOut)
-                                framesIn = framesOut;
-                            mRsmpInIndex += framesIn;
-                            framesOut -= framesIn;
-                            if (mChannelCount == mReqChannelCount) {
-                                memcpy(dst, src, framesIn * mFrameSize);
-                            } else {
-                                if (mChannelCount == 1) {
-                                    upmix_to_stereo_i16_from_mono_i16((int16_t *)dst,
-                                            (int16_t *)src, framesIn);
-                                } else {
-                                    downmix_to_mono_i16_from_stereo_i16((int16_t *)dst,
-                                            (int16_t *)src, framesIn);
-                                }
-                            }
-                        }
-                        if (framesOut && mFrameCount == mRsmpInIndex) {
-                            void *readInto;
-                            if (framesOut == mFrameCount && mChannelCount == mReqChannelCount) {
-                                readInto = buffer.raw;
-                                framesOut = 0;
-                            } else {
-                                readInto = mRsmpInBuffer;
-                                mRsmpInIndex = 0;
-                            }
-                            mBytesRead = mInput->stream->read(mInput->stream, readInto,
-                                    mBufferSize);
-                            if (mBytesRead <= 0) {
-                                if ((mBytesRead < 0) && (mActiveTrack->mState == TrackBase::ACTIVE))
-                                {
-                                    ALOGE("Error reading audio input");
-                                    // Force input into standby so that it tries to
-                                    // recover at next read attempt
-                                    inputStandBy();
-                                    usleep(kRecordThreadSleepUs);
-                                }
-                                mRsmpInIndex = mFrameCount;
-                                framesOut = 0;
-                                buffer.frameCount = 0;
-                            }
-#ifdef TEE_SINK
-                            else if (mTeeSink != 0) {
-                                (void) mTeeSink->write(readInto,
-                                        mBytesRead >> Format_frameBitShift(mTeeSink->format()));
-                            }
-#endif
+            // A single read from the audio input serves all active tracks
+            mBytesRead = readInput(mRsmpInBuffer, mBufferSize);
+            readOnce = true;
+            if (mBytesRead <= 0) {
+                if (mBytesRead < 0) {
+                    bool anyActive = false;
+                    for (size_t i = 0; i < activeTracks.size(); i++) {
+                        if (activeTracks[i]->mState == TrackBase::ACTIVE) {
+                            anyActive = true;
+                            break;
                         }
                     }
-                } else {
-                    // resampling
-
-                    // resampler accumulates, but we only have one source track
-                    memset(mRsmpOutBuffer, 0, framesOut * FCC_2 * sizeof(int32_t));
-                    // alter output frame count as if we were expecting stereo samples
-                    if (mChannelCount == 1 && mReqChannelCount == 1) {
-                        framesOut >>= 1;
+                    if (anyActive) {
+                        ALOGE("Error reading audio input");
+                        // Force input into standby so that it tries to
+                        // recover at next read attempt
+                        inputStandBy();
+                        usleep(kRecordThreadSleepUs);
                     }
-                    mResampler->resample(mRsmpOutBuffer, framesOut,
-                            this /* AudioBufferProvider* */);
-                    // ditherAndClamp() works as long as all buffers returned by
-                    // mActiveTrack->getNextBuffer() are 32 bit aligned which should be always true.
-                    if (mChannelCount == 2 && mReqChannelCount == 1) {
-                        // temporarily type pun mRsmpOutBuffer from Q19.12 to int16_t
-                        ditherAndClamp(mRsmpOutBuffer, mRsmpOutBuffer, framesOut);
-                        // the resampler always outputs stereo samples:
-                        // do post stereo to mono conversion
-                        downmix_to_mono_i16_from_stereo_i16(buffer.i16, (int16_t *)mRsmpOutBuffer,
-                                framesOut);
-                    } else {
-                        ditherAndClamp((int32_t *)buffer.raw, mRsmpOutBuffer, framesOut);
-                    }
-                    // now done with mRsmpOutBuffer
-
                 }
-                if (mFramestoDrop == 0) {
-                    mActiveTrack->releaseBuffer(&buffer);
-                } else {
-                    if (mFramestoDrop > 0) {
-                        mFramestoDrop -= buffer.frameCount;
-                        if (mFramestoDrop <= 0) {
-                            clearSyncStartEvent();
-                        }
-                    } else {
-                        mFramestoDrop += buffer.frameCount;
-                        if (mFramestoDrop >= 0 || mSyncStartEvent == 0 ||
-                                mSyncStartEvent->isCancelled()) {
-                            ALOGW("Synced record %s, session %d, trigger session %d",
-                                  (mFramestoDrop >= 0) ? "timed out" : "cancelled",
-                                  mActiveTrack->sessionId(),
-                                  (mSyncStartEvent != 0) ? mSyncStartEvent->triggerSession() : 0);
-                            clearSyncStartEvent();
-                        }
-                    }
+            } else {
+#ifdef TEE_SINK
+                if (mTeeSink != 0) {
+                    (void) mTeeSink->write(mRsmpInBuffer,
+                            mBytesRead >> Format_frameBitShift(mTeeSink->format()));
                 }
-                mActiveTrack->clearOverflow();
-            }
-            // client isn't retrieving buffers fast enough
-            else {
-                if (!mActiveTrack->setOverflow()) {
-                    nsecs_t now = systemTime();
-                    if ((now - lastWarning) > kWarningThrottleNs) {
-                        ALOGW("RecordThread: buffer overflow");
-                        lastWarning = now;
+#endif
+                if (mCapturePipe != 0) {
+                    (void) mCapturePipe->write(mRsmpInBuffer, mBytesRead / mFrameSize);
+                }
+                for (size_t i = 0; i < activeTracks.size(); i++) {
+                    const sp<RecordTrack>& activeTrack = activeTracks[i];
+                    if (activeTrack->mState == TrackBase::ACTIVE ||
+                            activeTrack->mState == TrackBase::RESUMING) {
+                        fillTrackBuffer(activeTrack, lastWarning);
                     }
                 }
-                // Release the processor for a while before asking for a new buffer.
-                // This will give the application more chance to read from the buffer and
-                // clear the overflow.
-                usleep(kRecordThreadSleepUs);
             }
         }
         // enable changes in effect chain
         unlockEffectChains(effectChains);
         effectChains.clear();
+        // tracks removed from mActiveTracks by another iteration must not be kept alive here
+        activeTracks.clear();
     }
 
     standby();
@@ -4637,7 +4881,10 @@ bool AudioFlinger::RecordThread::threadLoop()
             sp<RecordTrack> track = mTracks[i];
             track->invalidate();
         }
-        mActiveTrack.clear();
+        for (size_t i = 0; i < mActiveTracks.size(); i++) {
+            detachCapture_l(mActiveTracks[i]);
+        }
+        mActiveTracks.clear();
         mStartStopCond.broadcast();
     }
 
@@ -4647,6 +4894,177 @@ bool AudioFlinger::RecordThread::threadLoop()
     return false;
 }
 
+// Number of output frames that can certainly be produced from srcFrames input frames,
+// leaving a little margin for the phase of the resampler
+static size_t destinationFramesPossible(size_t srcFrames, uint32_t srcSampleRate,
+        uint32_t dstSampleRate)
+{
+    if (srcSampleRate == dstSampleRate) {
+        return srcFrames;
+    }
+    uint64_t dstFrames = ((uint64_t) srcFrames * dstSampleRate) / srcSampleRate;
+    return dstFrames > 2 ? dstFrames - 2 : 0;
+}
+
+void AudioFlinger::RecordThread::fillTrackBuffer(const sp<RecordTrack>& track,
+        nsecs_t& lastWarning)
+{
+    const sp<NBAIO_Source> reader = track->mPipeReader;
+    const bool direct = track->mDirectCapture;
+    if (reader == 0 && !direct) {
+        // the input can't be converted to the format of this track
+        return;
+    }
+    // without a capture pipe, the frames of the last HAL read that don't fit in the client
+    // buffer are lost
+    const size_t directFrames = (direct && mBytesRead > 0) ? mBytesRead / mFrameSize : 0;
+    size_t directFront = 0;
+    const uint32_t channelCount = track->channelCount();
+    const bool resample = track->sampleRate() != mSampleRate;
+
+    // lazily allocate the conversion state the first time this track needs it
+    if ((resample || channelCount != mChannelCount) && track->mRsmpInBuffer == NULL) {
+        track->mRsmpInFrames = mFrameCount;
+        track->mRsmpInBuffer = new int16_t[track->mRsmpInFrames * mChannelCount];
+        track->mRsmpInFront = 0;
+        track->mRsmpInRear = 0;
+    }
+    if (resample && track->mResampler == NULL) {
+        track->mResampler = AudioResampler::create(16, mChannelCount, track->sampleRate());
+        track->mResampler->setSampleRate(mSampleRate);
+        track->mResampler->setVolume(AudioMixer::UNITY_GAIN, AudioMixer::UNITY_GAIN);
+        track->mRsmpOutFrames = mFrameCount;
+        track->mRsmpOutBuffer = new int32_t[track->mRsmpOutFrames * FCC_2];
+    }
+
+    for (;;) {
+        ssize_t framesAvailable;
+        if (direct) {
+            framesAvailable = directFrames - directFront;
+        } else {
+            framesAvailable = reader->availableToRead();
+            if (framesAvailable == OVERRUN) {
+                // this track fell more than a pipe behind and lost input; the reader has
+                // skipped ahead to recent data
+                ALOGV("RecordThread: track %p capture overrun", track.get());
+                framesAvailable = reader->availableToRead();
+            }
+            if (framesAvailable < 0) {
+                break;
+            }
+        }
+        size_t framesIn = framesAvailable + (track->mRsmpInRear - track->mRsmpInFront);
+        size_t framesOut = resample ?
+                destinationFramesPossible(framesIn, mSampleRate, track->sampleRate()) : framesIn;
+        if (framesOut == 0) {
+            break;
+        }
+
+        AudioBufferProvider::Buffer buffer;
+        buffer.frameCount = framesOut;
+        status_t status = track->getNextBuffer(&buffer);
+        if (status != NO_ERROR || buffer.frameCount == 0) {
+            // client isn't retrieving buffers fast enough; its input stays in the capture pipe,
+            // and is lost if the client falls a whole pipe behind
+            if (!track->setOverflow()) {
+                nsecs_t now = systemTime();
+                if ((now - lastWarning) > kWarningThrottleNs) {
+                    ALOGW("RecordThread: buffer overflow");
+                    lastWarning = now;
+                }
+            }
+            break;
+        }
+        framesOut = buffer.frameCount;
+
+        if (direct) {
+            // straight from the HAL buffer to the client buffer, which has the same format
+            memcpy(buffer.raw, (int8_t *) mRsmpInBuffer + directFront * mFrameSize,
+                    framesOut * mFrameSize);
+            directFront += framesOut;
+        } else if (!resample && channelCount == mChannelCount) {
+            // straight from the capture pipe to the client buffer
+            ssize_t framesRead = reader->read(buffer.raw, framesOut,
+                    AudioBufferProvider::kInvalidPTS);
+            framesOut = framesRead > 0 ? framesRead : 0;
+        } else if (!resample) {
+            // channel conversion only
+            size_t framesDone = 0;
+            while (framesDone < framesOut) {
+                size_t framesReq = framesOut - framesDone;
+                if (framesReq > track->mRsmpInFrames) {
+                    framesReq = track->mRsmpInFrames;
+                }
+                ssize_t framesRead = reader->read(track->mRsmpInBuffer, framesReq,
+                        AudioBufferProvider::kInvalidPTS);
+                if (framesRead <= 0) {
+                    break;
+                }
+                int16_t *dst = buffer.i16 + framesDone * channelCount;
+                if (mChannelCount == 1) {
+                    upmix_to_stereo_i16_from_mono_i16(dst, track->mRsmpInBuffer, framesRead);
+                } else {
+                    downmix_to_mono_i16_from_stereo_i16(dst, track->mRsmpInBuffer, framesRead);
+                }
+                framesDone += framesRead;
+            }
+            framesOut = framesDone;
+        } else {
+            // resampling, in chunks of the resampler output buffer
+            size_t framesDone = 0;
+            while (framesDone < framesOut) {
+                size_t frames = framesOut - framesDone;
+                if (frames > track->mRsmpOutFrames) {
+                    frames = track->mRsmpOutFrames;
+                }
+                // resampler accumulates, and always outputs stereo
+                memset(track->mRsmpOutBuffer, 0, frames * FCC_2 * sizeof(int32_t));
+                track->mResampler->resample(track->mRsmpOutBuffer, frames,
+                        &track->mResamplerBufferProvider);
+                int16_t *dst = buffer.i16 + framesDone * channelCount;
+                if (channelCount == 1) {
+                    // temporarily type pun mRsmpOutBuffer from Q19.12 to int16_t
+                    ditherAndClamp(track->mRsmpOutBuffer, track->mRsmpOutBuffer, frames);
+                    downmix_to_mono_i16_from_stereo_i16(dst,
+                            (int16_t *) track->mRsmpOutBuffer, frames);
+                } else {
+                    // ditherAndClamp() works as long as all buffers returned by
+                    // track->getNextBuffer() are 32 bit aligned which should be always true.
+                    ditherAndClamp((int32_t *) dst, track->mRsmpOutBuffer, frames);
+                }
+                framesDone += frames;
+            }
+        }
+        buffer.frameCount = framesOut;
+
+        if (track->mFramesToDrop == 0) {
+            track->releaseBuffer(&buffer);
+        } else {
+            if (track->mFramesToDrop > 0) {
+                track->mFramesToDrop -= buffer.frameCount;
+                if (track->mFramesToDrop <= 0) {
+                    track->clearSyncStartEvent();
+                }
+            } else {
+                track->mFramesToDrop += buffer.frameCount;
+                if (track->mFramesToDrop >= 0 || track->mSyncStartEvent == 0 ||
+                        track->mSyncStartEvent->isCancelled()) {
+                    ALOGW("Synced record %s, session %d, trigger session %d",
+                          (track->mFramesToDrop >= 0) ? "timed out" : "cancelled",
+                          track->sessionId(),
+                          (track->mSyncStartEvent != 0) ?
+                                  track->mSyncStartEvent->triggerSession() : 0);
+                    track->clearSyncStartEvent();
+                }
+            }
+        }
+        track->clearOverflow();
+        if (framesOut == 0) {
+            break;
+        }
+    }
+}
+
 void AudioFlinger::RecordThread::standby()
 {
     if (!mStandby) {
@@ -4657,9 +5075,192 @@ void AudioFlinger::RecordThread::standby()
 
 void AudioFlinger::RecordThread::inputStandBy()
 {
+    // Idle the fast capture if it's currently running
+    if (mFastCapture != NULL) {
+        FastCaptureStateQueue *sq = mFastCapture->sq();
+        FastCaptureState *state = sq->begin();
+        if (!(state->mCommand & FastCaptureState::IDLE)) {
+            state->mCommand = FastCaptureState::COLD_IDLE;
+            state->mColdFutexAddr = &mFastCaptureFutex;
+            state->mColdGen++;
+            mFastCaptureFutex = 0;
+            sq->end();
+            // BLOCK_UNTIL_PUSHED would be insufficient, as we need it to stop doing I/O now
+            sq->push(FastCaptureStateQueue::BLOCK_UNTIL_ACKED);
+            // discard what was captured before standby, so it isn't delivered on restart
+            while (mPipeSource->read(mRsmpInBuffer, mBufferSize / mFrameSize,
+                    AudioBufferProvider::kInvalidPTS) > 0) {
+            }
+        } else {
+            sq->end(false /*didModify*/);
+        }
+    }
     mInput->stream->common.standby(&mInput->stream->common);
 }
 
+ssize_t AudioFlinger::RecordThread::readInput(void *buffer, size_t bytes)
+{
+    if (mFastCapture == NULL) {
+        return mInput->stream->read(mInput->stream, buffer, bytes);
+    }
+
+    // Start the fast capture if it's not already running
+    FastCaptureStateQueue *sq = mFastCapture->sq();
+    FastCaptureState *state = sq->begin();
+    if (state->mCommand != FastCaptureState::READ_WRITE) {
+        if (state->mCommand == FastCaptureState::COLD_IDLE) {
+            int32_t old = android_atomic_inc(&mFastCaptureFutex);
+            if (old == -1) {
+                __futex_syscall3(&mFastCaptureFutex, FUTEX_WAKE_PRIVATE, 1);
+            }
+        }
+        state->mCommand = FastCaptureState::READ_WRITE;
+        sq->end();
+        sq->push(FastCaptureStateQueue::BLOCK_UNTIL_PUSHED);
+    } else {
+        sq->end(false /*didModify*/);
+    }
+
+    // The pipe is non-blocking, so sleep for roughly the duration of the missing frames
+    // until the request is satisfied.  Give up after a few buffer periods in case the
+    // fast capture is not getting any input from the HAL.
+    size_t framesReq = bytes / mFrameSize;
+    size_t framesRead = 0;
+    uint32_t timeoutUs = (uint32_t) ((framesReq * 4000000LL) / mSampleRate);
+    uint32_t waitedUs = 0;
+    while (framesRead < framesReq) {
+        ssize_t ret = mPipeSource->read((int8_t *) buffer + framesRead * mFrameSize,
+                framesReq - framesRead, AudioBufferProvider::kInvalidPTS);
+        if (ret > 0) {
+            framesRead += ret;
+            continue;
+        }
+        if (waitedUs >= timeoutUs) {
+            break;
+        }
+        uint32_t sleepUs = (uint32_t) (((framesReq - framesRead) * 1000000LL) / mSampleRate);
+        if (sleepUs < 1000) {
+            sleepUs = 1000;
+        }
+        usleep(sleepUs);
+        waitedUs += sleepUs;
+    }
+    if (framesRead == 0) {
+        ALOGW("RecordThread: timed out reading from fast capture");
+        return 0;
+    }
+    if (framesRead < framesReq) {
+        // callers expect a full buffer, so pad the gap with silence
+        memset((int8_t *) buffer + framesRead * mFrameSize, 0,
+                (framesReq - framesRead) * mFrameSize);
+    }
+    return framesReq * mFrameSize;
+}
+
+void AudioFlinger::RecordThread::initFastCapture()
+{
+    ALOG_ASSERT(mFastCapture == NULL);
+
+    // initialize fast capture depending on configuration
+    size_t halFrameCount = mBufferSize / mFrameSize;
+    bool useFastCapture;
+    switch (kUseFastCapture) {
+    case FastCapture_Never:
+        useFastCapture = false;
+        break;
+    case FastCapture_Always:
+        useFastCapture = true;
+        break;
+    case FastCapture_Static:
+        useFastCapture = (halFrameCount * 1000) / mSampleRate < kMaxFastCaptureBufferSizeMs;
+        break;
+    }
+    // FastCapture only supports input that NBAIO can describe: 16-bit mono or stereo PCM
+    // at one of the standard sample rates
+    if (mFormat != AUDIO_FORMAT_PCM_16_BIT ||
+            Format_from_SR_C(mSampleRate, mChannelCount) == Format_Invalid) {
+        useFastCapture = false;
+    }
+    if (!useFastCapture) {
+        return;
+    }
+
+    // create an NBAIO source for the HAL input stream, and negotiate
+    const NBAIO_Format offers[1] = {Format_from_SR_C(mSampleRate, mChannelCount)};
+    AudioStreamInSource *inputSource = new AudioStreamInSource(mInput->stream);
+    size_t numCounterOffers = 0;
+    ssize_t index = inputSource->negotiate(offers, 1, NULL, numCounterOffers);
+    ALOG_ASSERT(index == 0);
+    mInputSource = inputSource;
+
+    // create a MonoPipe to connect the fast capture to the RecordThread; the fast capture
+    // must never block, so if the RecordThread falls behind, the newest input is dropped
+    NBAIO_Format format = mInputSource->format();
+    MonoPipe *monoPipe = new MonoPipe(halFrameCount * kFastCapturePipePeriods, format,
+            false /*writeCanBlock*/);
+    numCounterOffers = 0;
+    index = monoPipe->negotiate(offers, 1, NULL, numCounterOffers);
+    ALOG_ASSERT(index == 0);
+    mPipeSink = monoPipe;
+    MonoPipeReader *monoPipeReader = new MonoPipeReader(monoPipe);
+    numCounterOffers = 0;
+    index = monoPipeReader->negotiate(offers, 1, NULL, numCounterOffers);
+    ALOG_ASSERT(index == 0);
+    mPipeSource = monoPipeReader;
+
+    // create fast capture and configure it initially idle
+    mFastCapture = new FastCapture();
+    FastCaptureStateQueue *sq = mFastCapture->sq();
+    FastCaptureState *state = sq->begin();
+    state->mInputSource = mInputSource.get();
+    state->mInputSourceGen++;
+    state->mPipeSink = mPipeSink.get();
+    state->mPipeSinkGen++;
+    state->mFrameCount = halFrameCount;
+    state->mCommand = FastCaptureState::COLD_IDLE;
+    mFastCaptureFutex = 0;
+    state->mColdFutexAddr = &mFastCaptureFutex;
+    state->mColdGen++;
+    state->mDumpState = &mFastCaptureDumpState;
+    state->mNBLogWriter = mFastCaptureNBLogWriter.get();
+    state->mPerfNBLogWriter = mFastCapturePerfNBLogWriter.get();
+    sq->end();
+    sq->push(FastCaptureStateQueue::BLOCK_UNTIL_PUSHED);
+
+    // start the fast capture
+    mFastCapture->run("FastCapture", PRIORITY_URGENT_AUDIO);
+    pid_t tid = mFastCapture->getTid();
+    int err = requestPriority(getpid_cached, tid, kPriorityFastCapture);
+    if (err != 0) {
+        ALOGW("Policy SCHED_FIFO priority %d is unavailable for pid %d tid %d; error %d",
+                kPriorityFastCapture, getpid_cached, tid, err);
+    }
+}
+
+void AudioFlinger::RecordThread::destroyFastCapture()
+{
+    if (mFastCapture == NULL) {
+        return;
+    }
+    FastCaptureStateQueue *sq = mFastCapture->sq();
+    FastCaptureState *state = sq->begin();
+    if (state->mCommand == FastCaptureState::COLD_IDLE) {
+        int32_t old = android_atomic_inc(&mFastCaptureFutex);
+        if (old == -1) {
+            __futex_syscall3(&mFastCaptureFutex, FUTEX_WAKE_PRIVATE, 1);
+        }
+    }
+    state->mCommand = FastCaptureState::EXIT;
+    sq->end();
+    sq->push(FastCaptureStateQueue::BLOCK_UNTIL_PUSHED);
+    mFastCapture->join();
+    delete mFastCapture;
+    mFastCapture = NULL;
+    mPipeSource.clear();
+    mPipeSink.clear();
+    mInputSource.clear();
+}
+
 sp<AudioFlinger::RecordThread::RecordTrack>  AudioFlinger::RecordThread::createRecordTrack_l(
         const sp<AudioFlinger::Client>& client,
         uint32_t sampleRate,
@@ -4778,82 +5379,108 @@ status_t AudioFlinger::RecordThread::start(RecordThread::RecordTrack* recordTrac
     status_t status = NO_ERROR;
 
     if (event == AudioSystem::SYNC_EVENT_NONE) {
-        clearSyncStartEvent();
+        recordTrack->clearSyncStartEvent();
     } else if (event != AudioSystem::SYNC_EVENT_SAME) {
-        mSyncStartEvent = mAudioFlinger->createSyncEvent(event,
+        recordTrack->mSyncStartEvent = mAudioFlinger->createSyncEvent(event,
                                        triggerSession,
                                        recordTrack->sessionId(),
                                        syncStartEventCallback,
                                        this);
         // Sync event can be cancelled by the trigger session if the track is not in a
         // compatible state in which case we start record immediately
-        if (mSyncStartEvent->isCancelled()) {
-            clearSyncStartEvent();
+        if (recordTrack->mSyncStartEvent->isCancelled()) {
+            recordTrack->clearSyncStartEvent();
         } else {
             // do not wait for the event for more than AudioSystem::kSyncRecordStartTimeOutMs
-            mFramestoDrop = - ((AudioSystem::kSyncRecordStartTimeOutMs * mReqSampleRate) / 1000);
+            recordTrack->mFramesToDrop = - ((AudioSystem::kSyncRecordStartTimeOutMs *
+                    recordTrack->sampleRate()) / 1000);
         }
     }
 
     {
         AutoMutex lock(mLock);
-        if (mActiveTrack != 0) {
-            if (recordTrack != mActiveTrack.get()) {
-                status = -EBUSY;
-            } else if (mActiveTrack->mState == TrackBase::PAUSING) {
-                mActiveTrack->mState = TrackBase::ACTIVE;
+        if (mActiveTracks.indexOf(recordTrack) >= 0) {
+            if (recordTrack->mState == TrackBase::PAUSING) {
+                recordTrack->mState = TrackBase::ACTIVE;
             }
             return status;
         }
 
+        // the input is started in the audio policy only once for all active tracks, so a
+        // concurrent start must not see an empty mActiveTracks while that is in progress
+        while (mStartInputPending && !exitPending()) {
+            mStartStopCond.wait(mLock);
+        }
+        if (exitPending()) {
+            recordTrack->clearSyncStartEvent();
+            return INVALID_OPERATION;
+        }
+        const bool firstTrack = mActiveTracks.isEmpty();
         recordTrack->mState = TrackBase::IDLE;
-        mActiveTrack = recordTrack;
-        mLock.unlock();
-        status_t status = AudioSystem::startInput(mId);
-        mLock.lock();
-        if (status != NO_ERROR) {
-            mActiveTrack.clear();
-            clearSyncStartEvent();
-            return status;
+        if (firstTrack) {
+            mStartInputPending = true;
+            mLock.unlock();
+            status_t status = AudioSystem::startInput(mId);
+            mLock.lock();
+            if (status != NO_ERROR) {
+                mStartInputPending = false;
+                mStartStopCond.broadcast();
+                recordTrack->clearSyncStartEvent();
+                return status;
+            }
+            mBytesRead = 0;
         }
-        mRsmpInIndex = mFrameCount;
-        mBytesRead = 0;
-        if (mResampler != NULL) {
-            mResampler->reset();
+        // the track starts reading from the capture pipe at the next write, so it never
+        // receives data captured before it was started
+        if (!attachCapture_l(recordTrack)) {
+            ALOGV("Record failed to attach to capture");
+            status = BAD_VALUE;
+            goto startError;
+        }
+        recordTrack->mState = TrackBase::RESUMING;
+        mActiveTracks.add(recordTrack);
+        if (firstTrack) {
+            mStartInputPending = false;
+            mStartStopCond.broadcast();
         }
-        mActiveTrack->mState = TrackBase::RESUMING;
         // signal thread to start
         ALOGV("Signal record thread");
         mWaitWorkCV.broadcast();
         // do not wait for mStartStopCond if exiting
         if (exitPending()) {
-            mActiveTrack.clear();
+            detachCapture_l(recordTrack);
+            mActiveTracks.remove(recordTrack);
             status = INVALID_OPERATION;
             goto startError;
         }
-        mStartStopCond.wait(mLock);
-        if (mActiveTrack == 0) {
+        while (recordTrack->mState == TrackBase::RESUMING &&
+                mActiveTracks.indexOf(recordTrack) >= 0 && !exitPending()) {
+            mStartStopCond.wait(mLock);
+        }
+        if (mActiveTracks.indexOf(recordTrack) < 0) {
             ALOGV("Record failed to start");
             status = BAD_VALUE;
             goto startError;
         }
         ALOGV("Record started OK");
         return status;
-    }
 
 startError:
-    AudioSystem::stopInput(mId);
-    clearSyncStartEvent();
-    return status;
-}
-
-void AudioFlinger::RecordThread::clearSyncStartEvent()
-{
-    if (mSyncStartEvent != 0) {
-        mSyncStartEvent->cancel();
+        if (mActiveTracks.isEmpty()) {
+            // a concurrent start waits until the input is stopped, rather than starting it
+            // again before it is stopped
+            mStartInputPending = true;
+            mLock.unlock();
+            AudioSystem::stopInput(mId);
+            mLock.lock();
+        }
+        if (mStartInputPending) {
+            mStartInputPending = false;
+            mStartStopCond.broadcast();
+        }
+        recordTrack->clearSyncStartEvent();
+        return status;
     }
-    mSyncStartEvent.clear();
-    mFramestoDrop = 0;
 }
 
 void AudioFlinger::RecordThread::syncStartEventCallback(const wp<SyncEvent>& event)
@@ -4868,17 +5495,21 @@ void AudioFlinger::RecordThread::syncStartEventCallback(const wp<SyncEvent>& eve
 
 void AudioFlinger::RecordThread::handleSyncStartEvent(const sp<SyncEvent>& event)
 {
-    if (event == mSyncStartEvent) {
-        // TODO: use actual buffer filling status instead of 2 buffers when info is available
-        // from audio HAL
-        mFramestoDrop = mFrameCount * 2;
+    Mutex::Autolock _l(mLock);
+    for (size_t i = 0; i < mActiveTracks.size(); i++) {
+        const sp<RecordTrack>& track = mActiveTracks[i];
+        if (event == track->mSyncStartEvent) {
+            // TODO: use actual buffer filling status instead of 2 buffers when info is available
+            // from audio HAL
+            track->mFramesToDrop = mFrameCount * 2;
+        }
     }
 }
 
 bool AudioFlinger::RecordThread::stop(RecordThread::RecordTrack* recordTrack) {
     ALOGV("RecordThread::stop");
     AutoMutex _l(mLock);
-    if (recordTrack != mActiveTrack.get() || recordTrack->mState == TrackBase::PAUSING) {
+    if (mActiveTracks.indexOf(recordTrack) < 0 || recordTrack->mState == TrackBase::PAUSING) {
         return false;
     }
     recordTrack->mState = TrackBase::PAUSING;
@@ -4886,15 +5517,25 @@ bool AudioFlinger::RecordThread::stop(RecordThread::RecordTrack* recordTrack) {
     if (exitPending()) {
         return true;
     }
-    mStartStopCond.wait(mLock);
-    // if we have been restarted, recordTrack == mActiveTrack.get() here
-    if (exitPending() || recordTrack != mActiveTrack.get()) {
+    while (recordTrack->mState == TrackBase::PAUSING &&
+            mActiveTracks.indexOf(recordTrack) >= 0 && !exitPending()) {
+        mStartStopCond.wait(mLock);
+    }
+    // if we have been restarted, recordTrack is still in mActiveTracks here
+    if (exitPending() || mActiveTracks.indexOf(recordTrack) < 0) {
         ALOGV("Record stopped OK");
-        return true;
+        // the input is stopped in the audio policy only when the last track stops
+        return mActiveTracks.isEmpty();
     }
     return false;
 }
 
+bool AudioFlinger::RecordThread::isSoleActiveTrack(RecordThread::RecordTrack* recordTrack)
+{
+    AutoMutex _l(mLock);
+    return mActiveTracks.size() == 1 && mActiveTracks.indexOf(recordTrack) >= 0;
+}
+
 bool AudioFlinger::RecordThread::isValidSyncEvent(const sp<SyncEvent>& event) const
 {
     return false;
@@ -4931,7 +5572,7 @@ void AudioFlinger::RecordThread::destroyTrack_l(const sp<RecordTrack>& track)
     track->terminate();
     track->mState = TrackBase::STOPPED;
     // active tracks are removed by threadLoop()
-    if (mActiveTrack != track) {
+    if (mActiveTracks.indexOf(track) < 0) {
         removeTrack_l(track);
     }
 }
@@ -4942,6 +5583,49 @@ void AudioFlinger::RecordThread::removeTrack_l(const sp<RecordTrack>& track)
     // need anything related to effects here?
 }
 
+// attachCapture_l() must be called with ThreadBase::mLock held
+bool AudioFlinger::RecordThread::attachCapture_l(const sp<RecordTrack>& track)
+{
+    if (mCapturePipe == 0) {
+        // a single track of the input format reads the HAL buffer directly
+        if (track->channelCount() != mChannelCount || track->sampleRate() != mSampleRate) {
+            return false;
+        }
+        for (size_t i = 0; i < mActiveTracks.size(); i++) {
+            if (mActiveTracks[i] != track && mActiveTracks[i]->mDirectCapture) {
+                return false;
+            }
+        }
+        track->mDirectCapture = true;
+        return true;
+    }
+    // channel and sample rate conversions are only supported for mono and stereo
+    if (mChannelCount > FCC_2 && (track->channelCount() != mChannelCount ||
+            track->sampleRate() != mSampleRate)) {
+        return false;
+    }
+    PipeReader *pipeReader = new PipeReader(*(Pipe *) mCapturePipe.get());
+    NBAIO_Format offers[1] = {mCapturePipe->format()};
+    size_t numCounterOffers = 0;
+    ssize_t index = pipeReader->negotiate(offers, 1, NULL, numCounterOffers);
+    ALOG_ASSERT(index == 0);
+    track->mPipeReader = pipeReader;
+    track->mRsmpInChannelCount = mChannelCount;
+    track->mRsmpInFront = 0;
+    track->mRsmpInRear = 0;
+    if (track->mResampler != NULL) {
+        track->mResampler->reset();
+    }
+    return true;
+}
+
+// detachCapture_l() must be called with ThreadBase::mLock held
+void AudioFlinger::RecordThread::detachCapture_l(const sp<RecordTrack>& track)
+{
+    track->mPipeReader.clear();
+    track->mDirectCapture = false;
+}
+
 void AudioFlinger::RecordThread::dump(int fd, const Vector<String16>& args)
 {
     dumpInternals(fd, args);
@@ -4958,23 +5642,34 @@ void AudioFlinger::RecordThread::dumpInternals(int fd, const Vector<String16>& a
     snprintf(buffer, SIZE, "\nInput thread %p internals\n", this);
     result.append(buffer);
 
-    if (mActiveTrack != 0) {
-        snprintf(buffer, SIZE, "In index: %zu\n", mRsmpInIndex);
+    if (!mActiveTracks.isEmpty()) {
+        snprintf(buffer, SIZE, "Active record clients: %zu\n", mActiveTracks.size());
         result.append(buffer);
         snprintf(buffer, SIZE, "Buffer size: %zu bytes\n", mBufferSize);
         result.append(buffer);
-        snprintf(buffer, SIZE, "Resampling: %d\n", (mResampler != NULL));
-        result.append(buffer);
-        snprintf(buffer, SIZE, "Out channel count: %u\n", mReqChannelCount);
-        result.append(buffer);
-        snprintf(buffer, SIZE, "Out sample rate: %u\n", mReqSampleRate);
-        result.append(buffer);
+        if (mCapturePipe != 0) {
+            snprintf(buffer, SIZE, "Capture pipe: %zd frames, %zu frames written\n",
+                    mCapturePipe->availableToWrite(), mCapturePipe->framesWritten());
+            result.append(buffer);
+        }
+        for (size_t i = 0; i < mActiveTracks.size(); i++) {
+            const sp<RecordTrack>& track = mActiveTracks[i];
+            snprintf(buffer, SIZE, "  client %zu: %u Hz, %u channels, resampling: %d\n",
+                    i, track->sampleRate(), track->channelCount(), track->mResampler != NULL);
+            result.append(buffer);
+        }
     } else {
         result.append("No active record client\n");
     }
 
     write(fd, result.string(), result.size());
 
+    if (mFastCapture != NULL) {
+        // Make a non-atomic copy of fast capture dump state so it won't change underneath us
+        const FastCaptureDumpState copy(mFastCaptureDumpState);
+        copy.dump(fd);
+    }
+
     dumpBase(fd, args);
 }
 
@@ -4995,61 +5690,16 @@ void AudioFlinger::RecordThread::dumpTracks(int fd, const Vector<String16>& args
         }
     }
 
-    if (mActiveTrack != 0) {
+    if (!mActiveTracks.isEmpty()) {
         snprintf(buffer, SIZE, "\nInput thread %p active tracks\n", this);
         result.append(buffer);
         RecordTrack::appendDumpHeader(result);
-        mActiveTrack->dump(buffer, SIZE);
-        result.append(buffer);
-
-    }
-    write(fd, result.string(), result.size());
-}
-
-// AudioBufferProvider interface
-status_t AudioFlinger::RecordThread::getNextBuffer(AudioBufferProvider::Buffer* buffer, int64_t pts)
-{
-    size_t framesReq = buffer->frameCount;
-    size_t framesReady = mFrameCount - mRsmpInIndex;
-    int channelCount;
-
-    if (framesReady == 0) {
-        mBytesRead = mInput->stream->read(mInput->stream, mRsmpInBuffer, mBufferSize);
-        if (mBytesRead <= 0) {
-            if ((mBytesRead < 0) && (mActiveTrack->mState == TrackBase::ACTIVE)) {
-                ALOGE("RecordThread::getNextBuffer() Error reading audio input");
-                // Force input into standby so that it tries to
-                // recover at next read attempt
-                inputStandBy();
-                usleep(kRecordThreadSleepUs);
-            }
-            buffer->raw = NULL;
-            buffer->frameCount = 0;
-            return NOT_ENOUGH_DATA;
+        for (size_t i = 0; i < mActiveTracks.size(); ++i) {
+            mActiveTracks[i]->dump(buffer, SIZE);
+            result.append(buffer);
         }
-        mRsmpInIndex = 0;
-        framesReady = mFrameCount;
-    }
-
-    if (framesReq > framesReady) {
-        framesReq = framesReady;
     }
-
-    if (mChannelCount == 1 && mReqChannelCount == 2) {
-        channelCount = 1;
-    } else {
-        channelCount = 2;
-    }
-    buffer->raw = mRsmpInBuffer + mRsmpInIndex * channelCount;
-    buffer->frameCount = framesReq;
-    return NO_ERROR;
-}
-
-// AudioBufferProvider interface
-void AudioFlinger::RecordThread::releaseBuffer(AudioBufferProvider::Buffer* buffer)
-{
-    mRsmpInIndex += buffer->frameCount;
-    buffer->frameCount = 0;
+    write(fd, result.string(), result.size());
 }
 
 bool AudioFlinger::RecordThread::checkForNewParameters_l()
@@ -5085,7 +5735,7 @@ bool AudioFlinger::RecordThread::checkForNewParameters_l()
             // do not accept frame count changes if tracks are open as the track buffer
             // size depends on frame count and correct behavior would not be guaranteed
             // if frame count is changed after track creation
-            if (mActiveTrack != 0) {
+            if (!mActiveTracks.isEmpty()) {
                 status = INVALID_OPERATION;
             } else {
                 reconfig = true;
@@ -5202,12 +5852,11 @@ void AudioFlinger::RecordThread::audioConfigChanged_l(int event, int param) {
 
 void AudioFlinger::RecordThread::readInputParameters()
 {
+    // the fast capture is configured for the previous input HAL parameters
+    destroyFastCapture();
+
     delete[] mRsmpInBuffer;
     // mRsmpInBuffer is always assigned a new[] below
-    delete[] mRsmpOutBuffer;
-    mRsmpOutBuffer = NULL;
-    delete mResampler;
-    mResampler = NULL;
 
     mSampleRate = mInput->stream->common.get_sample_rate(&mInput->stream->common);
     mChannelMask = mInput->stream->common.get_channels(&mInput->stream->common);
@@ -5221,29 +5870,48 @@ void AudioFlinger::RecordThread::readInputParameters()
     mFrameCount = mBufferSize / mFrameSize;
     mRsmpInBuffer = new int16_t[mFrameCount * mChannelCount];
 
-    if (mSampleRate != mReqSampleRate && mChannelCount <= FCC_2 && mReqChannelCount <= FCC_2)
-    {
-        int channelCount;
-        // optimization: if mono to mono, use the resampler in stereo to stereo mode to avoid
-        // stereo to mono post process as the resampler always outputs stereo.
-        if (mChannelCount == 1 && mReqChannelCount == 2) {
-            channelCount = 1;
-        } else {
-            channelCount = 2;
-        }
-        mResampler = AudioResampler::create(16, channelCount, mReqSampleRate);
-        mResampler->setSampleRate(mSampleRate);
-        mResampler->setVolume(AudioMixer::UNITY_GAIN, AudioMixer::UNITY_GAIN);
-        mRsmpOutBuffer = new int32_t[mFrameCount * FCC_2];
-
-        // optmization: if mono to mono, alter input frame count as if we were inputing
-        // stereo samples
-        if (mChannelCount == 1 && mReqChannelCount == 1) {
-            mFrameCount >>= 1;
-        }
+    // Every HAL buffer is copied once into the capture pipe, and each active track reads
+    // from the pipe through its own PipeReader at its own pace, so the cost of the capture
+    // does not depend on the number of clients.
+    NBAIO_Format format = Format_from_SR_C(mSampleRate, mChannelCount);
+    if (format == Format_Invalid && mChannelCount <= FCC_2) {
+        // The pipe only uses the format to derive the frame size, so any standard rate will do
+        // for the non-standard rates NBAIO can't describe.
+        format = Format_from_SR_C(48000, mChannelCount);
+    }
 
+    // the conversion state of each track is lazily re-created for the new input parameters,
+    // and the readers must be detached before the old pipe is released
+    for (size_t i = 0; i < mTracks.size(); i++) {
+        const sp<RecordTrack>& track = mTracks[i];
+        delete[] track->mRsmpInBuffer;
+        track->mRsmpInBuffer = NULL;
+        track->mRsmpInFrames = 0;
+        delete track->mResampler;
+        track->mResampler = NULL;
+        delete[] track->mRsmpOutBuffer;
+        track->mRsmpOutBuffer = NULL;
+        track->mRsmpOutFrames = 0;
+        track->mPipeReader.clear();
+        track->mDirectCapture = false;
+    }
+    mCapturePipe.clear();
+    if (format != Format_Invalid) {
+        Pipe *pipe = new Pipe(mFrameCount * kCapturePipePeriods, format);
+        NBAIO_Format offers[1] = {format};
+        size_t numCounterOffers = 0;
+        ssize_t index = pipe->negotiate(offers, 1, NULL, numCounterOffers);
+        ALOG_ASSERT(index == 0);
+        mCapturePipe = pipe;
+    } else {
+        ALOGW("RecordThread: no capture pipe for %u channels at %u Hz, a single track of this "
+                "format can record", mChannelCount, mSampleRate);
     }
-    mRsmpInIndex = mFrameCount;
+    for (size_t i = 0; i < mActiveTracks.size(); i++) {
+        (void) attachCapture_l(mActiveTracks[i]);
+    }
+
+    initFastCapture();
 }
 
 unsigned int AudioFlinger::RecordThread::getInputFramesLost()
@@ -5291,6 +5959,8 @@ KeyedVector<int, bool> AudioFlinger::RecordThread::sessionIds() const
 AudioFlinger::AudioStreamIn* AudioFlinger::RecordThread::clearInput()
 {
     Mutex::Autolock _l(mLock);
+    // the fast capture must not outlive the input stream it reads
+    destroyFastCapture();
     AudioStreamIn *input = mInput;
     mInput = NULL;
     return input;
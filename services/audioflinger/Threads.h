@@ -481,6 +481,14 @@ protected:
     int16_t*                        mMixBuffer;         // frame size aligned mix buffer
     int8_t*                         mAllocMixBuffer;    // mixer buffer allocation address
 
+    // When mMixerBufferEnabled is true, the normal mixer accumulates the tracks which are not
+    // attached to an effect chain into mMixerBuffer, in float, and the result is converted
+    // to the 16 bit mMixBuffer once per cycle, after the mix.
+    bool                            mMixerBufferEnabled;
+    float*                          mMixerBuffer;       // NULL unless mMixerBufferEnabled
+    // true if at least one track was mixed into mMixerBuffer during the current cycle
+    bool                            mMixerBufferValid;
+
     // suspend count, > 0 means suspended.  While suspended, the thread continues to pull from
     // tracks and mix, but doesn't write to HAL.  A2DP and SCO HAL implementations can't handle
     // concurrent use of both of them, so Audio Policy Service suspends one of the threads to
@@ -621,6 +629,8 @@ private:
     uint32_t                mScreenState;   // cached copy of gScreenState
     static const size_t     kFastMixerLogSize = 4 * 1024;
     sp<NBLog::Writer>       mFastMixerNBLogWriter;
+    static const size_t     kFastMixerPerfLogSize = 4 * 1024;   // about 340 cycles
+    sp<NBLog::Writer>       mFastMixerPerfNBLogWriter;
 public:
     virtual     bool        hasFastMixer() const = 0;
     virtual     FastTrackUnderruns getFastTrackUnderruns(size_t fastIndex) const
@@ -675,6 +685,9 @@ protected:
 
                 AudioMixer* mAudioMixer;    // normal mixer
 private:
+                // adds the output of DuplicatingThreads which write through a pipe to mMixBuffer
+                void        mixPipeOutputTracks();
+
                 // one-time initialization, no locks required
                 FastMixer*  mFastMixer;         // non-NULL if there is also a fast mixer
                 sp<AudioWatchdog> mAudioWatchdog; // non-0 if there is an audio watchdog thread
@@ -691,6 +704,14 @@ private:
                 //          mFastMixer->sq()    // for mutating and pushing state
                 int32_t     mFastMixerFutex;    // for cold idle
 
+                // set by prepareTracks_l() and used by threadLoop_mix()
+                Vector< sp<OutputTrack> > mPipeOutputTracks;   // ready to be read this cycle
+                bool        mMixBufferWritten;  // whether the mixer overwrites mMixBuffer this cycle
+                uint32_t    mPipeVolume;        // master volume for mPipeOutputTracks, U4.12
+                uint32_t    mPipeVolumePrev;    // mPipeVolume of the last cycle, ramped from
+                int16_t*    mPipeBuffer;        // for reading mPipeOutputTracks, if mMixBufferWritten
+                size_t      mPipeBufferSamples; // allocated size of mPipeBuffer
+
 public:
     virtual     bool        hasFastMixer() const { return mFastMixer != NULL; }
     virtual     FastTrackUnderruns getFastTrackUnderruns(size_t fastIndex) const {
@@ -744,6 +765,11 @@ public:
                         audio_io_handle_t id, uint32_t device);
     virtual                 ~OffloadThread() {};
 
+                // Applies codec parameters of a track, such as gapless encoder delay and padding,
+                // or defers them while another track still owns the output.
+                status_t    setTrackParameters(const sp<Track>& track,
+                                               const String8& keyValuePairs);
+
 protected:
     // threadLoop snippets
     virtual     mixer_state prepareTracks_l(Vector< sp<Track> > *tracksToRemove);
@@ -762,7 +788,8 @@ private:
     bool        mFlushPending;
     size_t      mPausedWriteLength;     // length in bytes of write interrupted by pause
     size_t      mPausedBytesRemaining;  // bytes still waiting in mixbuffer after resume
-    wp<Track>   mPreviousTrack;         // used to detect track switch
+    wp<Track>   mPreviousTrack;         // track owning the output, used to detect track
+                                        // switch and to queue the next track behind it
 };
 
 class AsyncCallbackThread : public Thread {
@@ -838,8 +865,7 @@ public:
 
 
 // record thread
-class RecordThread : public ThreadBase, public AudioBufferProvider
-                        // derives from AudioBufferProvider interface for use by resampler
+class RecordThread : public ThreadBase
 {
 public:
 
@@ -893,14 +919,14 @@ public:
             // return true if the caller should then do it's part of the stopping process
             bool        stop(RecordTrack* recordTrack);
 
+            // return true if the specified track is the only active one, in which case
+            // destroying it also stops the input
+            bool        isSoleActiveTrack(RecordTrack* recordTrack);
+
             void        dump(int fd, const Vector<String16>& args);
             AudioStreamIn* clearInput();
             virtual audio_stream_t* stream() const;
 
-    // AudioBufferProvider interface
-    virtual status_t    getNextBuffer(AudioBufferProvider::Buffer* buffer, int64_t pts);
-    virtual void        releaseBuffer(AudioBufferProvider::Buffer* buffer);
-
     virtual bool        checkForNewParameters_l();
     virtual String8     getParameters(const String8& keys);
     virtual void        audioConfigChanged_l(int event, int param = 0);
@@ -923,42 +949,77 @@ public:
            void handleSyncStartEvent(const sp<SyncEvent>& event);
 
     virtual size_t      frameCount() const { return mFrameCount; }
-            bool        hasFastRecorder() const { return false; }
+            bool        hasFastRecorder() const { return mFastCapture != NULL; }
 
 private:
-            void clearSyncStartEvent();
-
             // Enter standby if not already in standby, and set mStandby flag
             void standby();
 
-            // Call the HAL standby method unconditionally, and don't change mStandby flag
+            // Call the HAL standby method unconditionally, and don't change mStandby flag.
+            // If there is a fast capture thread, it is idled first.
             void inputStandBy();
 
+            // Read one buffer of input, either from the HAL directly or from the fast capture
+            // pipe.  Same return value as the HAL read().
+            ssize_t readInput(void *buffer, size_t bytes);
+
+            // Called by readInputParameters() to create or destroy the fast capture thread
+            // depending on the input HAL configuration
+            void initFastCapture();
+            void destroyFastCapture();
+
+            // Attach a reader of the capture pipe to a track that is becoming active,
+            // and detach it when the track leaves the active set
+            bool attachCapture_l(const sp<RecordTrack>& track);
+            void detachCapture_l(const sp<RecordTrack>& track);
+
+            // Deliver as much of the captured input as is available and fits to one active track,
+            // converting sample rate and channel count as needed.  Called without mLock held.
+            void fillTrackBuffer(const sp<RecordTrack>& track, nsecs_t& lastWarning);
+
             AudioStreamIn                       *mInput;
             SortedVector < sp<RecordTrack> >    mTracks;
-            // mActiveTrack has dual roles:  it indicates the current active track, and
+            // mActiveTracks has dual roles:  it indicates the current active tracks, and
             // is used together with mStartStopCond to indicate start()/stop() progress
-            sp<RecordTrack>                     mActiveTrack;
+            SortedVector < sp<RecordTrack> >    mActiveTracks;
             Condition                           mStartStopCond;
 
             // updated by RecordThread::readInputParameters()
-            AudioResampler                      *mResampler;
-            // interleaved stereo pairs of fixed-point signed Q19.12
-            int32_t                             *mRsmpOutBuffer;
             int16_t                             *mRsmpInBuffer; // [mFrameCount * mChannelCount]
-            size_t                              mRsmpInIndex;
             size_t                              mBufferSize;    // stream buffer size for read()
+            // Each HAL read is written once to this pipe, and every active track has its own
+            // reader, so that tracks with different formats share a single capture.
+            // NULL if the input format can't be described by NBAIO; then a single track of the
+            // input format can be active, and reads mRsmpInBuffer directly.
+            sp<NBAIO_Sink>                      mCapturePipe;
             const uint32_t                      mReqChannelCount;
             const uint32_t                      mReqSampleRate;
+            // true while a start() of the first active track has released mLock to start the
+            // input in the audio policy, or while a failed start() stops it again
+            bool                                mStartInputPending;
             ssize_t                             mBytesRead;
-            // sync event triggering actual audio capture. Frames read before this event will
-            // be dropped and therefore not read by the application.
-            sp<SyncEvent>                       mSyncStartEvent;
-            // number of captured frames to drop after the start sync event has been received.
-            // when < 0, maximum frames to drop before starting capture even if sync event is
-            // not received
-            ssize_t                             mFramestoDrop;
 
             // For dumpsys
             const sp<NBAIO_Sink>                mTeeSink;
+
+            // updated by RecordThread::readInputParameters()
+            FastCapture*                        mFastCapture;   // non-NULL if there is also
+                                                                // a fast capture thread
+            // HAL input source, read by the fast capture only
+            sp<NBAIO_Source>                    mInputSource;
+            // non-blocking pipe written by the fast capture, and its reader for the normal thread
+            sp<NBAIO_Sink>                      mPipeSink;
+            sp<NBAIO_Source>                    mPipeSource;
+
+            // contents are not guaranteed to be consistent, no locks required
+            FastCaptureDumpState                mFastCaptureDumpState;
+
+            // accessible only within the threadLoop(), no locks required
+            //          mFastCapture->sq()      // for mutating and pushing state
+            int32_t                             mFastCaptureFutex;  // for cold idle
+
+            static const size_t                 kFastCaptureLogSize = 4 * 1024;
+            sp<NBLog::Writer>                   mFastCaptureNBLogWriter;
+            static const size_t                 kFastCapturePerfLogSize = 4 * 1024;
+            sp<NBLog::Writer>                   mFastCapturePerfNBLogWriter;
 };
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Configuration.h"
+#include "TrackStatistics.h"
+
+namespace android {
+
+void DurationHistogram::dump(String8& result, const char *name) const
+{
+    result.appendFormat("  %s: n=%u mean=%uus max=%uus\n   ", name, mCount, meanUs(), maxUs());
+    for (size_t i = 0; i < kBuckets; i++) {
+        if (mBuckets[i] == 0) {
+            continue;
+        }
+        if (i == kBuckets - 1) {
+            result.appendFormat(" >=%uus:%u", 1U << (i - 1), mBuckets[i]);
+        } else {
+            result.appendFormat(" <%uus:%u", 1U << i, mBuckets[i]);
+        }
+    }
+    result.append("\n");
+}
+
+/*static*/ void TrackStatistics::appendDumpHeader(String8& result)
+{
+    result.append("   Name   Cycles Mix us  (max) Rsmp us Obtain us  (max) Partial   Empty\n");
+}
+
+void TrackStatistics::dump(String8& result) const
+{
+    result.appendFormat(" %8u %6u %6u %7u %9u %6u %7u %7u\n",
+            mMix.mCount, mMix.meanUs(), mMix.maxUs(), mResampler.meanUs(),
+            mObtain.meanUs(), mObtain.maxUs(), mPartialObtains, mEmptyObtains);
+}
+
+void TrackStatistics::toParameterValue(String8& result) const
+{
+    result.appendFormat("%u:%u:%u:%u:%u:%u:%u", mMix.meanUs(), mMix.maxUs(), mResampler.meanUs(),
+            mObtain.meanUs(), mObtain.maxUs(), mPartialObtains, mEmptyObtains);
+}
+
+}   // namespace android
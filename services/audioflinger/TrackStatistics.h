@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_AUDIO_TRACK_STATISTICS_H
+#define ANDROID_AUDIO_TRACK_STATISTICS_H
+
+#include "Configuration.h"
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <utils/String8.h>
+
+namespace android {
+
+// Histogram of durations, with power of 2 buckets in microseconds.
+// There is a single writer, and no lock: readers such as dumpsys should work on a copy,
+// whose fields can be slightly inconsistent with each other.
+struct DurationHistogram {
+    DurationHistogram() { reset(); }
+
+    // bucket i counts durations in [2^(i-1), 2^i) microseconds, and the last one the rest
+    static const size_t kBuckets = 12;
+
+    void reset() { memset(this, 0, sizeof(*this)); }
+
+    void add(uint32_t ns) {
+        uint32_t us = ns / 1000;
+        size_t bucket = us == 0 ? 0 : 32 - __builtin_clz(us);
+        if (bucket >= kBuckets) {
+            bucket = kBuckets - 1;
+        }
+        mBuckets[bucket]++;
+        mCount++;
+        mTotalNs += ns;
+        if (ns > mMaxNs) {
+            mMaxNs = ns;
+        }
+    }
+
+    uint32_t meanUs() const { return mCount > 0 ? (uint32_t) (mTotalNs / mCount / 1000) : 0; }
+    uint32_t maxUs() const { return mMaxNs / 1000; }
+
+    // appends a one line summary and the non-empty buckets
+    void dump(String8& result, const char *name) const;
+
+    uint32_t mCount;
+    uint32_t mMaxNs;
+    uint64_t mTotalNs;      // not updated atomically on 32-bit, display only
+    uint32_t mBuckets[kBuckets];
+};
+
+// CPU time statistics of one playback track, collected when TRACK_MIX_STATISTICS is defined.
+// They are written only by the thread that mixes the track: the normal mixer thread for a
+// normal track, or the fast mixer for a fast track.
+struct TrackStatistics {
+    DurationHistogram   mMix;       // time in the mixer hook of the track, per mix cycle,
+                                    // including the resampler
+    DurationHistogram   mResampler; // part of mMix spent in the resampler, which includes
+                                    // the resampler's own calls to obtain buffers
+    DurationHistogram   mObtain;    // time spent obtaining a buffer from the client
+    uint32_t            mPartialObtains;    // obtains that returned fewer frames than requested
+    uint32_t            mEmptyObtains;      // obtains that returned no frames: underruns
+    uint32_t            mObtains;           // all obtains, of which 1 in kObtainSampling is timed
+
+    // keeps the clock reads off most obtains
+    static const uint32_t kObtainSampling = 8;
+
+    TrackStatistics() : mPartialObtains(0), mEmptyObtains(0), mObtains(0) { }
+
+    static void appendDumpHeader(String8& result);
+    // appends a one line summary, matching appendDumpHeader()
+    void dump(String8& result) const;
+    // appends a compact summary "mix:max:resampler:obtain:obtainmax:partial:empty", in
+    // microseconds, for reporting through getParameters()
+    void toParameterValue(String8& result) const;
+};
+
+// monotonic time in nanoseconds, for the statistics only
+static inline int64_t statisticsTimeNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Adds the duration of its scope, multiplied by "scale", to a nanosecond accumulator, if
+// statistics are collected for the track; compiles to nothing without TRACK_MIX_STATISTICS.
+// A scale larger than 1 extrapolates from a part of the mix cycle to the whole cycle.
+class ScopedStatisticsTimer {
+public:
+#ifdef TRACK_MIX_STATISTICS
+    ScopedStatisticsTimer(const TrackStatistics *statistics, uint32_t& ns, uint32_t scale = 1) :
+        mNs(statistics != NULL ? &ns : NULL), mScale(scale),
+        mStart(statistics != NULL ? statisticsTimeNs() : 0)
+        { }
+    ~ScopedStatisticsTimer() {
+        if (mNs != NULL) {
+            *mNs += (uint32_t) (statisticsTimeNs() - mStart) * mScale;
+        }
+    }
+private:
+    uint32_t * const    mNs;
+    const uint32_t      mScale;
+    const int64_t       mStart;
+#else
+    ScopedStatisticsTimer(const TrackStatistics *statistics, uint32_t& ns, uint32_t scale = 1)
+        { }
+#endif
+};
+
+}   // namespace android
+
+#endif  // ANDROID_AUDIO_TRACK_STATISTICS_H
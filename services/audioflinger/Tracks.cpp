@@ -32,6 +32,8 @@
 #include "AudioFlinger.h"
 #include "ServiceUtilities.h"
 
+#include <media/nbaio/MonoPipe.h>
+#include <media/nbaio/MonoPipeReader.h>
 #include <media/nbaio/Pipe.h>
 #include <media/nbaio/PipeReader.h>
 
@@ -115,7 +117,7 @@ AudioFlinger::ThreadBase::TrackBase::TrackBase(
     }
 
     if (client != 0) {
-        mCblkMemory = client->heap()->allocate(size);
+        mCblkMemory = client->allocateTrackMemory(size);
         if (mCblkMemory != 0) {
             mCblk = static_cast<audio_track_cblk_t *>(mCblkMemory->pointer());
             // can't assume mCblk != NULL
@@ -181,6 +183,10 @@ AudioFlinger::ThreadBase::TrackBase::~TrackBase()
             mCblk->~audio_track_cblk_t();   // destroy our shared-structure.
         }
     }
+    if (mClient != 0 && mCblkMemory != 0) {
+        // let the next track of this client reuse the shared memory
+        mClient->releaseTrackMemory(mCblkMemory);
+    }
     mCblkMemory.clear();    // free the shared memory before releasing the heap it belongs to
     if (mClient != 0) {
         // Client destructor must run with AudioFlinger mutex locked
@@ -374,7 +380,7 @@ AudioFlinger::PlaybackThread::Track::Track(
             mFastIndex = i;
             // Read the initial underruns because this field is never cleared by the fast mixer
             mObservedUnderruns = thread->getFastTrackUnderruns(i);
-            thread->mFastTrackAvailMask &= ~(1 << i);
+            thread->mFastTrackAvailMask &= ~(1U << i);
         }
     }
     ALOGV("Track constructor name %d, calling pid %d", mName,
@@ -519,7 +525,21 @@ status_t AudioFlinger::PlaybackThread::Track::getNextBuffer(
     ServerProxy::Buffer buf;
     size_t desiredFrames = buffer->frameCount;
     buf.mFrameCount = desiredFrames;
+#ifdef TRACK_MIX_STATISTICS
+    const bool timed = (mStatistics.mObtains++ % TrackStatistics::kObtainSampling) == 0;
+    int64_t obtainStart = timed ? statisticsTimeNs() : 0;
+#endif
     status_t status = mServerProxy->obtainBuffer(&buf);
+#ifdef TRACK_MIX_STATISTICS
+    if (timed) {
+        mStatistics.mObtain.add((uint32_t) (statisticsTimeNs() - obtainStart));
+    }
+    if (buf.mFrameCount == 0) {
+        mStatistics.mEmptyObtains++;
+    } else if (buf.mFrameCount < desiredFrames) {
+        mStatistics.mPartialObtains++;
+    }
+#endif
     buffer->frameCount = buf.mFrameCount;
     buffer->raw = buf.mRaw;
     if (buf.mFrameCount == 0) {
@@ -530,6 +550,34 @@ status_t AudioFlinger::PlaybackThread::Track::getNextBuffer(
 
 // releaseBuffer() is not overridden
 
+void AudioFlinger::PlaybackThread::Track::dumpStatistics(String8& result, bool detailed) const
+{
+    // make a copy so that the statistics don't change underneath us
+    const TrackStatistics statistics(mStatistics);
+    if (isFastTrack()) {
+        result.appendFormat("   F %2d", mFastIndex);
+    } else {
+        result.appendFormat("   %4d", mName - AudioMixer::TRACK0);
+    }
+    statistics.dump(result);
+    if (detailed) {
+        statistics.mMix.dump(result, "Mix time");
+    }
+}
+
+#ifdef TRACK_MIX_STATISTICS
+void AudioFlinger::PlaybackThread::Track::statisticsToParameterValue(String8& result) const
+{
+    const TrackStatistics statistics(mStatistics);
+    if (isFastTrack()) {
+        result.appendFormat("F%d:", mFastIndex);
+    } else {
+        result.appendFormat("%d:", mName - AudioMixer::TRACK0);
+    }
+    statistics.toParameterValue(result);
+}
+#endif
+
 // ExtendedAudioBufferProvider interface
 
 // Note that framesReady() takes a mutex on the control block using tryLock().
@@ -766,8 +814,10 @@ status_t AudioFlinger::PlaybackThread::Track::setParameters(const String8& keyVa
     if (thread == 0) {
         ALOGE("thread is dead");
         return FAILED_TRANSACTION;
-    } else if ((thread->type() == ThreadBase::DIRECT) ||
-                    (thread->type() == ThreadBase::OFFLOAD)) {
+    } else if (thread->type() == ThreadBase::OFFLOAD) {
+        OffloadThread *offloadThread = (OffloadThread *)thread.get();
+        return offloadThread->setTrackParameters(this, keyValuePairs);
+    } else if (thread->type() == ThreadBase::DIRECT) {
         return thread->setParameters(keyValuePairs);
     } else {
         return PERMISSION_DENIED;
@@ -1494,12 +1544,29 @@ AudioFlinger::PlaybackThread::OutputTrack::OutputTrack(
             audio_format_t format,
             audio_channel_mask_t channelMask,
             size_t frameCount,
-            int uid)
+            int uid,
+            bool usePipe)
     :   Track(playbackThread, NULL, AUDIO_STREAM_CNT, sampleRate, format, channelMask, frameCount,
                 NULL, 0, uid, IAudioFlinger::TRACK_DEFAULT),
     mActive(false), mSourceThread(sourceThread), mClientProxy(NULL)
 {
 
+    if (mCblk != NULL && usePipe) {
+        // the DuplicatingThread must never block on a destination thread which is not reading,
+        // so when the pipe is full write() waits at most waitTimeMs() and then drops the rest
+        const NBAIO_Format offers[1] = {Format_from_SR_C(sampleRate, mChannelCount)};
+        MonoPipe *monoPipe = new MonoPipe(frameCount, offers[0], false /*writeCanBlock*/);
+        size_t numCounterOffers = 0;
+        ssize_t index = monoPipe->negotiate(offers, 1, NULL, numCounterOffers);
+        ALOG_ASSERT(index == 0);
+        mPipe = monoPipe;
+        MonoPipeReader *monoPipeReader = new MonoPipeReader(monoPipe);
+        numCounterOffers = 0;
+        index = monoPipeReader->negotiate(offers, 1, NULL, numCounterOffers);
+        ALOG_ASSERT(index == 0);
+        mPipeReader = monoPipeReader;
+    }
+
     if (mCblk != NULL) {
         mOutBuffer.frameCount = 0;
         playbackThread->mTracks.add(this);
@@ -1550,6 +1617,10 @@ void AudioFlinger::PlaybackThread::OutputTrack::stop()
 
 bool AudioFlinger::PlaybackThread::OutputTrack::write(int16_t* data, uint32_t frames)
 {
+    if (mPipe != 0) {
+        return writePipe(data, frames);
+    }
+
     Buffer *pInBuffer;
     Buffer inBuffer;
     uint32_t channelCount = mChannelCount;
@@ -1678,6 +1749,69 @@ bool AudioFlinger::PlaybackThread::OutputTrack::write(int16_t* data, uint32_t fr
     return outputBufferFull;
 }
 
+bool AudioFlinger::PlaybackThread::OutputTrack::writePipe(int16_t* data, uint32_t frames)
+{
+    // When the DuplicatingThread has nothing to write, the destination thread reads silence
+    // from the empty pipe until this track is stopped on standby
+    if (frames == 0) {
+        return false;
+    }
+
+    if (!mActive) {
+        start();
+    }
+
+    uint32_t waitTimeLeftMs = mSourceThread->waitTimeMs();
+    uint32_t sampleRate = Format_sampleRate(mPipe->format());
+    for (;;) {
+        ssize_t written = mPipe->write(data, frames);
+        if (written > 0) {
+            data += written * mChannelCount;
+            frames -= written;
+        }
+        if (frames == 0) {
+            return false;
+        }
+        if (waitTimeLeftMs == 0) {
+            break;
+        }
+        // the destination thread frees space as it plays, so wait about as long as
+        // it takes to play the frames which didn't fit
+        uint32_t sleepMs = (frames * 1000) / sampleRate + 1;
+        if (sleepMs > waitTimeLeftMs) {
+            sleepMs = waitTimeLeftMs;
+        }
+        usleep(sleepMs * 1000);
+        waitTimeLeftMs -= sleepMs;
+    }
+
+    ALOGV("OutputTrack::write() %p thread %p pipe full, dropped %u frames", this,
+            mThread.unsafe_get(), frames);
+    return true;
+}
+
+size_t AudioFlinger::PlaybackThread::OutputTrack::framesReady() const
+{
+    if (mPipeReader == 0) {
+        return Track::framesReady();
+    }
+    ssize_t available = mPipeReader->availableToRead();
+    return available > 0 ? available : 0;
+}
+
+ssize_t AudioFlinger::PlaybackThread::OutputTrack::readPipe(int16_t* buffer, size_t frames)
+{
+    return mPipeReader->read(buffer, frames, AudioBufferProvider::kInvalidPTS);
+}
+
+void AudioFlinger::PlaybackThread::OutputTrack::flushPipe()
+{
+    int16_t discard[256];
+    size_t frames = sizeof(discard) / (mChannelCount * sizeof(int16_t));
+    while (readPipe(discard, frames) > 0) {
+    }
+}
+
 status_t AudioFlinger::PlaybackThread::OutputTrack::obtainBuffer(
         AudioBufferProvider::Buffer* buffer, uint32_t waitTimeMs)
 {
@@ -1760,7 +1894,12 @@ AudioFlinger::RecordThread::RecordTrack::RecordTrack(
             int uid)
     :   TrackBase(thread, client, sampleRate, format,
                   channelMask, frameCount, 0 /*sharedBuffer*/, sessionId, uid, false /*isOut*/),
-        mOverflow(false)
+        mOverflow(false),
+        // mPipeReader is attached by RecordThread when the track becomes active
+        mDirectCapture(false),
+        mRsmpInChannelCount(0), mRsmpInBuffer(NULL), mRsmpInFrames(0), mRsmpInFront(0),
+        mRsmpInRear(0), mResampler(NULL), mRsmpOutBuffer(NULL), mRsmpOutFrames(0),
+        mResamplerBufferProvider(this), mFramesToDrop(0)
 {
     ALOGV("RecordTrack constructor");
     if (mCblk != NULL) {
@@ -1773,6 +1912,9 @@ AudioFlinger::RecordThread::RecordTrack::RecordTrack(
 AudioFlinger::RecordThread::RecordTrack::~RecordTrack()
 {
     ALOGV("%s", __func__);
+    delete[] mRsmpInBuffer;
+    delete mResampler;
+    delete[] mRsmpOutBuffer;
 }
 
 // AudioBufferProvider interface
@@ -1821,17 +1963,28 @@ void AudioFlinger::RecordThread::RecordTrack::destroy()
     {
         sp<ThreadBase> thread = mThread.promote();
         if (thread != 0) {
-            if (mState == ACTIVE || mState == RESUMING) {
+            RecordThread *recordThread = (RecordThread *) thread.get();
+            // the input stays started in the audio policy while other tracks are active
+            if ((mState == ACTIVE || mState == RESUMING) &&
+                    recordThread->isSoleActiveTrack(this)) {
                 AudioSystem::stopInput(thread->id());
             }
             AudioSystem::releaseInput(thread->id());
             Mutex::Autolock _l(thread->mLock);
-            RecordThread *recordThread = (RecordThread *) thread.get();
             recordThread->destroyTrack_l(this);
         }
     }
 }
 
+void AudioFlinger::RecordThread::RecordTrack::clearSyncStartEvent()
+{
+    if (mSyncStartEvent != 0) {
+        mSyncStartEvent->cancel();
+    }
+    mSyncStartEvent.clear();
+    mFramesToDrop = 0;
+}
+
 void AudioFlinger::RecordThread::RecordTrack::invalidate()
 {
     // FIXME should use proxy, and needs work
@@ -1843,6 +1996,39 @@ void AudioFlinger::RecordThread::RecordTrack::invalidate()
 }
 
 
+// AudioBufferProvider interface
+status_t AudioFlinger::RecordThread::RecordTrack::ResamplerBufferProvider::getNextBuffer(
+        AudioBufferProvider::Buffer* buffer, int64_t pts)
+{
+    RecordTrack *recordTrack = mRecordTrack;
+    if (recordTrack->mRsmpInFront == recordTrack->mRsmpInRear) {
+        ssize_t framesRead = recordTrack->mPipeReader->read(recordTrack->mRsmpInBuffer,
+                recordTrack->mRsmpInFrames, pts);
+        if (framesRead <= 0) {
+            buffer->raw = NULL;
+            buffer->frameCount = 0;
+            return NOT_ENOUGH_DATA;
+        }
+        recordTrack->mRsmpInFront = 0;
+        recordTrack->mRsmpInRear = framesRead;
+    }
+    size_t framesReady = recordTrack->mRsmpInRear - recordTrack->mRsmpInFront;
+    if (buffer->frameCount > framesReady) {
+        buffer->frameCount = framesReady;
+    }
+    buffer->i16 = recordTrack->mRsmpInBuffer +
+            recordTrack->mRsmpInFront * recordTrack->mRsmpInChannelCount;
+    return NO_ERROR;
+}
+
+// AudioBufferProvider interface
+void AudioFlinger::RecordThread::RecordTrack::ResamplerBufferProvider::releaseBuffer(
+        AudioBufferProvider::Buffer* buffer)
+{
+    mRecordTrack->mRsmpInFront += buffer->frameCount;
+    buffer->frameCount = 0;
+}
+
 /*static*/ void AudioFlinger::RecordThread::RecordTrack::appendDumpHeader(String8& result)
 {
     result.append("Client Fmt Chn mask Session S   Server fCount\n");
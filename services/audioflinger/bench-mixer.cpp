@@ -0,0 +1,460 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Benchmark of the AudioMixer process hooks and of the resamplers.
+ *
+ * AudioMixer is driven with synthetic buffer providers over a matrix of track counts,
+ * track formats, track and output channel masks, sample rates and volume ramp states.
+ * Each resampler quality is then measured on its own.  For every combination the time,
+ * CPU cycles and cache misses per output frame are reported; the hardware counters are
+ * read through perf_event_open() and reported as "-" when unavailable.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include <cutils/bitops.h>
+#include <media/AudioBufferProvider.h>
+#include "AudioMixer.h"
+#include "AudioResampler.h"
+
+using namespace android;
+
+// ----------------------------------------------------------------------------
+
+// Provides an endless sine wave from a pre-generated loop, in 16 bit or float.
+class SineProvider : public AudioBufferProvider {
+public:
+    SineProvider(audio_format_t format, uint32_t channelCount, uint32_t sampleRate,
+            double frequency)
+        : mFrameSize(channelCount * (format == AUDIO_FORMAT_PCM_FLOAT ?
+                sizeof(float) : sizeof(int16_t))),
+          mNumFrames(kLoopFrames), mPosition(0)
+    {
+        mData = malloc(mNumFrames * mFrameSize);
+        for (size_t i = 0; i < mNumFrames; i++) {
+            const double y = 0.5 * sin(2 * M_PI * frequency * i / sampleRate);
+            for (uint32_t j = 0; j < channelCount; j++) {
+                if (format == AUDIO_FORMAT_PCM_FLOAT) {
+                    ((float *) mData)[i * channelCount + j] = float(y);
+                } else {
+                    ((int16_t *) mData)[i * channelCount + j] = int16_t(y * 32767);
+                }
+            }
+        }
+    }
+
+    virtual ~SineProvider() {
+        free(mData);
+    }
+
+    virtual status_t getNextBuffer(Buffer* buffer, int64_t pts = kInvalidPTS) {
+        size_t available = mNumFrames - mPosition;
+        if (buffer->frameCount > available) {
+            buffer->frameCount = available;
+        }
+        buffer->raw = (char *) mData + mPosition * mFrameSize;
+        return NO_ERROR;
+    }
+
+    virtual void releaseBuffer(Buffer* buffer) {
+        mPosition += buffer->frameCount;
+        if (mPosition >= mNumFrames) {
+            mPosition = 0;
+        }
+        buffer->raw = NULL;
+        buffer->frameCount = 0;
+    }
+
+private:
+    static const size_t kLoopFrames = 4800;
+
+    const size_t mFrameSize;
+    const size_t mNumFrames;
+    size_t mPosition;
+    void* mData;
+};
+
+// CPU cycle and cache miss counters for the calling thread.
+class PerfCounters {
+public:
+    PerfCounters() : mCyclesFd(-1), mMissesFd(-1) {
+        mCyclesFd = open(PERF_COUNT_HW_CPU_CYCLES, -1);
+        if (mCyclesFd >= 0) {
+            mMissesFd = open(PERF_COUNT_HW_CACHE_MISSES, mCyclesFd);
+        }
+    }
+
+    ~PerfCounters() {
+        if (mMissesFd >= 0) {
+            close(mMissesFd);
+        }
+        if (mCyclesFd >= 0) {
+            close(mCyclesFd);
+        }
+    }
+
+    bool valid() const { return mCyclesFd >= 0; }
+
+    void start() {
+        if (mCyclesFd >= 0) {
+            ioctl(mCyclesFd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(mCyclesFd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+    }
+
+    // returns the counts since start(), -1 for counters that are not available
+    void stop(int64_t* cycles, int64_t* misses) {
+        *cycles = -1;
+        *misses = -1;
+        if (mCyclesFd >= 0) {
+            ioctl(mCyclesFd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+            *cycles = readCounter(mCyclesFd);
+        }
+        if (mMissesFd >= 0) {
+            *misses = readCounter(mMissesFd);
+        }
+    }
+
+private:
+    static int open(uint64_t config, int groupFd) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = config;
+        attr.disabled = groupFd < 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        return syscall(__NR_perf_event_open, &attr, 0 /*pid*/, -1 /*cpu*/, groupFd, 0);
+    }
+
+    static int64_t readCounter(int fd) {
+        int64_t count;
+        if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+            return -1;
+        }
+        return count;
+    }
+
+    int mCyclesFd;
+    int mMissesFd;
+};
+
+static int64_t systemTimeNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Accumulates the measurements of a benchmark and prints one result line.
+struct Measurement {
+    int64_t ns;
+    int64_t cycles;
+    int64_t misses;
+
+    void print(size_t frames) const {
+        printf(" %9.2f", double(ns) / frames);
+        if (cycles >= 0) {
+            printf(" %9.1f", double(cycles) / frames);
+        } else {
+            printf(" %9s", "-");
+        }
+        if (misses >= 0) {
+            printf(" %9.3f\n", double(misses) / frames);
+        } else {
+            printf(" %9s\n", "-");
+        }
+    }
+};
+
+static const char* formatName(audio_format_t format)
+{
+    return format == AUDIO_FORMAT_PCM_FLOAT ? "float" : "i16";
+}
+
+// ----------------------------------------------------------------------------
+
+static const uint32_t kOutputSampleRate = 48000;
+
+struct MixerConfig {
+    uint32_t numTracks;
+    audio_format_t format;          // track format
+    audio_channel_mask_t channelMask;   // track channel mask
+    uint32_t sampleRate;            // track sample rate
+    bool ramp;                      // volume ramps in every buffer
+    audio_format_t mixerFormat;     // MIXER_FORMAT of the output buffer
+    audio_channel_mask_t mixerChannelMask;  // MIXER_CHANNEL_MASK of the output buffer
+};
+
+static Measurement benchMixer(const MixerConfig& config, size_t frameCount, int iterations,
+        PerfCounters& counters)
+{
+    AudioMixer mixer(frameCount, kOutputSampleRate);
+    const uint32_t channelCount = popcount(config.channelMask);
+    const size_t outSampleSize = config.mixerFormat == AUDIO_FORMAT_PCM_FLOAT ?
+            sizeof(float) : sizeof(int16_t);
+    void* out = calloc(frameCount * popcount(config.mixerChannelMask), outSampleSize);
+
+    SineProvider* providers[AudioMixer::MAX_NUM_TRACKS];
+    int names[AudioMixer::MAX_NUM_TRACKS];
+    for (uint32_t i = 0; i < config.numTracks; i++) {
+        providers[i] = new SineProvider(config.format, channelCount, config.sampleRate,
+                440.0 * (i + 1));
+        names[i] = mixer.getTrackName(config.channelMask, 0 /*sessionId*/);
+        const int name = names[i];
+        mixer.setBufferProvider(name, providers[i]);
+        mixer.setParameter(name, AudioMixer::TRACK, AudioMixer::MAIN_BUFFER, out);
+        mixer.setParameter(name, AudioMixer::TRACK, AudioMixer::MIXER_FORMAT,
+                (void *)(uintptr_t) config.mixerFormat);
+        mixer.setParameter(name, AudioMixer::TRACK, AudioMixer::MIXER_CHANNEL_MASK,
+                (void *)(uintptr_t) config.mixerChannelMask);
+        mixer.setParameter(name, AudioMixer::TRACK, AudioMixer::FORMAT,
+                (void *)(uintptr_t) config.format);
+        mixer.setParameter(name, AudioMixer::TRACK, AudioMixer::CHANNEL_MASK,
+                (void *)(uintptr_t) config.channelMask);
+        mixer.setParameter(name, AudioMixer::RESAMPLE, AudioMixer::SAMPLE_RATE,
+                (void *)(uintptr_t) config.sampleRate);
+        // keep the volume below unity so the sum of many tracks does not just clip
+        const uintptr_t volume = AudioMixer::UNITY_GAIN / config.numTracks;
+        mixer.setParameter(name, AudioMixer::VOLUME, AudioMixer::VOLUME0, (void *) volume);
+        mixer.setParameter(name, AudioMixer::VOLUME, AudioMixer::VOLUME1, (void *) volume);
+        mixer.enable(name);
+    }
+
+    Measurement m;
+    memset(&m, 0, sizeof(m));
+    // the first iterations warm up the caches and the resamplers, and are not measured
+    const int warmup = 10;
+    for (int n = -warmup; n < iterations; n++) {
+        if (config.ramp) {
+            // a new target volume every buffer, so every process() call ramps
+            const uintptr_t volume = (AudioMixer::UNITY_GAIN / config.numTracks) >> (n & 1);
+            for (uint32_t i = 0; i < config.numTracks; i++) {
+                mixer.setParameter(names[i], AudioMixer::RAMP_VOLUME, AudioMixer::VOLUME0,
+                        (void *) volume);
+                mixer.setParameter(names[i], AudioMixer::RAMP_VOLUME, AudioMixer::VOLUME1,
+                        (void *) volume);
+            }
+        }
+        int64_t cycles, misses;
+        const int64_t start = systemTimeNs();
+        counters.start();
+        mixer.process(AudioBufferProvider::kInvalidPTS);
+        counters.stop(&cycles, &misses);
+        const int64_t end = systemTimeNs();
+        if (n >= 0) {
+            m.ns += end - start;
+            m.cycles = (cycles >= 0 && m.cycles >= 0) ? m.cycles + cycles : -1;
+            m.misses = (misses >= 0 && m.misses >= 0) ? m.misses + misses : -1;
+        }
+    }
+
+    for (uint32_t i = 0; i < config.numTracks; i++) {
+        mixer.deleteTrackName(names[i]);
+        delete providers[i];
+    }
+    free(out);
+    return m;
+}
+
+static void runMixerBenchmarks(size_t frameCount, int iterations, PerfCounters& counters)
+{
+    static const uint32_t trackCounts[] = { 1, 2, 4, 8, 16, 32 };
+    static const audio_format_t formats[] = { AUDIO_FORMAT_PCM_16_BIT, AUDIO_FORMAT_PCM_FLOAT };
+    // multichannel tracks are downmixed to a stereo output, and remapped to a 5.1 or 7.1 one
+    static const audio_channel_mask_t channelMasks[] = {
+        AUDIO_CHANNEL_OUT_MONO,
+        AUDIO_CHANNEL_OUT_STEREO,
+        AUDIO_CHANNEL_OUT_5POINT1,
+        AUDIO_CHANNEL_OUT_7POINT1,
+    };
+    static const audio_channel_mask_t mixerChannelMasks[] = {
+        AUDIO_CHANNEL_OUT_STEREO,
+        AUDIO_CHANNEL_OUT_5POINT1,
+        AUDIO_CHANNEL_OUT_7POINT1,
+    };
+    static const uint32_t sampleRates[] = { kOutputSampleRate, 44100, 22050 };
+
+    printf("AudioMixer, %u Hz output, %zu frames per buffer, %d buffers\n",
+            kOutputSampleRate, frameCount, iterations);
+    printf("%6s %6s %3s %6s %3s %6s %5s %9s %9s %9s\n",
+            "tracks", "mixer", "out", "format", "ch", "rate", "ramp", "ns/frame", "cyc/frame",
+            "miss/frm");
+    for (size_t mc = 0; mc < sizeof(mixerChannelMasks) / sizeof(mixerChannelMasks[0]); mc++) {
+    for (size_t mf = 0; mf < sizeof(formats) / sizeof(formats[0]); mf++) {
+    for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+    for (size_t c = 0; c < sizeof(channelMasks) / sizeof(channelMasks[0]); c++) {
+    for (size_t r = 0; r < sizeof(sampleRates) / sizeof(sampleRates[0]); r++) {
+    for (int ramp = 0; ramp <= 1; ramp++) {
+    for (size_t t = 0; t < sizeof(trackCounts) / sizeof(trackCounts[0]); t++) {
+        MixerConfig config;
+        config.numTracks = trackCounts[t];
+        config.format = formats[f];
+        config.channelMask = channelMasks[c];
+        config.sampleRate = sampleRates[r];
+        config.ramp = ramp;
+        config.mixerFormat = formats[mf];
+        config.mixerChannelMask = mixerChannelMasks[mc];
+        const Measurement m = benchMixer(config, frameCount, iterations, counters);
+        printf("%6u %6s %3d %6s %3d %6u %5s", config.numTracks, formatName(config.mixerFormat),
+                popcount(config.mixerChannelMask), formatName(config.format),
+                popcount(config.channelMask), config.sampleRate, config.ramp ? "yes" : "no");
+        m.print(frameCount * iterations);
+    }
+    }
+    }
+    }
+    }
+    }
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+static Measurement benchResampler(AudioResampler::src_quality quality, uint32_t channelCount,
+        uint32_t sampleRate, size_t frameCount, int iterations, PerfCounters& counters)
+{
+    SineProvider provider(AUDIO_FORMAT_PCM_16_BIT, channelCount, sampleRate, 1000.0);
+    AudioResampler* resampler = AudioResampler::create(16, channelCount, kOutputSampleRate,
+            quality);
+    resampler->setSampleRate(sampleRate);
+    resampler->setVolume(AudioMixer::UNITY_GAIN, AudioMixer::UNITY_GAIN);
+    int32_t* out = new int32_t[frameCount * FCC_2];
+
+    Measurement m;
+    memset(&m, 0, sizeof(m));
+    const int warmup = 10;
+    for (int n = -warmup; n < iterations; n++) {
+        memset(out, 0, frameCount * FCC_2 * sizeof(int32_t));
+        int64_t cycles, misses;
+        const int64_t start = systemTimeNs();
+        counters.start();
+        resampler->resample(out, frameCount, &provider);
+        counters.stop(&cycles, &misses);
+        const int64_t end = systemTimeNs();
+        if (n >= 0) {
+            m.ns += end - start;
+            m.cycles = (cycles >= 0 && m.cycles >= 0) ? m.cycles + cycles : -1;
+            m.misses = (misses >= 0 && m.misses >= 0) ? m.misses + misses : -1;
+        }
+    }
+
+    delete[] out;
+    delete resampler;
+    return m;
+}
+
+static void runResamplerBenchmarks(size_t frameCount, int iterations, PerfCounters& counters)
+{
+    static const struct {
+        AudioResampler::src_quality quality;
+        const char* name;
+    } qualities[] = {
+        { AudioResampler::LOW_QUALITY,          "lq" },
+        { AudioResampler::MED_QUALITY,          "mq" },
+        { AudioResampler::HIGH_QUALITY,         "hq" },
+        { AudioResampler::VERY_HIGH_QUALITY,    "vhq" },
+        { AudioResampler::DYN_LOW_QUALITY,      "dlq" },
+        { AudioResampler::DYN_MED_QUALITY,      "dmq" },
+        { AudioResampler::DYN_HIGH_QUALITY,     "dhq" },
+    };
+    static const uint32_t channelCounts[] = { 1, 2 };
+    static const uint32_t sampleRates[] = { 8000, 22050, 44100, 88200, 96000 };
+
+    printf("\nAudioResampler, %u Hz output, %zu frames per buffer, %d buffers\n",
+            kOutputSampleRate, frameCount, iterations);
+    printf("%7s %3s %6s %9s %9s %9s\n",
+            "quality", "ch", "rate", "ns/frame", "cyc/frame", "miss/frm");
+    for (size_t q = 0; q < sizeof(qualities) / sizeof(qualities[0]); q++) {
+    for (size_t c = 0; c < sizeof(channelCounts) / sizeof(channelCounts[0]); c++) {
+    for (size_t r = 0; r < sizeof(sampleRates) / sizeof(sampleRates[0]); r++) {
+        const Measurement m = benchResampler(qualities[q].quality, channelCounts[c],
+                sampleRates[r], frameCount, iterations, counters);
+        printf("%7s %3u %6u", qualities[q].name, channelCounts[c], sampleRates[r]);
+        m.print(frameCount * iterations);
+    }
+    }
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+static int usage(const char* name) {
+    fprintf(stderr, "Usage: %s [-m] [-r] [-f frames] [-n buffers]\n", name);
+    fprintf(stderr, "    -m    AudioMixer benchmarks only\n");
+    fprintf(stderr, "    -r    resampler benchmarks only\n");
+    fprintf(stderr, "    -f    frames per buffer (default 256)\n");
+    fprintf(stderr, "    -n    number of measured buffers per configuration (default 200)\n");
+    return -1;
+}
+
+int main(int argc, char* argv[]) {
+    const char* const progname = argv[0];
+    bool mixer = true;
+    bool resampler = true;
+    size_t frameCount = 256;
+    int iterations = 200;
+
+    int ch;
+    while ((ch = getopt(argc, argv, "mrf:n:")) != -1) {
+        switch (ch) {
+        case 'm':
+            resampler = false;
+            break;
+        case 'r':
+            mixer = false;
+            break;
+        case 'f':
+            frameCount = atoi(optarg);
+            break;
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        case '?':
+        default:
+            return usage(progname);
+        }
+    }
+    // AudioMixer processes in blocks of 16 frames
+    if (frameCount == 0 || (frameCount & 15) != 0 || iterations <= 0) {
+        return usage(progname);
+    }
+
+    PerfCounters counters;
+    if (!counters.valid()) {
+        fprintf(stderr, "perf counters not available (%s), reporting time only\n",
+                strerror(errno));
+    }
+
+    if (mixer) {
+        runMixerBenchmarks(frameCount, iterations, counters);
+    }
+    if (resampler) {
+        runResamplerBenchmarks(frameCount, iterations, counters);
+    }
+    return 0;
+}
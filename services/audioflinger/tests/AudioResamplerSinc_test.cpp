@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "AudioResamplerSinc_test"
+
+#include <gtest/gtest.h>
+#include <math.h>
+#include <string.h>
+
+#include <media/AudioBufferProvider.h>
+#include <utils/Log.h>
+#include <utils/Vector.h>
+
+#include "AudioResamplerSinc.h"
+
+namespace android {
+
+// Plays a buffer of 16-bit samples in chunks of at most kMaxChunkFrames, so that the
+// resampler wraps its state buffer as it would in the mixer.
+class ChunkProvider : public AudioBufferProvider {
+public:
+    static const size_t kMaxChunkFrames = 37;
+
+    ChunkProvider(const int16_t *samples, size_t frameCount, int channelCount)
+        : mSamples(samples), mFrameCount(frameCount), mChannelCount(channelCount),
+          mNextFrame(0) { }
+
+    virtual status_t getNextBuffer(Buffer* buffer, int64_t pts) {
+        size_t frameCount = mFrameCount - mNextFrame;
+        if (frameCount > kMaxChunkFrames) {
+            frameCount = kMaxChunkFrames;
+        }
+        if (frameCount > buffer->frameCount) {
+            frameCount = buffer->frameCount;
+        }
+        buffer->frameCount = frameCount;
+        buffer->i16 = frameCount != 0 ?
+                const_cast<int16_t *>(mSamples) + mNextFrame * mChannelCount : NULL;
+        return frameCount != 0 ? NO_ERROR : NOT_ENOUGH_DATA;
+    }
+
+    virtual void releaseBuffer(Buffer* buffer) {
+        mNextFrame += buffer->frameCount;
+        buffer->frameCount = 0;
+        buffer->raw = NULL;
+    }
+
+private:
+    const int16_t * const mSamples;
+    const size_t mFrameCount;
+    const int mChannelCount;
+    size_t mNextFrame;
+};
+
+// The SSE4.1 and AVX2 sinc kernels must be bit-exact with the scalar implementation,
+// which is what af.resampler.simd=0 selects.  Each test resamples the same input twice,
+// once with the kernel selected for this CPU and once with the scalar path, and compares
+// every output sample.
+class AudioResamplerSincTest : public ::testing::Test {
+protected:
+    static const size_t kInputFrames = 4096;
+
+    // Returns the output of the sinc resampler, with the vector kernel or the scalar path.
+    // Returns an empty vector if no vector kernel applies to this configuration.
+    static Vector<int32_t> resample(int channelCount, int32_t inSampleRate,
+            int32_t outSampleRate, AudioResampler::src_quality quality, bool vector) {
+        Vector<int32_t> out;
+        AudioResamplerSinc *resampler = new AudioResamplerSinc(16, channelCount,
+                outSampleRate, quality);
+        if (!vector) {
+            resampler->mKernel = NULL;
+        } else if (resampler->mKernel == NULL) {
+            delete resampler;
+            return out;
+        }
+        static_cast<AudioResampler *>(resampler)->init();
+        resampler->setSampleRate(inSampleRate);
+        // unity and an odd volume, to exercise the volume multiply after the kernel
+        resampler->setVolume(0x1000, 0x0bcd);
+
+        // a chirp at full scale, with its negation on the right channel
+        int16_t in[kInputFrames * 2];
+        for (size_t i = 0; i < kInputFrames; i++) {
+            double t = double(i) / inSampleRate;
+            int16_t s = int16_t(floor(32767. * sin(M_PI * 2000. * t * t) + 0.5));
+            in[i * channelCount] = s;
+            if (channelCount == 2) {
+                in[i * channelCount + 1] = -s;
+            }
+        }
+        ChunkProvider provider(in, kInputFrames, channelCount);
+
+        // the output is always stereo
+        const size_t outFrames = (int64_t) kInputFrames * outSampleRate / inSampleRate - 64;
+        out.insertAt(0, 0, outFrames * 2);
+        resampler->resample(out.editArray(), outFrames, &provider);
+        delete resampler;
+        return out;
+    }
+
+    static void compare(int channelCount, int32_t inSampleRate, int32_t outSampleRate,
+            AudioResampler::src_quality quality) {
+        Vector<int32_t> vector = resample(channelCount, inSampleRate, outSampleRate, quality,
+                true /*vector*/);
+        if (vector.isEmpty()) {
+            ALOGI("no vector sinc kernel for %d channel(s) at quality %d, not compared",
+                    channelCount, quality);
+            return;
+        }
+        Vector<int32_t> scalar = resample(channelCount, inSampleRate, outSampleRate, quality,
+                false /*vector*/);
+        ASSERT_EQ(scalar.size(), vector.size());
+        for (size_t i = 0; i < scalar.size(); i++) {
+            ASSERT_EQ(scalar[i], vector[i]) << "sample " << i << " of " << channelCount
+                    << " channel(s) " << inSampleRate << " -> " << outSampleRate;
+        }
+    }
+};
+
+TEST_F(AudioResamplerSincTest, HighQualityMonoMatchesScalar) {
+    compare(1, 44100, 48000, AudioResampler::HIGH_QUALITY);
+    compare(1, 48000, 44100, AudioResampler::HIGH_QUALITY);
+}
+
+TEST_F(AudioResamplerSincTest, HighQualityStereoMatchesScalar) {
+    compare(2, 44100, 48000, AudioResampler::HIGH_QUALITY);
+    compare(2, 48000, 44100, AudioResampler::HIGH_QUALITY);
+}
+
+TEST_F(AudioResamplerSincTest, VeryHighQualityMonoMatchesScalar) {
+    compare(1, 22050, 48000, AudioResampler::VERY_HIGH_QUALITY);
+    compare(1, 48000, 32000, AudioResampler::VERY_HIGH_QUALITY);
+}
+
+TEST_F(AudioResamplerSincTest, VeryHighQualityStereoMatchesScalar) {
+    compare(2, 22050, 48000, AudioResampler::VERY_HIGH_QUALITY);
+    compare(2, 48000, 32000, AudioResampler::VERY_HIGH_QUALITY);
+}
+
+}  // namespace android
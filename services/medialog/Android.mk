@@ -2,7 +2,7 @@ LOCAL_PATH := $(call my-dir)
 
 include $(CLEAR_VARS)
 
-LOCAL_SRC_FILES := MediaLogService.cpp
+LOCAL_SRC_FILES := MediaLogService.cpp PerformanceAnalysis.cpp
 
 LOCAL_SHARED_LIBRARIES := libmedia libbinder libutils liblog libnbaio
 
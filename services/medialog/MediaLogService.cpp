@@ -17,7 +17,9 @@
 #define LOG_TAG "MediaLog"
 //#define LOG_NDEBUG 0
 
+#include <stdlib.h>
 #include <sys/mman.h>
+#include <unistd.h>
 #include <utils/Log.h>
 #include <binder/PermissionCache.h>
 #include <media/nbaio/NBLog.h>
@@ -26,6 +28,29 @@
 
 namespace android {
 
+const uint32_t MediaLogService::kSummaryWindowsSec[] = {10, 60, 600, 0};
+
+void MediaLogService::onFirstRef()
+{
+    mPollThread = new PollThread(*this);
+    mPollThread->run("MediaLogPoll");
+}
+
+bool MediaLogService::PollThread::threadLoop()
+{
+    Vector<NamedReader> namedReaders;
+    {
+        Mutex::Autolock _l(mService.mLock);
+        namedReaders = mService.mNamedReaders;
+    }
+    nsecs_t now = systemTime();
+    for (size_t i = 0; i < namedReaders.size(); i++) {
+        namedReaders[i].analysis()->poll(now);
+    }
+    usleep(kPollPeriodNs / 1000);
+    return true;
+}
+
 void MediaLogService::registerWriter(const sp<IMemory>& shared, size_t size, const char *name)
 {
     if (IPCThreadState::self()->getCallingUid() != AID_MEDIA || shared == 0 ||
@@ -34,7 +59,8 @@ void MediaLogService::registerWriter(const sp<IMemory>& shared, size_t size, con
         return;
     }
     sp<NBLog::Reader> reader(new NBLog::Reader(size, shared));
-    NamedReader namedReader(reader, name);
+    sp<PerformanceAnalysis> analysis(new PerformanceAnalysis(size, shared));
+    NamedReader namedReader(reader, analysis, name);
     Mutex::Autolock _l(mLock);
     mNamedReaders.add(namedReader);
 }
@@ -54,18 +80,69 @@ void MediaLogService::unregisterWriter(const sp<IMemory>& shared)
     }
 }
 
-status_t MediaLogService::dump(int fd, const Vector<String16>& args)
+bool MediaLogService::dumpAllowed() const
 {
     // FIXME merge with similar but not identical code at services/audioflinger/ServiceUtilities.cpp
     static const String16 sDump("android.permission.DUMP");
-    if (!(IPCThreadState::self()->getCallingUid() == AID_MEDIA ||
-            PermissionCache::checkCallingPermission(sDump))) {
+    return IPCThreadState::self()->getCallingUid() == AID_MEDIA ||
+            PermissionCache::checkCallingPermission(sDump);
+}
+
+void MediaLogService::summarizePerformance(String8& result, uint32_t windowSec)
+{
+    Vector<NamedReader> namedReaders;
+    {
+        Mutex::Autolock _l(mLock);
+        namedReaders = mNamedReaders;
+    }
+    nsecs_t now = systemTime();
+    for (size_t i = 0; i < namedReaders.size(); i++) {
+        const NamedReader& namedReader = namedReaders[i];
+        String8 summary;
+        if (windowSec != 0) {
+            namedReader.analysis()->summarize(summary, now, windowSec);
+        } else {
+            for (size_t j = 0; kSummaryWindowsSec[j] != 0; j++) {
+                namedReader.analysis()->summarize(summary, now, kSummaryWindowsSec[j]);
+            }
+        }
+        if (!summary.isEmpty()) {
+            result.appendFormat("%s:\n", namedReader.name());
+            result.append(summary);
+        }
+    }
+}
+
+status_t MediaLogService::getPerformanceSummary(uint32_t windowSec, String8 *summary)
+{
+    if (!dumpAllowed()) {
+        return PERMISSION_DENIED;
+    }
+    if (summary == NULL) {
+        return BAD_VALUE;
+    }
+    summary->clear();
+    summarizePerformance(*summary, windowSec);
+    return NO_ERROR;
+}
+
+status_t MediaLogService::dump(int fd, const Vector<String16>& args)
+{
+    if (!dumpAllowed()) {
         fdprintf(fd, "Permission Denial: can't dump media.log from pid=%d, uid=%d\n",
                 IPCThreadState::self()->getCallingPid(),
                 IPCThreadState::self()->getCallingUid());
         return NO_ERROR;
     }
 
+    // "--window <seconds>" limits the performance summary to one window
+    uint32_t windowSec = 0;
+    for (size_t i = 0; i + 1 < args.size(); i++) {
+        if (args[i] == String16("--window")) {
+            windowSec = atoi(String8(args[i + 1]).string());
+        }
+    }
+
     Vector<NamedReader> namedReaders;
     {
         Mutex::Autolock _l(mLock);
@@ -80,6 +157,16 @@ status_t MediaLogService::dump(int fd, const Vector<String16>& args)
         }
         namedReader.reader()->dump(fd, 0 /*indent*/);
     }
+
+    String8 summary;
+    summarizePerformance(summary, windowSec);
+    if (!summary.isEmpty()) {
+        if (fd >= 0) {
+            fdprintf(fd, "\nperformance:\n%s", summary.string());
+        } else {
+            ALOGI("performance:\n%s", summary.string());
+        }
+    }
     return NO_ERROR;
 }
 
@@ -20,6 +20,8 @@
 #include <binder/BinderService.h>
 #include <media/IMediaLogService.h>
 #include <media/nbaio/NBLog.h>
+#include <utils/Thread.h>
+#include "PerformanceAnalysis.h"
 
 namespace android {
 
@@ -29,7 +31,7 @@ class MediaLogService : public BinderService<MediaLogService>, public BnMediaLog
 public:
     MediaLogService() : BnMediaLogService() { }
     virtual ~MediaLogService() { }
-    virtual void onFirstRef() { }
+    virtual void onFirstRef();
 
     static const char*  getServiceName() { return "media.log"; }
 
@@ -37,27 +39,50 @@ public:
     static const size_t kMaxSize = 0x10000;
     virtual void        registerWriter(const sp<IMemory>& shared, size_t size, const char *name);
     virtual void        unregisterWriter(const sp<IMemory>& shared);
+    virtual status_t    getPerformanceSummary(uint32_t windowSec, String8 *summary);
 
     virtual status_t    dump(int fd, const Vector<String16>& args);
     virtual status_t    onTransact(uint32_t code, const Parcel& data, Parcel* reply,
                                 uint32_t flags);
 
 private:
+    bool                dumpAllowed() const;
+    // windowSec == 0 means a summary for each of kSummaryWindowsSec
+    void                summarizePerformance(String8& result, uint32_t windowSec);
+
     Mutex               mLock;
     class NamedReader {
     public:
-        NamedReader() : mReader(0) { mName[0] = '\0'; } // for Vector
-        NamedReader(const sp<NBLog::Reader>& reader, const char *name) : mReader(reader)
+        NamedReader() : mReader(0), mAnalysis(0) { mName[0] = '\0'; } // for Vector
+        NamedReader(const sp<NBLog::Reader>& reader, const sp<PerformanceAnalysis>& analysis,
+                const char *name) : mReader(reader), mAnalysis(analysis)
             { strlcpy(mName, name, sizeof(mName)); }
         ~NamedReader() { }
         const sp<NBLog::Reader>&  reader() const { return mReader; }
+        const sp<PerformanceAnalysis>& analysis() const { return mAnalysis; }
         const char*               name() const { return mName; }
     private:
         sp<NBLog::Reader>   mReader;
+        sp<PerformanceAnalysis> mAnalysis;  // has its own Reader of the same shared memory
         static const size_t kMaxName = 32;
         char                mName[kMaxName];
     };
     Vector<NamedReader> mNamedReaders;
+
+    // Periodically moves performance events out of each writer's timeline into its histograms,
+    // before the writer overwrites them
+    class PollThread : public Thread {
+    public:
+        PollThread(MediaLogService& service) : Thread(false /*canCallJava*/), mService(service) { }
+        virtual ~PollThread() { }
+    private:
+        virtual bool        threadLoop();
+        MediaLogService&    mService;
+    };
+    sp<PollThread>      mPollThread;
+
+    static const nsecs_t kPollPeriodNs = 250000000LL;  // 250 ms
+    static const uint32_t kSummaryWindowsSec[];
 };
 
 }   // namespace android
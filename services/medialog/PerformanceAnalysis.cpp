@@ -0,0 +1,226 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "MediaLog"
+//#define LOG_NDEBUG 0
+
+#include <string.h>
+#include <utils/Log.h>
+#include "PerformanceAnalysis.h"
+
+namespace android {
+
+void LogHistogram::clear()
+{
+    memset(mCounts, 0, sizeof(mCounts));
+    mCount = 0;
+    mMax = 0;
+}
+
+/*static*/
+size_t LogHistogram::bucketOf(uint32_t value)
+{
+    if (value < 4) {
+        return value;
+    }
+    // the two bits after the most significant bit select one of four buckets in the octave
+    int octave = 31 - __builtin_clz(value);
+    return (octave - 1) * 4 + ((value >> (octave - 2)) & 3);
+}
+
+/*static*/
+uint32_t LogHistogram::lowerBound(size_t bucket)
+{
+    if (bucket < 4) {
+        return bucket;
+    }
+    int octave = bucket / 4 + 1;
+    return (4 + (bucket & 3)) << (octave - 2);
+}
+
+void LogHistogram::add(uint32_t value)
+{
+    mCounts[bucketOf(value)]++;
+    mCount++;
+    if (value > mMax) {
+        mMax = value;
+    }
+}
+
+void LogHistogram::add(const LogHistogram& other)
+{
+    for (size_t i = 0; i < kBuckets; i++) {
+        mCounts[i] += other.mCounts[i];
+    }
+    mCount += other.mCount;
+    if (other.mMax > mMax) {
+        mMax = other.mMax;
+    }
+}
+
+uint32_t LogHistogram::percentile(uint32_t percent) const
+{
+    if (mCount == 0) {
+        return 0;
+    }
+    // the smallest number of values that are at or below the percentile
+    uint64_t target = ((uint64_t) mCount * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBuckets; i++) {
+        seen += mCounts[i];
+        if (seen >= target && seen > 0) {
+            uint32_t lower = lowerBound(i);
+            uint32_t upper = i + 1 < kBuckets ? lowerBound(i + 1) - 1 : UINT32_MAX;
+            uint32_t middle = lower + (upper - lower) / 2;
+            return middle < mMax ? middle : mMax;
+        }
+    }
+    return mMax;
+}
+
+void LogHistogram::summarize(String8& result) const
+{
+    result.appendFormat("n=%u p50=%u p90=%u p99=%u max=%u", mCount, percentile(50),
+            percentile(90), percentile(99), mMax);
+}
+
+// ---------------------------------------------------------------------------
+
+PerformanceAnalysis::PerformanceAnalysis(size_t size, const sp<IMemory>& shared)
+    : mReader(new NBLog::Reader(size, shared)), mIntervals(NULL), mNewest(0), mPrevCycleNs(-1),
+      mLostPolls(0)
+{
+}
+
+PerformanceAnalysis::~PerformanceAnalysis()
+{
+    delete[] mIntervals;
+}
+
+PerformanceAnalysis::Interval* PerformanceAnalysis::intervalAt(nsecs_t nowNs)
+{
+    int64_t index = nowNs / kIntervalNs;
+    if (mIntervals == NULL) {
+        // most writers never log a PerformanceEvent, so only allocate once one does
+        mIntervals = new Interval[kMaxIntervals];
+        for (size_t i = 0; i < kMaxIntervals; i++) {
+            mIntervals[i].mIndex = -1;
+        }
+    } else if (index <= mNewest) {
+        return &mIntervals[mNewest % kMaxIntervals];
+    }
+    // start a new interval, leaving any skipped intervals with a stale mIndex
+    Interval *interval = &mIntervals[index % kMaxIntervals];
+    interval->mIndex = index;
+    interval->mCycleUs.clear();
+    interval->mJitterUs.clear();
+    interval->mWarmupUs.clear();
+    interval->mUnderruns = 0;
+    mNewest = index;
+    return interval;
+}
+
+void PerformanceAnalysis::poll(nsecs_t nowNs)
+{
+    Vector<NBLog::PerformanceEntry> entries;
+    bool lost = mReader->readPerformance(entries);
+    Mutex::Autolock _l(mLock);
+    if (lost) {
+        // the next cycle doesn't follow the previous one we saw, so it has no jitter
+        mPrevCycleNs = -1;
+        mLostPolls++;
+    }
+    if (entries.isEmpty()) {
+        return;
+    }
+    Interval *interval = intervalAt(nowNs);
+    for (size_t i = 0; i < entries.size(); i++) {
+        const NBLog::PerformanceEntry& entry = entries[i];
+        if (entry.mNs < 0) {
+            continue;
+        }
+        uint32_t us = entry.mNs / 1000 > UINT32_MAX ? UINT32_MAX : entry.mNs / 1000;
+        switch (entry.mEvent) {
+        case NBLog::PERF_CYCLE:
+            interval->mCycleUs.add(us);
+            if (mPrevCycleNs >= 0) {
+                int64_t jitterNs = entry.mNs - mPrevCycleNs;
+                if (jitterNs < 0) {
+                    jitterNs = -jitterNs;
+                }
+                interval->mJitterUs.add(jitterNs / 1000 > UINT32_MAX ?
+                        UINT32_MAX : jitterNs / 1000);
+            }
+            mPrevCycleNs = entry.mNs;
+            break;
+        case NBLog::PERF_UNDERRUN:
+            interval->mUnderruns++;
+            break;
+        case NBLog::PERF_WARMUP:
+            interval->mWarmupUs.add(us);
+            // the first cycle after warmup doesn't follow the last one before standby
+            mPrevCycleNs = -1;
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+void PerformanceAnalysis::summarize(String8& result, nsecs_t nowNs, uint32_t windowSec) const
+{
+    Mutex::Autolock _l(mLock);
+    if (mIntervals == NULL) {
+        return;
+    }
+    if (windowSec > kMaxWindowSec) {
+        windowSec = kMaxWindowSec;
+    }
+    int64_t oldest = (nowNs - seconds(windowSec)) / kIntervalNs;
+    LogHistogram cycleUs, jitterUs, warmupUs, underruns;
+    uint32_t totalUnderruns = 0;
+    for (size_t i = 0; i < kMaxIntervals; i++) {
+        const Interval& interval = mIntervals[i];
+        if (interval.mIndex < oldest || interval.mIndex > mNewest ||
+                interval.mIndex <= mNewest - (int64_t) kMaxIntervals) {
+            continue;
+        }
+        cycleUs.add(interval.mCycleUs);
+        jitterUs.add(interval.mJitterUs);
+        warmupUs.add(interval.mWarmupUs);
+        if (interval.mCycleUs.count() > 0) {
+            // underruns per interval is only meaningful while the thread is active
+            underruns.add(interval.mUnderruns);
+        }
+        totalUnderruns += interval.mUnderruns;
+    }
+    result.appendFormat("  last %u sec:\n", windowSec);
+    result.append("    cycle us:   ");
+    cycleUs.summarize(result);
+    result.append("\n    jitter us:  ");
+    jitterUs.summarize(result);
+    result.appendFormat("\n    underruns:  total=%u, per %lld sec ", totalUnderruns,
+            kIntervalNs / 1000000000LL);
+    underruns.summarize(result);
+    result.append("\n    warmup us:  ");
+    warmupUs.summarize(result);
+    result.append("\n");
+    if (mLostPolls > 0) {
+        result.appendFormat("    warning: events were lost before %u polls\n", mLostPolls);
+    }
+}
+
+}   // namespace android
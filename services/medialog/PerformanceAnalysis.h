@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_MEDIA_PERFORMANCE_ANALYSIS_H
+#define ANDROID_MEDIA_PERFORMANCE_ANALYSIS_H
+
+#include <binder/IMemory.h>
+#include <media/nbaio/NBLog.h>
+#include <utils/Mutex.h>
+#include <utils/RefBase.h>
+#include <utils/String8.h>
+#include <utils/Timers.h>
+
+namespace android {
+
+// Histogram of unsigned values with four buckets per power of 2,
+// so percentiles are accurate to within 12.5% regardless of the range of values.
+class LogHistogram {
+public:
+    LogHistogram() { clear(); }
+
+    void        clear();
+    void        add(uint32_t value);
+    void        add(const LogHistogram& other);
+
+    uint32_t    count() const { return mCount; }
+    uint32_t    max() const { return mMax; }
+    // Returns the middle of the bucket containing the given percentile, but at most max()
+    uint32_t    percentile(uint32_t percent) const;
+
+    // Appends "n=... p50=... p90=... p99=... max=..."
+    void        summarize(String8& result) const;
+
+private:
+    static const size_t kBuckets = 124;     // enough for all uint32_t values
+
+    static size_t   bucketOf(uint32_t value);
+    static uint32_t lowerBound(size_t bucket);
+
+    uint32_t    mCounts[kBuckets];
+    uint32_t    mCount;
+    uint32_t    mMax;
+};
+
+// Reads the PerformanceEvents of one NBLog::Writer and keeps rolling histograms of them,
+// in fixed intervals so that they can be summarized over windows of different lengths.
+class PerformanceAnalysis : public RefBase {
+public:
+    PerformanceAnalysis(size_t size, const sp<IMemory>& shared);
+    virtual ~PerformanceAnalysis();
+
+    // Read the events logged since the previous poll, and attribute them to the interval
+    // containing nowNs.  This should be called often enough that the Writer doesn't overwrite
+    // events before they are read.
+    void        poll(nsecs_t nowNs);
+
+    // Append a summary of the intervals which overlap the windowSec seconds ending at nowNs,
+    // or nothing if the Writer has never logged a PerformanceEvent.
+    void        summarize(String8& result, nsecs_t nowNs, uint32_t windowSec) const;
+
+    static const nsecs_t    kIntervalNs = 10000000000LL;  // 10 seconds
+    static const size_t     kMaxIntervals = 60;          // so the longest window is 10 minutes
+    static const uint32_t   kMaxWindowSec = (kIntervalNs / 1000000000LL) * kMaxIntervals;
+
+private:
+    struct Interval {
+        int64_t         mIndex;         // start time / kIntervalNs
+        LogHistogram    mCycleUs;       // PERF_CYCLE durations
+        LogHistogram    mJitterUs;      // absolute difference between consecutive cycles
+        LogHistogram    mWarmupUs;      // PERF_WARMUP durations
+        uint32_t        mUnderruns;     // number of PERF_UNDERRUN
+    };
+
+    // Returns the interval containing nowNs, starting new intervals as needed
+    Interval*   intervalAt(nsecs_t nowNs);
+
+    mutable Mutex       mLock;
+    const sp<NBLog::Reader> mReader;    // a private Reader, as readPerformance() consumes events
+    Interval*           mIntervals;     // circular buffer of kMaxIntervals, allocated on demand
+    int64_t             mNewest;        // mIndex of the most recent interval
+    int64_t             mPrevCycleNs;   // duration of the previous cycle, or -1 if unknown
+    uint32_t            mLostPolls;     // number of polls that found events were overwritten
+};
+
+}   // namespace android
+
+#endif  // ANDROID_MEDIA_PERFORMANCE_ANALYSIS_H